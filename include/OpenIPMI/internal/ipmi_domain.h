@@ -156,6 +156,11 @@ void _ipmi_domain_system_event_handler(ipmi_domain_t *domain,
    not one. */
 ipmi_sdr_info_t *ipmi_domain_get_main_sdrs(ipmi_domain_t *domain);
 
+/* Get statistics about fetching the domain's main SDR repository, see
+   ipmi_sdr_fetch_stats_t in ipmi_sdr.h. */
+int ipmi_domain_get_main_sdr_fetch_stats(ipmi_domain_t          *domain,
+					 ipmi_sdr_fetch_stats_t *stats);
+
 /* Get the number of channels the domain supports. */
 int ipmi_domain_get_num_channels(ipmi_domain_t *domain, int *val);
 
@@ -57,6 +57,7 @@
 #define _IPMI_MALLOC_H
 
 #include <OpenIPMI/ipmi_log.h>
+#include <OpenIPMI/os_handler.h>
 
 /* IPMI uses this for memory allocation, so it can easily be
    substituted, etc. */
@@ -67,6 +68,24 @@ void ipmi_mem_free(void *data);
 char *ipmi_strdup(const char *str);
 char *ipmi_strndup(const char *str, int n);
 
+/* Pools of fixed-size objects, for the small things that get
+   allocated and freed for every message.  Objects are carved out of
+   larger slabs and kept on free lists, a per-thread one in front of a
+   shared one, so most allocations never touch the OS allocator or a
+   lock.  Everything in a pool goes away when the pool is freed.  While
+   malloc debugging is on, the pool just passes new allocations to
+   ipmi_mem_alloc() and frees them with ipmi_mem_free() so the objects
+   are tracked like any other allocation.  Pools are meant to
+   be allocated and freed at init and shutdown time, there is a small
+   limit on how many may exist at once. */
+typedef struct ipmi_mem_pool_s ipmi_mem_pool_t;
+int ipmi_mem_pool_alloc_pool(os_handler_t    *os_hnd,
+			     unsigned int    obj_size,
+			     ipmi_mem_pool_t **new_pool);
+void ipmi_mem_pool_free_pool(ipmi_mem_pool_t *pool);
+void *ipmi_mem_pool_alloc(ipmi_mem_pool_t *pool);
+void ipmi_mem_pool_free(ipmi_mem_pool_t *pool, void *data);
+
 /* If you have debug allocations on, then you should call this to
    check for data you haven't freed (after you have freed all the
    data, of course).  It's safe to call even if malloc debugging is
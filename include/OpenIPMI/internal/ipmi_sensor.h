@@ -64,6 +64,10 @@ unsigned int ipmi_sensors_get_count(ipmi_sensor_info_t *sensors);
 /* Allocate a sensor, it will not be associated with anything yet. */
 int ipmi_sensor_alloc_nonstandard(ipmi_sensor_t **new_sensor);
 
+/* Free a sensor from ipmi_sensor_alloc_nonstandard() that was never
+   added with ipmi_sensor_add_nonstandard(). */
+void ipmi_sensor_free_nonstandard(ipmi_sensor_t *sensor);
+
 typedef void (*ipmi_sensor_destroy_cb)(ipmi_sensor_t *sensor,
 				       void          *cb_data);
 
@@ -509,4 +513,7 @@ int ipmi_sensor_pointer_noseq_cb(ipmi_sensor_id_t   id,
 				 ipmi_sensor_ptr_cb handler,
 				 void               *cb_data);
 
+int _ipmi_sensor_init(void);
+void _ipmi_sensor_shutdown(void);
+
 #endif /* _IPMI_SENSOR_H */
@@ -175,6 +175,43 @@ int ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
    5-6 should be enough for anything.  The value is set in parm_val */
 #define IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT	12
 
+/* The most packets read from the connection's socket each time it is
+   readable (many connections may share a socket).  The default
+   is 16 and the maximum is 64; a socket uses the largest value of
+   the connections on it.  The value is set in parm_val. */
+#define IPMI_LANP_RECV_BATCH_SIZE		13
+
+/* Normally packets are queued and sent together (with one
+   sendmmsg() where available) at the start of the next selector
+   iteration.  If parm_val is true, each packet is sent right away
+   with its own sendto() instead. */
+#define IPMI_LANP_XMIT_IMMEDIATE		14
+
+/* Connections share UDP sockets.  If a new socket has to be created
+   for this connection, it will hold up to parm_val connections.  The
+   default is 32 and the maximum is 65536; raise it to run a lot of
+   connections on a few sockets. */
+#define IPMI_LANP_MAX_CONS_PER_FD		15
+
+/* If parm_val is not zero, the number of outstanding messages adapts
+   to how well the BMC keeps up, up to parm_val (which may be 1-63).
+   It starts at IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT, grows as
+   responses come in and is cut in half when a message times out.
+   The "lan_window" statistic follows the current value.  The default
+   is zero, a fixed IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT. */
+#define IPMI_LANP_ADAPTIVE_WINDOW		16
+
+/* Normally a message is resent if no response comes back in one
+   second.  If parm_val is not zero, the time to wait is computed
+   from the measured round trip time to each address instead (and
+   doubled each time the message is resent), but it is never less
+   than parm_val milliseconds.  The default is zero. */
+#define IPMI_LANP_RSP_TIMEOUT_MIN		17
+
+/* The most milliseconds to wait for a response when the time is
+   computed, see IPMI_LANP_RSP_TIMEOUT_MIN.  The default is 1000. */
+#define IPMI_LANP_RSP_TIMEOUT_MAX		18
+
 /*
  * Set up an IPMI LAN connection.  The boatload of parameters are:
  *
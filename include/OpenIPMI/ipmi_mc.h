@@ -94,6 +94,10 @@ int ipmi_mc_manufacturer_id(ipmi_mc_t *mc);
 int ipmi_mc_product_id(ipmi_mc_t *mc);
 void ipmi_mc_aux_fw_revision(ipmi_mc_t *mc, unsigned char val[]);
 
+/* Get statistics about fetching the MC's device SDRs, see
+   ipmi_sdr_fetch_stats_t in ipmi_sdr.h. */
+int ipmi_mc_get_sdr_fetch_stats(ipmi_mc_t *mc, ipmi_sdr_fetch_stats_t *stats);
+
 /* Get the GUID (if it is available).  Returns ENOSYS if the GUID is
    not available.  guid must point to 16 bytes of data. */
 int ipmi_mc_get_guid(ipmi_mc_t *mc, unsigned char *guid);
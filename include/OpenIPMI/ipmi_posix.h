@@ -102,8 +102,12 @@ void ipmi_posix_os_handler_set_sel(os_handler_t *os_hnd, selector_t *sel);
 /* Set up a selector.  wake_sig is used to wake up selects when things
    change and they need to wake up.  It must be some unused signal (it
    does not have to be queued); a signal handler will be installed for
-   it. */
+   it.  If wake_sig is 0, no signal is used, the selector wakes
+   threads with an eventfd or pipe instead (see SEL_FLAG_WAKE_FD). */
 os_handler_t *ipmi_posix_thread_setup_os_handler(int wake_sig);
+/* To run the handlers on a pool of worker threads instead of the
+   threads calling the operation loop, call sel_start_workers() on
+   the selector from ipmi_posix_thread_os_handler_get_sel(). */
 /* Gets the selector associated with the OS handler. */
 selector_t *ipmi_posix_thread_os_handler_get_sel(os_handler_t *os_hnd);
 
@@ -146,6 +146,29 @@ int ipmi_sdr_get_lun_has_sensors(ipmi_sdr_info_t *sdr,
 				 unsigned int    lun,
 				 int             *val);
 
+/* Statistics about fetching the SDRs.  The "last_fetch" values are
+   for the last fetch that actually read the SDRs (not one that found
+   the repository unchanged), the rest count over the life of the SDR
+   info.  The fetch size and window are the current number of bytes
+   read per request and number of requests kept outstanding, they
+   adapt to how well the MC responds. */
+typedef struct ipmi_sdr_fetch_stats_s
+{
+    unsigned int  fetches;
+    unsigned int  last_fetch_sdrs;
+    unsigned long last_fetch_bytes;
+    unsigned long last_fetch_usec;
+    unsigned long last_fetch_bytes_per_sec;
+    unsigned int  retries;
+    unsigned int  timeouts;
+    unsigned int  reservation_losses;
+    unsigned int  size_reductions;
+    unsigned int  fetch_size;
+    unsigned int  fetch_window;
+} ipmi_sdr_fetch_stats_t;
+int ipmi_sdr_get_fetch_stats(ipmi_sdr_info_t        *sdr,
+			     ipmi_sdr_fetch_stats_t *stats);
+
 /* Append the SDR to the repository. */
 int ipmi_sdr_add(ipmi_sdr_info_t *sdrs,
 		 ipmi_sdr_t      *sdr);
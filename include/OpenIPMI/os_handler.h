@@ -305,9 +305,11 @@ struct os_handler_s
        start the database operation, calling got_data() when it is
        done.
 
-       The data returned should be freed by database_free.  Note that
-       these routines are optional and do not need to be here, they
-       simply speed up operation when working correctly.  Also, if
+       The data returned should be freed by database_free.  The user
+       may keep it and use it in place until then, but must not
+       change it, it may be mapped straight from the database.  Note
+       that these routines are optional and do not need to be here,
+       they simply speed up operation when working correctly.  Also, if
        these routines fail for some reason it is not fatal to the
        operation of OpenIPMI.  It is not a big deal. */
     int (*database_store)(os_handler_t  *handler,
@@ -328,7 +330,10 @@ struct os_handler_s
 			  unsigned char *data);
     /* Sets the filename to use for the database to the one specified.
        The meaning is system-dependent.  On *nix systems it defaults
-       to $HOME/.OpenIPMI_db.  This is for use by the user, OpenIPMI
+       to $HOME/.OpenIPMI_db.  The POSIX OS handlers keep the data in
+       a directory named after the file with ".d" added (so
+       $HOME/.OpenIPMI_db.d by default) holding a file per key, the
+       others use a gdbm file.  This is for use by the user, OpenIPMI
        proper does not use this. */
     int (*database_set_filename)(os_handler_t *handler,
 				 char         *name);
@@ -47,6 +47,32 @@ typedef struct selector_s selector_t;
 /* You have to create a selector before you can use it. */
 int sel_alloc_selector(os_handler_t *os_hnd, selector_t **new_selector);
 
+/* Flags for sel_alloc_selector_flags(). */
+/* Wait for I/O with select() even if the selector was built with
+   epoll support.  Note that the user-supplied fds from
+   ipmi_sel_set_read_fds_handler() are always waited for with
+   select(). */
+#define SEL_FLAG_USE_SELECT	(1 << 0)
+
+/* Keep timers in a hierarchical timer wheel instead of a heap.
+   Starting and stopping a timer is O(1) instead of O(log n), which
+   helps when thousands of timers are running, but timers only have
+   millisecond resolution.  Timers never go off early. */
+#define SEL_FLAG_TIMER_WHEEL	(1 << 1)
+
+/* Wake threads waiting in sel_select() when timers or fds change by
+   writing to an eventfd (or a pipe if eventfd is not available) the
+   selector waits on, instead of calling the send_sig callback.  This
+   avoids needing a signal to wake threads, the send_sig callback is
+   not used. */
+#define SEL_FLAG_WAKE_FD	(1 << 2)
+
+/* Like sel_alloc_selector(), but the flags above can be used to
+   control how the selector works. */
+int sel_alloc_selector_flags(os_handler_t *os_hnd,
+			     unsigned int flags,
+			     selector_t   **new_selector);
+
 /* Used to destroy a selector. */
 int sel_free_selector(selector_t *new_selector);
 
@@ -58,7 +84,9 @@ typedef void (*sel_fd_handler_t)(int fd, void *data);
 /* Set the handlers for a file descriptor.  The "data" parameter is
    not used, it is just passed to the exception handlers.  The done
    handler (if non-NULL) will be called when the data is removed or
-   replaced. */
+   replaced.  Returns EINVAL if the fd cannot be monitored by the
+   selector; when select() is used, the fd must be below
+   FD_SETSIZE. */
 typedef void (*sel_fd_cleared_cb)(int fd, void *data);
 int sel_set_fd_handlers(selector_t        *sel,
 			int               fd,
@@ -135,6 +163,17 @@ int sel_select_loop(selector_t      *sel,
 		    long            thread_id,
 		    void            *cb_data);
 
+/* Start a pool of worker threads to run the fd and timer handlers.
+   The threads calling sel_select() then only wait for I/O and
+   timeouts; ready fds and expired timers are put on per-worker queues
+   and idle workers steal work from busy ones.  The handlers for an fd
+   are never run by more than one thread at a time.  The OS handler
+   must support threads.  This may only be done once, the workers are
+   stopped when the selector is freed.  A timer that has expired but
+   has not been run by a worker yet can still be stopped; starting it
+   again returns EBUSY until its handler is called. */
+int sel_start_workers(selector_t *sel, unsigned int num_workers);
+
 typedef void (*ipmi_sel_add_read_fds_cb)(selector_t     *sel,
 					 int            *num_fds,
 					 fd_set         *fdset,
@@ -270,6 +270,14 @@ struct lanserv_data_s
     lan_addr_t lan_addr;
     int lan_addr_set;
     uint16_t port;
+
+    /* The number of sockets bound to lan_addr with SO_REUSEPORT, 0
+       means the default of one. */
+    unsigned int num_sockets;
+
+    /* The most packets read from a socket each time it is readable,
+       0 means the default. */
+    unsigned int recv_batch_size;
 };
 
 
@@ -284,6 +284,27 @@ int ipmi_mc_add_polled_sensor(lmc_data_t    *mc,
 					  const char **errstr),
 			      void *cb_data);
 
+/*
+ * Statistics for a polled sensor, times are in microseconds.  The delay
+ * is from when the poll was due until it started, the duration is the
+ * time spent in the poll function.
+ */
+typedef struct ipmi_sensor_poll_stats_s
+{
+    unsigned long      polls;
+    unsigned long      errors;
+    unsigned long      last_duration;
+    unsigned long      max_duration;
+    unsigned long long total_duration;
+    unsigned long      max_delay;
+    unsigned long long total_delay;
+} ipmi_sensor_poll_stats_t;
+
+int ipmi_mc_sensor_get_poll_stats(lmc_data_t               *mc,
+				  unsigned char            lun,
+				  unsigned char            sens_num,
+				  ipmi_sensor_poll_stats_t *stats);
+
 int ipmi_mc_set_power(lmc_data_t *mc, unsigned char power, int gen_int);
 
 int ipmi_mc_set_num_leds(lmc_data_t   *mc,
@@ -63,6 +63,17 @@ int persist_init(const char *app, const char *instance, const char *basedir);
 persist_t *alloc_persist(const char *name, ...);
 persist_t *read_persist(const char *name, ...);
 int write_persist(persist_t *p);
+/*
+ * Add the items in the persist to the end of its file instead of
+ * replacing the file, creating the file if it does not exist.  This
+ * lets a user keep a journal of changes in the file and only write it
+ * in full now and then.  Note that reading the file returns the items
+ * in the reverse order they are in the file, and the same name may
+ * appear more than once, so a journal's entries should carry their
+ * own ordering.
+ */
+int append_persist(persist_t *p);
+/* Write the persist in the text format, whatever persist_binary is. */
 int write_persist_file(persist_t *p, FILE *f);
 void free_persist(persist_t *p);
 
@@ -97,4 +108,19 @@ void free_persist_str(char *str);
 /* Can be set to zero to disable persistence. */
 extern int persist_enable;
 
+/*
+ * Set to write persist files in a binary format instead of text.  A
+ * binary file is mapped when it is read and its values are used in
+ * place, which is a lot faster for big files.  Files in either format
+ * can be read.
+ */
+extern int persist_binary;
+
+/*
+ * Rewrite the given file in the binary format if binary is set, or in
+ * the text format if not, keeping the items in the same order.  The
+ * file name is a full path, this does not depend on persist_init().
+ */
+int persist_convert_file(const char *fname, int binary);
+
 #endif /* __PERSIST_H__ */
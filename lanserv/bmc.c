@@ -512,7 +512,8 @@ ipmi_emu_get_user_data(emu_data_t *emu)
 void
 ipmi_mc_destroy(lmc_data_t *mc)
 {
-    sel_entry_t *entry, *n_entry;
+    sel_entry_t  *entry, *n_entry;
+    unsigned int i;
 
     entry = mc->sel.entries;
     while (entry) {
@@ -520,6 +521,14 @@ ipmi_mc_destroy(lmc_data_t *mc)
 	free(entry);
 	entry = n_entry;
     }
+    if (mc->sel.hash)
+	free(mc->sel.hash);
+    if (mc->main_sdrs.hash)
+	free(mc->main_sdrs.hash);
+    for (i = 0; i < 4; i++) {
+	if (mc->device_sdrs[i].hash)
+	    free(mc->device_sdrs[i].hash);
+    }
     free(mc);
 }
 
@@ -593,10 +602,15 @@ ipmi_mc_set_num_leds(lmc_data_t   *mc,
     return 0;
 }
 
+static const char *device_sdr_names[4] = {
+    "device0", "device1", "device2", "device3"
+};
+
 static int
 init_mc(emu_data_t *emu, lmc_data_t *mc, unsigned int persist_sdr)
 {
-    int err;
+    int          err;
+    unsigned int i;
 
     err = mc->sysinfo->alloc_timer(mc->sysinfo, watchdog_timeout,
 				   mc, &mc->watchdog_timer);
@@ -606,10 +620,8 @@ init_mc(emu_data_t *emu, lmc_data_t *mc, unsigned int persist_sdr)
     }
 
     if (persist_sdr && mc->has_device_sdrs) {
-	read_mc_sdrs(mc, &mc->device_sdrs[0], "device0");
-	read_mc_sdrs(mc, &mc->device_sdrs[1], "device1");
-	read_mc_sdrs(mc, &mc->device_sdrs[2], "device2");
-	read_mc_sdrs(mc, &mc->device_sdrs[3], "device3");
+	for (i = 0; i < 4; i++)
+	    read_mc_sdrs(mc, &mc->device_sdrs[i], device_sdr_names[i]);
     }
 
     if (persist_sdr && (mc->device_support & IPMI_DEVID_SDR_REPOSITORY_DEV))
@@ -869,9 +881,11 @@ ipmi_emu_add_mc(emu_data_t    *emu,
     mc->main_sdrs.time_offset = 0;
     mc->main_sdrs.next_entry = 1;
     mc->main_sdrs.flags |= IPMI_SDR_RESERVE_SDR_SUPPORTED;
+    mc->main_sdrs.persist_name = "main";
     for (i=0; i<4; i++) {
 	mc->device_sdrs[i].time_offset = 0;
 	mc->device_sdrs[i].next_entry = 1;
+	mc->device_sdrs[i].persist_name = device_sdr_names[i];
     }
 
     mc->event_receiver = sys->bmc_ipmb;
@@ -70,11 +70,24 @@ typedef struct sel_entry_s
     uint16_t           record_id;
     unsigned char      data[16];
     struct sel_entry_s *next;
+    struct sel_entry_s *prev;
+    struct sel_entry_s *hash_next;
 } sel_entry_t;
 
 typedef struct sel_s
 {
+    /* The entries in the order they were added, and an index of them
+       by record id.  hash_size is a power of two. */
     sel_entry_t   *entries;
+    sel_entry_t   *last;
+    sel_entry_t   **hash;
+    unsigned int  hash_size;
+
+    /* Changes appended to the persist file since it was last written
+       in full, and the sequence number for the next one. */
+    unsigned int  journal_count;
+    unsigned int  journal_seq;
+
     int           count;
     int           max_count;
     uint32_t      last_add_time;
@@ -91,8 +104,10 @@ typedef struct sdr_s
 {
     uint16_t      record_id;
     unsigned int  length;
-    unsigned char *data;
+    unsigned char *data; /* Allocated with the sdr_t, right after it. */
     struct sdr_s  *next;
+    struct sdr_s  *prev;
+    struct sdr_s  *hash_next;
 } sdr_t;
 
 typedef struct sdrs_s
@@ -107,11 +122,46 @@ typedef struct sdrs_s
     uint16_t      next_entry;
     unsigned int  sdrs_length;
 
-    /* A linked list of SDR entries. */
+    /* A linked list of SDR entries, and an index of them by record
+       id.  hash_size is a power of two, the table grows as SDRs are
+       added. */
     sdr_t         *sdrs;
+    sdr_t         *last;
+    sdr_t         **hash;
+    unsigned int  hash_size;
+
+    /* The name of the persist file is "sdr.<ipmb>.<persist_name>".
+       Changes are appended to it as a journal, journal_count is the
+       number appended since it was last written in full.  Until the
+       file has been read or written, it may hold an old repository,
+       so persist_synced is not set and the first change writes it in
+       full. */
+    const char    *persist_name;
+    unsigned int  journal_count;
+    unsigned int  journal_seq;
+    int           persist_synced;
 } sdrs_t;
 
 typedef struct sensor_s sensor_t;
+
+/*
+ * Polled sensors with the same poll period share a timer, each tick
+ * polls all the sensors in the group.  The groups are kept in the emu.
+ */
+typedef struct sensor_poll_group_s sensor_poll_group_t;
+struct sensor_poll_group_s
+{
+    sys_data_t     *sysinfo;
+    struct timeval period;
+    struct timeval next_time; /* When the next tick is due. */
+    ipmi_timer_t   *timer;
+
+    sensor_t       *sensors;
+    sensor_t       *last;
+
+    sensor_poll_group_t *next;
+};
+
 struct sensor_s
 {
     lmc_data_t *mc;
@@ -152,10 +202,11 @@ struct sensor_s
     /* Called when the sensor changes values. */
     void (*sensor_update_handler)(lmc_data_t *mc, sensor_t *sensor);
 
-    ipmi_timer_t *poll_timer;
-    struct timeval poll_timer_time;
+    sensor_poll_group_t *poll_group;
+    sensor_t *poll_next;
     int (*poll)(void *cb_data, unsigned int *val, const char **errstr);
     void *cb_data;
+    ipmi_sensor_poll_stats_t poll_stats;
 };
 
 typedef struct fru_data_s fru_data_t;
@@ -390,6 +441,8 @@ struct emu_data_s
 
     struct timeval last_addr_change_time;
     emu_addr_t addr[MAX_EMU_ADDR];
+
+    sensor_poll_group_t *poll_groups;
 };
 
 /* Device ID support bits */
@@ -407,8 +460,7 @@ fru_data_t *find_fru(lmc_data_t *mc, unsigned int devid);
 int start_poweron_timer(lmc_data_t *mc);
 
 sdr_t *find_sdr_by_recid(sdrs_t     *sdrs,
-			 uint16_t   record_id,
-			 sdr_t      **prev);
+			 uint16_t   record_id);
 
 sdr_t *new_sdr_entry(sdrs_t *sdrs, unsigned char length);
 void add_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *entry);
@@ -30,6 +30,7 @@
  *  License along with this program; if not, write to the Free
  *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
 
+#include <config.h>
 #include "bmc.h"
 
 #include <errno.h>
@@ -41,12 +42,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef HAVE_INOTIFY_INIT1
+#include <sys/inotify.h>
+#endif
 
 #include <OpenIPMI/ipmi_err.h>
 #include <OpenIPMI/ipmi_msgbits.h>
 #include <OpenIPMI/ipmi_bits.h>
 
-static void sensor_poll(void *cb_data);
+static void sensor_poll(sensor_t *sensor);
+
 
 static void
 handle_get_event_receiver(lmc_data_t    *mc,
@@ -181,15 +186,9 @@ handle_get_device_sdr(lmc_data_t    *mc,
     if (record_id == 0) {
 	entry = mc->device_sdrs[msg->rs_lun].sdrs;
     } else if (record_id == 0xffff) {
-	entry = mc->device_sdrs[msg->rs_lun].sdrs;
-	if (entry) {
-	    while (entry->next) {
-		entry = entry->next;
-	    }
-	}
+	entry = mc->device_sdrs[msg->rs_lun].last;
     } else {
-	entry = find_sdr_by_recid(&mc->device_sdrs[msg->rs_lun],
-				  record_id, NULL);
+	entry = find_sdr_by_recid(&mc->device_sdrs[msg->rs_lun], record_id);
     }
 
     if (entry == NULL) {
@@ -1162,6 +1161,14 @@ ipmi_mc_add_sensor(lmc_data_t    *mc,
     return 0;
 }
 
+/*
+ * A file sensor keeps its file open and reads it with pread() on each
+ * poll.  If the file gets replaced instead of rewritten, the "reopen"
+ * option opens it on every poll instead.  With the "notify" option, the
+ * file is watched with inotify and only read after it changes, the
+ * last value is used in between.  That is for files that rarely
+ * change, it does not work on sysfs files.
+ */
 struct file_data {
     char *filename;
     unsigned int offset;
@@ -1181,57 +1188,133 @@ struct file_data {
     unsigned char depends_lun;
     unsigned char depends_sensor_num;
     unsigned char depends_sensor_bit;
+
+    int fd;
+    int reopen;
+
+    int notify;
+    int wd;
+    int changed;
+    unsigned int val;
+    struct file_data *notify_next;
 };
 
-static int
-file_poll(void *cb_data, unsigned int *rval, const char **errstr)
+static void
+file_close(struct file_data *f)
 {
-    struct file_data *f = cb_data;
-    int fd;
-    int rv;
-    int val;
-    char *end;
-    int errv;
+    if (f->fd != -1) {
+	close(f->fd);
+	f->fd = -1;
+    }
+}
 
-    if (f->depends_mc_addr) {
-	lmc_data_t *mc = f->sensor_mc;
-	sensor_t *sensor, *dsensor;
+#ifdef HAVE_INOTIFY_INIT1
+static int file_notify_fd = -1;
+static struct file_data *file_notify_list;
 
-	sensor = mc->sensors[f->sensor_lun][f->sensor_num];
-	if (!sensor) {
-	    *errstr = "Invalid sensor";
-	    return EINVAL;
-	}
+static void
+file_notify_ready(int fd, void *cb_data)
+{
+    char buf[4096]
+	__attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    struct file_data *f;
+    ssize_t len;
+    char *p;
+    int drop;
 
-	errv = ipmi_emu_get_mc_by_addr(mc->emu, f->depends_mc_addr, &mc);
-	if (errv) {
-	    *errstr = "Invalid depends mc address";
-	    return errv;
-	}
-	dsensor = mc->sensors[f->depends_lun][f->depends_sensor_num];
-	if (!dsensor) {
-	    *errstr = "Invalid depends sensor number or LUN";
-	    return EINVAL;
+    for (;;) {
+	len = read(fd, buf, sizeof(buf));
+	if (len <= 0)
+	    break;
+
+	for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+	    ev = (struct inotify_event *) p;
+	    drop = 0;
+	    for (f = file_notify_list; f; f = f->notify_next) {
+		if (!(ev->mask & IN_Q_OVERFLOW) && (ev->wd != f->wd))
+		    continue;
+		f->changed = 1;
+		if (ev->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF
+				| IN_IGNORED))
+		{
+		    /* The file may have been replaced, open it again and
+		       watch the new one. */
+		    file_close(f);
+		    f->wd = -1;
+		    drop = 1;
+		}
+	    }
+	    /*
+	     * Sensors on the same file share a watch, so remove it once
+	     * they have all let go of it.  The kernel already removed it
+	     * if it sent IN_IGNORED.
+	     */
+	    if (drop && !(ev->mask & IN_IGNORED))
+		inotify_rm_watch(fd, ev->wd);
 	}
-	sensor->enabled = bit_set(dsensor->event_status, f->depends_sensor_bit);
-	if (!sensor->enabled) 
-	    return 0;
     }
+}
 
-    fd = open(f->filename, O_RDONLY);
-    if (fd == -1) {
-	errv = errno;
-	*errstr = "Unable to open sensor file";
-	return errv;
+static void
+file_notify_watch(struct file_data *f)
+{
+    sys_data_t *sys = f->sensor_mc->sysinfo;
+    ipmi_io_t *io;
+    int fd;
+
+    if (file_notify_fd == -1) {
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1)
+	    return;
+	if (sys->add_io_hnd(sys, fd, file_notify_ready, NULL, &io)) {
+	    close(fd);
+	    return;
+	}
+	file_notify_fd = fd;
     }
 
-    if (f->offset) {
-	if (lseek(fd, f->offset, SEEK_SET) == -1) {
+    f->wd = inotify_add_watch(file_notify_fd, f->filename,
+			      IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+			      | IN_MOVE_SELF | IN_DELETE_SELF);
+}
+
+static void
+file_notify_add(struct file_data *f)
+{
+    f->notify_next = file_notify_list;
+    file_notify_list = f;
+}
+#else
+static void
+file_notify_watch(struct file_data *f)
+{
+}
+
+static void
+file_notify_add(struct file_data *f)
+{
+}
+#endif
+
+static int
+file_read(struct file_data *f, unsigned int *rval, const char **errstr)
+{
+    int rv;
+    int val;
+    char *end;
+    int errv;
+
+    if (f->fd == -1) {
+	f->fd = open(f->filename, O_RDONLY);
+	if (f->fd == -1) {
 	    errv = errno;
-	    close(fd);
-	    *errstr = "Unable to seek file";
+	    *errstr = "Unable to open sensor file";
 	    return errv;
 	}
+	fcntl(f->fd, F_SETFD, FD_CLOEXEC);
+	if (f->notify && (f->wd == -1))
+	    file_notify_watch(f);
     }
 
     if (f->is_raw) {
@@ -1241,9 +1324,10 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
 
 	if (length > 4)
 	    length = 4;
-	rv = read(fd, data, length);
+	rv = pread(f->fd, data, length, f->offset);
 	errv = errno;
-	close(fd);
+	if (rv == -1 || f->reopen)
+	    file_close(f);
 	if (rv == -1) {
 	    *errstr = "No data read from file";
 	    return errv;
@@ -1257,9 +1341,10 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
     } else {
 	char data[100];
 
-	rv = read(fd, data, sizeof(data) - 1);
+	rv = pread(f->fd, data, sizeof(data) - 1, f->offset);
 	errv = errno;
-	close(fd);
+	if (rv == -1 || f->reopen)
+	    file_close(f);
 	if (rv == -1) {
 	    *errstr = "No data read from file";
 	    return errv;
@@ -1288,6 +1373,51 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
     return 0;
 }
 
+static int
+file_poll(void *cb_data, unsigned int *rval, const char **errstr)
+{
+    struct file_data *f = cb_data;
+    int errv;
+
+    if (f->depends_mc_addr) {
+	lmc_data_t *mc = f->sensor_mc;
+	sensor_t *sensor, *dsensor;
+
+	sensor = mc->sensors[f->sensor_lun][f->sensor_num];
+	if (!sensor) {
+	    *errstr = "Invalid sensor";
+	    return EINVAL;
+	}
+
+	errv = ipmi_emu_get_mc_by_addr(mc->emu, f->depends_mc_addr, &mc);
+	if (errv) {
+	    *errstr = "Invalid depends mc address";
+	    return errv;
+	}
+	dsensor = mc->sensors[f->depends_lun][f->depends_sensor_num];
+	if (!dsensor) {
+	    *errstr = "Invalid depends sensor number or LUN";
+	    return EINVAL;
+	}
+	sensor->enabled = bit_set(dsensor->event_status, f->depends_sensor_bit);
+	if (!sensor->enabled) 
+	    return 0;
+    }
+
+    /* Without a watch on the file, there's no telling if it changed. */
+    if (f->notify && !f->changed && (f->wd != -1)) {
+	*rval = f->val;
+	return 0;
+    }
+
+    errv = file_read(f, &f->val, errstr);
+    if (errv)
+	return errv;
+    f->changed = 0;
+    *rval = f->val;
+    return 0;
+}
+
 static int
 file_init(lmc_data_t *mc,
 	  unsigned char lun, unsigned char sensor_num,
@@ -1312,6 +1442,9 @@ file_init(lmc_data_t *mc,
     if (!f)
 	return ENOMEM;
     memset(f, 0, sizeof(*f));
+    f->fd = -1;
+    f->wd = -1;
+    f->changed = 1;
     f->emu = mc->emu;
     f->sensor_mc = mc;
     f->sensor_lun = lun;
@@ -1358,6 +1491,10 @@ file_init(lmc_data_t *mc,
 	    f->is_raw = 1;
 	} else if (strcmp("ascii", tok) == 0) {
 	    f->is_raw = 0;
+	} else if (strcmp("reopen", tok) == 0) {
+	    f->reopen = 1;
+	} else if (strcmp("notify", tok) == 0) {
+	    f->notify = 1;
 	} else if (strncmp("offset=", tok, 7) == 0) {
 	    f->offset = strtoul(tok + 7, &end, 0);
 	    if (*end != '\0') {
@@ -1429,6 +1566,9 @@ file_init(lmc_data_t *mc,
 	return ENOMEM;
     }
 
+    if (f->notify)
+	file_notify_add(f);
+
     *rcb_data = f;
     return 0;
 
@@ -1493,45 +1633,174 @@ free_sensor(lmc_data_t *mc, sensor_t *sensor)
     free(sensor);
 }
 
+static long long
+timeval_us(struct timeval *tv)
+{
+    return ((long long) tv->tv_sec) * 1000000 + tv->tv_usec;
+}
+
+static long long
+diff_timeval_us(struct timeval *tv1, struct timeval *tv2)
+{
+    return timeval_us(tv1) - timeval_us(tv2);
+}
+
 static void
-sensor_poll(void *cb_data)
+add_timeval_us(struct timeval *tv, long long usec)
 {
-    sensor_t *sensor = cb_data;
+    usec += tv->tv_usec;
+    tv->tv_sec += usec / 1000000;
+    tv->tv_usec = usec % 1000000;
+    if (tv->tv_usec < 0) {
+	tv->tv_usec += 1000000;
+	tv->tv_sec -= 1;
+    }
+}
 
-    if (sensor->poll && sensor->scanning_enabled) {
-	lmc_data_t *mc = sensor->mc;
-	unsigned int val;
-	const char *errstr;
-	int err;
+static void
+sensor_do_poll(sensor_t *sensor, struct timeval *due)
+{
+    lmc_data_t *mc = sensor->mc;
+    ipmi_sensor_poll_stats_t *stats = &sensor->poll_stats;
+    struct timeval start, end;
+    unsigned int val;
+    const char *errstr;
+    unsigned long usec;
+    long long delay;
+    int err;
 
-	err = sensor->poll(sensor->cb_data, &val, &errstr);
-	if (err) {
-	    mc->sysinfo->log(mc->sysinfo, OS_ERROR, NULL,
-			     "Error getting sensor value (%2.2x,%d,%d): %s, %s",
-			     ipmi_mc_get_ipmb(mc), sensor->lun, sensor->num,
-			     strerror(err), errstr);
-	    goto out_restart;
-	}
+    mc->sysinfo->get_monotonic_time(mc->sysinfo, &start);
+    err = sensor->poll(sensor->cb_data, &val, &errstr);
+    mc->sysinfo->get_monotonic_time(mc->sysinfo, &end);
+
+    stats->polls++;
+    usec = diff_timeval_us(&end, &start);
+    stats->last_duration = usec;
+    stats->total_duration += usec;
+    if (usec > stats->max_duration)
+	stats->max_duration = usec;
+    delay = diff_timeval_us(&start, due);
+    if (delay > 0) {
+	stats->total_delay += delay;
+	if (delay > (long long) stats->max_delay)
+	    stats->max_delay = delay;
+    }
+
+    if (err) {
+	stats->errors++;
+	mc->sysinfo->log(mc->sysinfo, OS_ERROR, NULL,
+			 "Error getting sensor value (%2.2x,%d,%d): %s, %s",
+			 ipmi_mc_get_ipmb(mc), sensor->lun, sensor->num,
+			 strerror(err), errstr);
+	return;
+    }
 	
-	if (sensor->event_reading_code == IPMI_EVENT_READING_TYPE_THRESHOLD) {
-	    if (val < 0)
-		val = 0;
-	    else if (val > 255)
-		val = 255;
-	    set_sensor_value(mc, sensor, val, 1);
-	} else {
-	    unsigned int i;
+    if (sensor->event_reading_code == IPMI_EVENT_READING_TYPE_THRESHOLD) {
+	if (val < 0)
+	    val = 0;
+	else if (val > 255)
+	    val = 255;
+	set_sensor_value(mc, sensor, val, 1);
+    } else {
+	unsigned int i;
 	    
-	    for (i = 0; i < 15; i++)
-		set_sensor_bit(mc, sensor,
-			       i, ((val >> i) & 1), 0, 0xff, 0xff, 1);
-	}
+	for (i = 0; i < 15; i++)
+	    set_sensor_bit(mc, sensor,
+			   i, ((val >> i) & 1), 0, 0xff, 0xff, 1);
+    }
+}
+
+/* Poll the sensor now, if it is polled and scanning. */
+static void
+sensor_poll(sensor_t *sensor)
+{
+    lmc_data_t *mc = sensor->mc;
+    struct timeval now;
 
-      out_restart:
-	mc->sysinfo->start_timer(sensor->poll_timer, &sensor->poll_timer_time);
+    if (sensor->poll && sensor->scanning_enabled) {
+	mc->sysinfo->get_monotonic_time(mc->sysinfo, &now);
+	sensor_do_poll(sensor, &now);
     }
 }
 
+static void
+sensor_poll_group_tick(void *cb_data)
+{
+    sensor_poll_group_t *group = cb_data;
+    sys_data_t *sys = group->sysinfo;
+    sensor_t *sensor;
+    struct timeval now, timeout;
+    long long usec;
+
+    for (sensor = group->sensors; sensor; sensor = sensor->poll_next) {
+	if (sensor->scanning_enabled)
+	    sensor_do_poll(sensor, &group->next_time);
+    }
+
+    /* Go from when the tick was due, so the period does not drift.  If
+       the polls fell a whole period behind, start over from now. */
+    usec = timeval_us(&group->period);
+    add_timeval_us(&group->next_time, usec);
+    sys->get_monotonic_time(sys, &now);
+    if (diff_timeval_us(&group->next_time, &now) <= 0) {
+	group->next_time = now;
+	add_timeval_us(&group->next_time, usec);
+    }
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 0;
+    add_timeval_us(&timeout, diff_timeval_us(&group->next_time, &now));
+    sys->start_timer(group->timer, &timeout);
+}
+
+static int
+sensor_poll_group_add(lmc_data_t *mc, sensor_t *sensor, unsigned int poll_rate)
+{
+    emu_data_t *emu = mc->emu;
+    sys_data_t *sys = mc->sysinfo;
+    sensor_poll_group_t *group;
+    struct timeval period;
+    int err;
+
+    period.tv_sec = poll_rate / 1000;
+    period.tv_usec = (poll_rate % 1000) * 1000;
+
+    for (group = emu->poll_groups; group; group = group->next) {
+	if ((group->sysinfo == sys)
+	    && (group->period.tv_sec == period.tv_sec)
+	    && (group->period.tv_usec == period.tv_usec))
+	    break;
+    }
+
+    if (!group) {
+	group = malloc(sizeof(*group));
+	if (!group)
+	    return ENOMEM;
+	memset(group, 0, sizeof(*group));
+	group->sysinfo = sys;
+	group->period = period;
+	err = sys->alloc_timer(sys, sensor_poll_group_tick, group,
+			       &group->timer);
+	if (err) {
+	    free(group);
+	    return err;
+	}
+	sys->get_monotonic_time(sys, &group->next_time);
+	add_timeval_us(&group->next_time, timeval_us(&period));
+	sys->start_timer(group->timer, &period);
+	group->next = emu->poll_groups;
+	emu->poll_groups = group;
+    }
+
+    sensor->poll_group = group;
+    sensor->poll_next = NULL;
+    if (group->last)
+	group->last->poll_next = sensor;
+    else
+	group->sensors = sensor;
+    group->last = sensor;
+    return 0;
+}
+
 int
 ipmi_mc_add_polled_sensor(lmc_data_t    *mc,
 			  unsigned char lun,
@@ -1553,19 +1822,33 @@ ipmi_mc_add_polled_sensor(lmc_data_t    *mc,
     sensor = mc->sensors[lun][sens_num];
 
     sensor->poll = poll;
-    sensor->poll_timer_time.tv_sec = poll_rate / 1000;
-    sensor->poll_timer_time.tv_usec = (poll_rate % 1000) * 1000;
     sensor->cb_data = cb_data;
     
-    err = mc->sysinfo->alloc_timer(mc->sysinfo, sensor_poll, sensor,
-				   &sensor->poll_timer);
+    err = sensor_poll_group_add(mc, sensor, poll_rate);
     if (err) {
 	free_sensor(mc, sensor);
 	return err;
     }
 
-    mc->sysinfo->start_timer(sensor->poll_timer, &sensor->poll_timer_time);
+    return 0;
+}
+
+int
+ipmi_mc_sensor_get_poll_stats(lmc_data_t               *mc,
+			      unsigned char            lun,
+			      unsigned char            sens_num,
+			      ipmi_sensor_poll_stats_t *stats)
+{
+    sensor_t *sensor;
+
+    if ((lun >= 4) || (sens_num >= 255) || (!mc->sensors[lun][sens_num]))
+	return EINVAL;
+
+    sensor = mc->sensors[lun][sens_num];
+    if (!sensor->poll)
+	return EINVAL;
 
+    *stats = sensor->poll_stats;
     return 0;
 }
 
@@ -34,6 +34,7 @@
 
 #include <errno.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -44,6 +45,114 @@
 #include <OpenIPMI/ipmi_msgbits.h>
 #include <OpenIPMI/persist.h>
 
+/*
+ * Journals in persist files.
+ *
+ * The SEL and SDR repositories only write their persist files in full
+ * now and then.  In between, each change is appended to the file as
+ * a data item named "j<seq>", whose first byte says what the change
+ * is.  Reading the file returns the items in no useful order, so the
+ * journal items are collected while iterating and then sorted by
+ * sequence number to be applied.
+ */
+
+typedef struct journal_op_s
+{
+    unsigned int  seq;
+    unsigned int  len;
+    unsigned char *data;
+} journal_op_t;
+
+typedef struct journal_load_s
+{
+    journal_op_t *ops;
+    unsigned int num_ops;
+    unsigned int ops_size;
+} journal_load_t;
+
+static int
+is_journal_item(const char *name)
+{
+    return name[0] == 'j';
+}
+
+/* Returns EINVAL if the name is not a valid journal item name. */
+static int
+journal_collect(journal_load_t *j, const char *name,
+		void *data, unsigned int len)
+{
+    journal_op_t *op;
+    char         *end;
+    unsigned int seq;
+
+    seq = strtoul(name + 1, &end, 10);
+    if ((name[1] == '\0') || (*end != '\0') || (len == 0))
+	return EINVAL;
+
+    if (j->num_ops >= j->ops_size) {
+	unsigned int new_size = j->ops_size ? j->ops_size * 2 : 64;
+	journal_op_t *new_ops;
+
+	new_ops = realloc(j->ops, new_size * sizeof(*new_ops));
+	if (!new_ops)
+	    return ENOMEM;
+	j->ops = new_ops;
+	j->ops_size = new_size;
+    }
+
+    op = &j->ops[j->num_ops];
+    op->data = malloc(len);
+    if (!op->data)
+	return ENOMEM;
+    memcpy(op->data, data, len);
+    op->seq = seq;
+    op->len = len;
+    j->num_ops++;
+    return 0;
+}
+
+static int
+journal_op_cmp(const void *a, const void *b)
+{
+    const journal_op_t *op1 = a;
+    const journal_op_t *op2 = b;
+
+    if (op1->seq < op2->seq)
+	return -1;
+    if (op1->seq > op2->seq)
+	return 1;
+    return 0;
+}
+
+static void
+journal_sort(journal_load_t *j)
+{
+    qsort(j->ops, j->num_ops, sizeof(*j->ops), journal_op_cmp);
+}
+
+static void
+journal_free(journal_load_t *j)
+{
+    unsigned int i;
+
+    for (i = 0; i < j->num_ops; i++)
+	free(j->ops[i].data);
+    free(j->ops);
+}
+
+/* Append one journal item to the file for p, which should be empty. */
+static int
+journal_append(persist_t *p, unsigned int seq,
+	       unsigned char *data, unsigned int len)
+{
+    int err;
+
+    err = add_persist_data(p, data, len, "j%u", seq);
+    if (!err)
+	err = append_persist(p);
+    return err;
+}
+
 /*
  * SEL handling commands.
  */
@@ -52,31 +161,178 @@
 #define IPMI_SEL_SUPPORTS_RESERVE        (1 << 1)
 #define IPMI_SEL_SUPPORTS_GET_ALLOC_INFO (1 << 0)
 
+/*
+ * The SEL entries are kept in a list in the order they were added,
+ * with a hash index by record id, so adding, finding and deleting an
+ * entry does not depend on the size of the SEL.
+ *
+ * In the SEL's journal, an add holds the add time and the 16 bytes of
+ * the entry, a delete holds the record id.
+ */
+
+#define SEL_HASH_MIN_SIZE	16
+#define SEL_HASH_MAX_SIZE	65536
+
+#define SEL_JOURNAL_ADD		'a'
+#define SEL_JOURNAL_DELETE	'd'
+#define SEL_JOURNAL_ADD_LEN	21
+#define SEL_JOURNAL_DELETE_LEN	3
+
+/* Write the file in full when the journal gets this much longer than
+   the SEL itself. */
+#define SEL_JOURNAL_SLACK	64
+
 static sel_entry_t *
-find_sel_event_by_recid(lmc_data_t  *mc,
-			uint16_t    record_id,
-			sel_entry_t **prev)
+find_sel_event_by_recid(lmc_data_t *mc, uint16_t record_id)
 {
     sel_entry_t *entry;
-    sel_entry_t *p_entry = NULL;
 
-    entry = mc->sel.entries;
+    if (!mc->sel.hash)
+	return NULL;
+
+    entry = mc->sel.hash[record_id & (mc->sel.hash_size - 1)];
     while (entry) {
 	if (record_id == entry->record_id)
 	    break;
-	p_entry = entry;
-	entry = entry->next;
+	entry = entry->hash_next;
     }
-    if (prev)
-	*prev = p_entry;
     return entry;
 }
 
+/* Put the entry on the end of the SEL. */
+static void
+sel_link_entry(lmc_data_t *mc, sel_entry_t *e)
+{
+    unsigned int h = e->record_id & (mc->sel.hash_size - 1);
+
+    e->next = NULL;
+    e->prev = mc->sel.last;
+    if (mc->sel.last)
+	mc->sel.last->next = e;
+    else
+	mc->sel.entries = e;
+    mc->sel.last = e;
+
+    e->hash_next = mc->sel.hash[h];
+    mc->sel.hash[h] = e;
+    mc->sel.count++;
+}
+
+static void
+sel_unlink_entry(lmc_data_t *mc, sel_entry_t *e)
+{
+    sel_entry_t **p;
+
+    if (e->prev)
+	e->prev->next = e->next;
+    else
+	mc->sel.entries = e->next;
+    if (e->next)
+	e->next->prev = e->prev;
+    else
+	mc->sel.last = e->prev;
+
+    p = &mc->sel.hash[e->record_id & (mc->sel.hash_size - 1)];
+    while (*p != e)
+	p = &(*p)->hash_next;
+    *p = e->hash_next;
+    mc->sel.count--;
+}
+
+static void
+sel_free_entries(lmc_data_t *mc)
+{
+    sel_entry_t *entry, *n_entry;
+
+    entry = mc->sel.entries;
+    while (entry) {
+	n_entry = entry->next;
+	free(entry);
+	entry = n_entry;
+    }
+    mc->sel.entries = NULL;
+    mc->sel.last = NULL;
+    mc->sel.count = 0;
+    if (mc->sel.hash)
+	memset(mc->sel.hash, 0, mc->sel.hash_size * sizeof(sel_entry_t *));
+}
+
+typedef struct sel_load_s
+{
+    lmc_data_t     *mc;
+    journal_load_t journal;
+} sel_load_t;
+
+static int
+handle_sel_journal(sel_load_t *info, const char *name,
+		   void *data, unsigned int len)
+{
+    unsigned char *d = data;
+    int           err;
+
+    if (!((len == SEL_JOURNAL_ADD_LEN) && (d[0] == SEL_JOURNAL_ADD))
+	&& !((len == SEL_JOURNAL_DELETE_LEN) && (d[0] == SEL_JOURNAL_DELETE)))
+	err = EINVAL;
+    else
+	err = journal_collect(&info->journal, name, data, len);
+    if (err == EINVAL) {
+	info->mc->sysinfo->log(info->mc->sysinfo, INFO, NULL,
+			       "Got invalid SEL journal entry for %2.2x,"
+			       " name is %s",
+			       ipmi_mc_get_ipmb(info->mc), name);
+	err = 0;
+    }
+    if (err)
+	return err;
+    return ITER_PERSIST_CONTINUE;
+}
+
+static void
+apply_sel_journal(sel_load_t *info)
+{
+    lmc_data_t   *mc = info->mc;
+    sel_entry_t  *e;
+    unsigned int i;
+    uint16_t     record_id;
+
+    journal_sort(&info->journal);
+    for (i = 0; i < info->journal.num_ops; i++) {
+	journal_op_t *op = &info->journal.ops[i];
+
+	if (op->data[0] == SEL_JOURNAL_ADD) {
+	    record_id = ipmi_get_uint16(op->data + 5);
+	    e = find_sel_event_by_recid(mc, record_id);
+	    if (e) {
+		memcpy(e->data, op->data + 5, 16);
+	    } else {
+		e = malloc(sizeof(*e));
+		if (!e)
+		    continue;
+		memcpy(e->data, op->data + 5, 16);
+		e->record_id = record_id;
+		sel_link_entry(mc, e);
+	    }
+	    mc->sel.last_add_time = ipmi_get_uint32(op->data + 1);
+	} else {
+	    record_id = ipmi_get_uint16(op->data + 1);
+	    e = find_sel_event_by_recid(mc, record_id);
+	    if (e) {
+		sel_unlink_entry(mc, e);
+		free(e);
+	    }
+	}
+    }
+}
+
 static int
 handle_sel(const char *name, void *data, unsigned int len, void *cb_data)
 {
-    sel_entry_t *e, *n;
-    lmc_data_t *mc = cb_data;
+    sel_load_t  *info = cb_data;
+    lmc_data_t  *mc = info->mc;
+    sel_entry_t *n;
+
+    if (is_journal_item(name))
+	return handle_sel_journal(info, name, data, len);
 
     if (len != 16) {
 	mc->sysinfo->log(mc->sysinfo, INFO, NULL,
@@ -91,17 +347,11 @@ handle_sel(const char *name, void *data, unsigned int len, void *cb_data)
 
     memcpy(n->data, data, 16);
     n->record_id = n->data[0] | (n->data[1] << 8);
-    n->next = NULL;
-
-    e = mc->sel.entries;
-    if (!e)
-	mc->sel.entries = n;
-    else {
-	while (e->next)
-	    e = e->next;
-	e->next = n;
+    if (find_sel_event_by_recid(mc, n->record_id)) {
+	free(n);
+	goto out;
     }
-    mc->sel.count++;
+    sel_link_entry(mc, n);
 
   out:
     return ITER_PERSIST_CONTINUE;
@@ -110,7 +360,8 @@ handle_sel(const char *name, void *data, unsigned int len, void *cb_data)
 static int
 handle_sel_time(const char *name, long val, void *cb_data)
 {
-    lmc_data_t *mc = cb_data;
+    sel_load_t *info = cb_data;
+    lmc_data_t *mc = info->mc;
 
     if (strcmp(name, "last_add_time") == 0)
 	mc->sel.last_add_time = val;
@@ -125,28 +376,57 @@ ipmi_mc_list_sel(lmc_data_t *mc)
     return mc->sel.count;
 }
 
+static void rewrite_sels(lmc_data_t *mc);
+
 int
 ipmi_mc_enable_sel(lmc_data_t    *mc,
 		   int           max_entries,
 		   unsigned char flags)
 {
-    persist_t *p;
+    persist_t    *p;
+    sel_load_t   info;
+    unsigned int hash_size;
+
+    if (mc->sel.hash) {
+	sel_free_entries(mc);
+	free(mc->sel.hash);
+	mc->sel.hash = NULL;
+    }
+
+    hash_size = SEL_HASH_MIN_SIZE;
+    while ((hash_size < SEL_HASH_MAX_SIZE)
+	   && (hash_size < (unsigned int) max_entries))
+	hash_size *= 2;
+    mc->sel.hash = malloc(hash_size * sizeof(sel_entry_t *));
+    if (!mc->sel.hash)
+	return ENOMEM;
+    mc->sel.hash_size = hash_size;
 
-    mc->sel.entries = NULL;
-    mc->sel.count = 0;
+    sel_free_entries(mc);
     mc->sel.max_count = max_entries;
     mc->sel.last_add_time = 0;
     mc->sel.last_erase_time = 0;
     mc->sel.flags = flags & 0xb;
     mc->sel.reservation = 0;
     mc->sel.next_entry = 1;
+    mc->sel.journal_count = 0;
+    mc->sel.journal_seq = 0;
 
     p = read_persist("sel.%2.2x", ipmi_mc_get_ipmb(mc));
     if (!p)
 	return 0;
 
-    iterate_persist(p, mc, handle_sel, handle_sel_time);
+    info.mc = mc;
+    memset(&info.journal, 0, sizeof(info.journal));
+    iterate_persist(p, &info, handle_sel, handle_sel_time);
     free_persist(p);
+
+    if (info.journal.num_ops > 0) {
+	/* Fold the journal into the file, so it starts out empty. */
+	apply_sel_journal(&info);
+	rewrite_sels(mc);
+    }
+    journal_free(&info.journal);
     return 0;
 }
 		    
@@ -181,6 +461,10 @@ rewrite_sels(lmc_data_t *mc)
     if (err)
 	goto out_err;
     free_persist(p);
+
+    /* The journal is gone with the old file. */
+    mc->sel.journal_count = 0;
+    mc->sel.journal_seq = 0;
     return;
 
   out_err:
@@ -191,6 +475,43 @@ rewrite_sels(lmc_data_t *mc)
 	free_persist(p);
 }
 
+/* Record a change to the SEL in the persist file. */
+static void
+journal_sel(lmc_data_t *mc, unsigned char *data, unsigned int len)
+{
+    persist_t *p;
+    int       err;
+
+    if (mc->sel.journal_count
+	>= ((unsigned int) mc->sel.count + SEL_JOURNAL_SLACK))
+    {
+	rewrite_sels(mc);
+	return;
+    }
+
+    p = alloc_persist("sel.%2.2x", ipmi_mc_get_ipmb(mc));
+    if (!p) {
+	err = ENOMEM;
+	goto out_err;
+    }
+    err = journal_append(p, mc->sel.journal_seq, data, len);
+    free_persist(p);
+    if (err)
+	goto out_err;
+
+    mc->sel.journal_seq++;
+    mc->sel.journal_count++;
+    return;
+
+  out_err:
+    mc->sysinfo->log(mc->sysinfo, OS_ERROR, NULL,
+		     "Unable to add to the SEL journal for MC %d: %d",
+		     ipmi_mc_get_ipmb(mc), err);
+    /* The file may have missed the change, so try to get it back in
+       sync. */
+    rewrite_sels(mc);
+}
+
 int
 ipmi_mc_add_to_sel(lmc_data_t    *mc,
 		   unsigned char record_type,
@@ -200,6 +521,7 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
     sel_entry_t    *e;
     struct timeval t;
     uint16_t       start_record_id;
+    unsigned char  jdata[SEL_JOURNAL_ADD_LEN];
 
     if (!(mc->device_support & IPMI_DEVID_SEL_DEVICE))
 	return ENOTSUP;
@@ -213,17 +535,20 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
     if (!e)
 	return ENOMEM;
 
-    /* FIXME - this is inefficient, but simple */
-    e->record_id = mc->sel.next_entry;
-    mc->sel.next_entry++;
-    start_record_id = e->record_id;
-    while ((mc->sel.next_entry == 0)
-	   || find_sel_event_by_recid(mc, e->record_id, NULL))
-    {
-	e->record_id++;
-	if (e->record_id == start_record_id)
-	    return EAGAIN;
+    /* Record ids 0 and 0xffff are special, hand out the ones in
+       between, skipping the ones still in use. */
+    start_record_id = mc->sel.next_entry;
+    for (;;) {
+	e->record_id = mc->sel.next_entry;
 	mc->sel.next_entry++;
+	if (mc->sel.next_entry == 0xffff)
+	    mc->sel.next_entry = 1;
+	if ((e->record_id != 0) && !find_sel_event_by_recid(mc, e->record_id))
+	    break;
+	if (mc->sel.next_entry == start_record_id) {
+	    free(e);
+	    return EAGAIN;
+	}
     }
 
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
@@ -237,24 +562,17 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
 	memcpy(e->data+3, event, 13);
     }
 
-    e->next = NULL;
-    if (!mc->sel.entries) {
-	mc->sel.entries = e;
-    } else {
-	sel_entry_t *f = mc->sel.entries;
-	while (f->next)
-	    f = f->next;
-	f->next = e;
-    }
-
-    mc->sel.count++;
+    sel_link_entry(mc, e);
 
     mc->sel.last_add_time = t.tv_sec + mc->sel.time_offset;
 
     if (recid)
 	*recid = e->record_id;
 
-    rewrite_sels(mc);
+    jdata[0] = SEL_JOURNAL_ADD;
+    ipmi_set_uint32(jdata+1, mc->sel.last_add_time);
+    memcpy(jdata+5, e->data, 16);
+    journal_sel(mc, jdata, sizeof(jdata));
 
     return 0;
 }
@@ -400,18 +718,12 @@ handle_get_sel_entry(lmc_data_t    *mc,
 	return;
     }
 
-    if (record_id == 0) {
+    if (record_id == 0)
 	entry = mc->sel.entries;
-    } else if (record_id == 0xffff) {
-	entry = mc->sel.entries;
-	if (entry) {
-	    while (entry->next) {
-		entry = entry->next;
-	    }
-	}
-    } else {
-	entry = find_sel_event_by_recid(mc, record_id, NULL);
-    }
+    else if (record_id == 0xffff)
+	entry = mc->sel.last;
+    else
+	entry = find_sel_event_by_recid(mc, record_id);
 
     if (entry == NULL) {
 	rdata[0] = IPMI_NOT_PRESENT_CC;
@@ -470,8 +782,9 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 			unsigned int  *rdata_len,
 			void          *cb_data)
 {
-    uint16_t    record_id;
-    sel_entry_t *entry, *p_entry;
+    uint16_t      record_id;
+    sel_entry_t   *entry;
+    unsigned char jdata[SEL_JOURNAL_DELETE_LEN];
 
     if (!(mc->device_support & IPMI_DEVID_SEL_DEVICE)) {
 	handle_invalid_cmd(mc, rdata, rdata_len);
@@ -498,31 +811,19 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 
     record_id = ipmi_get_uint16(msg->data+2);
 
-    if (record_id == 0) {
+    if (record_id == 0)
 	entry = mc->sel.entries;
-	p_entry = NULL;
-    } else if (record_id == 0xffff) {
-	entry = mc->sel.entries;
-	p_entry = NULL;
-	if (entry) {
-	    while (entry->next) {
-		p_entry = entry;
-		entry = entry->next;
-	    }
-	}
-    } else {
-	entry = find_sel_event_by_recid(mc, record_id, &p_entry);
-    }
+    else if (record_id == 0xffff)
+	entry = mc->sel.last;
+    else
+	entry = find_sel_event_by_recid(mc, record_id);
     if (!entry) {
 	rdata[0] = IPMI_NOT_PRESENT_CC;
 	*rdata_len = 1;
 	return;
     }
 
-    if (p_entry)
-	p_entry->next = entry->next;
-    else
-	mc->sel.entries = entry->next;
+    sel_unlink_entry(mc, entry);
 
     /* Clear the overflow flag. */
     mc->sel.flags &= ~0x80;
@@ -531,10 +832,11 @@ handle_delete_sel_entry(lmc_data_t    *mc,
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
 
-    mc->sel.count--;
+    jdata[0] = SEL_JOURNAL_DELETE;
+    ipmi_set_uint16(jdata+1, entry->record_id);
     free(entry);
 
-    rewrite_sels(mc);
+    journal_sel(mc, jdata, sizeof(jdata));
 }
 
 static void
@@ -544,7 +846,6 @@ handle_clear_sel(lmc_data_t    *mc,
 		 unsigned int  *rdata_len,
 		 void          *cb_data)
 {
-    sel_entry_t    *entry, *n_entry;
     unsigned char  op;
     struct timeval t;
 
@@ -584,16 +885,8 @@ handle_clear_sel(lmc_data_t    *mc,
     }
 
     rdata[1] = 1;
-    if (op == 0xaa) {
-	entry = mc->sel.entries;
-	mc->sel.entries = NULL;
-	mc->sel.count = 0;
-	while (entry) {
-	    n_entry = entry->next;
-	    free(entry);
-	    entry = n_entry;
-	}
-    }
+    if (op == 0xaa)
+	sel_free_entries(mc);
 
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
     mc->sel.last_erase_time = t.tv_sec + mc->sel.time_offset;
@@ -676,26 +969,171 @@ handle_set_sel_time(lmc_data_t    *mc,
 #define IPMI_SDR_MODAL_ONLY		2
 #define IPMI_SDR_MODAL_BOTH		3
 
+/*
+ * An SDR repository keeps its entries in a list in record order, with
+ * a hash index by record id, so getting, adding and deleting an SDR
+ * does not walk the list.  Each SDR's data is allocated along with
+ * it.
+ *
+ * In the repository's journal, an add holds the add time and the
+ * SDR, a delete holds the record id and the erase time.
+ */
+
+#define SDR_HASH_MIN_SIZE	16
+
+#define SDR_JOURNAL_ADD		'a'
+#define SDR_JOURNAL_DELETE	'd'
+#define SDR_JOURNAL_DELETE_LEN	7
+
+/* Write the file in full when the journal gets this much longer than
+   the repository itself. */
+#define SDR_JOURNAL_SLACK	64
+
+static unsigned int
+sdr_hash(sdrs_t *sdrs, uint16_t record_id)
+{
+    return record_id & (sdrs->hash_size - 1);
+}
+
 sdr_t *
 find_sdr_by_recid(sdrs_t     *sdrs,
-		  uint16_t   record_id,
-		  sdr_t      **prev)
+		  uint16_t   record_id)
 {
     sdr_t *entry;
-    sdr_t *p_entry = NULL;
 
-    entry = sdrs->sdrs;
+    if (!sdrs->hash) {
+	/* Could not allocate an index, just search. */
+	entry = sdrs->sdrs;
+	while (entry && (record_id != entry->record_id))
+	    entry = entry->next;
+	return entry;
+    }
+
+    entry = sdrs->hash[sdr_hash(sdrs, record_id)];
     while (entry) {
 	if (record_id == entry->record_id)
 	    break;
-	p_entry = entry;
-	entry = entry->next;
+	entry = entry->hash_next;
+    }
+    return entry;
+}
+
+/* Make the index bigger when it gets full.  If that fails, keep using
+   the one we have, the chains just get longer. */
+static void
+sdr_hash_grow(sdrs_t *sdrs)
+{
+    unsigned int new_size;
+    sdr_t        **new_hash;
+    sdr_t        *entry;
+    unsigned int h;
+
+    if (sdrs->hash && (sdrs->sdr_count < sdrs->hash_size))
+	return;
+
+    new_size = sdrs->hash ? sdrs->hash_size * 2 : SDR_HASH_MIN_SIZE;
+    new_hash = malloc(new_size * sizeof(sdr_t *));
+    if (!new_hash)
+	return;
+    memset(new_hash, 0, new_size * sizeof(sdr_t *));
+
+    free(sdrs->hash);
+    sdrs->hash = new_hash;
+    sdrs->hash_size = new_size;
+    for (entry = sdrs->sdrs; entry; entry = entry->next) {
+	h = sdr_hash(sdrs, entry->record_id);
+	entry->hash_next = new_hash[h];
+	new_hash[h] = entry;
+    }
+}
+
+/* Put the entry on the end of the repository. */
+static void
+sdr_link_entry(sdrs_t *sdrs, sdr_t *entry)
+{
+    unsigned int h;
+
+    sdr_hash_grow(sdrs);
+
+    entry->next = NULL;
+    entry->prev = sdrs->last;
+    if (sdrs->last)
+	sdrs->last->next = entry;
+    else
+	sdrs->sdrs = entry;
+    sdrs->last = entry;
+
+    if (sdrs->hash) {
+	h = sdr_hash(sdrs, entry->record_id);
+	entry->hash_next = sdrs->hash[h];
+	sdrs->hash[h] = entry;
+    }
+    sdrs->sdr_count++;
+}
+
+static void
+sdr_unlink_entry(sdrs_t *sdrs, sdr_t *entry)
+{
+    sdr_t **p;
+
+    if (entry->prev)
+	entry->prev->next = entry->next;
+    else
+	sdrs->sdrs = entry->next;
+    if (entry->next)
+	entry->next->prev = entry->prev;
+    else
+	sdrs->last = entry->prev;
+
+    if (sdrs->hash) {
+	p = &sdrs->hash[sdr_hash(sdrs, entry->record_id)];
+	while (*p != entry)
+	    p = &(*p)->hash_next;
+	*p = entry->hash_next;
     }
-    if (prev)
-	*prev = p_entry;
+    sdrs->sdr_count--;
+}
+
+static sdr_t *
+alloc_sdr(unsigned int length)
+{
+    sdr_t *entry;
+
+    entry = malloc(sizeof(*entry) + length);
+    if (!entry)
+	return NULL;
+    entry->data = (unsigned char *) (entry + 1);
+    entry->length = length;
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->hash_next = NULL;
     return entry;
 }
 
+static void
+free_sdr(sdr_t *sdr)
+{
+    free(sdr);
+}
+
+static void
+free_sdr_entries(sdrs_t *sdrs)
+{
+    sdr_t *entry, *n_entry;
+
+    entry = sdrs->sdrs;
+    while (entry) {
+	n_entry = entry->next;
+	free_sdr(entry);
+	entry = n_entry;
+    }
+    sdrs->sdrs = NULL;
+    sdrs->last = NULL;
+    sdrs->sdr_count = 0;
+    if (sdrs->hash)
+	memset(sdrs->hash, 0, sdrs->hash_size * sizeof(sdr_t *));
+}
+
 sdr_t *
 new_sdr_entry(sdrs_t *sdrs, unsigned char length)
 {
@@ -703,7 +1141,7 @@ new_sdr_entry(sdrs_t *sdrs, unsigned char length)
     uint16_t start_recid;
 
     start_recid = sdrs->next_entry;
-    while (find_sdr_by_recid(sdrs, sdrs->next_entry, NULL)) {
+    while (find_sdr_by_recid(sdrs, sdrs->next_entry)) {
 	sdrs->next_entry++;
 	if (sdrs->next_entry == 0xffff)
 	    sdrs->next_entry = 1;
@@ -711,22 +1149,16 @@ new_sdr_entry(sdrs_t *sdrs, unsigned char length)
 	    return NULL;
     }
 
-    entry = malloc(sizeof(*entry));
+    entry = alloc_sdr(length + 6);
     if (!entry)
 	return NULL;
 
-    entry->data = malloc(length + 6);
-    if (!entry->data)
-	return NULL;
-
     entry->record_id = sdrs->next_entry;
 
     sdrs->next_entry++;
 
     ipmi_set_uint16(entry->data, entry->record_id);
 
-    entry->length = length + 6;
-    entry->next = NULL;
     return entry;
 }
 
@@ -737,7 +1169,8 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
     sdr_t *sdr;
     int err;
 
-    p = alloc_persist("sdr.%2.2x.main", ipmi_mc_get_ipmb(mc));
+    p = alloc_persist("sdr.%2.2x.%s", ipmi_mc_get_ipmb(mc),
+		      sdrs->persist_name);
     if (!p) {
 	err = ENOMEM;
 	goto out_err;
@@ -762,6 +1195,11 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
     if (err)
 	goto out_err;
     free_persist(p);
+
+    /* The journal is gone with the old file. */
+    sdrs->journal_count = 0;
+    sdrs->journal_seq = 0;
+    sdrs->persist_synced = 1;
     return;
 
   out_err:
@@ -772,65 +1210,194 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
 	free_persist(p);
 }
 
+/* Record a change to the repository in the persist file. */
+static void
+journal_sdrs(lmc_data_t *mc, sdrs_t *sdrs,
+	     unsigned char *data, unsigned int len)
+{
+    persist_t *p;
+    int       err;
+
+    if (!sdrs->persist_synced
+	|| (sdrs->journal_count
+	    >= ((unsigned int) sdrs->sdr_count + SDR_JOURNAL_SLACK)))
+    {
+	rewrite_sdrs(mc, sdrs);
+	return;
+    }
+
+    p = alloc_persist("sdr.%2.2x.%s", ipmi_mc_get_ipmb(mc),
+		      sdrs->persist_name);
+    if (!p) {
+	err = ENOMEM;
+	goto out_err;
+    }
+    err = journal_append(p, sdrs->journal_seq, data, len);
+    free_persist(p);
+    if (err)
+	goto out_err;
+
+    sdrs->journal_seq++;
+    sdrs->journal_count++;
+    return;
+
+  out_err:
+    mc->sysinfo->log(mc->sysinfo, OS_ERROR, NULL,
+		     "Unable to add to the SDR journal for MC %d: %d",
+		     ipmi_mc_get_ipmb(mc), err);
+    rewrite_sdrs(mc, sdrs);
+}
+
+/* The entry's data must be filled in before this is called. */
 void
 add_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *entry)
 {
-    sdr_t          *p;
     struct timeval t;
+    unsigned char  *jdata;
 
-    entry->next = NULL;
-    p = sdrs->sdrs;
-    if (!p)
-	sdrs->sdrs = entry;
-    else {
-	while (p->next)
-	    p = p->next;
-	p->next = entry;
-    }
+    sdr_link_entry(sdrs, entry);
 
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
     sdrs->last_add_time = t.tv_sec + mc->main_sdrs.time_offset;
-    sdrs->sdr_count++;
 
-    rewrite_sdrs(mc, sdrs);
+    jdata = malloc(entry->length + 5);
+    if (!jdata) {
+	rewrite_sdrs(mc, sdrs);
+	return;
+    }
+    jdata[0] = SDR_JOURNAL_ADD;
+    ipmi_set_uint32(jdata+1, sdrs->last_add_time);
+    memcpy(jdata+5, entry->data, entry->length);
+    journal_sdrs(mc, sdrs, jdata, entry->length + 5);
+    free(jdata);
 }
 
+/* Remove the entry from the repository and free it. */
 static void
-free_sdr(sdr_t *sdr)
+delete_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *entry)
 {
-    free(sdr->data);
-    free(sdr);
+    struct timeval t;
+    unsigned char  jdata[SDR_JOURNAL_DELETE_LEN];
+
+    sdr_unlink_entry(sdrs, entry);
+
+    mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
+    sdrs->last_erase_time = t.tv_sec + sdrs->time_offset;
+
+    jdata[0] = SDR_JOURNAL_DELETE;
+    ipmi_set_uint16(jdata+1, entry->record_id);
+    ipmi_set_uint32(jdata+3, sdrs->last_erase_time);
+    free_sdr(entry);
+    journal_sdrs(mc, sdrs, jdata, sizeof(jdata));
 }
 
+typedef struct sdr_load_s
+{
+    lmc_data_t     *mc;
+    sdrs_t         *sdrs;
+    journal_load_t journal;
+} sdr_load_t;
+
+/* Put a copy of an SDR read from the persist file into the
+   repository.  If there is already one with the record id, replace
+   it. */
 static int
-handle_sdr(const char *name, void *data, unsigned int len, void *cb_data)
+load_sdr(sdrs_t *sdrs, unsigned char *data, unsigned int len)
 {
-    sdr_t *sdr, *p;
-    sdrs_t *sdrs = cb_data;
+    sdr_t *sdr, *old;
 
-    sdr = new_sdr_entry(sdrs, len);
+    sdr = alloc_sdr(len);
     if (!sdr)
 	return ENOMEM;
     memcpy(sdr->data, data, len);
+    sdr->record_id = ipmi_get_uint16(data);
 
-    sdr->next = NULL;
-    p = sdrs->sdrs;
-    if (!p)
-	sdrs->sdrs = sdr;
-    else {
-	while (p->next)
-	    p = p->next;
-	p->next = sdr;
+    old = find_sdr_by_recid(sdrs, sdr->record_id);
+    if (old) {
+	sdr_unlink_entry(sdrs, old);
+	free_sdr(old);
     }
-    sdrs->sdr_count++;
+    sdr_link_entry(sdrs, sdr);
+    return 0;
+}
 
+static void
+apply_sdr_journal(sdr_load_t *info)
+{
+    sdrs_t       *sdrs = info->sdrs;
+    sdr_t        *sdr;
+    unsigned int i;
+
+    journal_sort(&info->journal);
+    for (i = 0; i < info->journal.num_ops; i++) {
+	journal_op_t *op = &info->journal.ops[i];
+
+	if (op->data[0] == SDR_JOURNAL_ADD) {
+	    if (load_sdr(sdrs, op->data + 5, op->len - 5))
+		continue;
+	    sdrs->last_add_time = ipmi_get_uint32(op->data + 1);
+	} else {
+	    sdr = find_sdr_by_recid(sdrs, ipmi_get_uint16(op->data + 1));
+	    if (sdr) {
+		sdr_unlink_entry(sdrs, sdr);
+		free_sdr(sdr);
+	    }
+	    sdrs->last_erase_time = ipmi_get_uint32(op->data + 3);
+	}
+    }
+}
+
+static int
+handle_sdr_journal(sdr_load_t *info, const char *name,
+		   void *data, unsigned int len)
+{
+    unsigned char *d = data;
+    int           err;
+
+    if (!((len >= 10) && (d[0] == SDR_JOURNAL_ADD))
+	&& !((len == SDR_JOURNAL_DELETE_LEN) && (d[0] == SDR_JOURNAL_DELETE)))
+	err = EINVAL;
+    else
+	err = journal_collect(&info->journal, name, data, len);
+    if (err == EINVAL) {
+	info->mc->sysinfo->log(info->mc->sysinfo, INFO, NULL,
+			       "Got invalid SDR journal entry for %2.2x,"
+			       " name is %s",
+			       ipmi_mc_get_ipmb(info->mc), name);
+	err = 0;
+    }
+    if (err)
+	return err;
+    return ITER_PERSIST_CONTINUE;
+}
+
+static int
+handle_sdr(const char *name, void *data, unsigned int len, void *cb_data)
+{
+    sdr_load_t *info = cb_data;
+    int        err;
+
+    if (is_journal_item(name))
+	return handle_sdr_journal(info, name, data, len);
+
+    if (len < 5) {
+	info->mc->sysinfo->log(info->mc->sysinfo, INFO, NULL,
+			       "Got invalid SDR for %2.2x, name is %s",
+			       ipmi_mc_get_ipmb(info->mc), name);
+	return ITER_PERSIST_CONTINUE;
+    }
+
+    err = load_sdr(info->sdrs, data, len);
+    if (err)
+	return err;
     return ITER_PERSIST_CONTINUE;
 }
 
 static int
 handle_sdr_time(const char *name, long val, void *cb_data)
 {
-    sdrs_t *sdrs = cb_data;
+    sdr_load_t *info = cb_data;
+    sdrs_t     *sdrs = info->sdrs;
 
     if (strcmp(name, "last_add_time") == 0)
 	sdrs->last_add_time = val;
@@ -842,14 +1409,27 @@ handle_sdr_time(const char *name, long val, void *cb_data)
 void
 read_mc_sdrs(lmc_data_t *mc, sdrs_t *sdrs, const char *sdrtype)
 {
-    persist_t *p;
+    persist_t  *p;
+    sdr_load_t info;
 
     p = read_persist("sdr.%2.2x.%s", ipmi_mc_get_ipmb(mc), sdrtype);
     if (!p)
 	return;
 
-    iterate_persist(p, sdrs, handle_sdr, handle_sdr_time);
+    info.mc = mc;
+    info.sdrs = sdrs;
+    memset(&info.journal, 0, sizeof(info.journal));
+    iterate_persist(p, &info, handle_sdr, handle_sdr_time);
     free_persist(p);
+
+    if (info.journal.num_ops > 0) {
+	/* Fold the journal into the file, so it starts out empty. */
+	apply_sdr_journal(&info);
+	rewrite_sdrs(mc, sdrs);
+    } else {
+	sdrs->persist_synced = 1;
+    }
+    journal_free(&info.journal);
 }
 
 int
@@ -896,10 +1476,10 @@ ipmi_mc_add_device_sdr(lmc_data_t    *mc,
     if (!entry)
 	return ENOMEM;
 
-    add_sdr_entry(mc, &mc->device_sdrs[lun], entry);
-
     memcpy(entry->data+2, data+2, data_len-2);
 
+    add_sdr_entry(mc, &mc->device_sdrs[lun], entry);
+
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
     mc->sensor_population_change_time = t.tv_sec + mc->main_sdrs.time_offset;
     mc->lun_has_sensors[lun] = 1;
@@ -1030,14 +1610,9 @@ handle_get_sdr(lmc_data_t    *mc,
     if (record_id == 0) {
 	entry = mc->main_sdrs.sdrs;
     } else if (record_id == 0xffff) {
-	entry = mc->main_sdrs.sdrs;
-	if (entry) {
-	    while (entry->next) {
-		entry = entry->next;
-	    }
-	}
+	entry = mc->main_sdrs.last;
     } else {
-	entry = find_sdr_by_recid(&mc->main_sdrs, record_id, NULL);
+	entry = find_sdr_by_recid(&mc->main_sdrs, record_id);
     }
 
     if (entry == NULL) {
@@ -1112,10 +1687,10 @@ handle_add_sdr(lmc_data_t    *mc,
 	*rdata_len = 1;
 	return;
     }
-    add_sdr_entry(mc, &mc->main_sdrs, entry);
-
     memcpy(entry->data+2, msg->data+2, entry->length-2);
 
+    add_sdr_entry(mc, &mc->main_sdrs, entry);
+
     rdata[0] = 0;
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
@@ -1187,6 +1762,11 @@ handle_partial_add_sdr(lmc_data_t    *mc,
 	    return;
 	}
 	mc->part_add_sdr = new_sdr_entry(&mc->main_sdrs, msg->data[11]);
+	if (!mc->part_add_sdr) {
+	    rdata[0] = IPMI_OUT_OF_SPACE_CC;
+	    *rdata_len = 1;
+	    return;
+	}
 	memcpy(mc->part_add_sdr->data+2, msg->data+8, msg->len - 8);
 	mc->part_add_next = msg->len - 8;
     } else {
@@ -1251,8 +1831,7 @@ handle_delete_sdr(lmc_data_t    *mc,
 		  void          *cb_data)
 {
     uint16_t       record_id;
-    sdr_t          *entry, *p_entry;
-    struct timeval t;
+    sdr_t          *entry;
 
     if (!(mc->device_support & IPMI_DEVID_SDR_REPOSITORY_DEV)) {
 	handle_invalid_cmd(mc, rdata, rdata_len);
@@ -1272,22 +1851,14 @@ handle_delete_sdr(lmc_data_t    *mc,
 	}
     }
 
-    record_id = ipmi_get_uint16(rdata+2);
+    record_id = ipmi_get_uint16(msg->data+2);
 
     if (record_id == 0) {
 	entry = mc->main_sdrs.sdrs;
-	p_entry = NULL;
     } else if (record_id == 0xffff) {
-	entry = mc->main_sdrs.sdrs;
-	p_entry = NULL;
-	if (entry) {
-	    while (entry->next) {
-		p_entry = entry;
-		entry = entry->next;
-	    }
-	}
+	entry = mc->main_sdrs.last;
     } else {
-	entry = find_sdr_by_recid(&mc->main_sdrs, record_id, &p_entry);
+	entry = find_sdr_by_recid(&mc->main_sdrs, record_id);
     }
     if (!entry) {
 	rdata[0] = IPMI_NOT_PRESENT_CC;
@@ -1295,21 +1866,11 @@ handle_delete_sdr(lmc_data_t    *mc,
 	return;
     }
 
-    if (p_entry)
-	p_entry->next = entry->next;
-    else
-	mc->main_sdrs.sdrs = entry->next;
-
     rdata[0] = 0;
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
 
-    free_sdr(entry);
-
-    mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
-    mc->main_sdrs.last_erase_time = t.tv_sec + mc->main_sdrs.time_offset;
-    mc->main_sdrs.sdr_count--;
-    rewrite_sdrs(mc, &mc->main_sdrs);
+    delete_sdr_entry(mc, &mc->main_sdrs, entry);
 }
 
 static void
@@ -1319,7 +1880,6 @@ handle_clear_sdr_repository(lmc_data_t    *mc,
 			    unsigned int  *rdata_len,
 			    void          *cb_data)
 {
-    sdr_t          *entry, *n_entry;
     struct timeval t;
     unsigned char  op;
 
@@ -1359,21 +1919,15 @@ handle_clear_sdr_repository(lmc_data_t    *mc,
     }
 
     rdata[1] = 1;
-    if (op == 0) {
-	entry = mc->main_sdrs.sdrs;
-	while (entry) {
-	    n_entry = entry->next;
-	    free_sdr(entry);
-	    entry = n_entry;
-	}
+    if (op == 0xaa) {
+	free_sdr_entries(&mc->main_sdrs);
+	mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
+	mc->main_sdrs.last_erase_time = t.tv_sec + mc->main_sdrs.time_offset;
+	rewrite_sdrs(mc, &mc->main_sdrs);
     }
 
     rdata[0] = 0;
     *rdata_len = 2;
-
-    mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
-    mc->main_sdrs.last_erase_time = t.tv_sec + mc->main_sdrs.time_offset;
-    rewrite_sdrs(mc, &mc->main_sdrs);
 }
 
 static void
@@ -870,6 +870,16 @@ read_config(sys_data_t *sys,
 				NULL, SOCK_STREAM, &errstr);
     } else if (strcmp(tok, "clear_sel_event") == 0) {
 	    err = get_bool(&tokptr, &sys->clear_sel_event, &errstr);
+	} else if (strcmp(tok, "persist_format") == 0) {
+	    tok = mystrtok(NULL, " \t\n", &tokptr);
+	    if (tok && (strcmp(tok, "text") == 0)) {
+		persist_binary = 0;
+	    } else if (tok && (strcmp(tok, "binary") == 0)) {
+		persist_binary = 1;
+	    } else {
+		errstr = "Invalid persist format, must be 'text' or 'binary'";
+		err = -1;
+	    }
 	} else {
 	    errstr = "Invalid configuration option";
 	    err = -1;
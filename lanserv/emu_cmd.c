@@ -552,6 +552,41 @@ sensor_set_value(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
     return rv;
 }
 
+static int
+sensor_poll_stats(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    int                      rv;
+    unsigned char            lun;
+    unsigned char            num;
+    ipmi_sensor_poll_stats_t stats;
+    unsigned long long       avg_duration = 0, avg_delay = 0;
+
+    rv = emu_get_uchar(out, toks, &lun, "LUN", 0);
+    if (rv)
+	return rv;
+
+    rv = emu_get_uchar(out, toks, &num, "sensor num", 0);
+    if (rv)
+	return rv;
+
+    rv = ipmi_mc_sensor_get_poll_stats(mc, lun, num, &stats);
+    if (rv) {
+	out->printf(out, "**Not a polled sensor, error 0x%x\n", rv);
+	return rv;
+    }
+
+    if (stats.polls) {
+	avg_duration = stats.total_duration / stats.polls;
+	avg_delay = stats.total_delay / stats.polls;
+    }
+    out->printf(out, "polls %lu errors %lu\n", stats.polls, stats.errors);
+    out->printf(out, "duration usec last %lu max %lu avg %llu\n",
+		stats.last_duration, stats.max_duration, avg_duration);
+    out->printf(out, "delay usec max %lu avg %llu\n",
+		stats.max_delay, avg_delay);
+    return 0;
+}
+
 static int
 sensor_set_hysteresis(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
 {
@@ -1294,7 +1329,8 @@ static struct emu_cmd_info cmds[] =
     { "sel_list",	MC,		sel_list,		&cmds[30] },
     { "mc_add_i2c_data", MC, mc_add_i2c_data, &cmds[31] },
     { "get_user_password", MC, mc_get_user_password, &cmds[32] },
-    { "persist",	NOMC,		persist_cmd,		 NULL },
+    { "persist",	NOMC,		persist_cmd,		 &cmds[33] },
+    { "sensor_poll_stats", MC,		sensor_poll_stats,	 NULL },
     { NULL }
 };
 
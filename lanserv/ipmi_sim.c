@@ -54,6 +54,9 @@
  *      written permission.
  */
 
+/* Get recvmmsg() for GNU. */
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -235,6 +238,73 @@ sys_gen_rand(sys_data_t *lan, void *data, int len)
     return 0;
 }
 
+/*
+ * Each LAN socket reads a batch of packets each time it is readable,
+ * with one recvmmsg() where that is available.  The replies generated
+ * while handling the batch are queued on the socket and sent together
+ * with one sendmmsg() when the batch is done.  Anything sent outside a
+ * batch, or too big to queue, goes out right away.
+ */
+#define DEFAULT_LAN_BATCH_SIZE 16
+#define MAX_LAN_BATCH_SIZE 64
+#define MAX_LAN_PKT_LEN 256
+#define MAX_LAN_SOCKETS 64
+
+typedef struct lan_sock_s
+{
+    lanserv_data_t *lan;
+    int            fd;
+    unsigned int   batch_size;
+
+    unsigned char  rdata[MAX_LAN_BATCH_SIZE][MAX_LAN_PKT_LEN];
+    int            rlen[MAX_LAN_BATCH_SIZE];
+    sim_addr_t     raddr[MAX_LAN_BATCH_SIZE];
+
+    unsigned int   xmit_len;
+    unsigned char  xdata[MAX_LAN_BATCH_SIZE][MAX_LAN_PKT_LEN];
+    unsigned int   xlen[MAX_LAN_BATCH_SIZE];
+    sim_addr_t     xaddr[MAX_LAN_BATCH_SIZE];
+} lan_sock_t;
+
+/* The socket whose batch is being handled, if any. */
+static lan_sock_t *lan_batch_sock;
+
+static void
+lan_flush_xmit(lan_sock_t *s)
+{
+    unsigned int   i;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[MAX_LAN_BATCH_SIZE];
+    struct iovec   iov[MAX_LAN_BATCH_SIZE];
+    unsigned int   sent;
+    int            rv;
+
+    memset(msgs, 0, sizeof(msgs[0]) * s->xmit_len);
+    for (i = 0; i < s->xmit_len; i++) {
+	iov[i].iov_base = s->xdata[i];
+	iov[i].iov_len = s->xlen[i];
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &s->xaddr[i].addr;
+	msgs[i].msg_hdr.msg_namelen = s->xaddr[i].addr_len;
+    }
+    sent = 0;
+    while (sent < s->xmit_len) {
+	rv = sendmmsg(s->fd, msgs + sent, s->xmit_len - sent, 0);
+	if (rv <= 0)
+	    /* The first one failed, skip it, the remote end will retry. */
+	    sent++;
+	else
+	    sent += rv;
+    }
+#else
+    for (i = 0; i < s->xmit_len; i++)
+	sendto(s->fd, s->xdata[i], s->xlen[i], 0,
+	       (struct sockaddr *) &s->xaddr[i].addr, s->xaddr[i].addr_len);
+#endif
+    s->xmit_len = 0;
+}
+
 static void
 lan_send(lanserv_data_t *lan,
 	 struct iovec *data, int vecs,
@@ -242,6 +312,10 @@ lan_send(lanserv_data_t *lan,
 {
     struct msghdr msg;
     sim_addr_t    *l = addr;
+    lan_sock_t    *s = lan_batch_sock;
+    unsigned int  len = 0;
+    unsigned char *p;
+    int           i;
     int           rv;
 
     /* When we send messages to ourself, we set the address to NULL so
@@ -249,6 +323,23 @@ lan_send(lanserv_data_t *lan,
     if (!l)
 	return;
 
+    for (i = 0; i < vecs; i++)
+	len += data[i].iov_len;
+
+    if (s && (s->fd == l->xmit_fd) && (len <= MAX_LAN_PKT_LEN)) {
+	if (s->xmit_len >= s->batch_size)
+	    lan_flush_xmit(s);
+	p = s->xdata[s->xmit_len];
+	for (i = 0; i < vecs; i++) {
+	    memcpy(p, data[i].iov_base, data[i].iov_len);
+	    p += data[i].iov_len;
+	}
+	s->xlen[s->xmit_len] = len;
+	s->xaddr[s->xmit_len] = *l;
+	s->xmit_len++;
+	return;
+    }
+
     msg.msg_name = &(l->addr);
     msg.msg_namelen = l->addr_len;
     msg.msg_iov = data;
@@ -264,54 +355,94 @@ lan_send(lanserv_data_t *lan,
 }
 
 static void
-lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
+lan_handle_packet(lanserv_data_t *lan, unsigned char *msgd, int len,
+		  sim_addr_t *l)
 {
-    lanserv_data_t    *lan = cb_data;
-    int           len;
-    sim_addr_t    l;
-    unsigned char msgd[256];
-
-    l.addr_len = sizeof(l.addr);
-    len = recvfrom(lan_fd, msgd, sizeof(msgd), 0,
-		   (struct sockaddr *) &(l.addr), &(l.addr_len));
-    if (len < 0) {
-	if (errno != EINTR) {
-	    perror("Error receiving message");
-	    exit(1);
-	}
-	goto out;
-    }
-    l.xmit_fd = lan_fd;
-
     if (lan->sysinfo->debug & DEBUG_RAW_MSG) {
-	debug_log_raw_msg(lan->sysinfo, (void *) &l.addr, l.addr_len,
+	debug_log_raw_msg(lan->sysinfo, (void *) &l->addr, l->addr_len,
 			  "Raw LAN receive from:");
 	debug_log_raw_msg(lan->sysinfo, msgd, len,
 			  " Receive message:");
     }
 
     if (len < 4)
-	goto out;
+	return;
 
     if (msgd[0] != 6)
-	goto out; /* Invalid version */
+	return; /* Invalid version */
 
     /* Check the message class. */
     switch (msgd[3]) {
 	case 6:
-	    handle_asf(lan, msgd, len, &l, sizeof(l));
+	    handle_asf(lan, msgd, len, l, sizeof(*l));
 	    break;
 
 	case 7:
-	    ipmi_handle_lan_msg(lan, msgd, len, &l, sizeof(l));
+	    ipmi_handle_lan_msg(lan, msgd, len, l, sizeof(*l));
 	    break;
     }
- out:
-    return;
+}
+
+/* Read up to the socket's batch size of packets and handle them.  The
+   reads don't wait, so this stops when the socket is empty.  If more
+   packets are waiting the socket is still readable and we will be
+   called again, so other fds are not starved. */
+static void
+lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    lan_sock_t     *s = cb_data;
+    int            count;
+    int            i;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[MAX_LAN_BATCH_SIZE];
+    struct iovec   iov[MAX_LAN_BATCH_SIZE];
+
+    memset(msgs, 0, sizeof(msgs[0]) * s->batch_size);
+    for (i = 0; i < (int) s->batch_size; i++) {
+	iov[i].iov_base = s->rdata[i];
+	iov[i].iov_len = sizeof(s->rdata[i]);
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &s->raddr[i].addr;
+	msgs[i].msg_hdr.msg_namelen = sizeof(s->raddr[i].addr);
+    }
+    count = recvmmsg(lan_fd, msgs, s->batch_size, MSG_DONTWAIT, NULL);
+    for (i = 0; i < count; i++) {
+	s->raddr[i].addr_len = msgs[i].msg_hdr.msg_namelen;
+	s->rlen[i] = msgs[i].msg_len;
+    }
+#else
+    for (count = 0; count < (int) s->batch_size; count++) {
+	s->raddr[count].addr_len = sizeof(s->raddr[count].addr);
+	s->rlen[count] = recvfrom(lan_fd, s->rdata[count],
+				  sizeof(s->rdata[count]), MSG_DONTWAIT,
+				  (struct sockaddr *) &s->raddr[count].addr,
+				  &s->raddr[count].addr_len);
+	if (s->rlen[count] < 0)
+	    break;
+    }
+    if (count == 0)
+	count = -1;
+#endif
+    if (count < 0) {
+	if ((errno != EINTR) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+	    perror("Error receiving message");
+	    exit(1);
+	}
+	return;
+    }
+
+    lan_batch_sock = s;
+    for (i = 0; i < count; i++) {
+	s->raddr[i].xmit_fd = lan_fd;
+	lan_handle_packet(s->lan, s->rdata[i], s->rlen[i], &s->raddr[i]);
+    }
+    lan_batch_sock = NULL;
+    lan_flush_xmit(s);
 }
 
 static int
-open_lan_fd(struct sockaddr *addr, socklen_t addr_len)
+open_lan_fd(struct sockaddr *addr, socklen_t addr_len, int reuseport)
 {
     int fd;
     int rv;
@@ -331,6 +462,21 @@ open_lan_fd(struct sockaddr *addr, socklen_t addr_len)
 	exit(1);
     }
 
+    if (reuseport) {
+#ifdef SO_REUSEPORT
+	rv = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+	if (rv == -1) {
+	    fprintf(stderr, "Unable to set SO_REUSEPORT: %s\n",
+		    strerror(errno));
+	    exit(1);
+	}
+#else
+	fprintf(stderr, "SO_REUSEPORT is not supported, only one LAN"
+		" socket may be used\n");
+	exit(1);
+#endif
+    }
+
     rv = bind(fd, addr, addr_len);
     if (rv == -1) {
 	fprintf(stderr, "Unable to bind to LAN port: %s\n",
@@ -352,6 +498,8 @@ lan_channel_init(void *info, channel_t *chan)
     int lan_fd;
     os_hnd_fd_id_t *fd_id;
     unsigned char addr_data[6];
+    unsigned int num_sockets, batch_size, i;
+    lan_sock_t *s;
 
     lan->user_info = data;
     lan->send_out = lan_send;
@@ -370,12 +518,19 @@ lan_channel_init(void *info, channel_t *chan)
     }
 
     if (lan->lan_addr_set) {
-	lan_fd = open_lan_fd(&lan->lan_addr.addr.s_ipsock.s_addr,
-			     lan->lan_addr.addr_len);
-	if (lan_fd == -1) {
-	    fprintf(stderr, "Unable to open LAN address\n");
+	num_sockets = lan->num_sockets;
+	if (num_sockets == 0)
+	    num_sockets = 1;
+	if (num_sockets > MAX_LAN_SOCKETS) {
+	    fprintf(stderr, "Too many LAN sockets, the maximum is %d\n",
+		    MAX_LAN_SOCKETS);
 	    exit(1);
 	}
+	batch_size = lan->recv_batch_size;
+	if (batch_size == 0)
+	    batch_size = DEFAULT_LAN_BATCH_SIZE;
+	else if (batch_size > MAX_LAN_BATCH_SIZE)
+	    batch_size = MAX_LAN_BATCH_SIZE;
 
 	memcpy(addr_data,
 	       &lan->lan_addr.addr.s_ipsock.s_addr4.sin_addr.s_addr,
@@ -384,12 +539,31 @@ lan_channel_init(void *info, channel_t *chan)
 	       &lan->lan_addr.addr.s_ipsock.s_addr4.sin_port, 2);
 	ipmi_emu_set_addr(data->emu, 0, 0, addr_data, 6);
 
-	err = data->os_hnd->add_fd_to_wait_for(data->os_hnd, lan_fd,
-					       lan_data_ready, lan,
-					       NULL, &fd_id);
-	if (err) {
-	    fprintf(stderr, "Unable to add socket wait: 0x%x\n", err);
-	    exit(1);
+	for (i = 0; i < num_sockets; i++) {
+	    lan_fd = open_lan_fd(&lan->lan_addr.addr.s_ipsock.s_addr,
+				 lan->lan_addr.addr_len, num_sockets > 1);
+	    if (lan_fd == -1) {
+		fprintf(stderr, "Unable to open LAN address\n");
+		exit(1);
+	    }
+
+	    s = malloc(sizeof(*s));
+	    if (!s) {
+		fprintf(stderr, "Out of memory allocating LAN socket\n");
+		exit(1);
+	    }
+	    memset(s, 0, sizeof(*s));
+	    s->lan = lan;
+	    s->fd = lan_fd;
+	    s->batch_size = batch_size;
+
+	    err = data->os_hnd->add_fd_to_wait_for(data->os_hnd, lan_fd,
+						   lan_data_ready, s,
+						   NULL, &fd_id);
+	    if (err) {
+		fprintf(stderr, "Unable to add socket wait: 0x%x\n", err);
+		exit(1);
+	    }
 	}
     }
 
@@ -156,6 +156,10 @@ lanserv_read_config(sys_data_t    *sys,
 		    lan->port = 0;
 		lan->port = htons(lan->port);
 	    }
+	} else if (strcmp(tok, "sockets") == 0) {
+	    err = get_uint(&tokptr, &lan->num_sockets, &errstr);
+	} else if (strcmp(tok, "recv_batch") == 0) {
+	    err = get_uint(&tokptr, &lan->recv_batch_size, &errstr);
 	} else if (strcmp(tok, "guid") == 0) {
 	    if (!lan->guid)
 		lan->guid = malloc(16);
@@ -58,11 +58,44 @@
 #include <ctype.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <stdarg.h>
 #include <OpenIPMI/persist.h>
 
+/*
+ * Persist files come in two formats.  The text format has one item per
+ * line, "name:type:value", with data and strings escaped.  The binary
+ * format starts with an 8 byte header, the magic number and a version,
+ * followed by records:
+ *
+ *   uint32_t csum   checksum of the rest of the record, padding included
+ *   uint8_t  type   'd', 'i' or 's'
+ *   uint8_t  pad
+ *   uint16_t nlen   length of the name, including its nil
+ *   uint32_t dlen   length of the value, 8 for an int
+ *   the name, padded to 8 bytes
+ *   the value, a nil after a string, padded to 8 bytes
+ *
+ * Everything is in host byte order.  Since the values are aligned, a
+ * mapping of the file can be used in place, so reading one does not
+ * copy or convert anything.  Appending to a file may be cut short by
+ * a crash, so reading stops at the first record that is short or does
+ * not match its checksum.
+ *
+ * Reading takes either format, persist_binary picks what is written.
+ * Appending to a file in the other format converts the file first.
+ */
+#define PERSIST_BIN_MAGIC	0x4f495042 /* "OIPB" */
+#define PERSIST_BIN_VERSION	1
+#define PERSIST_BIN_HDR_LEN	8
+#define PERSIST_BIN_REC_LEN	12
+#define PERSIST_BIN_ALIGN(v)	(((v) + 7) & ~7)
+
 enum pitem_type {
     PITEM_DATA = 'd',
     PITEM_INT = 'i',
@@ -74,6 +107,7 @@ struct pitem {
     enum pitem_type type;
     void *data;
     long dval;
+    int mapped; /* iname and data point into the persist's mapping. */
     struct pitem *next;
 };
 
@@ -81,9 +115,14 @@ struct persist_s {
     char *name;
 
     struct pitem *items;
+
+    /* A binary file that was read is mapped here. */
+    void *map;
+    size_t map_len;
 };
 
 int persist_enable = 1;
+int persist_binary = 0;
 
 static char *app = NULL;
 static const char *basedir;
@@ -165,6 +204,8 @@ alloc_vpersist(const char *iname, va_list ap)
 	return NULL;
     }
     p->items = NULL;
+    p->map = NULL;
+    p->map_len = 0;
     return p;
 }
 
@@ -199,6 +240,27 @@ get_fname(persist_t *p, char *sfx)
     return fname;
 }
 
+static uint32_t
+bin_csum(const unsigned char *d, unsigned int len)
+{
+    uint32_t csum = 2166136261U;
+
+    /* FNV-1a */
+    while (len > 0) {
+	csum ^= *d++;
+	csum *= 16777619U;
+	len--;
+    }
+    return csum;
+}
+
+static unsigned int
+bin_rec_len(unsigned int nlen, unsigned int vlen)
+{
+    return (PERSIST_BIN_ALIGN(PERSIST_BIN_REC_LEN + nlen)
+	    + PERSIST_BIN_ALIGN(vlen));
+}
+
 static unsigned char
 fromhex(char c)
 {
@@ -259,36 +321,13 @@ write_data(void *idata, unsigned int len, FILE *f)
     }
 }
 
-persist_t *
-read_persist(const char *name, ...)
+static int
+read_persist_text(persist_t *p, FILE *f)
 {
-    char *fname;
-    va_list ap;
-    persist_t *p;
-    FILE *f;
     char *line;
     char *end;
     size_t n;
 
-    if (!persist_enable)
-	return NULL;
-
-    va_start(ap, name);
-    p = alloc_vpersist(name, ap);
-    if (!p)
-	return NULL;
-    fname = get_fname(p, "");
-    if (!fname) {
-	free_persist(p);
-	return NULL;
-    }
-    f = fopen(fname, "r");
-    free(fname);
-    if (!f) {
-	free_persist(p);
-	return NULL;
-    }
-
     for (line = NULL; getline(&line, &n, f) != -1; free(line), line = NULL) {
 	char *name = line;
 	char *type = strchr(name, ':');
@@ -306,18 +345,17 @@ read_persist(const char *name, ...)
 	pi = malloc(sizeof(*pi));
 	if (!pi) {
 	    free(line);
-	    free_persist(p);
-	    return NULL;
+	    return ENOMEM;
 	}
 
 	pi->iname = strdup(name);
 	if (!pi->iname) {
 	    free(pi);
 	    free(line);
-	    free_persist(p);
-	    return NULL;
+	    return ENOMEM;
 	}
 	pi->type = type[0];
+	pi->mapped = 0;
 
 	switch (type[0]) {
 	case PITEM_DATA:
@@ -347,6 +385,149 @@ read_persist(const char *name, ...)
 	p->items = pi;
     }
 
+    return 0;
+}
+
+/*
+ * Add the items in a mapped binary file to the persist.  Like the
+ * text reader, this puts each one on the front of the list.
+ */
+static int
+read_persist_bin(persist_t *p)
+{
+    unsigned char *d = p->map;
+    size_t        pos = PERSIST_BIN_HDR_LEN;
+
+    while (p->map_len - pos >= PERSIST_BIN_REC_LEN) {
+	unsigned char *r = d + pos;
+	unsigned int  type = r[4];
+	unsigned int  nlen = *((uint16_t *) (r + 6));
+	unsigned int  dlen = *((uint32_t *) (r + 8));
+	unsigned int  vlen, len;
+	unsigned char *name, *val;
+	struct pitem  *pi;
+
+	if (dlen > p->map_len)
+	    break;
+	vlen = dlen + (type == PITEM_STR);
+	len = bin_rec_len(nlen, vlen);
+	if ((nlen == 0) || (len > p->map_len - pos))
+	    break;
+	if (*((uint32_t *) r) != bin_csum(r + 4, len - 4))
+	    break;
+
+	name = r + PERSIST_BIN_REC_LEN;
+	val = r + PERSIST_BIN_ALIGN(PERSIST_BIN_REC_LEN + nlen);
+	pos += len;
+
+	if (name[nlen - 1] != '\0')
+	    continue;
+	if ((type == PITEM_INT) && (dlen != sizeof(int64_t)))
+	    continue;
+	if ((type == PITEM_STR) && (val[dlen] != '\0'))
+	    continue;
+	if ((type != PITEM_DATA) && (type != PITEM_INT) && (type != PITEM_STR))
+	    continue;
+
+	pi = malloc(sizeof(*pi));
+	if (!pi)
+	    return ENOMEM;
+	pi->iname = (char *) name;
+	pi->type = type;
+	pi->mapped = 1;
+	if (type == PITEM_INT) {
+	    pi->data = NULL;
+	    pi->dval = *((int64_t *) val);
+	} else {
+	    pi->data = val;
+	    pi->dval = dlen;
+	}
+
+	pi->next = p->items;
+	p->items = pi;
+    }
+
+    return 0;
+}
+
+static int
+read_persist_fname(persist_t *p, const char *fname)
+{
+    int         fd;
+    struct stat st;
+    void        *map;
+    uint32_t    *hdr;
+    FILE        *f;
+    int         rv;
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1)
+	return errno;
+
+    if (fstat(fd, &st) == -1) {
+	rv = errno;
+	close(fd);
+	return rv;
+    }
+
+    if (st.st_size >= PERSIST_BIN_HDR_LEN) {
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+	    rv = errno;
+	    close(fd);
+	    return rv;
+	}
+	hdr = map;
+	if (hdr[0] == PERSIST_BIN_MAGIC) {
+	    close(fd);
+	    p->map = map;
+	    p->map_len = st.st_size;
+	    if (hdr[1] != PERSIST_BIN_VERSION)
+		return EINVAL;
+	    return read_persist_bin(p);
+	}
+	munmap(map, st.st_size);
+    }
+
+    f = fdopen(fd, "r");
+    if (!f) {
+	rv = errno;
+	close(fd);
+	return rv;
+    }
+    rv = read_persist_text(p, f);
+    fclose(f);
+    return rv;
+}
+
+persist_t *
+read_persist(const char *name, ...)
+{
+    char *fname;
+    va_list ap;
+    persist_t *p;
+    int rv;
+
+    if (!persist_enable)
+	return NULL;
+
+    va_start(ap, name);
+    p = alloc_vpersist(name, ap);
+    va_end(ap);
+    if (!p)
+	return NULL;
+    fname = get_fname(p, "");
+    if (!fname) {
+	free_persist(p);
+	return NULL;
+    }
+    rv = read_persist_fname(p, fname);
+    free(fname);
+    if (rv) {
+	free_persist(p);
+	return NULL;
+    }
+
     return p;
 }
 
@@ -367,45 +548,228 @@ write_persist_file(persist_t *p, FILE *f)
 	}
 	fputc('\n', f);
     }
+    if (ferror(f))
+	return EIO;
     return 0;
 }
 
-int
-write_persist(persist_t *p)
+static int
+write_persist_bin_hdr(FILE *f)
+{
+    uint32_t hdr[2];
+
+    hdr[0] = PERSIST_BIN_MAGIC;
+    hdr[1] = PERSIST_BIN_VERSION;
+    if (fwrite(hdr, PERSIST_BIN_HDR_LEN, 1, f) != 1)
+	return EIO;
+    return 0;
+}
+
+static int
+write_persist_bin(persist_t *p, FILE *f)
+{
+    struct pitem  *pi;
+    unsigned char *r = NULL;
+    unsigned int  r_size = 0;
+    int           rv = 0;
+
+    for (pi = p->items; pi; pi = pi->next) {
+	unsigned int nlen = strlen(pi->iname) + 1;
+	unsigned int dlen, vlen, len;
+	int64_t      ival;
+	void         *val;
+
+	if (pi->type == PITEM_INT) {
+	    ival = pi->dval;
+	    val = &ival;
+	    dlen = sizeof(ival);
+	} else {
+	    val = pi->data;
+	    dlen = pi->dval;
+	}
+	vlen = dlen + (pi->type == PITEM_STR);
+	if (nlen > 0xffff) {
+	    rv = EINVAL;
+	    break;
+	}
+
+	len = bin_rec_len(nlen, vlen);
+	if (len > r_size) {
+	    free(r);
+	    r_size = len * 2;
+	    r = malloc(r_size);
+	    if (!r) {
+		rv = ENOMEM;
+		break;
+	    }
+	}
+	memset(r, 0, len);
+	r[4] = pi->type;
+	*((uint16_t *) (r + 6)) = nlen;
+	*((uint32_t *) (r + 8)) = dlen;
+	memcpy(r + PERSIST_BIN_REC_LEN, pi->iname, nlen);
+	memcpy(r + PERSIST_BIN_ALIGN(PERSIST_BIN_REC_LEN + nlen), val, dlen);
+	*((uint32_t *) r) = bin_csum(r + 4, len - 4);
+
+	if (fwrite(r, len, 1, f) != 1) {
+	    rv = EIO;
+	    break;
+	}
+    }
+    free(r);
+    return rv;
+}
+
+/* Write the persist to a file with the given name in the given format,
+   through a temporary file so the old one stays until it is done. */
+static int
+write_persist_fname(persist_t *p, const char *fname, int binary)
 {
-    char *fname, *fname2;
+    char *tname;
     int rv = 0;
     FILE *f;
 
+    tname = malloc(strlen(fname) + 5);
+    if (!tname)
+	return ENOMEM;
+    strcpy(tname, fname);
+    strcat(tname, ".tmp");
+
+    f = fopen(tname, "w");
+    if (!f) {
+	rv = errno;
+	free(tname);
+	return rv;
+    }
+
+    if (binary) {
+	rv = write_persist_bin_hdr(f);
+	if (!rv)
+	    rv = write_persist_bin(p, f);
+    } else {
+	rv = write_persist_file(p, f);
+    }
+    if ((fclose(f) != 0) && !rv)
+	rv = errno;
+
+    if (!rv && (rename(tname, fname) != 0))
+	rv = errno;
+    if (rv)
+	unlink(tname);
+
+    free(tname);
+
+    return rv;
+}
+
+int
+write_persist(persist_t *p)
+{
+    char *fname;
+    int rv;
+
     if (!persist_enable)
 	return 0;
 
-    fname = get_fname(p, ".tmp");
-    if (!fname) {
+    fname = get_fname(p, "");
+    if (!fname)
 	return ENOMEM;
+
+    rv = write_persist_fname(p, fname, persist_binary);
+    free(fname);
+
+    return rv;
+}
+
+/* Put the items back in the order they are in the file. */
+static void
+reverse_items(persist_t *p)
+{
+    struct pitem *pi, *next, *items = NULL;
+
+    for (pi = p->items; pi; pi = next) {
+	next = pi->next;
+	pi->next = items;
+	items = pi;
     }
+    p->items = items;
+}
 
-    fname2 = get_fname(p, "");
-    if (!fname2) {
-	free(fname);
+int
+persist_convert_file(const char *fname, int binary)
+{
+    persist_t *p;
+    int rv;
+
+    p = alloc_persist("%s", fname);
+    if (!p)
 	return ENOMEM;
+    rv = read_persist_fname(p, fname);
+    if (!rv) {
+	reverse_items(p);
+	rv = write_persist_fname(p, fname, binary);
     }
+    free_persist(p);
+    return rv;
+}
 
-    f = fopen(fname, "w");
+int
+append_persist(persist_t *p)
+{
+    char *fname;
+    int rv = 0;
+    FILE *f;
+    uint32_t hdr;
+    int binary;
+
+    if (!persist_enable)
+	return 0;
+
+    fname = get_fname(p, "");
+    if (!fname)
+	return ENOMEM;
+
+    f = fopen(fname, "a+");
     if (!f) {
+	rv = errno;
 	free(fname);
-	free(fname2);
-	return ENOMEM;
+	return rv;
     }
 
-    write_persist_file(p, f);
-    fclose(f);
-
-    if (rename(fname, fname2) != 0)
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+	hdr = 0; /* Too short to be binary, or empty. */
+    if (fseek(f, 0, SEEK_END) != 0)
 	rv = errno;
-
+    else if (ftell(f) == 0) {
+	if (persist_binary)
+	    rv = write_persist_bin_hdr(f);
+    } else {
+	binary = hdr == PERSIST_BIN_MAGIC;
+	if (binary != persist_binary) {
+	    /* Switched formats, convert the file before adding to it. */
+	    fclose(f);
+	    rv = persist_convert_file(fname, persist_binary);
+	    if (!rv) {
+		f = fopen(fname, "a");
+		if (!f)
+		    rv = errno;
+	    }
+	    if (rv) {
+		free(fname);
+		return rv;
+	    }
+	}
+    }
     free(fname);
-    free(fname2);
+
+    if (!rv) {
+	if (persist_binary)
+	    rv = write_persist_bin(p, f);
+	else
+	    rv = write_persist_file(p, f);
+    }
+    if ((fclose(f) != 0) && !rv)
+	rv = errno;
 
     return rv;
 }
@@ -453,11 +817,16 @@ free_persist(persist_t *p)
 	pi = p->items;
 	p->items = pi->next;
 
-	if (pi->data)
-	    free(pi->data);
-	free(pi->iname);
+	if (!pi->mapped) {
+	    if (pi->data)
+		free(pi->data);
+	    free(pi->iname);
+	}
 	free(pi);
     }
+    if (p->map)
+	munmap(p->map, p->map_len);
+    free(p->name);
     free(p);
 }
 
@@ -491,6 +860,7 @@ alloc_pi(persist_t *p, enum pitem_type type, const void *data, long len,
     }
 
     pi->dval = len;
+    pi->mapped = 0;
     pi->next = p->items;
     p->items = pi;
 
@@ -0,0 +1,68 @@
+/*
+ * persist_convert.c
+ *
+ * Convert ipmi_sim persist files between the text and binary formats.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <OpenIPMI/persist.h>
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-b|-t] file [file ...]\n"
+	    "  Rewrite each persist file in place in the binary format\n"
+	    "  (-b, the default) or the text format (-t).\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int binary = 1;
+    int i = 1;
+    int rv = 0;
+    int err;
+
+    if ((i < argc) && (strcmp(argv[i], "-b") == 0)) {
+	i++;
+    } else if ((i < argc) && (strcmp(argv[i], "-t") == 0)) {
+	binary = 0;
+	i++;
+    }
+    if (i >= argc) {
+	usage(argv[0]);
+	return 1;
+    }
+
+    for (; i < argc; i++) {
+	err = persist_convert_file(argv[i], binary);
+	if (err) {
+	    fprintf(stderr, "Unable to convert %s: %s\n", argv[i],
+		    strerror(err));
+	    rv = 1;
+	}
+    }
+    return rv;
+}
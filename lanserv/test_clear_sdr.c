@@ -0,0 +1,402 @@
+/*
+ * test_clear_sdr.c
+ *
+ * Check that Clear SDR Repository only erases the repository when an
+ * erase is initiated, not when the erase status is asked for.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * An emulator with a single BMC is set up without any of ipmi_sim's
+ * I/O, persisting into a temporary directory.  Two SDRs are added to
+ * the main repository, then Clear SDR Repository is sent asking for
+ * the erase status and then to initiate the erase.  The number of
+ * SDRs is read with Get SDR Repository Info after each, and the
+ * repository's persist file is checked to only be rewritten by the
+ * erase.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include <OpenIPMI/ipmi_msgbits.h>
+#include <OpenIPMI/ipmi_err.h>
+#include <OpenIPMI/serv.h>
+#include <OpenIPMI/mcserv.h>
+#include <OpenIPMI/persist.h>
+
+#include "emu.h"
+
+#define BMC_IPMB 0x20
+
+static sys_data_t sysinfo;
+static char statedir[] = "/tmp/test_clear_sdrXXXXXX";
+static char sdr_file[256];
+
+/*
+ * The emulator code calls these, ipmi_sim provides them.  Nothing
+ * here starts commands or registers for ticks.
+ */
+void
+ipmi_emu_shutdown(emu_data_t *emu)
+{
+    exit(1);
+}
+
+void
+ipmi_register_tick_handler(ipmi_tick_handler_t *handler)
+{
+}
+
+void
+ipmi_register_child_quit_handler(ipmi_child_quit_t *handler)
+{
+}
+
+void
+ipmi_register_shutdown_handler(ipmi_shutdown_t *handler)
+{
+}
+
+void
+ipmi_do_start_cmd(startcmd_t *startcmd)
+{
+}
+
+void
+ipmi_do_kill(startcmd_t *startcmd, int noblock)
+{
+}
+
+static void *
+t_alloc(sys_data_t *sys, int size)
+{
+    return malloc(size);
+}
+
+static void
+t_free(sys_data_t *sys, void *data)
+{
+    free(data);
+}
+
+static int
+t_get_time(sys_data_t *sys, struct timeval *tv)
+{
+    return gettimeofday(tv, NULL);
+}
+
+static int
+t_alloc_timer(sys_data_t *sys, void (*cb)(void *cb_data),
+	      void *cb_data, ipmi_timer_t **rtimer)
+{
+    /* Never started, just needs to be something. */
+    *rtimer = malloc(1);
+    if (!*rtimer)
+	return ENOMEM;
+    return 0;
+}
+
+static int
+t_start_timer(ipmi_timer_t *timer, struct timeval *timeout)
+{
+    return 0;
+}
+
+static int
+t_stop_timer(ipmi_timer_t *timer)
+{
+    return 0;
+}
+
+static void
+t_free_timer(ipmi_timer_t *timer)
+{
+    free(timer);
+}
+
+static void
+t_log(sys_data_t *sys, int logtype, msg_t *msg, const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+static void
+t_clog(channel_t *chan, int logtype, msg_t *msg, const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+static void *
+t_calloc(channel_t *chan, int size)
+{
+    return malloc(size);
+}
+
+static void
+t_cfree(channel_t *chan, void *data)
+{
+    free(data);
+}
+
+/* The system interface asks for the device id when it is enabled,
+   nobody is there to answer. */
+static int
+t_smi_send(channel_t *chan, msg_t *msg)
+{
+    free(msg);
+    return 0;
+}
+
+static void
+t_printf(emu_out_t *out, char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+static void
+sleeper(emu_data_t *emu, struct timeval *time)
+{
+}
+
+static unsigned int
+send_cmd(emu_data_t *emu, lmc_data_t *mc, unsigned char cmd,
+	 unsigned char *data, unsigned int data_len,
+	 unsigned char *rdata)
+{
+    msg_t        msg;
+    unsigned int rdata_len = IPMI_SIM_MAX_MSG_LENGTH;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.netfn = IPMI_STORAGE_NETFN;
+    msg.rs_addr = BMC_IPMB;
+    msg.cmd = cmd;
+    msg.data = data;
+    msg.len = data_len;
+    ipmi_emu_handle_msg(emu, mc, &msg, rdata, &rdata_len);
+    if (rdata_len < 1) {
+	fprintf(stderr, "Command 0x%2.2x: empty response\n", cmd);
+	exit(1);
+    }
+    if (rdata[0] != 0) {
+	fprintf(stderr, "Command 0x%2.2x: completion code 0x%2.2x\n",
+		cmd, rdata[0]);
+	exit(1);
+    }
+    return rdata_len;
+}
+
+static unsigned int
+sdr_count(emu_data_t *emu, lmc_data_t *mc)
+{
+    unsigned char rdata[IPMI_SIM_MAX_MSG_LENGTH];
+
+    if (send_cmd(emu, mc, IPMI_GET_SDR_REPOSITORY_INFO_CMD, NULL, 0, rdata)
+	< 4)
+    {
+	fprintf(stderr, "Get SDR Repository Info response too short\n");
+	exit(1);
+    }
+    return rdata[2] | (rdata[3] << 8);
+}
+
+static int
+file_changed(struct stat *old)
+{
+    struct stat st;
+
+    if (stat(sdr_file, &st) != 0)
+	memset(&st, 0, sizeof(st));
+    if ((st.st_ino == old->st_ino)
+	&& (st.st_size == old->st_size)
+	&& (st.st_mtim.tv_sec == old->st_mtim.tv_sec)
+	&& (st.st_mtim.tv_nsec == old->st_mtim.tv_nsec))
+	return 0;
+    *old = st;
+    return 1;
+}
+
+static void
+clear_sdrs(emu_data_t *emu, lmc_data_t *mc, unsigned char op)
+{
+    unsigned char data[6] = { 0, 0, 'C', 'L', 'R', op };
+    unsigned char rdata[IPMI_SIM_MAX_MSG_LENGTH];
+
+    send_cmd(emu, mc, IPMI_CLEAR_SDR_REPOSITORY_CMD, data, 6, rdata);
+}
+
+static void
+remove_dir(const char *dname)
+{
+    DIR           *d;
+    struct dirent *e;
+    char          name[512];
+    struct stat   st;
+
+    d = opendir(dname);
+    if (!d)
+	return;
+    while ((e = readdir(d))) {
+	if ((strcmp(e->d_name, ".") == 0) || (strcmp(e->d_name, "..") == 0))
+	    continue;
+	snprintf(name, sizeof(name), "%s/%s", dname, e->d_name);
+	if ((lstat(name, &st) == 0) && S_ISDIR(st.st_mode))
+	    remove_dir(name);
+	else
+	    unlink(name);
+    }
+    closedir(d);
+    rmdir(dname);
+}
+
+static void
+cleanup(void)
+{
+    remove_dir(statedir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    emu_data_t    *emu;
+    lmc_data_t    *mc;
+    emu_out_t     out;
+    char          setbmc_cmd[] = "mc_setbmc 0x20";
+    char          add_cmd[] = ("mc_add 0x20 0 no-device-sdrs 0x23 9 8"
+			       " 0x9f 0x1291 0xf02 persist_sdr");
+    char          enable_cmd[] = "mc_enable 0x20";
+    unsigned char sdr[] = { 0, 0, 0x51, 0x12, 0x0b, BMC_IPMB, 0, 0, 0x1f,
+			    0, 0, 0, 0xf0, 1, 0, 0xc0 };
+    unsigned int  count;
+    struct stat   st;
+
+    if (!mkdtemp(statedir)) {
+	perror("mkdtemp");
+	return 1;
+    }
+    atexit(cleanup);
+    if (persist_init("test_clear_sdr", "bmc", statedir)) {
+	fprintf(stderr, "persist_init failed\n");
+	return 1;
+    }
+    snprintf(sdr_file, sizeof(sdr_file),
+	     "%s/test_clear_sdr/bmc/sdr.%2.2x.main", statedir, BMC_IPMB);
+
+    sysinfo.alloc = t_alloc;
+    sysinfo.free = t_free;
+    sysinfo.get_monotonic_time = t_get_time;
+    sysinfo.get_real_time = t_get_time;
+    sysinfo.alloc_timer = t_alloc_timer;
+    sysinfo.start_timer = t_start_timer;
+    sysinfo.stop_timer = t_stop_timer;
+    sysinfo.free_timer = t_free_timer;
+    sysinfo.log = t_log;
+    sysinfo.clog = t_clog;
+    sysinfo.calloc = t_calloc;
+    sysinfo.cfree = t_cfree;
+    sysinfo.csmi_send = t_smi_send;
+    sysinfo.bmc_ipmb = BMC_IPMB;
+
+    emu = ipmi_emu_alloc(NULL, sleeper, &sysinfo);
+    if (!emu) {
+	fprintf(stderr, "Unable to allocate the emulator\n");
+	return 1;
+    }
+
+    /* ipmi_emu_cmd() takes the commands apart in place. */
+    out.printf = t_printf;
+    out.data = NULL;
+    if (ipmi_emu_cmd(&out, emu, setbmc_cmd)
+	|| ipmi_emu_cmd(&out, emu, add_cmd)
+	|| ipmi_emu_cmd(&out, emu, enable_cmd)
+	|| ipmi_emu_get_mc_by_addr(emu, BMC_IPMB, &mc))
+    {
+	fprintf(stderr, "Unable to add the BMC\n");
+	return 1;
+    }
+
+    if (ipmi_mc_add_main_sdr(mc, sdr, sizeof(sdr))) {
+	fprintf(stderr, "Unable to add an SDR\n");
+	return 1;
+    }
+    sdr[7] = 1; /* Sensor number */
+    if (ipmi_mc_add_main_sdr(mc, sdr, sizeof(sdr))) {
+	fprintf(stderr, "Unable to add an SDR\n");
+	return 1;
+    }
+
+    count = sdr_count(emu, mc);
+    if (count != 2) {
+	fprintf(stderr, "Expected 2 SDRs after adding, got %u\n", count);
+	return 1;
+    }
+    memset(&st, 0, sizeof(st));
+    file_changed(&st);
+
+    /* Asking for the erase status must leave everything alone. */
+    clear_sdrs(emu, mc, 0);
+    count = sdr_count(emu, mc);
+    if (count != 2) {
+	fprintf(stderr, "Expected 2 SDRs after getting the erase status,"
+		" got %u\n", count);
+	return 1;
+    }
+    if (file_changed(&st)) {
+	fprintf(stderr, "Getting the erase status rewrote the SDRs\n");
+	return 1;
+    }
+
+    clear_sdrs(emu, mc, 0xaa);
+    count = sdr_count(emu, mc);
+    if (count != 0) {
+	fprintf(stderr, "Expected 0 SDRs after the erase, got %u\n", count);
+	return 1;
+    }
+    if (!file_changed(&st)) {
+	fprintf(stderr, "The erase did not rewrite the SDRs\n");
+	return 1;
+    }
+
+    return 0;
+}
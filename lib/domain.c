@@ -119,9 +119,16 @@ typedef struct ll_msg_s
 
     int                          side_effects;
 
-    ilist_item_t link;
+    /* Links for the domain's table of outstanding commands, hnext is
+       the next item in the hash bucket, next and prev are the list in
+       the order the commands were sent. */
+    struct ll_msg_s              *hnext;
+    struct ll_msg_s              *next, *prev;
 } ll_msg_t;
 
+/* Every command sent through the domain gets one of these. */
+static ipmi_mem_pool_t *ll_msg_pool;
+
 typedef struct activate_timer_info_s
 {
     int           cancelled;
@@ -133,13 +140,6 @@ typedef struct activate_timer_info_s
 
 typedef struct domain_check_oem_s domain_check_oem_t;
 
-typedef struct mc_table_s
-{
-    unsigned short size;
-    unsigned short curr;
-    ipmi_mc_t      **mcs;
-} mc_table_t;
-
 struct ipmi_domain_s
 {
     /* Used for error reporting. We add an extra space at the end, thus
@@ -191,15 +191,28 @@ struct ipmi_domain_s
     /* Used for generating unique numbers for a domain. */
     unsigned int uniq_num;
 
-#define IPMB_HASH 32
-    mc_table_t ipmb_mcs[IPMB_HASH];
+    /* The MCs on IPMB, indexed directly by channel and then by slave
+       address.  The table for a channel is allocated when the first
+       MC on that channel is added.  A lookup only has to hold mc_lock
+       long enough to fetch the pointer and take a use on the MC. */
+#define IPMB_CHANNELS 16
+#define IPMB_ADDRS    256
+    ipmi_mc_t **ipmb_mcs[IPMB_CHANNELS];
 #define MAX_CONS 2
     ipmi_mc_t *sys_intf_mcs[MAX_CONS];
     ipmi_lock_t *mc_lock;
 
-    /* A list of outstanding messages.  We use this so we can reroute
-       messages to another connection in case a connection fails. */
-    ilist_t     *cmds;
+    /* The outstanding messages.  We use this so we can reroute
+       messages to another connection in case a connection fails.
+       They are hashed by seq into cmds (which has cmds_size buckets,
+       a power of two) so responses can find them quickly; since seq
+       numbers are handed out in order, the buckets rarely have more
+       than one item.  They are also kept in a list in the order they
+       were sent, from cmds_first to cmds_last, for rerouting. */
+    ll_msg_t    **cmds;
+    unsigned int cmds_size;
+    unsigned int cmds_count;
+    ll_msg_t    *cmds_first, *cmds_last;
     ipmi_lock_t *cmds_lock;
     long        cmds_seq; /* Sequence number for messages to avoid
 			     reuse problems. */
@@ -424,6 +437,104 @@ get_con_num(ipmi_domain_t *domain, ipmi_con_t *ipmi)
     return u;
 }
 
+/* The initial number of hash buckets for outstanding commands. */
+#define CMDS_INIT_SIZE 64
+
+/* The outstanding command table, these must be called with the
+   cmds_lock held. */
+static ll_msg_t *
+cmds_find(ipmi_domain_t *domain, long seq)
+{
+    ll_msg_t *nmsg;
+
+    nmsg = domain->cmds[((unsigned long) seq) & (domain->cmds_size - 1)];
+    while (nmsg && (nmsg->seq != seq))
+	nmsg = nmsg->hnext;
+    return nmsg;
+}
+
+static void
+cmds_hash_add(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    unsigned int idx;
+
+    idx = ((unsigned long) nmsg->seq) & (domain->cmds_size - 1);
+    nmsg->hnext = domain->cmds[idx];
+    domain->cmds[idx] = nmsg;
+}
+
+static void
+cmds_hash_remove(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    ll_msg_t **p;
+
+    p = &domain->cmds[((unsigned long) nmsg->seq) & (domain->cmds_size - 1)];
+    while (*p != nmsg)
+	p = &(*p)->hnext;
+    *p = nmsg->hnext;
+}
+
+/* If the table is getting full, double its size.  If that fails we
+   just live with longer chains. */
+static void
+cmds_grow(ipmi_domain_t *domain)
+{
+    ll_msg_t     **ncmds;
+    unsigned int nsize = domain->cmds_size * 2;
+    ll_msg_t     *nmsg;
+
+    ncmds = ipmi_mem_alloc(sizeof(ll_msg_t *) * nsize);
+    if (!ncmds)
+	return;
+    memset(ncmds, 0, sizeof(ll_msg_t *) * nsize);
+    ipmi_mem_free(domain->cmds);
+    domain->cmds = ncmds;
+    domain->cmds_size = nsize;
+    for (nmsg = domain->cmds_first; nmsg; nmsg = nmsg->next)
+	cmds_hash_add(domain, nmsg);
+}
+
+static void
+cmds_add(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    if (domain->cmds_count >= domain->cmds_size)
+	cmds_grow(domain);
+    cmds_hash_add(domain, nmsg);
+    nmsg->next = NULL;
+    nmsg->prev = domain->cmds_last;
+    if (domain->cmds_last)
+	domain->cmds_last->next = nmsg;
+    else
+	domain->cmds_first = nmsg;
+    domain->cmds_last = nmsg;
+    domain->cmds_count++;
+}
+
+static void
+cmds_remove(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    cmds_hash_remove(domain, nmsg);
+    if (nmsg->next)
+	nmsg->next->prev = nmsg->prev;
+    else
+	domain->cmds_last = nmsg->prev;
+    if (nmsg->prev)
+	nmsg->prev->next = nmsg->next;
+    else
+	domain->cmds_first = nmsg->next;
+    domain->cmds_count--;
+}
+
+/* Change the seq of a command in the table, it keeps its place in
+   the list. */
+static void
+cmds_set_seq(ipmi_domain_t *domain, ll_msg_t *nmsg, long seq)
+{
+    cmds_hash_remove(domain, nmsg);
+    nmsg->seq = seq;
+    cmds_hash_add(domain, nmsg);
+}
+
 static void
 deliver_rsp(ipmi_domain_t                *domain, 
 	    ipmi_addr_response_handler_t rsp_handler,
@@ -609,17 +720,13 @@ cleanup_domain(ipmi_domain_t *domain)
     /* Nuke all outstanding messages. */
     if ((domain->cmds_lock) && (domain->cmds)) {
 	ll_msg_t     *nmsg;
-	int          ok;
-	ilist_iter_t iter;
 
 	ipmi_lock(domain->cmds_lock);
 
-	ilist_init_iter(&iter, domain->cmds);
-	ok = ilist_first(&iter);
-	while (ok) {
+	while (domain->cmds_first) {
 	    ipmi_msgi_t *rspi;
 
-	    nmsg = ilist_get(&iter);
+	    nmsg = domain->cmds_first;
 	    rspi = nmsg->rsp_item;
 
 	    rspi->msg.netfn = nmsg->msg.netfn | 1;
@@ -629,16 +736,15 @@ cleanup_domain(ipmi_domain_t *domain)
 	    rspi->msg.data[0] = IPMI_UNKNOWN_ERR_CC;
 	    deliver_rsp(domain, nmsg->rsp_handler, rspi);
 	    
-	    ilist_delete(&iter);
-	    ipmi_mem_free(nmsg);
-	    ok = ilist_first(&iter);
+	    cmds_remove(domain, nmsg);
+	    ipmi_mem_pool_free(ll_msg_pool, nmsg);
 	}
 	ipmi_unlock(domain->cmds_lock);
     }
     if (domain->cmds_lock)
 	ipmi_destroy_lock(domain->cmds_lock);
     if (domain->cmds)
-	free_ilist(domain->cmds);
+	ipmi_mem_free(domain->cmds);
 
     /* Shutdown code called here. */
     if (domain->shutdown_handler)
@@ -809,9 +915,9 @@ cleanup_domain(ipmi_domain_t *domain)
     if (domain->mc_upd_cl_handlers)
 	locked_list_destroy(domain->mc_upd_cl_handlers);
 
-    for (i=0; i<IPMB_HASH; i++) {
-	if (domain->ipmb_mcs[i].mcs)
-	    ipmi_mem_free(domain->ipmb_mcs[i].mcs);
+    for (i=0; i<IPMB_CHANNELS; i++) {
+	if (domain->ipmb_mcs[i])
+	    ipmi_mem_free(domain->ipmb_mcs[i]);
     }
 
     /* We wait until here to call the OEM data destroyer, the process
@@ -1109,11 +1215,13 @@ setup_domain(const char         *name,
     if (rv)
 	goto out_err;
 
-    domain->cmds = alloc_ilist();
+    domain->cmds = ipmi_mem_alloc(sizeof(ll_msg_t *) * CMDS_INIT_SIZE);
     if (! domain->cmds) {
 	rv = ENOMEM;
 	goto out_err;
     }
+    memset(domain->cmds, 0, sizeof(ll_msg_t *) * CMDS_INIT_SIZE);
+    domain->cmds_size = CMDS_INIT_SIZE;
 
     domain->con_change_cl_handlers = locked_list_alloc(domain->os_hnd);
     if (! domain->con_change_cl_handlers) {
@@ -1618,8 +1726,6 @@ int _ipmi_domain_fru_call_special_setup(ipmi_domain_t *domain,
  *
  **********************************************************************/
 
-#define HASH_SLAVE_ADDR(x) (((x) >> 1) & (IPMB_HASH-1))
-
 ipmi_mc_t *
 _ipmi_find_mc_by_addr(ipmi_domain_t     *domain,
 		      const ipmi_addr_t *addr,
@@ -1630,37 +1736,24 @@ _ipmi_find_mc_by_addr(ipmi_domain_t     *domain,
     if (addr_len > sizeof(ipmi_addr_t))
 	return NULL;
 
-    ipmi_lock(domain->mc_lock);
     if (addr->addr_type == IPMI_SYSTEM_INTERFACE_ADDR_TYPE) {
+	ipmi_lock(domain->mc_lock);
 	if (addr->channel == IPMI_BMC_CHANNEL)
 	    mc = domain->si_mc;
 	else if (addr->channel < MAX_CONS)
 	    mc = domain->sys_intf_mcs[addr->channel];
     } else if (addr->addr_type == IPMI_IPMB_ADDR_TYPE) {
 	const ipmi_ipmb_addr_t *ipmb = (ipmi_ipmb_addr_t *) addr;
-	int                    idx;
-	const mc_table_t       *tab;
-	ipmi_addr_t            addr2;
-	unsigned int           addr2_len;
-	int                    i;
-
-	if (addr_len >= sizeof(*ipmb)) {
-	    idx = HASH_SLAVE_ADDR(ipmb->slave_addr);
-	    tab = &(domain->ipmb_mcs[idx]);
-	    for (i=0; i<tab->size; i++) {
-		if (tab->mcs[i]) {
-		    ipmi_mc_get_ipmi_address(tab->mcs[i], &addr2, &addr2_len);
-
-		    if (ipmi_addr_equal_nolun(addr, addr_len,
-					      &addr2, addr2_len))
-		    {
-			mc = tab->mcs[i];
-			break;
-		    }
-		}
-	    }
-	}
-    }
+
+	if ((addr_len < sizeof(*ipmb))
+	    || (((unsigned short) ipmb->channel) >= IPMB_CHANNELS))
+	    return NULL;
+
+	ipmi_lock(domain->mc_lock);
+	if (domain->ipmb_mcs[ipmb->channel])
+	    mc = domain->ipmb_mcs[ipmb->channel][ipmb->slave_addr];
+    } else
+	return NULL;
 
     /* If we cannot get the MC, it has been destroyed. */
     if (mc) {
@@ -1771,35 +1864,28 @@ add_mc_to_domain(ipmi_domain_t *domain, ipmi_mc_t *mc)
 	    domain->sys_intf_mcs[addr->channel] = mc;
     } else if (addr->addr_type == IPMI_IPMB_ADDR_TYPE) {
 	ipmi_ipmb_addr_t *ipmb = (ipmi_ipmb_addr_t *) addr;
-	int              idx;
-	mc_table_t       *tab;
-	int              i;
+	ipmi_mc_t        **tab;
 
-	idx = HASH_SLAVE_ADDR(ipmb->slave_addr);
-	tab = &(domain->ipmb_mcs[idx]);
-	if (tab->size == tab->curr) {
-	    ipmi_mc_t **nmcs;
-
-	    nmcs = ipmi_mem_alloc(sizeof(ipmi_mc_t *) * (tab->size+5));
-	    if (!nmcs) {
+	if (((unsigned short) ipmb->channel) >= IPMB_CHANNELS) {
+	    rv = EINVAL;
+	    goto out_unlock;
+	}
+	tab = domain->ipmb_mcs[ipmb->channel];
+	if (!tab) {
+	    tab = ipmi_mem_alloc(sizeof(ipmi_mc_t *) * IPMB_ADDRS);
+	    if (!tab) {
 		rv = ENOMEM;
 		goto out_unlock;
 	    }
-	    if (tab->mcs) {
-		memcpy(nmcs, tab->mcs, sizeof(ipmi_mc_t *) * tab->size);
-		ipmi_mem_free(tab->mcs);
-	    }
-	    memset(nmcs+tab->size, 0, sizeof(ipmi_mc_t *) * 5);
-	    tab->size += 5;
-	    tab->mcs = nmcs;
+	    memset(tab, 0, sizeof(ipmi_mc_t *) * IPMB_ADDRS);
+	    domain->ipmb_mcs[ipmb->channel] = tab;
 	}
-	for (i=0; i<tab->size; i++) {
-	    if (!tab->mcs[i]) {
-		tab->mcs[i] = mc;
-		tab->curr++;
-		break;
-	    }
+	if (tab[ipmb->slave_addr]) {
+	    /* Only one MC may live at an address. */
+	    rv = EEXIST;
+	    goto out_unlock;
 	}
+	tab[ipmb->slave_addr] = mc;
     }
 
 out_unlock:
@@ -1918,18 +2004,13 @@ _ipmi_remove_mc_from_domain(ipmi_domain_t *domain, ipmi_mc_t *mc)
 	}
     } else if (addr->addr_type == IPMI_IPMB_ADDR_TYPE) {
 	ipmi_ipmb_addr_t *ipmb = (ipmi_ipmb_addr_t *) addr;
-	int              idx;
-	mc_table_t       *tab;
-	int              i;
+	ipmi_mc_t        **tab = NULL;
 
-	idx = HASH_SLAVE_ADDR(ipmb->slave_addr);
-	tab = &(domain->ipmb_mcs[idx]);
-	for (i=0; i<tab->size; i++) {
-	    if (tab->mcs[i] == mc) {
-		tab->curr--;
-		tab->mcs[i] = NULL;
-		found = 1;
-	    }
+	if (((unsigned short) ipmb->channel) < IPMB_CHANNELS)
+	    tab = domain->ipmb_mcs[ipmb->channel];
+	if (tab && (tab[ipmb->slave_addr] == mc)) {
+	    tab[ipmb->slave_addr] = NULL;
+	    found = 1;
 	}
     }
 
@@ -2005,31 +2086,16 @@ _ipmi_find_or_create_mc_by_slave_addr(ipmi_domain_t *domain,
  *
  **********************************************************************/
 
-static int cmp_nmsg(void *item, void *cb_data)
-{
-    ll_msg_t *nmsg1 = item;
-    ll_msg_t *nmsg2 = cb_data;
-
-    return ((nmsg1 == nmsg2)
-	    && (nmsg1->domain == nmsg2->domain));
-}
-
 /* Must be called with the cmds_lock held. */
 static int
 find_and_remove_msg(ipmi_domain_t *domain, ll_msg_t *nmsg, long seq)
 {
-    ilist_iter_t iter;
-    int          rv = 0;
-
-    ilist_init_iter(&iter, domain->cmds);
-    ilist_unpositioned(&iter);
-    if ((ilist_search_iter(&iter, cmp_nmsg, nmsg) != NULL)
-	&& (nmsg->seq == seq))
-    {
-	ilist_delete(&iter);
-	rv = 1;
-    }
-    return rv;
+    /* Don't look at nmsg until we know it is in the table, it may
+       have been freed. */
+    if (cmds_find(domain, seq) != nmsg)
+	return 0;
+    cmds_remove(domain, nmsg);
+    return 1;
 }
 
 static int
@@ -2070,7 +2136,7 @@ ll_rsp_handler(ipmi_con_t   *ipmi,
 	deliver_rsp(domain, nmsg->rsp_handler, rspi);
     } else
 	ipmi_free_msg_item(rspi);
-    ipmi_mem_free(nmsg);
+    ipmi_mem_pool_free(ll_msg_pool, nmsg);
  out_unlock:
     _ipmi_domain_put(domain);
     return IPMI_MSG_ITEM_NOT_USED;
@@ -2102,7 +2168,7 @@ ll_si_rsp_handler(ipmi_con_t *ipmi, ipmi_msgi_t *orspi)
 	deliver_rsp(domain, nmsg->rsp_handler, rspi);
     } else
 	ipmi_free_msg_item(rspi);
-    ipmi_mem_free(nmsg);
+    ipmi_mem_pool_free(ll_msg_pool, nmsg);
 
     _ipmi_domain_put(domain);
     return IPMI_MSG_ITEM_NOT_USED;
@@ -2203,12 +2269,12 @@ send_command_addr(ipmi_domain_t                *domain,
 
     CHECK_DOMAIN_LOCK(domain);
 
-    nmsg = ipmi_mem_alloc(sizeof(*nmsg));
+    nmsg = ipmi_mem_pool_alloc(ll_msg_pool);
     if (!nmsg)
 	return ENOMEM;
     nmsg->rsp_item = ipmi_alloc_msg_item();
     if (!nmsg->rsp_item) {
-	ipmi_mem_free(nmsg);
+	ipmi_mem_pool_free(ll_msg_pool, nmsg);
 	return ENOMEM;
     }
 
@@ -2300,7 +2366,7 @@ send_command_addr(ipmi_domain_t                *domain,
 	/* If it's a system interface we don't add it to the list of
 	   commands running, because it will never need to be
 	   rerouted. */
-	ilist_add_tail(domain->cmds, nmsg, &nmsg->link);
+	cmds_add(domain, nmsg);
     }
  out_unlock:
     ipmi_unlock(domain->cmds_lock);
@@ -2308,7 +2374,7 @@ send_command_addr(ipmi_domain_t                *domain,
  out:
     if (rv) {
 	ipmi_free_msg_item(nmsg->rsp_item);
-	ipmi_mem_free(nmsg);
+	ipmi_mem_pool_free(ll_msg_pool, nmsg);
     }
     return rv;
 }
@@ -2344,25 +2410,22 @@ ipmi_send_command_addr_sideeff(ipmi_domain_t                *domain,
 static void
 reroute_cmds(ipmi_domain_t *domain, int old_con, int new_con)
 {
-    ilist_iter_t iter;
     int          rv;
-    ll_msg_t     *nmsg;
+    ll_msg_t     *nmsg, *next;
 
     ipmi_lock(domain->cmds_lock);
-    ilist_init_iter(&iter, domain->cmds);
-    rv = ilist_first(&iter);
     (domain->conn_seq[old_con])++;
-    while (rv) {
-	nmsg = ilist_get(&iter);
+    for (nmsg = domain->cmds_first; nmsg; nmsg = next) {
+	next = nmsg->next;
 	if (nmsg->con == old_con) {
 	    ipmi_msgi_t       *rspi;
 	    ipmi_con_option_t opt_data[2];
 	    ipmi_con_option_t *options = NULL;
 
-	    nmsg->seq = domain->cmds_seq;
-	    domain->cmds_seq++; /* Make the message unique so a
-                                   response from the other connection
-                                   will not match. */
+	    /* Make the message unique so a response from the other
+	       connection will not match. */
+	    cmds_set_seq(domain, nmsg, domain->cmds_seq);
+	    domain->cmds_seq++;
 	    nmsg->con = new_con;
 
 	    rspi = ipmi_alloc_msg_item();
@@ -2400,12 +2463,10 @@ reroute_cmds(ipmi_domain_t *domain, int old_con, int new_con)
 		    rspi->data[0] = IPMI_UNKNOWN_ERR_CC;
 		    deliver_rsp(domain, nmsg->rsp_handler, rspi);
 		}
-		rv = ilist_delete(&iter);
-		ipmi_mem_free(nmsg);
-		continue;
+		cmds_remove(domain, nmsg);
+		ipmi_mem_pool_free(ll_msg_pool, nmsg);
 	    }
 	}
-	rv = ilist_next(&iter);
     }
     ipmi_unlock(domain->cmds_lock);
 }
@@ -3870,11 +3931,15 @@ ipmi_domain_iterate_mcs(ipmi_domain_t              *domain,
 	    ipmi_lock(domain->mc_lock);
 	}
     }
-    for (i=0; i<IPMB_HASH; i++) {
-	mc_table_t *tab = &(domain->ipmb_mcs[i]);
+    for (i=0; i<IPMB_CHANNELS; i++) {
+	for (j=0; j<IPMB_ADDRS; j++) {
+	    ipmi_mc_t *mc;
 
-	for (j=0; j<tab->size; j++) {
-	    ipmi_mc_t *mc = tab->mcs[j];
+	    /* The handler may add the first MC on a channel, so
+	       check the table every time around. */
+	    if (!domain->ipmb_mcs[i])
+		break;
+	    mc = domain->ipmb_mcs[i][j];
 	    if (mc && !_ipmi_mc_get(mc)) {
 		ipmi_unlock(domain->mc_lock);
 		handler(domain, mc, cb_data);
@@ -3897,11 +3962,13 @@ ipmi_domain_iterate_mcs_rev(ipmi_domain_t              *domain,
     CHECK_DOMAIN_LOCK(domain);
 
     ipmi_lock(domain->mc_lock);
-    for (i=IPMB_HASH-1; i>=0; i--) {
-	mc_table_t *tab = &(domain->ipmb_mcs[i]);
+    for (i=IPMB_CHANNELS-1; i>=0; i--) {
+	for (j=IPMB_ADDRS-1; j>=0; j--) {
+	    ipmi_mc_t *mc;
 
-	for (j=tab->size-1; j>=0; j--) {
-	    ipmi_mc_t *mc = tab->mcs[j];
+	    if (!domain->ipmb_mcs[i])
+		break;
+	    mc = domain->ipmb_mcs[i][j];
 	    if (mc && !_ipmi_mc_get(mc)) {
 		ipmi_unlock(domain->mc_lock);
 		handler(domain, mc, cb_data);
@@ -5671,6 +5738,16 @@ ipmi_domain_get_main_sdrs(ipmi_domain_t *domain)
     return domain->main_sdrs;
 }
 
+int
+ipmi_domain_get_main_sdr_fetch_stats(ipmi_domain_t          *domain,
+				     ipmi_sdr_fetch_stats_t *stats)
+{
+    CHECK_DOMAIN_LOCK(domain);
+    if (!domain->main_sdrs)
+	return ENOSYS;
+    return ipmi_sdr_get_fetch_stats(domain->main_sdrs, stats);
+}
+
 int
 ipmi_domain_get_num_channels(ipmi_domain_t *domain, int *val)
 {
@@ -6378,6 +6455,19 @@ _ipmi_domain_init(void)
 	return rv;
     }
 
+    rv = ipmi_mem_pool_alloc_pool(ipmi_get_global_os_handler(),
+				  sizeof(ll_msg_t), &ll_msg_pool);
+    if (rv) {
+	locked_list_destroy(domain_change_handlers);
+	locked_list_destroy(domains_list);
+	domains_list = NULL;
+	free_ilist(oem_handlers);
+	oem_handlers = NULL;
+	ipmi_destroy_lock(domains_lock);
+	domains_lock = NULL;
+	return rv;
+    }
+
     domains_initialized = 1;
 
     return 0;
@@ -6396,6 +6486,8 @@ _ipmi_domain_shutdown(void)
     oem_handlers = NULL;
     ipmi_destroy_lock(domains_lock);
     domains_lock = NULL;
+    ipmi_mem_pool_free_pool(ll_msg_pool);
+    ll_msg_pool = NULL;
 }
 
 
@@ -147,6 +147,9 @@ struct ipmi_entity_s
 
     dlr_ref_t key;
 
+    /* Link in the entity info's hash index, keyed on the key above. */
+    ipmi_entity_t *hash_next;
+
     /* Lock used for protecting misc data. */
     ipmi_lock_t *elock;
 
@@ -301,12 +304,22 @@ struct ipmi_entity_info_s
     ipmi_domain_t         *domain;
     ipmi_domain_id_t      domain_id;
     locked_list_t         *entities;
+
+    /* A hash index of the entities list, so they can be found by key
+       without walking the list.  Protected by the domain entity lock,
+       like the list.  It grows as entities are added. */
+    ipmi_entity_t         **hash;
+    unsigned int          hash_size;
+    unsigned int          hash_count;
 };
 
+#define ENTITY_HASH_INIT_SIZE 64
+
 #define ent_lock(e) ipmi_lock(e->elock)
 #define ent_unlock(e) ipmi_unlock(e->elock)
 
 static void entity_mc_active(ipmi_mc_t *mc, int active, void *cb_data);
+static void entity_hash_remove(ipmi_entity_info_t *ents, ipmi_entity_t *ent);
 static void call_presence_handlers(ipmi_entity_t *ent, int present);
 static void call_fully_up_handlers(ipmi_entity_t *ent);
 
@@ -419,10 +432,19 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
 
     ents->domain = domain;
     ents->domain_id = ipmi_domain_convert_to_id(domain);
+    ents->hash_count = 0;
+    ents->hash_size = ENTITY_HASH_INIT_SIZE;
+    ents->hash = ipmi_mem_alloc(sizeof(ipmi_entity_t *) * ents->hash_size);
+    if (!ents->hash) {
+	ipmi_mem_free(ents);
+	return ENOMEM;
+    }
+    memset(ents->hash, 0, sizeof(ipmi_entity_t *) * ents->hash_size);
     ents->entities = locked_list_alloc_my_lock(entities_lock,
 					       entities_unlock,
 					       domain);
     if (! ents->entities) {
+	ipmi_mem_free(ents->hash);
 	ipmi_mem_free(ents);
 	return ENOMEM;
     }
@@ -430,6 +452,7 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
     ents->update_handlers = locked_list_alloc(ipmi_domain_get_os_hnd(domain));
     if (! ents->update_handlers) {
 	locked_list_destroy(ents->entities);
+	ipmi_mem_free(ents->hash);
 	ipmi_mem_free(ents);
 	return ENOMEM;
     }
@@ -439,6 +462,7 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
     if (! ents->update_cl_handlers) {
 	locked_list_destroy(ents->update_handlers);
 	locked_list_destroy(ents->entities);
+	ipmi_mem_free(ents->hash);
 	ipmi_mem_free(ents);
 	return ENOMEM;
     }
@@ -788,6 +812,7 @@ ipmi_entity_info_destroy(ipmi_entity_info_t *ents)
     locked_list_destroy(ents->update_cl_handlers);
     locked_list_iterate(ents->entities, destroy_entity, NULL);
     locked_list_destroy(ents->entities);
+    ipmi_mem_free(ents->hash);
     ipmi_mem_free(ents);
     return 0;
 }
@@ -855,6 +880,7 @@ cleanup_entity(ipmi_entity_t *ent)
 
 	/* Remove it from the entities list. */
 	locked_list_remove_nolock(ent->ents->entities, ent, NULL);
+	entity_hash_remove(ent->ents, ent);
 
 	/* The sensor, control, parent, and child lists should be empty
 	   now, we can just destroy it. */
@@ -1158,27 +1184,87 @@ ipmi_entity_info_remove_update_handler_cl(ipmi_entity_info_t       *ents,
 	return EINVAL;
 }
 
-typedef struct search_info_s {
-    dlr_ref_t         key;
-    ipmi_entity_t     *ent;
-} search_info_t;
+static unsigned int
+entity_hash(ipmi_entity_info_t *ents, dlr_ref_t *key)
+{
+    unsigned int h;
+
+    h = key->device_num.channel;
+    h = (h << 8) | key->device_num.address;
+    h = (h * 31) + key->entity_id;
+    h = (h * 31) + key->entity_instance;
+    h ^= h >> 11;
+    return h & (ents->hash_size - 1);
+}
 
 static int
-search_entity(void *cb_data, void *item1, void *item2)
+entity_key_equal(dlr_ref_t *k1, dlr_ref_t *k2)
 {
-    ipmi_entity_t *ent = (ipmi_entity_t *) item1;
-    search_info_t *info = (search_info_t *) cb_data;
-    int           same;
+    return ((k1->device_num.channel == k2->device_num.channel)
+	    && (k1->device_num.address == k2->device_num.address)
+	    && (k1->entity_id == k2->entity_id)
+	    && (k1->entity_instance == k2->entity_instance));
+}
+
+/* Double the size of the hash table.  If that fails, just keep using
+   the table we have, the chains will get longer. */
+static void
+entity_hash_grow(ipmi_entity_info_t *ents)
+{
+    ipmi_entity_t **old_hash = ents->hash;
+    unsigned int  old_size = ents->hash_size;
+    ipmi_entity_t **new_hash;
+    ipmi_entity_t *ent;
+    unsigned int  i, h;
 
-    same = ((ent->key.device_num.channel == info->key.device_num.channel)
-	    && (ent->key.device_num.address == info->key.device_num.address)
-	    && (ent->key.entity_id == info->key.entity_id)
-	    && (ent->key.entity_instance == info->key.entity_instance));
-    if (same) {
-	info->ent = ent;
-	return LOCKED_LIST_ITER_STOP;
+    new_hash = ipmi_mem_alloc(sizeof(ipmi_entity_t *) * old_size * 2);
+    if (!new_hash)
+	return;
+    memset(new_hash, 0, sizeof(ipmi_entity_t *) * old_size * 2);
+
+    ents->hash = new_hash;
+    ents->hash_size = old_size * 2;
+    for (i=0; i<old_size; i++) {
+	while (old_hash[i]) {
+	    ent = old_hash[i];
+	    old_hash[i] = ent->hash_next;
+	    h = entity_hash(ents, &ent->key);
+	    ent->hash_next = new_hash[h];
+	    new_hash[h] = ent;
+	}
+    }
+    ipmi_mem_free(old_hash);
+}
+
+/* These must be called with the domain entity lock held. */
+static void
+entity_hash_add(ipmi_entity_info_t *ents, ipmi_entity_t *ent)
+{
+    unsigned int h;
+
+    if (ents->hash_count >= ents->hash_size)
+	entity_hash_grow(ents);
+    h = entity_hash(ents, &ent->key);
+    ent->hash_next = ents->hash[h];
+    ents->hash[h] = ent;
+    ents->hash_count++;
+}
+
+static void
+entity_hash_remove(ipmi_entity_info_t *ents, ipmi_entity_t *ent)
+{
+    ipmi_entity_t **prev;
+
+    prev = &ents->hash[entity_hash(ents, &ent->key)];
+    while (*prev) {
+	if (*prev == ent) {
+	    *prev = ent->hash_next;
+	    ent->hash_next = NULL;
+	    ents->hash_count--;
+	    return;
+	}
+	prev = &(*prev)->hash_next;
     }
-    return LOCKED_LIST_ITER_CONTINUE;
 }
 
 static int
@@ -1188,19 +1274,21 @@ entity_find(ipmi_entity_info_t *ents,
 	    int                entity_instance,
 	    ipmi_entity_t      **found_ent)
 {
-    search_info_t info = { {device_num, entity_id, entity_instance}, NULL};
-    int           rv = 0;
+    dlr_ref_t     key = {device_num, entity_id, entity_instance};
+    ipmi_entity_t *ent;
 
-    locked_list_iterate_nolock(ents->entities, search_entity, &info);
-    if (info.ent == NULL) {
-	rv = ENOENT;
-    } else {
-	info.ent->usecount++;
-	if (found_ent)
-	    *found_ent = info.ent;
+    for (ent = ents->hash[entity_hash(ents, &key)]; ent; ent = ent->hash_next)
+    {
+	if (entity_key_equal(&ent->key, &key))
+	    break;
     }
+    if (ent == NULL)
+	return ENOENT;
 
-    return rv;
+    ent->usecount++;
+    if (found_ent)
+	*found_ent = ent;
+    return 0;
 }
 
 int
@@ -1387,6 +1475,7 @@ entity_add(ipmi_entity_info_t *ents,
 
     if (! locked_list_add_nolock(ents->entities, ent, NULL))
 	goto out_err;
+    entity_hash_add(ents, ent);
 
     _ipmi_domain_entity_unlock(ent->domain);
 
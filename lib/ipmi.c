@@ -47,6 +47,7 @@
 #include <OpenIPMI/ipmi_msgbits.h>
 
 #include <OpenIPMI/internal/ipmi_domain.h>
+#include <OpenIPMI/internal/ipmi_sensor.h>
 #include <OpenIPMI/internal/ipmi_mc.h>
 #include <OpenIPMI/internal/ipmi_int.h>
 #include <OpenIPMI/internal/ipmi_oem.h>
@@ -440,6 +441,7 @@ void _ipmi_fru_shutdown(void);
 void _ipmi_normal_fru_shutdown(void);
 void _ipmi_fru_spd_decoder_shutdown(void);
 int _ipmi_sol_init(void);
+int _ipmi_sdr_init(void);
 
 void _ipmi_rakp_shutdown(void);
 void _ipmi_aes_cbc_shutdown(void);
@@ -452,9 +454,15 @@ void ipmi_oem_atca_shutdown(void);
 int _ipmi_smi_shutdown(void);
 int _ipmi_lan_shutdown(void);
 void _ipmi_sol_shutdown(void);
+void _ipmi_sdr_shutdown(void);
 
 
 static locked_list_t *con_type_list;
+
+/* Message items are allocated for every message sent, they come out of
+   a pool once ipmi_init() has been called. */
+static ipmi_mem_pool_t *msg_item_pool;
+
 static int ipmi_initialized;
 
 int
@@ -481,6 +489,11 @@ ipmi_init(os_handler_t *handler)
 
     ipmi_initialized = 1;
 
+    rv = ipmi_mem_pool_alloc_pool(handler, sizeof(ipmi_msgi_t),
+				  &msg_item_pool);
+    if (rv)
+	goto out_err;
+
     if (handler->create_lock) {
 	rv = handler->create_lock(handler, &seq_lock);
 	if (rv)
@@ -502,6 +515,14 @@ ipmi_init(os_handler_t *handler)
     _ipmi_domain_init();
     _ipmi_mc_init();
 
+    rv = _ipmi_sensor_init();
+    if (rv)
+	goto out_err;
+
+    rv = _ipmi_sdr_init();
+    if (rv)
+	goto out_err;
+
     rv = _ipmi_rakp_init();
     if (rv)
 	goto out_err;
@@ -566,6 +587,8 @@ ipmi_shutdown(void)
     ipmi_oem_atca_conn_shutdown();
     ipmi_oem_intel_shutdown();
     ipmi_oem_kontron_conn_shutdown();
+    _ipmi_sdr_shutdown();
+    _ipmi_sensor_shutdown();
     _ipmi_mc_shutdown();
     _ipmi_domain_shutdown();
     _ipmi_fru_spd_decoder_shutdown();
@@ -576,6 +599,10 @@ ipmi_shutdown(void)
 	ipmi_os_handler->destroy_lock(ipmi_os_handler, seq_lock);
     if (con_type_list)
 	locked_list_destroy(con_type_list);
+    if (msg_item_pool) {
+	ipmi_mem_pool_free_pool(msg_item_pool);
+	msg_item_pool = NULL;
+    }
 
     ipmi_os_handler = NULL;
 
@@ -1188,7 +1215,10 @@ ipmi_alloc_msg_item(void)
 {
     ipmi_msgi_t *rv;
 
-    rv = ipmi_mem_alloc(sizeof(ipmi_msgi_t));
+    if (msg_item_pool)
+	rv = ipmi_mem_pool_alloc(msg_item_pool);
+    else
+	rv = ipmi_mem_alloc(sizeof(ipmi_msgi_t));
     if (!rv)
 	return NULL;
     memset(rv, 0, sizeof(*rv));
@@ -1201,7 +1231,10 @@ ipmi_free_msg_item(ipmi_msgi_t *item)
 {
     if (item->msg.data && (item->msg.data != item->data))
 	ipmi_free_msg_item_data(item->msg.data);
-    ipmi_mem_free(item);
+    if (msg_item_pool)
+	ipmi_mem_pool_free(msg_item_pool, item);
+    else
+	ipmi_mem_free(item);
 }
 
 void *
@@ -33,6 +33,9 @@
 
 #include <config.h>
 
+/* Get recvmmsg() for GNU. */
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -42,8 +45,10 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
@@ -82,6 +87,12 @@ dump_hex(void *vdata, int len)
 /* # of times to try a message before we fail it. */
 #define LAN_RSP_RETRIES 6
 
+/* The defaults for the bounds on the response timeout when it is
+   computed from the round trip time, in milliseconds.  A minimum of
+   zero means the timeout is not computed, LAN_RSP_TIMEOUT is used. */
+#define DEFAULT_LAN_RSP_TIMEOUT_MIN 0
+#define DEFAULT_LAN_RSP_TIMEOUT_MAX (LAN_RSP_TIMEOUT / 1000)
+
 /* Number of microseconds of consecutive failures allowed on an IP
    before it is considered failed. */
 #define IP_FAIL_TIME 7000000
@@ -217,7 +228,12 @@ typedef struct lan_stat_info_s
 #define STAT_INVALID_PAYLOAD	16
 #define STAT_SEQ_ERR		17
 #define STAT_RSP_NO_CMD		18
-#define NUM_STATS 19
+#define STAT_RECV_BATCHES	19
+#define STAT_WINDOW		20
+#define STAT_RTT_SAMPLES	21
+#define STAT_RTT_USEC		22
+#define STAT_RTT_DEV_USEC	23
+#define NUM_STATS 24
     /* Statistics */
     void *stats[NUM_STATS];
 } lan_stat_info_t;
@@ -242,7 +258,21 @@ static const char *lan_stat_names[NUM_STATS] =
     "lan_decrypt_fail",
     "lan_invalid_payload",
     "lan_seq_err",
-    "lan_rsp_no_cmd"
+    "lan_rsp_no_cmd",
+    /* Counted once per fd wakeup that received packets for the
+       connection, lan_recv_packets / lan_recv_batches is the number
+       of packets handled per wakeup. */
+    "lan_recv_batches",
+    /* Not a count, this goes up and down with the number of messages
+       allowed to be outstanding. */
+    "lan_window",
+    /* Round trip times measured on responses to messages that were
+       not resent.  lan_rtt_usec / lan_rtt_samples is the average
+       round trip time, lan_rtt_dev_usec / lan_rtt_samples is the
+       average difference from the smoothed round trip time. */
+    "lan_rtt_samples",
+    "lan_rtt_usec",
+    "lan_rtt_dev_usec"
 };
 
 
@@ -283,6 +313,20 @@ typedef struct lan_ip_data_s
 
     /* Use for linked-lists of IP addresses. */
     lan_link_t                 ip_link;
+
+    /* Used for the address hash in the lan_fd_t. */
+    lan_link_t                 fd_link;
+
+    /* Round trip time estimates in microseconds, as in Jacobson and
+       Karels' "Congestion Avoidance and Control".  srtt is the
+       smoothed round trip time times 8, rttvar the smoothed mean
+       deviation times 4, and rsp_timeout (srtt + 4 * the deviation)
+       is the timeout to use for the address.  These are protected
+       by the seq_num_lock and only valid if rtt_valid is set. */
+    int                        rtt_valid;
+    long                       srtt;
+    long                       rttvar;
+    long                       rsp_timeout;
 } lan_ip_data_t;
 
 
@@ -300,6 +344,18 @@ struct lan_data_s
     lan_fd_t                   *fd;
     int                        fd_slot;
 
+    /* The most packets to read from the fd per wakeup, see
+       IPMI_LANP_RECV_BATCH_SIZE. */
+    unsigned int               recv_batch_size;
+
+    /* Send each packet with its own sendto() instead of queueing it
+       on the fd, see IPMI_LANP_XMIT_IMMEDIATE. */
+    int                        xmit_immediate;
+
+    /* The number of connections a new fd is created with, see
+       IPMI_LANP_MAX_CONS_PER_FD. */
+    unsigned int               max_cons_per_fd;
+
     unsigned char              slave_addr[MAX_IPMI_USED_CHANNELS];
     int                        is_active;
 
@@ -375,6 +431,14 @@ struct lan_data_s
 
 	/* The number of the last IP address sent on. */
 	int                   last_ip_num;
+
+	/* The value of send_count when the message was sent. */
+	uint32_t              send_num;
+
+	/* When the message was last sent, and if it has been resent
+	   (the round trip time is only measured if it has not). */
+	struct timeval        send_time;
+	int                   resent;
     } seq_table[64];
     ipmi_lock_t               *seq_num_lock;
 
@@ -391,6 +455,29 @@ struct lan_data_s
        sequence zero. */
     unsigned int max_outstanding_msg_count;
 
+    /* The number of messages that may be outstanding now.  If
+       window_max is zero this is always max_outstanding_msg_count.
+       Otherwise it is adjusted like a TCP congestion window: it
+       starts at max_outstanding_msg_count, grows by one for each
+       response until it reaches window_thresh then by one for each
+       window's worth of responses, and is halved (and window_thresh
+       set to the result) when a message times out.  It never goes
+       above window_max.  Only timeouts of messages sent after the
+       last shrink (when send_count was window_shrink_send) shrink
+       it, so a burst of losses only shrinks it once. */
+    unsigned int cur_window;
+    unsigned int window_max;
+    unsigned int window_thresh;
+    unsigned int window_acks;
+    uint32_t     send_count;
+    uint32_t     window_shrink_send;
+
+    /* The bounds for response timeouts computed from the round trip
+       time, in microseconds.  If rsp_timeout_min is zero the fixed
+       timeouts are used. */
+    long         rsp_timeout_min;
+    long         rsp_timeout_max;
+
     /* List of messages waiting to be sent. */
     lan_wait_queue_t *wait_q, *wait_q_tail;
 
@@ -1071,16 +1158,59 @@ static int send_auth_cap(ipmi_con_t *ipmi, lan_data_t *lan, int addr_num,
 
 static os_handler_t *lan_os_hnd;
 
-#define MAX_CONS_PER_FD	32
+/* Every command sent gets a timer info, and a wait queue entry if it
+   has to wait for room in the window. */
+static ipmi_mem_pool_t *lan_timer_pool;
+static ipmi_mem_pool_t *lan_wait_q_pool;
+
+/* A packet waiting on a lan_fd_t's transmit queue. */
+typedef struct lan_xmit_s lan_xmit_t;
+
+#define DEFAULT_MAX_CONS_PER_FD	32
+#define MAX_MAX_CONS_PER_FD	65536
 struct lan_fd_s
 {
     int            fd;
     os_hnd_fd_id_t *fd_wait_id;
     unsigned int   cons_in_use;
-    lan_data_t     *lan[MAX_CONS_PER_FD];
+    /* The most packets to read per wakeup, the largest batch size
+       of the connections that have used this fd. */
+    unsigned int   recv_batch_size;
+
+    /* The connections, indexed by slot.  The slot is the RMCP+
+       session id (minus one) we give out, so those can be looked up
+       directly.  Free slots are kept on a stack so finding one is
+       quick. */
+    unsigned int   max_cons;
+    lan_data_t     **lan;
+    unsigned int   *free_slots;
+    unsigned int   num_free_slots;
+
+    /* A hash of the addresses of the connections in this fd.  An
+       address may only appear once in an fd, so this finds the
+       connection for an IPMI 1.5 packet (which must then have the
+       right session id) and is used to check that a new connection
+       may use this fd.  addr_hash_mask + 1 is the number of buckets,
+       each bucket is a list with a head whose lan is NULL. */
+    lan_link_t     *addr_hash;
+    unsigned int   addr_hash_mask;
+
     lan_fd_t       *next, *prev;
     ipmi_lock_t    *con_lock;
 
+    /* Packets queued to send, they are all sent with one sendmmsg()
+       when xmit_timer goes off at the start of the next selector
+       iteration, or when the queue is full.  Sending is done with
+       xmit_lock held so the queue is sent in order and nothing is
+       sent after the fd is closed. */
+    ipmi_lock_t       *xmit_lock;
+    lan_xmit_t        *xmit_q, *xmit_q_tail;
+    unsigned int      xmit_q_len;
+    lan_xmit_t        *xmit_free;
+    unsigned int      xmit_free_len;
+    os_hnd_timer_id_t *xmit_timer;
+    int               xmit_timer_running;
+
     /* Main list info. */
     ipmi_lock_t    *lock;
     lan_fd_t       **free_list;
@@ -1104,6 +1234,7 @@ static lan_fd_t *fd6_free_list;
 static void data_handler(int            fd,
 			 void           *cb_data,
 			 os_hnd_fd_id_t *id);
+static void lan_flush_xmit_q(lan_fd_t *item);
 
 static int
 lan_addr_same(sockaddr_ip_t *a1, sockaddr_ip_t *a2)
@@ -1179,6 +1310,187 @@ move_to_lan_list_head(lan_fd_t *item)
     list->next = item;
 }
 
+static unsigned int
+hash_lan_fd_addr(sockaddr_ip_t *addr, unsigned int mask)
+{
+    uint32_t h;
+
+    switch (addr->s_ipsock.s_addr.sa_family) {
+    case PF_INET:
+	{
+	    struct sockaddr_in *ip = &addr->s_ipsock.s_addr4;
+	    h = ip->sin_addr.s_addr ^ (((uint32_t) ip->sin_port) << 16);
+	}
+	break;
+
+#ifdef PF_INET6
+    case PF_INET6:
+	{
+	    struct sockaddr_in6 *ip = &addr->s_ipsock.s_addr6;
+	    uint32_t            v;
+	    int                 i;
+
+	    h = ip->sin6_port;
+	    for (i=0; i<16; i+=4) {
+		memcpy(&v, ip->sin6_addr.s6_addr + i, sizeof(v));
+		h = (h * 31) ^ v;
+	    }
+	}
+	break;
+#endif
+    default:
+	h = 0;
+    }
+
+    /* Mix the bits so the low ones depend on all of them. */
+    h *= 0x9e3779b1;
+    return (h ^ (h >> 16)) & mask;
+}
+
+/* Find the connection using the given address in the fd.  Must be
+   called with the fd's con_lock or the list lock held. */
+static lan_data_t *
+lan_fd_find_addr(lan_fd_t *item, sockaddr_ip_t *addr, int *addr_num)
+{
+    lan_link_t    *head = &item->addr_hash[hash_lan_fd_addr(addr,
+							item->addr_hash_mask)];
+    lan_link_t    *l;
+    lan_ip_data_t *ip;
+
+    for (l=head->next; l!=head; l=l->next) {
+	ip = (lan_ip_data_t *) (((char *) l) - offsetof(lan_ip_data_t,
+							fd_link));
+	*addr_num = ip - l->lan->ip;
+	if (lan_addr_same(&l->lan->cparm.ip_addr[*addr_num], addr))
+	    return l->lan;
+    }
+    return NULL;
+}
+
+/* Returns true if any of the connection's addresses are already in
+   the fd.  Must be called with the list lock held. */
+static int
+lan_fd_has_addr(lan_fd_t *item, lan_data_t *lan)
+{
+    unsigned int i;
+    int          addr_num;
+
+    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+	if (lan_fd_find_addr(item, &lan->cparm.ip_addr[i], &addr_num))
+	    return 1;
+    }
+    return 0;
+}
+
+/* Put the connection into the fd, must be called with the list lock
+   held. */
+static unsigned int
+lan_fd_add_con(lan_fd_t *item, lan_data_t *lan)
+{
+    unsigned int slot;
+    unsigned int i;
+    lan_link_t   *head;
+    lan_link_t   *l;
+
+    ipmi_lock(item->con_lock);
+    item->num_free_slots--;
+    slot = item->free_slots[item->num_free_slots];
+    item->lan[slot] = lan;
+    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+	head = &item->addr_hash[hash_lan_fd_addr(&lan->cparm.ip_addr[i],
+						 item->addr_hash_mask)];
+	l = &lan->ip[i].fd_link;
+	l->lan = lan;
+	l->next = head;
+	l->prev = head->prev;
+	head->prev->next = l;
+	head->prev = l;
+    }
+    ipmi_unlock(item->con_lock);
+
+    item->cons_in_use++;
+    if (lan->recv_batch_size > item->recv_batch_size)
+	item->recv_batch_size = lan->recv_batch_size;
+
+    return slot;
+}
+
+/* Take the connection in the slot out of the fd, must be called with
+   the list lock held. */
+static void
+lan_fd_remove_con(lan_fd_t *item, unsigned int slot)
+{
+    lan_data_t   *lan = item->lan[slot];
+    unsigned int i;
+    lan_link_t   *l;
+
+    ipmi_lock(item->con_lock);
+    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+	l = &lan->ip[i].fd_link;
+	l->prev->next = l->next;
+	l->next->prev = l->prev;
+	l->lan = NULL;
+    }
+    item->lan[slot] = NULL;
+    item->free_slots[item->num_free_slots] = slot;
+    item->num_free_slots++;
+    ipmi_unlock(item->con_lock);
+
+    item->cons_in_use--;
+}
+
+static void
+free_lan_fd_slots(lan_fd_t *item)
+{
+    if (item->lan)
+	ipmi_mem_free(item->lan);
+    if (item->free_slots)
+	ipmi_mem_free(item->free_slots);
+    if (item->addr_hash)
+	ipmi_mem_free(item->addr_hash);
+    item->lan = NULL;
+    item->free_slots = NULL;
+    item->addr_hash = NULL;
+    item->max_cons = 0;
+}
+
+/* Set up an empty fd to hold max_cons connections. */
+static int
+alloc_lan_fd_slots(lan_fd_t *item, unsigned int max_cons)
+{
+    unsigned int hash_size;
+    unsigned int i;
+
+    if (item->max_cons == max_cons)
+	return 0;
+
+    free_lan_fd_slots(item);
+
+    for (hash_size = 1; hash_size < max_cons; hash_size <<= 1)
+	;
+    item->lan = ipmi_mem_alloc(sizeof(lan_data_t *) * max_cons);
+    item->free_slots = ipmi_mem_alloc(sizeof(unsigned int) * max_cons);
+    item->addr_hash = ipmi_mem_alloc(sizeof(lan_link_t) * hash_size);
+    if (!item->lan || !item->free_slots || !item->addr_hash) {
+	free_lan_fd_slots(item);
+	return ENOMEM;
+    }
+
+    memset(item->lan, 0, sizeof(lan_data_t *) * max_cons);
+    /* Slot 0 is used first. */
+    for (i=0; i<max_cons; i++)
+	item->free_slots[i] = max_cons - i - 1;
+    item->num_free_slots = max_cons;
+    for (i=0; i<hash_size; i++) {
+	item->addr_hash[i].next = &item->addr_hash[i];
+	item->addr_hash[i].prev = &item->addr_hash[i];
+	item->addr_hash[i].lan = NULL;
+    }
+    item->addr_hash_mask = hash_size - 1;
+    item->max_cons = max_cons;
+    return 0;
+}
+
 static lan_fd_t *
 find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 {
@@ -1186,7 +1498,6 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
     lan_fd_t    *list, *item;
     lan_fd_t    **free_list;
     int         rv;
-    int         i;
 
     if (family == PF_INET) {
 	lock = fd_list_lock;
@@ -1207,46 +1518,17 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
     ipmi_lock(lock);
     item = list->next;
  retry:
-    if (item->cons_in_use < MAX_CONS_PER_FD) {
-	int tslot = -1;
-	/* Got an entry with a slot, just reuse it. */
-	for (i=0; i<MAX_CONS_PER_FD; i++) {
-	    if (item->lan[i]) {
-		/* Check for a matching IP address.  Can't have two
-		   systems with the same address in the same fd entry. */
-		unsigned int j, k;
-		lan_data_t   *l = item->lan[i];
-
-		for (j=0; j<l->cparm.num_ip_addr; j++) {
-		    for (k=0; k<lan->cparm.num_ip_addr; k++) {
-			if (lan_addr_same(&l->cparm.ip_addr[j],
-					  &lan->cparm.ip_addr[k]))
-			{
-			    /* Found the same address in the same
-			       lan_data file.  Try another one. */
-			    item = item->next;
-			    goto retry;
-			}
-		    }
-		}
-	    } else if (tslot < 0)
-		tslot = i;
-	}
-	if (tslot < 0) {
-	    lan_fd_t *next = item->next;
-	    /* Can't happen, but log and fix it up. */
-	    ipmi_log(IPMI_LOG_SEVERE, "ipmi_lan.c: Internal error, count"
-		     " in lan fd list item incorrect, but we can recover.");
-	    item->cons_in_use = MAX_CONS_PER_FD;
-	    move_to_lan_list_end(item);
-	    item = next;
+    if (item->cons_in_use < item->max_cons) {
+	/* Got an entry with a slot, just reuse it.  Can't have two
+	   systems with the same address in the same fd entry, so if
+	   one is already here try the next one. */
+	if (lan_fd_has_addr(item, lan)) {
+	    item = item->next;
 	    goto retry;
 	}
-	item->cons_in_use++;
-	item->lan[tslot] = lan;
-	*slot = tslot;
+	*slot = lan_fd_add_con(item, lan);
 
-	if (item->cons_in_use == MAX_CONS_PER_FD)
+	if (item->cons_in_use == item->max_cons)
 	    /* Out of connections in this item, move it to the end of
 	       the list. */
 	    move_to_lan_list_end(item);
@@ -1263,6 +1545,22 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 		rv = ipmi_create_global_lock(&item->con_lock);
 		if (rv) {
 		    ipmi_mem_free(item);
+		    item = NULL;
+		    goto out_unlock;
+		}
+		rv = ipmi_create_global_lock(&item->xmit_lock);
+		if (rv) {
+		    ipmi_destroy_lock(item->con_lock);
+		    ipmi_mem_free(item);
+		    item = NULL;
+		    goto out_unlock;
+		}
+		rv = lan_os_hnd->alloc_timer(lan_os_hnd, &item->xmit_timer);
+		if (rv) {
+		    ipmi_destroy_lock(item->xmit_lock);
+		    ipmi_destroy_lock(item->con_lock);
+		    ipmi_mem_free(item);
+		    item = NULL;
 		    goto out_unlock;
 		}
 		item->lock = lock;
@@ -1276,6 +1574,15 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 	item->next = item;
 	item->prev = item;
 
+	rv = alloc_lan_fd_slots(item, lan->max_cons_per_fd);
+	if (rv) {
+	    item->next = *free_list;
+	    *free_list = item;
+	    item = NULL;
+	    errno = rv;
+	    goto out_unlock;
+	}
+
 	item->fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
 	if (item->fd == -1) {
 	    item->next = *free_list;
@@ -1310,9 +1617,8 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 	    goto out_unlock;
 	}
 
-	item->cons_in_use++;
-	item->lan[0] = lan;
-	*slot = 0;
+	item->recv_batch_size = lan->recv_batch_size;
+	*slot = lan_fd_add_con(item, lan);
 
 	/* This will have free items, put it at the head of the list. */
 	move_to_lan_list_head(item);
@@ -1326,10 +1632,10 @@ static void
 release_lan_fd(lan_fd_t *item, int slot)
 {
     ipmi_lock(item->lock);
-    item->lan[slot] = NULL;
-    item->cons_in_use--;
+    lan_fd_remove_con(item, slot);
     if (item->cons_in_use == 0) {
 	lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, item->fd_wait_id);
+	lan_flush_xmit_q(item);
 	close(item->fd);
 	item->next->prev = item->prev;
 	item->prev->next = item->next;
@@ -1605,8 +1911,193 @@ auth_check(lan_data_t    *lan,
 }
 
 #define IPMI_MAX_LAN_LEN    (IPMI_MAX_MSG_LENGTH + 128)
+
+/* The default and the largest number of packets read from a socket
+   each time it is readable. */
+#define DEFAULT_LAN_RECV_BATCH_SIZE 16
+#define MAX_LAN_RECV_BATCH_SIZE 64
 #define IPMI_LAN_MAX_HEADER 128
 
+/* The most packets sent with one sendmmsg(). */
+#define MAX_LAN_XMIT_BATCH_SIZE 64
+
+struct lan_xmit_s
+{
+    lan_xmit_t    *next;
+    sockaddr_ip_t addr;
+    unsigned int  len;
+    unsigned char data[IPMI_MAX_LAN_LEN+IPMI_LAN_MAX_HEADER];
+};
+
+/* Send a list of packets on the fd and put the entries on the free
+   list.  Must be called with the fd's xmit_lock held.  Errors are
+   ignored, like lost packets they are handled by retransmits. */
+static void
+lan_send_xmit_list(lan_fd_t *item, lan_xmit_t *list)
+{
+    lan_xmit_t     *batch[MAX_LAN_XMIT_BATCH_SIZE];
+    int            count;
+    int            i;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[MAX_LAN_XMIT_BATCH_SIZE];
+    struct iovec   iov[MAX_LAN_XMIT_BATCH_SIZE];
+    int            sent;
+    int            rv;
+#endif
+
+    while (list) {
+	for (count=0; list && (count<MAX_LAN_XMIT_BATCH_SIZE); count++) {
+	    batch[count] = list;
+	    list = list->next;
+	}
+
+#ifdef HAVE_SENDMMSG
+	memset(msgs, 0, sizeof(msgs[0]) * count);
+	for (i=0; i<count; i++) {
+	    iov[i].iov_base = batch[i]->data;
+	    iov[i].iov_len = batch[i]->len;
+	    msgs[i].msg_hdr.msg_iov = &iov[i];
+	    msgs[i].msg_hdr.msg_iovlen = 1;
+	    msgs[i].msg_hdr.msg_name = &batch[i]->addr.s_ipsock;
+	    msgs[i].msg_hdr.msg_namelen = batch[i]->addr.ip_addr_len;
+	}
+	sent = 0;
+	while (sent < count) {
+	    rv = sendmmsg(item->fd, msgs + sent, count - sent, 0);
+	    if (rv <= 0)
+		/* The first one failed, skip it. */
+		sent++;
+	    else
+		sent += rv;
+	}
+#else
+	for (i=0; i<count; i++)
+	    sendto(item->fd, batch[i]->data, batch[i]->len, 0,
+		   (struct sockaddr *) &batch[i]->addr.s_ipsock,
+		   batch[i]->addr.ip_addr_len);
+#endif
+
+	for (i=0; i<count; i++) {
+	    if (item->xmit_free_len < MAX_LAN_XMIT_BATCH_SIZE) {
+		batch[i]->next = item->xmit_free;
+		item->xmit_free = batch[i];
+		item->xmit_free_len++;
+	    } else
+		ipmi_mem_free(batch[i]);
+	}
+    }
+}
+
+/* Send everything on the fd's transmit queue. */
+static void
+lan_flush_xmit_q(lan_fd_t *item)
+{
+    lan_xmit_t *list;
+
+    ipmi_lock(item->xmit_lock);
+    list = item->xmit_q;
+    item->xmit_q = NULL;
+    item->xmit_q_tail = NULL;
+    item->xmit_q_len = 0;
+    lan_send_xmit_list(item, list);
+    ipmi_unlock(item->xmit_lock);
+}
+
+static void
+lan_xmit_timeout(void *cb_data, os_hnd_timer_id_t *id)
+{
+    lan_fd_t *item = cb_data;
+
+    ipmi_lock(item->xmit_lock);
+    item->xmit_timer_running = 0;
+    ipmi_unlock(item->xmit_lock);
+    lan_flush_xmit_q(item);
+}
+
+/* Put a packet on the fd's transmit queue.  The first packet queued
+   starts a zero-length timer, so everything queued until the selector
+   runs timers again goes out in one batch. */
+static int
+lan_queue_xmit(lan_fd_t      *item,
+	       unsigned char *data,
+	       unsigned int  len,
+	       sockaddr_ip_t *addr)
+{
+    lan_xmit_t     *x;
+    struct timeval timeout;
+    int            rv;
+
+    ipmi_lock(item->xmit_lock);
+    x = item->xmit_free;
+    if (x) {
+	item->xmit_free = x->next;
+	item->xmit_free_len--;
+    } else {
+	x = ipmi_mem_alloc(sizeof(*x));
+	if (!x) {
+	    ipmi_unlock(item->xmit_lock);
+	    return ENOMEM;
+	}
+    }
+    memcpy(x->data, data, len);
+    x->len = len;
+    x->addr = *addr;
+    x->next = NULL;
+    if (item->xmit_q_tail)
+	item->xmit_q_tail->next = x;
+    else
+	item->xmit_q = x;
+    item->xmit_q_tail = x;
+    item->xmit_q_len++;
+
+    if (item->xmit_q_len >= MAX_LAN_XMIT_BATCH_SIZE) {
+	/* Full, send it now. */
+	ipmi_unlock(item->xmit_lock);
+	lan_flush_xmit_q(item);
+	return 0;
+    }
+
+    if (!item->xmit_timer_running) {
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+	rv = lan_os_hnd->start_timer(lan_os_hnd, item->xmit_timer, &timeout,
+				     lan_xmit_timeout, item);
+	if (rv) {
+	    /* Can't wait, just send it. */
+	    ipmi_unlock(item->xmit_lock);
+	    lan_flush_xmit_q(item);
+	    return 0;
+	}
+	item->xmit_timer_running = 1;
+    }
+    ipmi_unlock(item->xmit_lock);
+
+    return 0;
+}
+
+static void
+free_lan_fd(lan_fd_t *item)
+{
+    lan_xmit_t *x;
+
+    lan_os_hnd->stop_timer(lan_os_hnd, item->xmit_timer);
+    lan_os_hnd->free_timer(lan_os_hnd, item->xmit_timer);
+    while (item->xmit_q) {
+	x = item->xmit_q;
+	item->xmit_q = x->next;
+	ipmi_mem_free(x);
+    }
+    while (item->xmit_free) {
+	x = item->xmit_free;
+	item->xmit_free = x->next;
+	ipmi_mem_free(x);
+    }
+    ipmi_destroy_lock(item->xmit_lock);
+    ipmi_destroy_lock(item->con_lock);
+    free_lan_fd_slots(item);
+    ipmi_mem_free(item);
+}
+
 static int
 rmcpp_format_msg(lan_data_t *lan, int addr_num,
 		 unsigned int payload_type, int in_session,
@@ -1919,6 +2410,10 @@ lan_send_addr(lan_data_t              *lan,
 
     add_stat(lan->ipmi, STAT_XMIT_PACKETS, 1);
 
+    if (!lan->xmit_immediate)
+	return lan_queue_xmit(lan->fd, tmsg, pos,
+			      &(lan->cparm.ip_addr[addr_num]));
+
     rv = sendto(lan->fd->fd, tmsg, pos, 0,
 		(struct sockaddr *) &(lan->cparm.ip_addr[addr_num].s_ipsock),
 		lan->cparm.ip_addr[addr_num].ip_addr_len);
@@ -2353,6 +2848,152 @@ lost_connection(lan_data_t *lan, unsigned int addr_num)
     }
 }
 
+/* Must be called with the message sequence lock held. */
+static void
+lan_set_window(ipmi_con_t *ipmi, lan_data_t *lan, unsigned int window)
+{
+    if (window < 1)
+	window = 1;
+    else if (window > lan->window_max)
+	window = lan->window_max;
+    if (window != lan->cur_window) {
+	add_stat(ipmi, STAT_WINDOW, (int) window - (int) lan->cur_window);
+	lan->cur_window = window;
+    }
+}
+
+/* A response came in, open the window up.  Must be called with the
+   message sequence lock held. */
+static void
+lan_window_grow(ipmi_con_t *ipmi, lan_data_t *lan)
+{
+    if (!lan->window_max || (lan->cur_window >= lan->window_max))
+	return;
+
+    if (lan->cur_window < lan->window_thresh) {
+	lan_set_window(ipmi, lan, lan->cur_window + 1);
+    } else {
+	lan->window_acks++;
+	if (lan->window_acks >= lan->cur_window) {
+	    lan->window_acks = 0;
+	    lan_set_window(ipmi, lan, lan->cur_window + 1);
+	}
+    }
+}
+
+/* The message in seq timed out, close the window down.  Must be
+   called with the message sequence lock held. */
+static void
+lan_window_shrink(ipmi_con_t *ipmi, lan_data_t *lan, int seq)
+{
+    if (!lan->window_max)
+	return;
+
+    if ((int32_t) (lan->seq_table[seq].send_num - lan->window_shrink_send)
+	<= 0)
+	/* Sent before the last shrink, that one covered it. */
+	return;
+
+    lan->window_shrink_send = lan->send_count;
+    lan->window_acks = 0;
+    lan->window_thresh = lan->cur_window / 2;
+    if (lan->window_thresh < 1)
+	lan->window_thresh = 1;
+    lan_set_window(ipmi, lan, lan->window_thresh);
+}
+
+static long
+lan_ip_rsp_timeout(lan_data_t *lan, int ip_num)
+{
+    if (lan->ip[ip_num].rtt_valid)
+	return lan->ip[ip_num].rsp_timeout;
+    return lan->rsp_timeout_max;
+}
+
+/* Get the time to wait for a response to a message sent to ip_num
+   (or to whichever address lan_send() picks if ip_num is -1) after it
+   has been resent the given number of times.  Must be called with
+   the message sequence lock held. */
+static void
+lan_get_rsp_timeout(lan_data_t     *lan,
+		    int            ip_num,
+		    int            side_effects,
+		    int            resends,
+		    struct timeval *timeout)
+{
+    long         t;
+    unsigned int i;
+
+    if (side_effects)
+	t = LAN_RSP_TIMEOUT_SIDEEFF;
+    else if (!lan->rsp_timeout_min)
+	t = LAN_RSP_TIMEOUT;
+    else {
+	if (ip_num >= 0)
+	    t = lan_ip_rsp_timeout(lan, ip_num);
+	else {
+	    t = 0;
+	    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+		long it = lan_ip_rsp_timeout(lan, i);
+		if (it > t)
+		    t = it;
+	    }
+	}
+
+	/* Back off exponentially on resends. */
+	while ((resends > 0) && (t < lan->rsp_timeout_max)) {
+	    t <<= 1;
+	    resends--;
+	}
+	if (t < lan->rsp_timeout_min)
+	    t = lan->rsp_timeout_min;
+	else if (t > lan->rsp_timeout_max)
+	    t = lan->rsp_timeout_max;
+    }
+
+    timeout->tv_sec = t / 1000000;
+    timeout->tv_usec = t % 1000000;
+}
+
+/* A response came in for seq from ip_num, update the round trip time
+   estimate for the address.  Must be called with the message sequence
+   lock held. */
+static void
+lan_rtt_sample(ipmi_con_t *ipmi, lan_data_t *lan, int ip_num, int seq)
+{
+    lan_ip_data_t  *ip = &lan->ip[ip_num];
+    struct timeval now, diff;
+    long           rtt, delta;
+
+    /* A response to a resent message can't be matched to a send, and
+       messages with side effects may take a long time on the BMC. */
+    if (lan->seq_table[seq].resent || lan->seq_table[seq].side_effects
+	|| (lan->seq_table[seq].last_ip_num != ip_num))
+	return;
+
+    ipmi->os_hnd->get_monotonic_time(ipmi->os_hnd, &now);
+    diff_timeval(&diff, &now, &lan->seq_table[seq].send_time);
+    rtt = (diff.tv_sec * 1000000) + diff.tv_usec;
+
+    if (!ip->rtt_valid) {
+	ip->srtt = rtt << 3;
+	ip->rttvar = rtt << 1;
+	ip->rtt_valid = 1;
+	delta = rtt / 2;
+    } else {
+	delta = rtt - (ip->srtt >> 3);
+	ip->srtt += delta;
+	if (delta < 0)
+	    delta = -delta;
+	ip->rttvar += delta - (ip->rttvar >> 2);
+    }
+    ip->rsp_timeout = (ip->srtt >> 3) + ip->rttvar;
+
+    add_stat(ipmi, STAT_RTT_SAMPLES, 1);
+    add_stat(ipmi, STAT_RTT_USEC, rtt);
+    add_stat(ipmi, STAT_RTT_DEV_USEC, delta);
+}
+
 static void
 rsp_timeout_handler(void              *cb_data,
 		    os_hnd_timer_id_t *id)
@@ -2445,6 +3086,8 @@ rsp_timeout_handler(void              *cb_data,
 	}
     }
 
+    lan_window_shrink(ipmi, lan, seq);
+
     rspi = lan->seq_table[seq].rsp_item;
 
     if (lan->seq_table[seq].retries_left > 0)
@@ -2453,6 +3096,7 @@ rsp_timeout_handler(void              *cb_data,
 	int            rv;
 
 	lan->seq_table[seq].retries_left--;
+	lan->seq_table[seq].resent = 1;
 
 	add_stat(ipmi, STAT_REXMITS, 1);
 
@@ -2481,13 +3125,11 @@ rsp_timeout_handler(void              *cb_data,
 	       error. */
 	    rspi->data[0] = IPMI_UNKNOWN_ERR_CC;
 	} else {
-	    if (!lan->seq_table[seq].side_effects) {
-		timeout.tv_sec = LAN_RSP_TIMEOUT / 1000000;
-		timeout.tv_usec = LAN_RSP_TIMEOUT % 1000000;
-	    } else {
-		timeout.tv_sec = LAN_RSP_TIMEOUT_SIDEEFF / 1000000;
-		timeout.tv_usec = LAN_RSP_TIMEOUT_SIDEEFF % 1000000;
-	    }
+	    lan_get_rsp_timeout(lan, lan->seq_table[seq].last_ip_num,
+				lan->seq_table[seq].side_effects,
+				LAN_RSP_RETRIES
+				- lan->seq_table[seq].retries_left,
+				&timeout);
 	    ipmi->os_hnd->start_timer(ipmi->os_hnd,
 				      id,
 				      &timeout,
@@ -2543,7 +3185,7 @@ rsp_timeout_handler(void              *cb_data,
 
  out:
     lan_put(ipmi);
-    ipmi_mem_free(info);
+    ipmi_mem_pool_free(lan_timer_pool, info);
 }
 
 typedef struct call_event_handler_s
@@ -2700,7 +3342,7 @@ handle_msg_send(lan_timer_info_t      *info,
 
 	if (ipmb->channel >= MAX_IPMI_USED_CHANNELS) {
 	    ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_free(lan_timer_pool, info);
 	    rv = EINVAL;
 	    goto out;
 	}
@@ -2722,6 +3364,8 @@ handle_msg_send(lan_timer_info_t      *info,
 
     info->seq = seq;
     lan->seq_table[seq].inuse = 1;
+    lan->send_count++;
+    lan->seq_table[seq].send_num = lan->send_count;
     lan->seq_table[seq].side_effects = side_effects;
     lan->seq_table[seq].addr_num = addr_num;
     lan->seq_table[seq].rsp_handler = rsp_handler;
@@ -2747,13 +3391,8 @@ handle_msg_send(lan_timer_info_t      *info,
 	lan->seq_table[seq].use_orig_addr = 0;
     }
 
-    if (!side_effects) {
-	timeout.tv_sec = LAN_RSP_TIMEOUT / 1000000;
-	timeout.tv_usec = LAN_RSP_TIMEOUT % 1000000;
-    } else {
-	timeout.tv_sec = LAN_RSP_TIMEOUT_SIDEEFF / 1000000;
-	timeout.tv_usec = LAN_RSP_TIMEOUT_SIDEEFF % 1000000;
-    }
+    lan->seq_table[seq].resent = 0;
+    lan_get_rsp_timeout(lan, addr_num, side_effects, 0, &timeout);
     lan->seq_table[seq].timer = info->timer;
     rv = ipmi->os_hnd->start_timer(ipmi->os_hnd,
 				   lan->seq_table[seq].timer,
@@ -2765,12 +3404,14 @@ handle_msg_send(lan_timer_info_t      *info,
 	ipmi->os_hnd->free_timer(ipmi->os_hnd,
 				 lan->seq_table[seq].timer);
 	lan->seq_table[seq].timer = NULL;
-	ipmi_mem_free(info);
+	ipmi_mem_pool_free(lan_timer_pool, info);
 	goto out;
     }
 
     lan->last_seq = seq;
 
+    ipmi->os_hnd->get_monotonic_time(ipmi->os_hnd,
+				     &lan->seq_table[seq].send_time);
     if (addr_num >= 0) {
 	rv = lan_send_addr(lan, addr, addr_len, msg, seq, addr_num, NULL);
 	lan->seq_table[seq].last_ip_num = addr_num;
@@ -2794,21 +3435,26 @@ handle_msg_send(lan_timer_info_t      *info,
 	    ipmi->os_hnd->free_timer(ipmi->os_hnd,
 				     lan->seq_table[seq].timer);
 	    lan->seq_table[seq].timer = NULL;
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_free(lan_timer_pool, info);
 	}
     }
  out:
     return rv;
 }
 
+/* A message has finished, start as many of the waiting ones as the
+   window allows.  Must be called with the message sequence lock
+   held. */
 static void
 check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 {
     int              rv;
     lan_wait_queue_t *q_item;
-    int              started = 0;
 
-    while (!started && (lan->wait_q != NULL)) {
+    lan->outstanding_msg_count--;
+    while ((lan->outstanding_msg_count < lan->cur_window)
+	   && (lan->wait_q != NULL))
+    {
 	/* Commands are waiting to be started, remove the queue item
            and start it. */
 	q_item = lan->wait_q;
@@ -2837,14 +3483,10 @@ check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 					 &q_item->msg, q_item->rsp_handler);
 	    ipmi_lock(lan->seq_num_lock);
 	} else {
-	    /* We successfully sent a message, break out of the loop. */
-	    started = 1;
+	    lan->outstanding_msg_count++;
 	}
-	ipmi_mem_free(q_item);
+	ipmi_mem_pool_free(lan_wait_q_pool, q_item);
     }
-
-    if (!started)
-	lan->outstanding_msg_count--;
 }
 
 /* Per the spec, RMCP and RMCP+ have different allowed sequence number
@@ -2986,6 +3628,8 @@ handle_payload(ipmi_con_t    *ipmi,
        count. */
     lan->ip[addr_num].consecutive_failures = 0;
 
+    lan_rtt_sample(ipmi, lan, addr_num, seq);
+
     /* The command matches up, cancel the timer and deliver it */
     rv = ipmi->os_hnd->stop_timer(ipmi->os_hnd,
 				  lan->seq_table[seq].timer);
@@ -2997,7 +3641,7 @@ handle_payload(ipmi_con_t    *ipmi,
 	/* Timer is cancelled, free its data. */
 	ipmi->os_hnd->free_timer(ipmi->os_hnd,
 				 lan->seq_table[seq].timer);
-	ipmi_mem_free(lan->seq_table[seq].timer_info);
+	ipmi_mem_pool_free(lan_timer_pool, lan->seq_table[seq].timer_info);
     }
 
     handler = lan->seq_table[seq].rsp_handler;
@@ -3011,6 +3655,7 @@ handle_payload(ipmi_con_t    *ipmi,
 	rspi->addr_len = lan->seq_table[seq].orig_addr_len;
     }
 
+    lan_window_grow(ipmi, lan);
     check_command_queue(ipmi, lan);
     ipmi_unlock(lan->seq_num_lock);
     
@@ -3420,15 +4065,21 @@ rmcpp_find_ipmi(lan_fd_t      *item,
     } else
 	tag = sid - 1;
 
-    if (tag >= MAX_CONS_PER_FD) {
-	if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
-	    ipmi_log(IPMI_LOG_DEBUG, "tag is out of range: %d", tag);
-	return NULL;
-    }
-
     ipmi_lock(item->con_lock);
-    lan = item->lan[tag];
-    if (lan && addr_match_lan(lan, sid, addr, addr_num))
+    if (sid == 0) {
+	/* Message tags are only 8 bits, they are the low bits of the
+	   slot.  Find the connection by address and make sure the
+	   tag matches. */
+	lan = lan_fd_find_addr(item, addr, addr_num);
+	if (lan && ((lan->fd_slot & 0xff) != tag))
+	    lan = NULL;
+    } else if (tag < item->max_cons) {
+	lan = item->lan[tag];
+	if (lan && !addr_match_lan(lan, sid, addr, addr_num))
+	    lan = NULL;
+    } else
+	lan = NULL;
+    if (lan)
 	ipmi = lan->ipmi;
     else if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
 	ipmi_log(IPMI_LOG_DEBUG, "tag doesn't match: %d", tag);
@@ -3444,10 +4095,11 @@ rmcp_find_ipmi(lan_fd_t      *item,
 	       sockaddr_ip_t *addr,
 	       int           *addr_num)
 {
-    /* Old RMCP is harder, we have to hunt. */
+    /* Old RMCP doesn't have our session id in it, but an address is
+       only used once in an fd, so look the connection up by
+       address and make sure it has the session id. */
     uint32_t   sid;
     lan_data_t *lan;
-    int        i;
     ipmi_con_t *ipmi = NULL;
 
     if (len < 13) {
@@ -3458,44 +4110,33 @@ rmcp_find_ipmi(lan_fd_t      *item,
 
     sid = ipmi_get_uint32(data+9);
     ipmi_lock(item->con_lock);
-    for (i=0; i<MAX_CONS_PER_FD; i++) {
-	lan = item->lan[i];
-	if (lan && addr_match_lan(lan, sid, addr, addr_num)) {
-	    ipmi = lan->ipmi;
-	    break;
-	}
-    }
+    lan = lan_fd_find_addr(item, addr, addr_num);
+    if (lan && (!sid || (lan->ip[*addr_num].session_id == sid)))
+	ipmi = lan->ipmi;
     ipmi_unlock(item->con_lock);
 
     return ipmi;
 }
 
+/* Handle one packet received on the fd.  The connections that have
+   gotten packets in this batch are kept in batch_cons, so the batch
+   statistic is only counted once per connection. */
 static void
-data_handler(int            fd,
-	     void           *cb_data,
-	     os_hnd_fd_id_t *id)
+handle_lan_packet(lan_fd_t      *item,
+		  unsigned char *data,
+		  int           len,
+		  sockaddr_ip_t *ipaddrd,
+		  ipmi_con_t    **batch_cons,
+		  unsigned int  *num_batch_cons)
 {
-    lan_fd_t           *item = cb_data;
     ipmi_con_t         *ipmi;
     lan_data_t         *lan;
-    unsigned char      data[IPMI_MAX_LAN_LEN];
-    sockaddr_ip_t      ipaddrd;
-    socklen_t          from_len;
-    int                len;
     int                addr_num = 0; /* Keep gcc happy and initialize */
+    unsigned int       i;
 
-    from_len = sizeof(ipaddrd.s_ipsock);
-    len = recvfrom(fd, data, sizeof(data), 0, (struct sockaddr *)&ipaddrd, 
-		   &from_len);
-
-    if (len < 0)
-	/* Got an error, probably no data, just return. */
-	return;
-
-    ipaddrd.ip_addr_len = from_len;
     if (DEBUG_RAWMSG) {
 	ipmi_log(IPMI_LOG_DEBUG_START, "incoming\n addr = ");
-	dump_hex((unsigned char *) &ipaddrd, from_len);
+	dump_hex((unsigned char *) ipaddrd, ipaddrd->ip_addr_len);
 	if (len) {
 	    ipmi_log(IPMI_LOG_DEBUG_CONT, "\n data =\n  ");
 	    dump_hex(data, len);
@@ -3520,9 +4161,9 @@ data_handler(int            fd,
     }
 
     if ((data[4] & 0x0f) == IPMI_AUTHTYPE_RMCP_PLUS) {
-	ipmi = rmcpp_find_ipmi(item, data, len, &ipaddrd, &addr_num);
+	ipmi = rmcpp_find_ipmi(item, data, len, ipaddrd, &addr_num);
     } else {
-	ipmi = rmcp_find_ipmi(item, data, len, &ipaddrd, &addr_num);
+	ipmi = rmcp_find_ipmi(item, data, len, ipaddrd, &addr_num);
     }
 
     if (!lan_valid_ipmi(ipmi))
@@ -3533,6 +4174,15 @@ data_handler(int            fd,
     lan = ipmi->con_data;
 
     add_stat(ipmi, STAT_RECV_PACKETS, 1);
+    for (i=0; i<*num_batch_cons; i++) {
+	if (batch_cons[i] == ipmi)
+	    break;
+    }
+    if (i == *num_batch_cons) {
+	batch_cons[i] = ipmi;
+	(*num_batch_cons)++;
+	add_stat(ipmi, STAT_RECV_BATCHES, 1);
+    }
 
     if ((data[4] & 0x0f) == IPMI_AUTHTYPE_RMCP_PLUS) {
 	handle_rmcpp_recv(ipmi, lan, addr_num, data, len);
@@ -3541,7 +4191,70 @@ data_handler(int            fd,
     }
     
     lan_put(ipmi);
-    return;
+}
+
+/* Read up to the fd's batch size of packets and handle them.  The
+   socket is non-blocking, so this stops when it is empty.  If more
+   packets are waiting the fd is still readable and we will be called
+   again. */
+static void
+data_handler(int            fd,
+	     void           *cb_data,
+	     os_hnd_fd_id_t *id)
+{
+    lan_fd_t           *item = cb_data;
+    unsigned char      data[MAX_LAN_RECV_BATCH_SIZE][IPMI_MAX_LAN_LEN];
+    sockaddr_ip_t      ipaddrd[MAX_LAN_RECV_BATCH_SIZE];
+    int                lens[MAX_LAN_RECV_BATCH_SIZE];
+    ipmi_con_t         *batch_cons[MAX_LAN_RECV_BATCH_SIZE];
+    unsigned int       num_batch_cons = 0;
+    unsigned int       batch = item->recv_batch_size;
+    int                count;
+    int                i;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr     msgs[MAX_LAN_RECV_BATCH_SIZE];
+    struct iovec       iov[MAX_LAN_RECV_BATCH_SIZE];
+#else
+    socklen_t          from_len;
+#endif
+
+    if ((batch < 1) || (batch > MAX_LAN_RECV_BATCH_SIZE))
+	batch = 1;
+
+#ifdef HAVE_RECVMMSG
+    memset(msgs, 0, sizeof(msgs[0]) * batch);
+    for (i=0; i<(int) batch; i++) {
+	iov[i].iov_base = data[i];
+	iov[i].iov_len = sizeof(data[i]);
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &ipaddrd[i].s_ipsock;
+	msgs[i].msg_hdr.msg_namelen = sizeof(ipaddrd[i].s_ipsock);
+    }
+    count = recvmmsg(fd, msgs, batch, 0, NULL);
+    if (count < 0)
+	/* Got an error, probably no data, just return. */
+	return;
+    for (i=0; i<count; i++) {
+	ipaddrd[i].ip_addr_len = msgs[i].msg_hdr.msg_namelen;
+	lens[i] = msgs[i].msg_len;
+    }
+#else
+    for (count=0; count<(int) batch; count++) {
+	from_len = sizeof(ipaddrd[count].s_ipsock);
+	lens[count] = recvfrom(fd, data[count], sizeof(data[count]), 0,
+			       (struct sockaddr *) &ipaddrd[count].s_ipsock,
+			       &from_len);
+	if (lens[count] < 0)
+	    /* Got an error, probably no more data. */
+	    break;
+	ipaddrd[count].ip_addr_len = from_len;
+    }
+#endif
+
+    for (i=0; i<count; i++)
+	handle_lan_packet(item, data[i], lens[i], &ipaddrd[i],
+			  batch_cons, &num_batch_cons);
 }
 
 /* Note that this puts the address number in data4 of the rspi. */
@@ -3578,7 +4291,7 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
     if (msg->netfn & 1)
 	return lan_send_addr(lan, addr, addr_len, msg, 0, addr_num, NULL);
 
-    info = ipmi_mem_alloc(sizeof(*info));
+    info = ipmi_mem_pool_alloc(lan_timer_pool);
     if (!info)
 	return ENOMEM;
     memset(info, 0, sizeof(*info));
@@ -3589,7 +4302,7 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
 
     rv = ipmi->os_hnd->alloc_timer(ipmi->os_hnd, &(info->timer));
     if (rv) {
-	ipmi_mem_free(info);
+	ipmi_mem_pool_free(lan_timer_pool, info);
 	return rv;
     }
 
@@ -3616,7 +4329,7 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
 	if (info) {
 	    if (info->timer)
 		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_free(lan_timer_pool, info);
 	}
     }
     return rv;
@@ -3662,12 +4375,12 @@ lan_send_command_option(ipmi_con_t              *ipmi,
     }
 
     if (!rspi) {
-	rspi = ipmi_mem_alloc(sizeof(*rspi));
+	rspi = ipmi_alloc_msg_item();
 	if (!rspi)
 	    return ENOMEM;
     }
 
-    info = ipmi_mem_alloc(sizeof(*info));
+    info = ipmi_mem_pool_alloc(lan_timer_pool);
     if (!info) {
 	rv = ENOMEM;
 	goto out_unlock2;
@@ -3684,10 +4397,10 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 
     ipmi_lock(lan->seq_num_lock);
 
-    if (lan->outstanding_msg_count >= lan->max_outstanding_msg_count) {
+    if (lan->outstanding_msg_count >= lan->cur_window) {
 	lan_wait_queue_t *q_item;
 
-	q_item = ipmi_mem_alloc(sizeof(*q_item));
+	q_item = ipmi_mem_pool_alloc(lan_wait_q_pool);
 	if (!q_item) {
 	    ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
 	    rv = ENOMEM;
@@ -3724,7 +4437,7 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	lan->outstanding_msg_count++;
     else if (!trspi && rspi)
 	/* If we allocated an rspi, free it on error. */
-	ipmi_mem_free(rspi);
+	ipmi_free_msg_item(rspi);
     ipmi_unlock(lan->seq_num_lock);
     return rv;
 
@@ -3734,14 +4447,14 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	if (info) {
 	    if (info->timer)
 		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_free(lan_timer_pool, info);
 	}
     }
  out_unlock2:
     if (rv) {
 	/* If we allocated an rspi, free it. */
 	if (!trspi && rspi)
-	    ipmi_mem_free(rspi);
+	    ipmi_free_msg_item(rspi);
     }
     return rv;
 }
@@ -4031,7 +4744,7 @@ lan_cleanup(ipmi_con_t *ipmi)
 		info->cancelled = 1;
 	    else {
 		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-		ipmi_mem_free(info);
+		ipmi_mem_pool_free(lan_timer_pool, info);
 	    }
 
 	    ipmi_unlock(lan->seq_num_lock);
@@ -4065,8 +4778,8 @@ lan_cleanup(ipmi_con_t *ipmi)
 
 	ipmi_lock(lan->seq_num_lock);
 
-	ipmi_mem_free(q_item->info);
-	ipmi_mem_free(q_item);
+	ipmi_mem_pool_free(lan_timer_pool, q_item->info);
+	ipmi_mem_pool_free(lan_wait_q_pool, q_item);
     }
     if (lan->audit_info) {
 	rv = ipmi->os_hnd->stop_timer(ipmi->os_hnd, lan->audit_timer);
@@ -4325,7 +5038,7 @@ lan_oem_done(ipmi_con_t *ipmi, void *cb_data)
     int         addr_num = (long) rspi->data4;
 
     if (! ipmi) {
-	ipmi_mem_free(rspi);
+	ipmi_free_msg_item(rspi);
 	return;
     }
 
@@ -4333,7 +5046,7 @@ lan_oem_done(ipmi_con_t *ipmi, void *cb_data)
     rv = send_get_dev_id(ipmi, lan, addr_num, rspi);
     if (rv) {
         handle_connected(ipmi, rv, addr_num);
-	ipmi_mem_free(rspi);
+	ipmi_free_msg_item(rspi);
     }
 }
 
@@ -5125,7 +5838,7 @@ send_auth_cap(ipmi_con_t *ipmi, lan_data_t *lan, int addr_num,
     /* FIXME - a system may only support RMCP+ and not RMCP.  We need
        a way to detect and handle that.  */
 
-    rspi = ipmi_mem_alloc(sizeof(*rspi));
+    rspi = ipmi_alloc_msg_item();
     if (!rspi)
 	return ENOMEM;
 
@@ -5153,7 +5866,7 @@ send_auth_cap(ipmi_con_t *ipmi, lan_data_t *lan, int addr_num,
 				       (ipmi_addr_t *) &addr, sizeof(addr),
 				       &msg, rsp_handler, rspi);
     if (rv)
-	ipmi_mem_free(rspi);
+	ipmi_free_msg_item(rspi);
     return rv;
 }
 
@@ -5364,7 +6077,11 @@ lan_register_stat_handler(ipmi_con_t          *ipmi,
 	ipmi_ll_con_stat_call_register(info, lan_stat_names[i],
 				       ipmi->name, &(nstat->stats[i]));
 
+    /* The window stat is changed by differences, start it at the
+       current value. */
+    ipmi_lock(lan->seq_num_lock);
     if (!locked_list_add(lan->lan_stat_list, nstat, info)) {
+	ipmi_unlock(lan->seq_num_lock);
 	for (i=0; i<NUM_STATS; i++)
 	    if (nstat->stats[i]) {
 		ipmi_ll_con_stat_call_unregister(info, nstat->stats[i]);
@@ -5373,6 +6090,10 @@ lan_register_stat_handler(ipmi_con_t          *ipmi,
 	ipmi_mem_free(nstat);
 	return ENOMEM;
     }
+    if (nstat->stats[STAT_WINDOW])
+	ipmi_ll_con_stat_call_adder(info, nstat->stats[STAT_WINDOW],
+				    lan->cur_window);
+    ipmi_unlock(lan->seq_num_lock);
 
     return 0;
 }
@@ -5470,6 +6191,12 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
     char               **ports = NULL;
     lan_conn_parms_t   cparm;
     int max_outstanding_msg_count = DEFAULT_MAX_OUTSTANDING_MSG_COUNT;
+    unsigned int recv_batch_size = DEFAULT_LAN_RECV_BATCH_SIZE;
+    int xmit_immediate = 0;
+    unsigned int max_cons_per_fd = DEFAULT_MAX_CONS_PER_FD;
+    unsigned int window_max = 0;
+    unsigned int rsp_timeout_min = DEFAULT_LAN_RSP_TIMEOUT_MIN;
+    unsigned int rsp_timeout_max = DEFAULT_LAN_RSP_TIMEOUT_MAX;
 
     memset(&cparm, 0, sizeof(cparm));
 
@@ -5577,6 +6304,43 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
 		return EINVAL;
 	    max_outstanding_msg_count = parms[i].parm_val;
 	    break;
+
+	case IPMI_LANP_RECV_BATCH_SIZE:
+	    if ((parms[i].parm_val < 1)
+		|| (parms[i].parm_val > MAX_LAN_RECV_BATCH_SIZE))
+		return EINVAL;
+	    recv_batch_size = parms[i].parm_val;
+	    break;
+
+	case IPMI_LANP_XMIT_IMMEDIATE:
+	    xmit_immediate = parms[i].parm_val != 0;
+	    break;
+
+	case IPMI_LANP_MAX_CONS_PER_FD:
+	    if ((parms[i].parm_val < 1)
+		|| (parms[i].parm_val > MAX_MAX_CONS_PER_FD))
+		return EINVAL;
+	    max_cons_per_fd = parms[i].parm_val;
+	    break;
+
+	case IPMI_LANP_ADAPTIVE_WINDOW:
+	    if ((parms[i].parm_val < 0)
+		|| (parms[i].parm_val > MAX_POSSIBLE_OUTSTANDING_MSG_COUNT))
+		return EINVAL;
+	    window_max = parms[i].parm_val;
+	    break;
+
+	case IPMI_LANP_RSP_TIMEOUT_MIN:
+	    if (parms[i].parm_val < 0)
+		return EINVAL;
+	    rsp_timeout_min = parms[i].parm_val;
+	    break;
+
+	case IPMI_LANP_RSP_TIMEOUT_MAX:
+	    if (parms[i].parm_val < 1)
+		return EINVAL;
+	    rsp_timeout_max = parms[i].parm_val;
+	    break;
 		
 	default:
 	    return EINVAL;
@@ -5592,6 +6356,8 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
 	return EINVAL;
     if ((cparm.num_ip_addr < 1) || (cparm.num_ip_addr > MAX_IP_ADDR))
 	return EINVAL;
+    if (rsp_timeout_min > rsp_timeout_max)
+	return EINVAL;
 
     if (ports) {
 	for (i=0; i<MAX_IP_ADDR; i++)
@@ -5721,6 +6487,18 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
 
     lan->outstanding_msg_count = 0;
     lan->max_outstanding_msg_count = max_outstanding_msg_count;
+    lan->window_max = window_max;
+    lan->rsp_timeout_min = ((long) rsp_timeout_min) * 1000;
+    lan->rsp_timeout_max = ((long) rsp_timeout_max) * 1000;
+    lan->cur_window = max_outstanding_msg_count;
+    if (window_max) {
+	if (lan->cur_window > window_max)
+	    lan->cur_window = window_max;
+	lan->window_thresh = window_max;
+    }
+    lan->recv_batch_size = recv_batch_size;
+    lan->xmit_immediate = xmit_immediate;
+    lan->max_cons_per_fd = max_cons_per_fd;
     lan->wait_q = NULL;
     lan->wait_q_tail = NULL;
 
@@ -5945,6 +6723,9 @@ typedef struct lan_args_s
 
     unsigned int    hacks;		/* parms 13, 14 */
     unsigned int    max_outstanding_msgs;/* parm 15 */
+    unsigned int    adaptive_window;	/* parm 16 */
+    unsigned int    rsp_timeout_min;	/* parm 17 */
+    unsigned int    rsp_timeout_max;	/* parm 18 */
 } lan_args_t;
 
 static const char *auth_range[] = { "default", "none", "md2", "md5",
@@ -5995,7 +6776,7 @@ static struct lan_argnum_info_s
     const char *help;
     const char **range;
     const int  *values;
-} lan_argnum_info[17] =
+} lan_argnum_info[20] =
 {
     { "Address",	"str",
       "*IP name or address of the MC",
@@ -6045,6 +6826,17 @@ static struct lan_argnum_info_s
     { "Max_Outstanding_Msgs",	"int",
       "How many outstanding messages on the connection, range 1-63",
       NULL, NULL },
+    { "Adaptive_Window",	"int",
+      "If not 0, adjust the outstanding messages by how the BMC keeps up,"
+      " up to this, range 0-63",
+      NULL, NULL },
+    { "Rsp_Timeout_Min",	"int",
+      "If not 0, compute response timeouts from the round trip time,"
+      " but no shorter than this many milliseconds",
+      NULL, NULL },
+    { "Rsp_Timeout_Max",	"int",
+      "The longest computed response timeout, in milliseconds",
+      NULL, NULL },
 
     { NULL },
 };
@@ -6121,6 +6913,9 @@ get_startup_args(ipmi_con_t *ipmi)
 	largs->bmc_key_set = 1;
     }
     largs->max_outstanding_msgs = lan->max_outstanding_msg_count;
+    largs->adaptive_window = lan->window_max;
+    largs->rsp_timeout_min = lan->rsp_timeout_min / 1000;
+    largs->rsp_timeout_max = lan->rsp_timeout_max / 1000;
     return args;
 
  out_err:
@@ -6136,7 +6931,7 @@ lan_connect_args(ipmi_args_t  *args,
 {
     lan_args_t       *largs = _ipmi_args_get_extra_data(args);
     int              i;
-    ipmi_lanp_parm_t parms[12];
+    ipmi_lanp_parm_t parms[15];
     int              rv;
 
     i = 0;
@@ -6187,6 +6982,15 @@ lan_connect_args(ipmi_args_t  *args,
     parms[i].parm_id = IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT;
     parms[i].parm_val = largs->max_outstanding_msgs;
     i++;
+    parms[i].parm_id = IPMI_LANP_ADAPTIVE_WINDOW;
+    parms[i].parm_val = largs->adaptive_window;
+    i++;
+    parms[i].parm_id = IPMI_LANP_RSP_TIMEOUT_MIN;
+    parms[i].parm_val = largs->rsp_timeout_min;
+    i++;
+    parms[i].parm_id = IPMI_LANP_RSP_TIMEOUT_MAX;
+    parms[i].parm_val = largs->rsp_timeout_max;
+    i++;
     rv = ipmi_lanp_setup_con(parms, i, handlers, user_data, con);
     if (!rv)
 	(*con)->hacks = largs->hacks;
@@ -6372,6 +7176,18 @@ lan_args_get_val(ipmi_args_t  *args,
 	rv = get_int_val(value, largs->max_outstanding_msgs);
 	break;
 
+    case 16:
+	rv = get_int_val(value, largs->adaptive_window);
+	break;
+
+    case 17:
+	rv = get_int_val(value, largs->rsp_timeout_min);
+	break;
+
+    case 18:
+	rv = get_int_val(value, largs->rsp_timeout_max);
+	break;
+
     default:
 	return E2BIG;
     }
@@ -6582,6 +7398,18 @@ lan_args_set_val(ipmi_args_t  *args,
 	rv = set_uint_val(&largs->max_outstanding_msgs, value);
 	break;
 
+    case 16:
+	rv = set_uint_val(&largs->adaptive_window, value);
+	break;
+
+    case 17:
+	rv = set_uint_val(&largs->rsp_timeout_min, value);
+	break;
+
+    case 18:
+	rv = set_uint_val(&largs->rsp_timeout_max, value);
+	break;
+
     default:
 	rv = E2BIG;
     }
@@ -6820,6 +7648,40 @@ lan_parse_args(int         *curr_arg,
 		goto out_err;
 	    }
 	    largs->max_outstanding_msgs = val;
+	} else if (strcmp(args[*curr_arg], "-W") == 0) {
+	    char *end;
+	    int val;
+	    (*curr_arg)++; CHECK_ARG;
+	    if (args[*curr_arg][0] == '\0') {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    val = strtol(args[*curr_arg], &end, 0);
+	    if (*end != '\0') {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    largs->adaptive_window = val;
+	} else if (strcmp(args[*curr_arg], "-T") == 0) {
+	    char *end;
+	    long min, max = largs->rsp_timeout_max;
+	    (*curr_arg)++; CHECK_ARG;
+	    if (args[*curr_arg][0] == '\0') {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    min = strtol(args[*curr_arg], &end, 0);
+	    if (*end == ':')
+		max = strtol(end + 1, &end, 0);
+	    /* The same limits ipmi_lanp_setup_con() puts on the parms. */
+	    if ((*end != '\0') || (min < 0) || (max < 1) || (min > max)
+		|| (max > INT_MAX))
+	    {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    largs->rsp_timeout_min = min;
+	    largs->rsp_timeout_max = max;
 	}
 	(*curr_arg)++;
     }
@@ -6858,7 +7720,8 @@ lan_parse_help(void)
 	" lan [-U <username>] [-P <password>] [-p[2] port] [-A <authtype>]\n"
 	"     [-L <privilege>] [-s] [-Ra <auth alg>] [-Ri <integ alg>]\n"
 	"     [-Rc <conf algo>] [-Rl] [-Rk <bmc key>] [-H <hackname>]\n"
-	"     [-M <max outstanding msgs>] <host1> [<host2>]\n"
+	"     [-M <max outstanding msgs>] [-W <max window>]\n"
+	"     [-T <min timeout>[:<max timeout>]] <host1> [<host2>]\n"
 	"If -s is supplied, then two host names are taken (the second port\n"
 	"may be specified with -p2).  Otherwise, only one hostname is\n"
 	"taken.  The defaults are an empty username and password (anonymous),\n"
@@ -6882,7 +7745,13 @@ lan_parse_help(void)
 	"different privileges and different passwords), the default is straight\n"
 	"name lookup.  -Rk sets the BMC key, needed if the system does two-key\n"
 	"lookups.  The -M option sets the maximum outstanding messages.\n"
-	"The default is 2, ranges 1-63.\n"
+	"The default is 2, ranges 1-63.  The -W option makes the number of\n"
+	"outstanding messages adapt to the BMC, it starts at the -M value,\n"
+	"grows while responses come back and shrinks when messages time\n"
+	"out, but never goes above the -W value (1-63).\n"
+	"The -T option computes response timeouts from the measured round\n"
+	"trip time instead of waiting one second, bounded by the given\n"
+	"times in milliseconds (the maximum defaults to 1000).\n"
 	"The -H option enables certain hacks for broken platforms.  This may\n"
 	"be listed multiple times to enable multiple hacks.  The currently\n"
 	"available hacks are:\n"
@@ -6916,6 +7785,8 @@ lan_con_alloc_args(void)
     largs->auth_alg = most_secure_lanp_auth();
     largs->name_lookup_only = 1;
     largs->max_outstanding_msgs = DEFAULT_MAX_OUTSTANDING_MSG_COUNT;
+    largs->rsp_timeout_min = DEFAULT_LAN_RSP_TIMEOUT_MIN;
+    largs->rsp_timeout_max = DEFAULT_LAN_RSP_TIMEOUT_MAX;
     /* largs->hacks = IPMI_CONN_HACK_RAKP3_WRONG_ROLEM; */
     return args;
 }
@@ -6938,7 +7809,7 @@ _ipmi_lan_init(os_handler_t *os_hnd)
     memset(&fd_list, 0, sizeof(fd_list));
     fd_list.next = &fd_list;
     fd_list.prev = &fd_list;
-    fd_list.cons_in_use = MAX_CONS_PER_FD;
+    /* The list head has no slots, so it always looks full. */
 
 #ifdef PF_INET6
     rv = ipmi_create_global_lock(&fd6_list_lock);
@@ -6947,7 +7818,7 @@ _ipmi_lan_init(os_handler_t *os_hnd)
     memset(&fd6_list, 0, sizeof(fd6_list));
     fd6_list.next = &fd6_list;
     fd6_list.prev = &fd6_list;
-    fd6_list.cons_in_use = MAX_CONS_PER_FD;
+    /* The list head has no slots, so it always looks full. */
 #endif
 
     for (i=0; i<LAN_HASH_SIZE; i++) {
@@ -6967,6 +7838,16 @@ _ipmi_lan_init(os_handler_t *os_hnd)
     if (rv)
 	return rv;
 
+    rv = ipmi_mem_pool_alloc_pool(os_hnd, sizeof(lan_timer_info_t),
+				  &lan_timer_pool);
+    if (rv)
+	return rv;
+
+    rv = ipmi_mem_pool_alloc_pool(os_hnd, sizeof(lan_wait_queue_t),
+				  &lan_wait_q_pool);
+    if (rv)
+	return rv;
+
     lan_setup = _ipmi_alloc_con_setup(lan_parse_args, lan_parse_help,
 				      lan_con_alloc_args);
     if (! lan_setup)
@@ -7030,14 +7911,12 @@ _ipmi_lan_shutdown(void)
 	e->prev->next = e->next;
 	lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, e->fd_wait_id);
 	close(e->fd);
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
     while (fd_free_list) {
 	lan_fd_t *e = fd_free_list;
 	fd_free_list = e->next;
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
 #ifdef PF_INET6
     if (fd6_list_lock) {
@@ -7050,15 +7929,21 @@ _ipmi_lan_shutdown(void)
 	e->prev->next = e->next;
 	lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, e->fd_wait_id);
 	close(e->fd);
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
     while (fd6_free_list) {
 	lan_fd_t *e = fd6_free_list;
 	fd6_free_list = e->next;
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
 #endif
+    if (lan_timer_pool) {
+	ipmi_mem_pool_free_pool(lan_timer_pool);
+	lan_timer_pool = NULL;
+    }
+    if (lan_wait_q_pool) {
+	ipmi_mem_pool_free_pool(lan_wait_q_pool);
+	lan_wait_q_pool = NULL;
+    }
     lan_os_hnd = NULL;
 }
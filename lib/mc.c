@@ -3711,6 +3711,15 @@ ipmi_mc_get_guid(ipmi_mc_t *mc, unsigned char *guid)
     return 0;
 }
 
+int
+ipmi_mc_get_sdr_fetch_stats(ipmi_mc_t *mc, ipmi_sdr_fetch_stats_t *stats)
+{
+    CHECK_MC_LOCK(mc);
+    if (!mc->sdrs)
+	return ENOSYS;
+    return ipmi_sdr_get_fetch_stats(mc->sdrs, stats);
+}
+
 void
 ipmi_mc_set_guid(ipmi_mc_t *mc, unsigned char *data)
 {
@@ -129,7 +129,7 @@ kontron_ipmb_fetch_amc(ipmi_con_t           *conn,
     int                          rv;
     ipmi_msgi_t                  *rspi;
 
-    rspi = ipmi_mem_alloc(sizeof(*rspi));
+    rspi = ipmi_alloc_msg_item();
     if (!rspi)
 	return ENOMEM;
 
@@ -148,7 +148,7 @@ kontron_ipmb_fetch_amc(ipmi_con_t           *conn,
     rv = conn->send_command(conn, (ipmi_addr_t *) &si, sizeof(si), &msg,
 			    ipmb_handler_amc, rspi);
     if (rv)
-	ipmi_mem_free(rspi);
+	ipmi_free_msg_item(rspi);
     return rv;    
 }
 
@@ -210,7 +210,7 @@ kontron_ipmb_fetch(ipmi_con_t           *conn,
     int                          rv;
     ipmi_msgi_t                  *rspi;
 
-    rspi = ipmi_mem_alloc(sizeof(*rspi));
+    rspi = ipmi_alloc_msg_item();
     if (!rspi)
 	return ENOMEM;
 
@@ -229,7 +229,7 @@ kontron_ipmb_fetch(ipmi_con_t           *conn,
     rv = conn->send_command(conn, (ipmi_addr_t *) &si, sizeof(si), &msg,
 			    ipmb_handler, rspi);
     if (rv)
-	ipmi_mem_free(rspi);
+	ipmi_free_msg_item(rspi);
     return rv;    
 }
 
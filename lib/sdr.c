@@ -55,8 +55,16 @@
 /* Do up to this many retries when the reservation is lost. */
 #define MAX_SDR_FETCH_RETRIES 10
 
-/* Number of outstanding fetch requests we can have out. */
-#define MAX_SDR_FETCH_OUTSTANDING 3
+/* Number of outstanding fetch requests we can have out, and the
+   number we start with. */
+#define MAX_SDR_FETCH_OUTSTANDING 8
+#define STD_SDR_FETCH_OUTSTANDING 3
+
+/* After this many good reads in a row, try one more outstanding
+   request and a bigger fetch size (by the increment, up to the
+   largest size that has not failed). */
+#define SDR_FETCH_GROW_AFTER 8
+#define SDR_FETCH_BYTES_INCR 4
 
 typedef struct sdr_fetch_handler_s
 {
@@ -82,6 +90,8 @@ typedef struct fetch_info_s
     ilist_item_t link;
 } fetch_info_t;
 
+typedef struct sdr_shared_s sdr_shared_t;
+
 #undef DEBUG_INFO_TRACKING
 
 struct ipmi_sdr_info_s
@@ -149,7 +159,20 @@ struct ipmi_sdr_info_s
     unsigned int           curr_rec_id;
     unsigned int           read_offset; /* Next data to read */
 
+    /* The fetch size and the number of requests to keep outstanding
+       adapt to how well the MC is doing.  max_fetch_size is lowered
+       when the MC says a size is too big, so it is not tried again. */
     unsigned int           fetch_size;
+    unsigned int           max_fetch_size;
+    unsigned int           fetch_window;
+    unsigned int           num_outstanding;
+    unsigned int           good_reads;
+
+    /* Statistics, and the start time and data count of the current
+       fetch. */
+    ipmi_sdr_fetch_stats_t stats;
+    struct timeval         fetch_start;
+    unsigned long          fetch_bytes;
 
     unsigned int           curr_read_rec_id;
     unsigned int           next_read_rec_id;
@@ -197,6 +220,15 @@ struct ipmi_sdr_info_s
     char db_key[32+5];
     int  db_key_set;
 
+    /* If the SDRs are being used in place from the database, this is
+       what the database returned, to be handed back with
+       database_free() when the SDRs are replaced. */
+    unsigned char *db_data;
+
+    /* If the SDRs are shared with other SDR infos holding the same
+       repository, this is the shared copy. */
+    sdr_shared_t *shared;
+
 #ifdef DEBUG_INFO_TRACKING
     struct {
 	int            line;
@@ -246,6 +278,39 @@ cancel_fetch(ilist_iter_t *iter, void *item, void *cb_data)
 
     info->fetch_retry_num = -1;
     ilist_delete(iter);
+    info->sdrs->num_outstanding--;
+}
+
+/* A read worked, open up the window and the fetch size slowly. */
+static void
+sdr_fetch_grow(ipmi_sdr_info_t *sdrs)
+{
+    sdrs->good_reads++;
+    if (sdrs->good_reads < SDR_FETCH_GROW_AFTER)
+	return;
+    sdrs->good_reads = 0;
+
+    if (sdrs->fetch_window < MAX_SDR_FETCH_OUTSTANDING)
+	sdrs->fetch_window++;
+    if (sdrs->fetch_size < sdrs->max_fetch_size) {
+	sdrs->fetch_size += SDR_FETCH_BYTES_INCR;
+	if (sdrs->fetch_size > sdrs->max_fetch_size)
+	    sdrs->fetch_size = sdrs->max_fetch_size;
+    }
+}
+
+/* A read timed out, the MC (or something in the way) is not keeping
+   up.  Cut the window in half and go back to the guaranteed fetch
+   size, then grow again from there. */
+static void
+sdr_fetch_backoff(ipmi_sdr_info_t *sdrs)
+{
+    sdrs->good_reads = 0;
+    sdrs->fetch_window /= 2;
+    if (sdrs->fetch_window < 1)
+	sdrs->fetch_window = 1;
+    if (sdrs->fetch_size > STD_SDR_FETCH_BYTES)
+	sdrs->fetch_size = STD_SDR_FETCH_BYTES;
 }
 
 static void
@@ -256,46 +321,348 @@ cleanup_fetch_items(ipmi_sdr_info_t *sdrs)
     ilist_iter(sdrs->outstanding_fetch, cancel_fetch, NULL);
 }
 
+/*
+ * The database holds the SDRs as they are kept in memory, behind a
+ * header, so a database that maps its data into memory lets the SDRs
+ * be used in place with no copy.  The header is:
+ *
+ *   0  "OSDR"
+ *   4  version (SDR_DB_VERSION)
+ *   8  SDR_DB_ORDER, in host byte order
+ *  12  sizeof(ipmi_sdr_t)
+ *  16  number of SDRs
+ *  20  last addition timestamp
+ *  24  last erase timestamp
+ *  28  checksum of the SDRs
+ *
+ * Everything but the byte order mark is little-endian.  The byte
+ * order mark and the SDR size make sure the SDRs are laid out like
+ * this host would lay them out.  The checksum is a 32-bit FNV-1a hash.
+ *
+ * Version 1 had no header, just the SDRs followed by the two
+ * timestamps and a version byte at the end.  It is still read, but
+ * has to be copied since the SDRs may not be aligned.
+ */
+#define SDR_DB_VERSION		2
+#define SDR_DB_HDR_LEN		32
+#define SDR_DB_ORDER		0x01020304
+
+#define SDR_HASH_BASIS		0x811c9dc5
+
+static uint32_t
+sdr_hash_bytes(uint32_t h, const unsigned char *data, unsigned int len)
+{
+    while (len > 0) {
+	h = (h ^ *data) * 0x01000193;
+	data++;
+	len--;
+    }
+    return h;
+}
+
+static uint32_t
+sdr_db_checksum(const unsigned char *data, unsigned int len)
+{
+    return sdr_hash_bytes(SDR_HASH_BASIS, data, len);
+}
+
+static int
+sdrs_in_db(ipmi_sdr_info_t *sdrs, ipmi_sdr_t *array)
+{
+    return (sdrs->db_data
+	    && (array == (ipmi_sdr_t *) (sdrs->db_data + SDR_DB_HDR_LEN)));
+}
+
+/*
+ * MCs of the same kind usually have the same SDR repository, so
+ * fetched SDR arrays are shared between SDR infos.  When a fetch
+ * completes, the new array is looked up by a hash of its records and
+ * the repository timestamps.  If another SDR info already holds the
+ * same repository, its array is used and the new one is freed.
+ * Shared arrays are refcounted and may not be changed; an SDR info
+ * copies the array before changing it, like it does for SDRs used in
+ * place from the database.
+ */
+#define SDR_SHARE_HASH_SIZE 64
+
+struct sdr_shared_s
+{
+    uint32_t     hash;
+    unsigned int num_sdrs;
+    uint32_t     last_addition_timestamp;
+    uint32_t     last_erase_timestamp;
+    ipmi_sdr_t   *sdrs;
+    unsigned int refcount;
+    sdr_shared_t *next;
+};
+
+static ipmi_lock_t  *sdr_share_lock;
+static sdr_shared_t *sdr_shared[SDR_SHARE_HASH_SIZE];
+
+/* Only the used part of each record is hashed and compared, the rest
+   of the data is garbage. */
+static uint32_t
+sdr_share_hash(ipmi_sdr_info_t *sdrs)
+{
+    uint32_t      h = SDR_HASH_BASIS;
+    unsigned char d[8];
+    ipmi_sdr_t    *sdr;
+    unsigned int  i;
+
+    ipmi_set_uint32(d, sdrs->last_addition_timestamp);
+    ipmi_set_uint32(d + 4, sdrs->last_erase_timestamp);
+    h = sdr_hash_bytes(h, d, 8);
+    for (i=0; i<sdrs->num_sdrs; i++) {
+	sdr = &sdrs->sdrs[i];
+	ipmi_set_uint16(d, sdr->record_id);
+	d[2] = sdr->major_version;
+	d[3] = sdr->minor_version;
+	d[4] = sdr->type;
+	d[5] = sdr->length;
+	h = sdr_hash_bytes(h, d, 6);
+	h = sdr_hash_bytes(h, sdr->data, sdr->length);
+    }
+    return h;
+}
+
+static int
+sdr_share_match(sdr_shared_t *sh, ipmi_sdr_info_t *sdrs, uint32_t hash)
+{
+    ipmi_sdr_t   *a, *b;
+    unsigned int i;
+
+    if ((sh->hash != hash)
+	|| (sh->num_sdrs != sdrs->num_sdrs)
+	|| (sh->last_addition_timestamp != sdrs->last_addition_timestamp)
+	|| (sh->last_erase_timestamp != sdrs->last_erase_timestamp))
+	return 0;
+
+    for (i=0; i<sh->num_sdrs; i++) {
+	a = &sh->sdrs[i];
+	b = &sdrs->sdrs[i];
+	if ((a->record_id != b->record_id)
+	    || (a->major_version != b->major_version)
+	    || (a->minor_version != b->minor_version)
+	    || (a->type != b->type)
+	    || (a->length != b->length)
+	    || (memcmp(a->data, b->data, a->length) != 0))
+	    return 0;
+    }
+    return 1;
+}
+
+/* Share the SDR info's freshly fetched array, or switch to an
+   identical one that is already shared.  If anything fails the SDR
+   info just keeps its own array. */
 static void
-process_db_data(ipmi_sdr_info_t *sdrs,
-		unsigned char   *db_data,
-		unsigned int    len)
+sdr_share_array(ipmi_sdr_info_t *sdrs)
 {
-    int           num;
-    unsigned char *d;
-    ipmi_sdr_t    *to_free;
+    sdr_shared_t *sh;
+    uint32_t     hash;
+
+    if (!sdr_share_lock || !sdrs->sdrs || (sdrs->num_sdrs == 0)
+	|| sdrs->shared || sdrs_in_db(sdrs, sdrs->sdrs))
+	return;
+
+    hash = sdr_share_hash(sdrs);
+    ipmi_lock(sdr_share_lock);
+    for (sh = sdr_shared[hash % SDR_SHARE_HASH_SIZE]; sh; sh = sh->next) {
+	if (sdr_share_match(sh, sdrs, hash))
+	    break;
+    }
+    if (sh) {
+	ipmi_mem_free(sdrs->sdrs);
+	sdrs->sdrs = sh->sdrs;
+    } else {
+	sh = ipmi_mem_alloc(sizeof(*sh));
+	if (!sh)
+	    goto out_unlock;
+	sh->hash = hash;
+	sh->num_sdrs = sdrs->num_sdrs;
+	sh->last_addition_timestamp = sdrs->last_addition_timestamp;
+	sh->last_erase_timestamp = sdrs->last_erase_timestamp;
+	sh->sdrs = sdrs->sdrs;
+	sh->refcount = 0;
+	sh->next = sdr_shared[hash % SDR_SHARE_HASH_SIZE];
+	sdr_shared[hash % SDR_SHARE_HASH_SIZE] = sh;
+    }
+    sh->refcount++;
+    sdrs->shared = sh;
+    sdrs->sdr_array_size = sdrs->num_sdrs;
+ out_unlock:
+    ipmi_unlock(sdr_share_lock);
+}
+
+static void
+sdr_put_shared(ipmi_sdr_info_t *sdrs)
+{
+    sdr_shared_t *sh = sdrs->shared;
+    sdr_shared_t **prev;
+
+    sdrs->shared = NULL;
+    if (!sdr_share_lock) {
+	/* After shutdown the array is no longer on the hash list and
+	   nothing else can find it, the last user frees it. */
+	sh->refcount--;
+	if (sh->refcount == 0) {
+	    ipmi_mem_free(sh->sdrs);
+	    ipmi_mem_free(sh);
+	}
+	return;
+    }
 
-    if (len < 9)
-	goto no_db;
+    ipmi_lock(sdr_share_lock);
+    sh->refcount--;
+    if (sh->refcount == 0) {
+	prev = &sdr_shared[sh->hash % SDR_SHARE_HASH_SIZE];
+	for (; *prev; prev = &(*prev)->next) {
+	    if (*prev == sh) {
+		*prev = sh->next;
+		break;
+	    }
+	}
+	ipmi_mem_free(sh->sdrs);
+	ipmi_mem_free(sh);
+    }
+    ipmi_unlock(sdr_share_lock);
+}
 
-    /* Format# is the last byte. */
-    d = db_data + len - 1;
-    if (*d != 1)
-	goto no_db;
+static int
+sdrs_shared(ipmi_sdr_info_t *sdrs, ipmi_sdr_t *array)
+{
+    return sdrs->shared && (array == sdrs->shared->sdrs);
+}
+
+/* Free an SDR array, giving it back to the database or dropping the
+   shared copy if that is where it came from. */
+static void
+sdr_free_array(ipmi_sdr_info_t *sdrs, ipmi_sdr_t *array)
+{
+    if (!array)
+	return;
+    if (sdrs_in_db(sdrs, array)) {
+	sdrs->os_hnd->database_free(sdrs->os_hnd, sdrs->db_data);
+	sdrs->db_data = NULL;
+    } else if (sdrs_shared(sdrs, array))
+	sdr_put_shared(sdrs);
+    else
+	ipmi_mem_free(array);
+}
+
+/* SDRs used in place from the database or shared with other SDR
+   infos may not be changed, so copy them before changing them. */
+static int
+sdr_own_array(ipmi_sdr_info_t *sdrs)
+{
+    ipmi_sdr_t *array;
+
+    if (!sdrs_in_db(sdrs, sdrs->sdrs) && !sdrs_shared(sdrs, sdrs->sdrs))
+	return 0;
+
+    array = ipmi_mem_alloc(sizeof(ipmi_sdr_t) * (sdrs->num_sdrs + 1));
+    if (!array)
+	return ENOMEM;
+    memcpy(array, sdrs->sdrs, sizeof(ipmi_sdr_t) * sdrs->num_sdrs);
+    sdr_free_array(sdrs, sdrs->sdrs);
+    sdrs->sdrs = array;
+    sdrs->sdr_array_size = sdrs->num_sdrs + 1;
+    return 0;
+}
+
+static int
+process_db_data_v1(ipmi_sdr_info_t *sdrs,
+		   unsigned char   *db_data,
+		   unsigned int    len)
+{
+    int           num;
+    unsigned char *d;
+    ipmi_sdr_t    *new_sdrs;
 
     /* timestamps are the 8 bytes before the format#. */
-    d -= 8;
-    sdrs->last_addition_timestamp = ipmi_get_uint32(d);
-    d += 4;
-    sdrs->last_erase_timestamp = ipmi_get_uint32(d);
-    d += 4;
+    d = db_data + len - 9;
     len -= 9;
     num = len / sizeof(ipmi_sdr_t);
-    /* Allocate 9 extra bytes for storing the timestamps and
-     * format#. */
-    to_free = sdrs->sdrs;
-    sdrs->sdrs = ipmi_mem_alloc((sizeof(ipmi_sdr_t) * num) + 9);
-    if (!sdrs->sdrs)
-	goto no_db;
-    memcpy(sdrs->sdrs, db_data, sizeof(ipmi_sdr_t) * num);
+    new_sdrs = ipmi_mem_alloc(sizeof(ipmi_sdr_t) * (num + 1));
+    if (!new_sdrs)
+	return 0;
+    memcpy(new_sdrs, db_data, sizeof(ipmi_sdr_t) * num);
+    sdrs->last_addition_timestamp = ipmi_get_uint32(d);
+    sdrs->last_erase_timestamp = ipmi_get_uint32(d + 4);
+    sdr_free_array(sdrs, sdrs->sdrs);
+    sdrs->sdrs = new_sdrs;
+    sdrs->num_sdrs = num;
+    sdrs->sdr_array_size = num + 1;
+    sdrs->fetched = 1;
+    return 0;
+}
+
+/* Returns true if the SDRs are now using db_data in place, so it must
+   not be freed. */
+static int
+process_db_data(ipmi_sdr_info_t *sdrs,
+		unsigned char   *db_data,
+		unsigned int    len)
+{
+    unsigned int num;
+    uint32_t     order;
+
+    if ((len < SDR_DB_HDR_LEN) || (memcmp(db_data, "OSDR", 4) != 0)) {
+	if ((len >= 9) && (db_data[len - 1] == 1))
+	    return process_db_data_v1(sdrs, db_data, len);
+	return 0;
+    }
+    if (ipmi_get_uint32(db_data + 4) != SDR_DB_VERSION)
+	return 0;
+    memcpy(&order, db_data + 8, 4);
+    if ((order != SDR_DB_ORDER)
+	|| (ipmi_get_uint32(db_data + 12) != sizeof(ipmi_sdr_t)))
+	return 0;
+    num = ipmi_get_uint32(db_data + 16);
+    if ((len - SDR_DB_HDR_LEN) / sizeof(ipmi_sdr_t) < num)
+	return 0;
+    if (len != (SDR_DB_HDR_LEN + (num * sizeof(ipmi_sdr_t))))
+	return 0;
+    if (ipmi_get_uint32(db_data + 28)
+	!= sdr_db_checksum(db_data + SDR_DB_HDR_LEN, len - SDR_DB_HDR_LEN))
+	return 0;
+
+    /* ipmi_sdr_t only needs the alignment of its record id. */
+    if (((unsigned long) db_data) % sizeof(uint16_t))
+	return 0;
+
+    sdr_free_array(sdrs, sdrs->sdrs);
+    sdrs->db_data = db_data;
+    sdrs->sdrs = (ipmi_sdr_t *) (db_data + SDR_DB_HDR_LEN);
     sdrs->num_sdrs = num;
     sdrs->sdr_array_size = num;
+    sdrs->last_addition_timestamp = ipmi_get_uint32(db_data + 20);
+    sdrs->last_erase_timestamp = ipmi_get_uint32(db_data + 24);
     sdrs->fetched = 1;
-    if (to_free)
-	ipmi_mem_free(to_free);
+    return 1;
+}
 
- no_db:
-    sdrs->os_hnd->database_free(sdrs->os_hnd, db_data);
+static void
+store_db_data(ipmi_sdr_info_t *sdrs)
+{
+    unsigned int  len = sdrs->num_sdrs * sizeof(ipmi_sdr_t);
+    unsigned char *d;
+    uint32_t      order = SDR_DB_ORDER;
+
+    d = ipmi_mem_alloc(SDR_DB_HDR_LEN + len);
+    if (!d)
+	return;
+    memcpy(d, "OSDR", 4);
+    ipmi_set_uint32(d + 4, SDR_DB_VERSION);
+    memcpy(d + 8, &order, 4);
+    ipmi_set_uint32(d + 12, sizeof(ipmi_sdr_t));
+    ipmi_set_uint32(d + 16, sdrs->num_sdrs);
+    ipmi_set_uint32(d + 20, sdrs->last_addition_timestamp);
+    ipmi_set_uint32(d + 24, sdrs->last_erase_timestamp);
+    memcpy(d + SDR_DB_HDR_LEN, sdrs->sdrs, len);
+    ipmi_set_uint32(d + 28, sdr_db_checksum(d + SDR_DB_HDR_LEN, len));
+    sdrs->os_hnd->database_store(sdrs->os_hnd, sdrs->db_key,
+				 d, SDR_DB_HDR_LEN + len);
+    ipmi_mem_free(d);
 }
 
 static void
@@ -305,10 +672,14 @@ db_fetched(void          *cb_data,
 	   unsigned int  db_data_len)
 {
     ipmi_sdr_info_t *sdrs = cb_data;
+    os_handler_t    *os_hnd = sdrs->os_hnd;
+    int             in_use = 0;
 
     sdr_lock(sdrs);
     if (sdrs->destroyed) {
 	internal_destroy_sdr_info(sdrs);
+	if (!err)
+	    os_hnd->database_free(os_hnd, db_data);
 	return;
     }
 
@@ -316,12 +687,12 @@ db_fetched(void          *cb_data,
        check to see if another fetch is going on and has finished.  We
        are guaranteed that this works. */
     if (!err)
-	process_db_data(sdrs, db_data, db_data_len);
+	in_use = process_db_data(sdrs, db_data, db_data_len);
 
     sdrs->db_fetching = 0;
     sdr_unlock(sdrs);
-    if (!err)
-	sdrs->os_hnd->database_free(sdrs->os_hnd, db_data);
+    if (!err && !in_use)
+	os_hnd->database_free(os_hnd, db_data);
     opq_op_done(sdrs->sdr_wait_q);
 }
 
@@ -357,7 +728,8 @@ start_db_fetch(void *cb_data, int shutdown)
 	/* If the above fails, no problem, the db_data will be NULL. */
 	if (!rv) {
 	    if (data_fetched) {
-		process_db_data(sdrs, db_data, db_data_len);
+		if (!process_db_data(sdrs, db_data, db_data_len))
+		    sdrs->os_hnd->database_free(sdrs->os_hnd, db_data);
 		rv = -1; /* Just mark it as done */
 	    }
 	}
@@ -419,6 +791,8 @@ ipmi_sdr_info_alloc(ipmi_domain_t   *domain,
     sdrs->sdr_wait_q = NULL;
     /* use guaranteed size */
     sdrs->fetch_size = STD_SDR_FETCH_BYTES;
+    sdrs->max_fetch_size = MAX_SDR_FETCH_BYTES;
+    sdrs->fetch_window = STD_SDR_FETCH_OUTSTANDING;
 
     /* Assume we have a dynamic population until told otherwise. */
     sdrs->dynamic_population = 1;
@@ -523,16 +897,14 @@ internal_destroy_sdr_info(ipmi_sdr_info_t *sdrs)
     if (sdrs->destroy_handler)
 	sdrs->destroy_handler(sdrs, sdrs->destroy_cb_data);
 
-    if (sdrs->sdrs)
-	ipmi_mem_free(sdrs->sdrs);
+    sdr_free_array(sdrs, sdrs->sdrs);
     ipmi_mem_free(sdrs);
 }
 
 void
 ipmi_sdr_clean_out_sdrs(ipmi_sdr_info_t *sdrs)
 {
-    if (sdrs->sdrs)
-	ipmi_mem_free(sdrs->sdrs);
+    sdr_free_array(sdrs, sdrs->sdrs);
     sdrs->sdrs = NULL;
     sdrs->dynamic_population = 1;
     sdrs->fetched = 0;
@@ -607,6 +979,27 @@ ipmi_sdr_info_destroy(ipmi_sdr_info_t      *sdrs,
     return 0;
 }
 
+static void
+sdr_fetch_stats_done(ipmi_sdr_info_t *sdrs)
+{
+    ipmi_sdr_fetch_stats_t *stats = &sdrs->stats;
+    struct timeval         now;
+    unsigned long          usec;
+
+    sdrs->os_hnd->get_monotonic_time(sdrs->os_hnd, &now);
+    usec = ((now.tv_sec - sdrs->fetch_start.tv_sec) * 1000000
+	    + (now.tv_usec - sdrs->fetch_start.tv_usec));
+    stats->fetches++;
+    stats->last_fetch_sdrs = sdrs->curr_read_idx + 1;
+    stats->last_fetch_bytes = sdrs->fetch_bytes;
+    stats->last_fetch_usec = usec;
+    if (usec)
+	stats->last_fetch_bytes_per_sec = ((double) sdrs->fetch_bytes
+					   * 1000000.0 / usec);
+    else
+	stats->last_fetch_bytes_per_sec = 0;
+}
+
 /* Must be called with the SDR locked.  This will unlock the SDR
    before calling the callback, and will return with the sdr unlocked. */
 static void
@@ -627,6 +1020,9 @@ fetch_complete(ipmi_sdr_info_t *sdrs, int err)
 	ipmi_sdr_t *to_free = NULL;
 
 	DEBUG_INFO(sdrs);
+	if (sdrs->working_sdrs != sdrs->sdrs)
+	    /* SDRs were really read. */
+	    sdr_fetch_stats_done(sdrs);
 	sdrs->fetched = 1;
 	sdrs->num_sdrs = sdrs->curr_read_idx+1;
 	sdrs->sdr_array_size = sdrs->num_sdrs;
@@ -634,26 +1030,15 @@ fetch_complete(ipmi_sdr_info_t *sdrs, int err)
 	    to_free = sdrs->sdrs;
 	sdrs->sdrs = sdrs->working_sdrs;
 	sdrs->working_sdrs = NULL;
-	if (to_free)
-	    ipmi_mem_free(to_free);
-
-	if (sdrs->sdrs && sdrs->db_key_set && sdrs->os_hnd->database_store) {
-	    unsigned int  len = sdrs->num_sdrs * sizeof(ipmi_sdr_t);
-	    unsigned char *d = ((unsigned char *) sdrs->sdrs) + len;
-
-	    /* We always allocate 9 extra bytes in the SDR data to put
-	       the timestamps and format at the end. */
-	    ipmi_set_uint32(d, sdrs->last_addition_timestamp);
-	    d += 4;
-	    ipmi_set_uint32(d, sdrs->last_erase_timestamp);
-	    d += 4;
-	    *d = 1; /* format # */
-	    len += 9;
-	    sdrs->os_hnd->database_store(sdrs->os_hnd,
-					 sdrs->db_key,
-					 (unsigned char *) sdrs->sdrs,
-					 len);
-	}
+	sdr_free_array(sdrs, to_free);
+
+	/* If the SDRs are still the ones from the database, it is
+	   already up to date. */
+	if (sdrs->sdrs && sdrs->db_key_set && sdrs->os_hnd->database_store
+	    && !sdrs_in_db(sdrs, sdrs->sdrs))
+	    store_db_data(sdrs);
+
+	sdr_share_array(sdrs);
     }
     sdrs->fetch_state = HANDLERS;
     sdr_unlock(sdrs);
@@ -712,6 +1097,7 @@ handle_reservation_check(ipmi_mc_t  *mc,
 	/* We lost our reservation, restart the operation.  Only do
            this so many times, in order to guarantee that this
            completes. */
+	sdrs->stats.reservation_losses++;
 	sdrs->fetch_retry_count++;
 	if (sdrs->fetch_retry_count > MAX_SDR_FETCH_RETRIES) {
 	    ipmi_log(IPMI_LOG_ERR_INFO,
@@ -928,6 +1314,7 @@ info_send(ipmi_sdr_info_t *sdrs, fetch_info_t *info, ipmi_mc_t *mc)
     } else {
 	DEBUG_INFO(sdrs);
 	ilist_add_tail(sdrs->outstanding_fetch, info, &info->link);
+	sdrs->num_outstanding++;
     }
 
     return rv;
@@ -953,6 +1340,7 @@ handle_sdr_data(ipmi_mc_t  *mc,
 		 " outstanding operation list", sdrs->name);
 	goto out_unlock;
     }
+    sdrs->num_outstanding--;
 
     if (sdrs->destroyed) {
 	DEBUG_INFO(sdrs);
@@ -1023,10 +1411,15 @@ handle_sdr_data(ipmi_mc_t  *mc,
 	goto out_nextmsg;
     }
 
-    if (rsp->data[0] == 0x80) {
-	/* Data changed during fetch, retry.  Only do this so many
-           times before giving up. */
+    if ((rsp->data[0] == 0x80) || (rsp->data[0] == IPMI_TIMEOUT_CC)) {
+	/* Data changed during fetch or the read timed out, retry.
+           Only do this so many times before giving up. */
 	DEBUG_INFO(sdrs);
+	if (rsp->data[0] == IPMI_TIMEOUT_CC) {
+	    sdrs->stats.timeouts++;
+	    sdr_fetch_backoff(sdrs);
+	}
+	sdrs->stats.retries++;
 	sdrs->sdr_retry_count++;
 	if (sdrs->sdr_retry_count > MAX_SDR_FETCH_RETRIES) {
 	    /* Cause the operation to be terminated. */
@@ -1068,6 +1461,7 @@ handle_sdr_data(ipmi_mc_t  *mc,
            completes. */
 	DEBUG_INFO(sdrs);
 	ilist_add_tail(sdrs->free_fetch, info, &info->link);
+	sdrs->stats.reservation_losses++;
 	sdrs->fetch_retry_count++;
 	if (sdrs->fetch_retry_count > MAX_SDR_FETCH_RETRIES) {
 	    DEBUG_INFO(sdrs);
@@ -1132,7 +1526,15 @@ handle_sdr_data(ipmi_mc_t  *mc,
 	   decrease the size. */
 	ilist_add_tail(sdrs->free_fetch, info, &info->link);
 
-	sdrs->fetch_size -= SDR_FETCH_BYTES_DECR;
+	sdrs->stats.size_reductions++;
+	sdrs->stats.retries++;
+	sdrs->good_reads = 0;
+	if (info->read_len <= sdrs->fetch_size) {
+	    /* Reads bigger than the fetch size were sent before the
+	       last decrease, don't decrease again for them. */
+	    sdrs->fetch_size -= SDR_FETCH_BYTES_DECR;
+	    sdrs->max_fetch_size = sdrs->fetch_size;
+	}
 	if (sdrs->fetch_size < MIN_SDR_FETCH_BYTES) {
 	    DEBUG_INFO(sdrs);
 	    ipmi_log(IPMI_LOG_ERR_INFO,
@@ -1207,6 +1609,8 @@ handle_sdr_data(ipmi_mc_t  *mc,
     }
 
     /* We have a good response */
+    sdrs->fetch_bytes += info->read_len;
+    sdr_fetch_grow(sdrs);
 
     /* First handle the info for fetching data. */
     if (info->offset == 0) {
@@ -1259,7 +1663,9 @@ handle_sdr_data(ipmi_mc_t  *mc,
     }
 
  out_nextmsg:
-    while (!ilist_empty(sdrs->free_fetch)) {
+    while (!ilist_empty(sdrs->free_fetch)
+	   && (sdrs->num_outstanding < sdrs->fetch_window))
+    {
 	/* We have some free buffers, see what we can do with them. */
 
 	if (sdrs->next_read_offset == 0)
@@ -1291,9 +1697,8 @@ handle_sdr_data(ipmi_mc_t  *mc,
 		    unsigned int new_num_sdrs = sdrs->working_num_sdrs + 10;
 		    ipmi_sdr_t *new_sdrs;
 
-		    /* Allocate 9 extra bytes for the db info. */
-		    new_sdrs = ipmi_mem_alloc((sizeof(ipmi_sdr_t)
-					       * new_num_sdrs) + 9);
+		    new_sdrs = ipmi_mem_alloc(sizeof(ipmi_sdr_t)
+					      * new_num_sdrs);
 		    if (!new_sdrs) {
 			ipmi_log(IPMI_LOG_ERR_INFO,
 				 "%ssdr.c(handle_sdr_data): "
@@ -1629,7 +2034,7 @@ handle_sdr_info(ipmi_mc_t  *mc,
 	/* No sdrs, so there's nothing to do. */
 	if (sdrs->sdrs) {
 	    DEBUG_INFO(sdrs);
-	    ipmi_mem_free(sdrs->sdrs);
+	    sdr_free_array(sdrs, sdrs->sdrs);
 	    sdrs->sdrs = NULL;
 	}
 	DEBUG_INFO(sdrs);
@@ -1638,9 +2043,8 @@ handle_sdr_info(ipmi_mc_t  *mc,
 	goto out;
     }
 
-    /* Allocate 9 extra bytes for the db info. */
-    sdrs->working_sdrs = ipmi_mem_alloc((sizeof(ipmi_sdr_t)
-					* sdrs->working_num_sdrs) + 9);
+    sdrs->working_sdrs = ipmi_mem_alloc(sizeof(ipmi_sdr_t)
+					* sdrs->working_num_sdrs);
     if (!sdrs->working_sdrs) {
 	DEBUG_INFO(sdrs);
 	ipmi_log(IPMI_LOG_ERR_INFO,
@@ -1832,6 +2236,8 @@ initial_start_fetch(void *cb_data, int shutdown)
 	return OPQ_HANDLER_STARTED;
 
     sdrs->fetch_retry_count = 0;
+    sdrs->fetch_bytes = 0;
+    sdrs->os_hnd->get_monotonic_time(sdrs->os_hnd, &sdrs->fetch_start);
     handle_start_fetch(sdrs);
 
     return OPQ_HANDLER_STARTED;
@@ -2072,8 +2478,11 @@ ipmi_set_sdr_by_index(ipmi_sdr_info_t *sdrs,
 
     if ((unsigned int)index >= sdrs->num_sdrs)
 	rv = ENOENT;
-    else
-	sdrs->sdrs[index] = *sdr;
+    else {
+	rv = sdr_own_array(sdrs);
+	if (!rv)
+	    sdrs->sdrs[index] = *sdr;
+    }
 
     sdr_unlock(sdrs);
     return rv;
@@ -2242,6 +2651,17 @@ ipmi_sdr_get_dynamic_population(ipmi_sdr_info_t *sdrs, int *val)
     return 0;
 }
 
+int
+ipmi_sdr_get_fetch_stats(ipmi_sdr_info_t *sdrs, ipmi_sdr_fetch_stats_t *stats)
+{
+    sdr_lock(sdrs);
+    *stats = sdrs->stats;
+    stats->fetch_size = sdrs->fetch_size;
+    stats->fetch_window = sdrs->fetch_window;
+    sdr_unlock(sdrs);
+    return 0;
+}
+
 int
 ipmi_sdr_get_lun_has_sensors(ipmi_sdr_info_t *sdrs, unsigned int lun, int *val)
 {
@@ -2268,17 +2688,19 @@ ipmi_sdr_add(ipmi_sdr_info_t *sdrs,
     int pos;
 
     sdr_lock(sdrs);
+    rv = sdr_own_array(sdrs);
+    if (rv)
+	goto out_unlock;
     if (sdrs->num_sdrs >= sdrs->sdr_array_size) {
 	ipmi_sdr_t *new_array;
-	/* Allocate 9 extra bytes for the db info. */
-	new_array = ipmi_mem_alloc((sizeof(ipmi_sdr_t)
-				    * (sdrs->sdr_array_size + 10)) + 9);
+	new_array = ipmi_mem_alloc(sizeof(ipmi_sdr_t)
+				   * (sdrs->sdr_array_size + 10));
 	if (!new_array) {
 	    rv = ENOMEM;
 	    goto out_unlock;
 	}
 	memcpy(new_array, sdrs->sdrs, sizeof(ipmi_sdr_t)*sdrs->sdr_array_size);
-	ipmi_mem_free(sdrs->sdrs);
+	sdr_free_array(sdrs, sdrs->sdrs);
 	sdrs->sdrs = new_array;
 	sdrs->sdr_array_size += 10;
     }
@@ -2914,3 +3336,36 @@ ipmi_sdr_save(ipmi_sdr_info_t  *sdrs,
 	return rv;
     return info.rv;
 }
+
+int
+_ipmi_sdr_init(void)
+{
+    if (sdr_share_lock)
+	return 0;
+    return ipmi_create_global_lock(&sdr_share_lock);
+}
+
+/* Every shared array on the lists is still held by some SDR info (an
+   array is freed when its last user drops it), so just empty the
+   lists and let the users free the arrays. */
+void
+_ipmi_sdr_shutdown(void)
+{
+    sdr_shared_t *sh;
+    int          i;
+
+    if (!sdr_share_lock)
+	return;
+
+    ipmi_lock(sdr_share_lock);
+    for (i=0; i<SDR_SHARE_HASH_SIZE; i++) {
+	while (sdr_shared[i]) {
+	    sh = sdr_shared[i];
+	    sdr_shared[i] = sh->next;
+	    sh->next = NULL;
+	}
+    }
+    ipmi_unlock(sdr_share_lock);
+    ipmi_destroy_lock(sdr_share_lock);
+    sdr_share_lock = NULL;
+}
@@ -63,10 +63,20 @@ typedef struct sel_event_holder_s
 {
     unsigned int deleted : 1;
     unsigned int cancelled : 1;
+
+    /* Found in the SEL during the current full read. */
+    unsigned int seen : 1;
     unsigned int refcount;
     ipmi_event_t *event;
+
+    /* Link in the SEL's record id index. */
+    struct sel_event_holder_s *hash_next;
 } sel_event_holder_t;
 
+/* Number of buckets in the record id index of the events.  Record ids
+   are mostly handed out in order, so the low bits spread them well. */
+#define SEL_HASH_SIZE 256
+
 static sel_event_holder_t *
 sel_event_holder_alloc(void)
 {
@@ -76,8 +86,10 @@ sel_event_holder_alloc(void)
 	return NULL;
     holder->deleted = 0;
     holder->cancelled = 0;
+    holder->seen = 1;
     holder->refcount = 1;
     holder->event = NULL;
+    holder->hash_next = NULL;
     return holder;
 }
 
@@ -165,6 +177,12 @@ struct ipmi_sel_info_s
     unsigned int           start_rec_id;
     unsigned char          start_rec_id_data[14];
 
+    /* Set if the current fetch is reading the whole SEL from the
+       first record, instead of resuming from start_rec_id.  At the
+       end of a full read, events that were not seen are gone from
+       the SEL and are dropped. */
+    unsigned int           full_read : 1;
+
     /* A lock, primarily for handling race conditions fetching the data. */
     os_hnd_lock_t *sel_lock;
 
@@ -179,6 +197,11 @@ struct ipmi_sel_info_s
     unsigned int num_sels;
     unsigned int del_sels;
 
+    /* An index of the events list by record id, so a fetch does not
+       have to search the list for every record it gets.  Every
+       holder in the list is in here. */
+    sel_event_holder_t *hash[SEL_HASH_SIZE];
+
     /* We serialize operations through here, since we are dealing with
        a locked resource. */
     opq_t *opq;
@@ -237,10 +260,47 @@ recid_search_cmp(void *item, void *cb_data)
 
     return ipmi_event_get_record_id(holder->event) == recid;
 }
+
+/* The index must be updated whenever a holder goes on or comes off
+   the events list, with the SEL lock held.  The holder's event must
+   be set before it is added. */
+static void
+sel_hash_add(ipmi_sel_info_t *sel, sel_event_holder_t *holder)
+{
+    unsigned int h = ipmi_event_get_record_id(holder->event) % SEL_HASH_SIZE;
+
+    holder->hash_next = sel->hash[h];
+    sel->hash[h] = holder;
+}
+
+static void
+sel_hash_remove(ipmi_sel_info_t *sel, sel_event_holder_t *holder)
+{
+    unsigned int       h;
+    sel_event_holder_t **p;
+
+    h = ipmi_event_get_record_id(holder->event) % SEL_HASH_SIZE;
+    for (p = &sel->hash[h]; *p; p = &(*p)->hash_next) {
+	if (*p == holder) {
+	    *p = holder->hash_next;
+	    holder->hash_next = NULL;
+	    break;
+	}
+    }
+}
+
 static sel_event_holder_t *
-find_event(ilist_t *list, unsigned int recid)
+find_event(ipmi_sel_info_t *sel, unsigned int recid)
 {
-    return ilist_search(list, recid_search_cmp, &recid);
+    sel_event_holder_t *holder;
+
+    holder = sel->hash[recid % SEL_HASH_SIZE];
+    while (holder) {
+	if (ipmi_event_get_record_id(holder->event) == recid)
+	    break;
+	holder = holder->hash_next;
+    }
+    return holder;
 }
 
 static int
@@ -529,6 +589,7 @@ free_deleted_event(ilist_iter_t *iter, void *item, void *cb_data)
 
     if (holder->deleted) {
 	ilist_delete(iter);
+	sel_hash_remove(sel, holder);
 	holder->cancelled = 1;
 	sel->del_sels--;
 	sel_event_holder_put(holder);
@@ -541,6 +602,51 @@ free_deleted_events(ipmi_sel_info_t *sel)
     ilist_iter(sel->events, free_deleted_event, sel);
 }
 
+static void
+clear_seen_event(ilist_iter_t *iter, void *item, void *cb_data)
+{
+    sel_event_holder_t *holder = item;
+
+    holder->seen = 0;
+}
+
+/* Read the SEL from the first record on the current fetch. */
+static void
+start_full_read(ipmi_sel_info_t *sel)
+{
+    sel->start_rec_id = 0;
+    sel->curr_rec_id = 0;
+    sel->full_read = 1;
+    ilist_iter(sel->events, clear_seen_event, NULL);
+}
+
+static void
+free_unseen_event(ilist_iter_t *iter, void *item, void *cb_data)
+{
+    sel_event_holder_t *holder = item;
+    ipmi_sel_info_t    *sel = cb_data;
+
+    if (holder->seen)
+	return;
+    ilist_delete(iter);
+    sel_hash_remove(sel, holder);
+    if (holder->deleted) {
+	holder->cancelled = 1;
+	sel->del_sels--;
+    } else
+	sel->num_sels--;
+    sel_event_holder_put(holder);
+}
+
+/* Called when a full read completes, drop the events that are no
+   longer in the SEL. */
+static void
+free_unseen_events(ipmi_sel_info_t *sel)
+{
+    ilist_iter(sel->events, free_unseen_event, sel);
+    sel->full_read = 0;
+}
+
 static void
 handle_sel_clear(ipmi_mc_t  *mc,
 		 ipmi_msg_t *rsp,
@@ -695,8 +801,7 @@ handle_sel_data(ipmi_mc_t  *mc,
 	       reservation, it may be that another system deleted our
 	       "current" record.  Start over from the beginning of the
 	       SEL. */
-	    sel->start_rec_id = 0;
-	    sel->curr_rec_id = 0;
+	    start_full_read(sel);
 	    del_event = NULL;
 	    goto start_request_sel_data;
 	}
@@ -736,7 +841,7 @@ handle_sel_data(ipmi_mc_t  *mc,
     if ((timestamp > 0) && (timestamp < ipmi_mc_get_startup_SEL_time(mc)))
 	ipmi_event_set_is_old(del_event, 1);
 
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder) {
 	holder = sel_event_holder_alloc();
 	if (!holder) {
@@ -758,6 +863,7 @@ handle_sel_data(ipmi_mc_t  *mc,
 	}
 	holder->event = del_event;
 	holder->deleted = 0;
+	sel_hash_add(sel, holder);
 	event_is_new = 1;
 	sel->num_sels++;
 	if (sel->sel_received_events)
@@ -779,6 +885,7 @@ handle_sel_data(ipmi_mc_t  *mc,
     } else {
 	ipmi_event_free(del_event);
     }
+    holder->seen = 1;
 
     if (sel->next_rec_id == 0xFFFF) {
 	/* Only set the timestamps if the SEL fetch completed
@@ -787,6 +894,9 @@ handle_sel_data(ipmi_mc_t  *mc,
 	sel->last_addition_timestamp = sel->curr_addition_timestamp;
 	sel->last_erase_timestamp = sel->curr_erase_timestamp;
 
+	if (sel->full_read)
+	    free_unseen_events(sel);
+
 	/* To avoid confusion, deliver the event before we deliver fetch
            complete. */
 	if (event_is_new && sel->new_event_handler) {
@@ -942,9 +1052,13 @@ handle_sel_info(ipmi_mc_t  *mc,
     sel_fixups(mc, sel);
 
     /* If the timestamps still match, no need to re-fetch the
-       repository.  Note that we only check the add timestamp.  We
-       don't care if things were deleted. */
-    if (sel->fetched && (add_timestamp == sel->last_addition_timestamp)) {
+       repository.  Single deletes don't change either timestamp, we
+       don't care about those.  A clear only changes the erase
+       timestamp, so that must be checked, too. */
+    if (sel->fetched
+	&& (add_timestamp == sel->last_addition_timestamp)
+	&& (erase_timestamp == sel->last_erase_timestamp))
+    {
 	/* If the operation completed successfully and everything in
 	   our SEL is deleted, then clear it with our old reservation.
 	   We also do the clear if the overflow flag is set; on some
@@ -977,6 +1091,11 @@ handle_sel_info(ipmi_mc_t  *mc,
 
 	/* Set the timestamps here, because they are not the same, but
 	   there was nothing to do. */
+	if (sel->fetched && (erase_timestamp != sel->last_erase_timestamp)) {
+	    /* Everything we had was erased. */
+	    start_full_read(sel);
+	    free_unseen_events(sel);
+	}
 	sel->last_addition_timestamp = sel->curr_addition_timestamp;
 	sel->last_erase_timestamp = sel->curr_erase_timestamp;
 	sel->start_rec_id = 0;
@@ -986,6 +1105,14 @@ handle_sel_info(ipmi_mc_t  *mc,
 	goto out;
     }
 
+    /* Normally we resume from the last record we fetched, only the
+       records added since then are read.  If something was erased,
+       the records we have may be gone and the record ids reused, so
+       read the whole thing again. */
+    if ((sel->start_rec_id == 0)
+	|| (erase_timestamp != sel->last_erase_timestamp))
+	start_full_read(sel);
+
     /* Fetch the first SEL entry. */
     sel->curr_rec_id = sel->start_rec_id;
     cmd_msg.data = cmd_data;
@@ -1338,6 +1465,7 @@ free_all_event(ilist_iter_t *iter, void *item, void *cb_data)
 	holder->cancelled = 1;
     }
     ilist_delete(iter);
+    sel_hash_remove(sel, holder);
     sel_event_holder_put(holder);
 }
 
@@ -1480,14 +1608,11 @@ handle_sel_delete(ipmi_mc_t  *mc,
     } else {	
 	/* We deleted the entry, so remove it from our database. */
 	sel_event_holder_t *real_holder;
-	ilist_iter_t       iter;
 
-	ilist_init_iter(&iter, sel->events);
-	ilist_unpositioned(&iter);
-	real_holder = ilist_search_iter(&iter, recid_search_cmp,
-					&(data->record_id));
+	real_holder = find_event(sel, data->record_id);
 	if (real_holder) {
-	    ilist_delete(&iter);
+	    ilist_remove_item_from_list(sel->events, real_holder);
+	    sel_hash_remove(sel, real_holder);
 	    sel_event_holder_put(real_holder);
 	    sel->del_sels--;
 	}
@@ -1836,7 +1961,6 @@ sel_del_event_cb(ipmi_mc_t *mc, void *cb_data)
     ipmi_event_t          *event = info->event;
     int                   cmp_event = info->cmp_event;
     sel_event_holder_t    *real_holder = NULL;
-    ilist_iter_t          iter;
     int                   start_fetch = 0;
 
     sel_lock(sel);
@@ -1846,10 +1970,7 @@ sel_del_event_cb(ipmi_mc_t *mc, void *cb_data)
     }
 
     if (event) {
-	ilist_init_iter(&iter, sel->events);
-	ilist_unpositioned(&iter);
-	real_holder = ilist_search_iter(&iter, recid_search_cmp,
-				    &info->record_id);
+	real_holder = find_event(sel, info->record_id);
 	if (!real_holder) {
 	    info->rv = EINVAL;
 	    goto out_unlock;
@@ -2156,7 +2277,7 @@ ipmi_sel_get_event_by_recid(ipmi_sel_info_t *sel,
 	return NULL;
     }
 
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder)
 	goto out_unlock;
 
@@ -2401,7 +2522,7 @@ ipmi_sel_event_add(ipmi_sel_info_t *sel,
     }
 
     record_id = ipmi_event_get_record_id(new_event);
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder) {
 	holder = sel_event_holder_alloc();
 	if (!holder) {
@@ -2409,10 +2530,12 @@ ipmi_sel_event_add(ipmi_sel_info_t *sel,
 	    goto out_unlock;
 	}
 	if (!ilist_add_tail(sel->events, holder, NULL)) {
+	    ipmi_mem_free(holder);
 	    rv = ENOMEM;
 	    goto out_unlock;
 	}
 	holder->event = ipmi_event_dup(new_event);
+	sel_hash_add(sel, holder);
 	sel->num_sels++;
     } else if (event_cmp(holder->event, new_event) == 0) {
 	/* A duplicate event, just ignore it and return the right
@@ -67,6 +67,19 @@ struct ipmi_sensor_info_s
 };
 
 #define SENSOR_ID_LEN 32 /* 16 bytes are allowed for a sensor. */
+typedef struct sensor_conv_s
+{
+    int m : 10;
+    unsigned int tolerance : 6;
+    int b : 10;
+    int r_exp : 4;
+    unsigned int accuracy_exp : 2;
+    int accuracy : 10;
+    int b_exp : 4;
+} sensor_conv_t;
+
+typedef struct sensor_cooked_tab_s sensor_cooked_tab_t;
+
 struct ipmi_sensor_s
 {
     unsigned int  usecount;
@@ -157,15 +170,20 @@ struct ipmi_sensor_s
 
     unsigned char linearization;
 
-    struct {
-	int m : 10;
-	unsigned int tolerance : 6;
-	int b : 10;
-	int r_exp : 4;
-	unsigned int accuracy_exp : 2;
-	int accuracy : 10;
-	int b_exp : 4;
-    } conv[256];
+    /* The conversion factors for each raw value.  These are almost
+       always the same for every raw value, so they are kept once in
+       conv.  If something (an OEM fixup, generally) gives a raw value
+       factors different from the rest, conv_tab is allocated with an
+       entry for every raw value and conv is not used. */
+    sensor_conv_t conv;
+    sensor_conv_t *conv_tab;
+
+    /* The shared table of converted values for the factors above,
+       allocated the first time a value is converted.  cooked_failed
+       is set if the factors can't be converted, so the table isn't
+       tried again until they change. */
+    sensor_cooked_tab_t *cooked;
+    unsigned int  cooked_failed : 1;
 
     unsigned int  normal_min_specified : 1;
     unsigned int  normal_max_specified : 1;
@@ -225,6 +243,72 @@ struct ipmi_sensor_s
 };
 
 static void sensor_final_destroy(ipmi_sensor_t *sensor);
+static void sensor_put_cooked(ipmi_sensor_t *sensor);
+
+/***********************************************************************
+ *
+ * Conversion factor storage.
+ *
+ **********************************************************************/
+
+static sensor_conv_t *
+sensor_conv(ipmi_sensor_t *sensor, int val)
+{
+    if (sensor->conv_tab)
+	return &sensor->conv_tab[val & 0xff];
+    return &sensor->conv;
+}
+
+static int
+sensor_conv_equal(sensor_conv_t *c1, sensor_conv_t *c2)
+{
+    return ((c1->m == c2->m)
+	    && (c1->tolerance == c2->tolerance)
+	    && (c1->b == c2->b)
+	    && (c1->r_exp == c2->r_exp)
+	    && (c1->accuracy_exp == c2->accuracy_exp)
+	    && (c1->accuracy == c2->accuracy)
+	    && (c1->b_exp == c2->b_exp));
+}
+
+/* Set the conversion factors for one raw value.  Users generally set
+   every raw value in a loop, which passes through a state where the
+   values differ.  So when the last raw value is set, check if they
+   have all become the same again and go back to a single entry. */
+static void
+sensor_set_conv(ipmi_sensor_t *sensor, int idx, sensor_conv_t *conv)
+{
+    int i;
+
+    idx &= 0xff;
+
+    if (!sensor->conv_tab) {
+	if (sensor_conv_equal(&sensor->conv, conv))
+	    return;
+	sensor_put_cooked(sensor);
+	sensor->conv_tab = ipmi_mem_alloc(sizeof(sensor_conv_t) * 256);
+	if (!sensor->conv_tab) {
+	    /* Better to have the wrong factors for the other raw
+	       values than the wrong factors for this one. */
+	    sensor->conv = *conv;
+	    return;
+	}
+	for (i=0; i<256; i++)
+	    sensor->conv_tab[i] = sensor->conv;
+    }
+
+    sensor->conv_tab[idx] = *conv;
+
+    if (idx != 255)
+	return;
+    for (i=0; i<255; i++) {
+	if (!sensor_conv_equal(&sensor->conv_tab[i], conv))
+	    return;
+    }
+    sensor->conv = *conv;
+    ipmi_mem_free(sensor->conv_tab);
+    sensor->conv_tab = NULL;
+}
 
 /***********************************************************************
  *
@@ -831,6 +915,17 @@ ipmi_sensor_alloc_nonstandard(ipmi_sensor_t **new_sensor)
     return 0;
 }
 
+void
+ipmi_sensor_free_nonstandard(ipmi_sensor_t *sensor)
+{
+    if (sensor->oem_info_cleanup_handler)
+	sensor->oem_info_cleanup_handler(sensor, sensor->oem_info);
+    sensor_put_cooked(sensor);
+    if (sensor->conv_tab)
+	ipmi_mem_free(sensor->conv_tab);
+    ipmi_mem_free(sensor);
+}
+
 int
 ipmi_sensor_add_nonstandard(ipmi_mc_t              *mc,
 			    ipmi_mc_t              *source_mc,
@@ -1047,6 +1142,9 @@ sensor_final_destroy(ipmi_sensor_t *sensor)
 	sensor->oem_info_cleanup_handler(sensor, sensor->oem_info);
 
     _ipmi_entity_put(sensor->entity);
+    sensor_put_cooked(sensor);
+    if (sensor->conv_tab)
+	ipmi_mem_free(sensor->conv_tab);
     ipmi_mem_free(sensor);
 }
 
@@ -1346,16 +1444,14 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 	    s[p]->linearization = sdr.data[18] & 0x7f;
 
 	    if (s[p]->linearization <= 11) {
-		for (j=0; j<256; j++) {
-		    s[p]->conv[j].m = sdr.data[19] | ((sdr.data[20] & 0xc0) << 2);
-		    s[p]->conv[j].tolerance = sdr.data[20] & 0x3f;
-		    s[p]->conv[j].b = sdr.data[21] | ((sdr.data[22] & 0xc0) << 2);
-		    s[p]->conv[j].accuracy = ((sdr.data[22] & 0x3f)
-					     | ((sdr.data[23] & 0xf0) << 2));
-		    s[p]->conv[j].accuracy_exp = (sdr.data[23] >> 2) & 0x3;
-		    s[p]->conv[j].r_exp = (sdr.data[24] >> 4) & 0xf;
-		    s[p]->conv[j].b_exp = sdr.data[24] & 0xf;
-		}
+		s[p]->conv.m = sdr.data[19] | ((sdr.data[20] & 0xc0) << 2);
+		s[p]->conv.tolerance = sdr.data[20] & 0x3f;
+		s[p]->conv.b = sdr.data[21] | ((sdr.data[22] & 0xc0) << 2);
+		s[p]->conv.accuracy = ((sdr.data[22] & 0x3f)
+				       | ((sdr.data[23] & 0xf0) << 2));
+		s[p]->conv.accuracy_exp = (sdr.data[23] >> 2) & 0x3;
+		s[p]->conv.r_exp = (sdr.data[24] >> 4) & 0xf;
+		s[p]->conv.b_exp = sdr.data[24] & 0xf;
 	    }
 
 	    s[p]->sensor_direction = sdr.data[23] & 0x3;
@@ -1620,13 +1716,8 @@ static int cmp_sensor(ipmi_sensor_t *s1,
     if (s1->modifier_unit != s2->modifier_unit) return 0;
     if (s1->linearization != s2->linearization) return 0;
     if (s1->linearization <= 11) {
-	if (s1->conv[0].m != s2->conv[0].m) return 0;
-	if (s1->conv[0].tolerance != s2->conv[0].tolerance) return 0;
-	if (s1->conv[0].b != s2->conv[0].b) return 0;
-	if (s1->conv[0].accuracy != s2->conv[0].accuracy) return 0;
-	if (s1->conv[0].accuracy_exp != s2->conv[0].accuracy_exp) return 0;
-	if (s1->conv[0].r_exp != s2->conv[0].r_exp) return 0;
-	if (s1->conv[0].b_exp != s2->conv[0].b_exp) return 0;
+	if (!sensor_conv_equal(sensor_conv(s1, 0), sensor_conv(s2, 0)))
+	    return 0;
     }
     if (s1->normal_min_specified != s2->normal_min_specified) return 0;
     if (s1->normal_max_specified != s2->normal_max_specified) return 0;
@@ -2745,7 +2836,7 @@ ipmi_sensor_get_raw_m(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].m;
+    return sensor_conv(sensor, val)->m;
 }
 
 int
@@ -2753,7 +2844,7 @@ ipmi_sensor_get_raw_tolerance(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].tolerance;
+    return sensor_conv(sensor, val)->tolerance;
 }
 
 int
@@ -2761,7 +2852,7 @@ ipmi_sensor_get_raw_b(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].b;
+    return sensor_conv(sensor, val)->b;
 }
 
 int
@@ -2769,7 +2860,7 @@ ipmi_sensor_get_raw_accuracy(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].accuracy;
+    return sensor_conv(sensor, val)->accuracy;
 }
 
 int
@@ -2777,7 +2868,7 @@ ipmi_sensor_get_raw_accuracy_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].accuracy_exp;
+    return sensor_conv(sensor, val)->accuracy_exp;
 }
 
 int
@@ -2785,7 +2876,7 @@ ipmi_sensor_get_raw_r_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].r_exp;
+    return sensor_conv(sensor, val)->r_exp;
 }
 
 int
@@ -2793,7 +2884,7 @@ ipmi_sensor_get_raw_b_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].b_exp;
+    return sensor_conv(sensor, val)->b_exp;
 }
 
 int
@@ -3075,6 +3166,7 @@ void
 ipmi_sensor_set_analog_data_format(ipmi_sensor_t *sensor,
 				   int           analog_data_format)
 {
+    sensor_put_cooked(sensor);
     sensor->analog_data_format = analog_data_format;
 }
 
@@ -3111,49 +3203,71 @@ ipmi_sensor_set_modifier_unit(ipmi_sensor_t *sensor, int modifier_unit)
 void
 ipmi_sensor_set_linearization(ipmi_sensor_t *sensor, int linearization)
 {
+    sensor_put_cooked(sensor);
     sensor->linearization = linearization;
 }
 
 void
 ipmi_sensor_set_raw_m(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].m = val;
+    sensor_conv_t conv = *sensor_conv(sensor, idx);
+
+    conv.m = val;
+    sensor_set_conv(sensor, idx, &conv);
 }
 
 void
 ipmi_sensor_set_raw_tolerance(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].tolerance = val;
+    sensor_conv_t conv = *sensor_conv(sensor, idx);
+
+    conv.tolerance = val;
+    sensor_set_conv(sensor, idx, &conv);
 }
 
 void
 ipmi_sensor_set_raw_b(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].b = val;
+    sensor_conv_t conv = *sensor_conv(sensor, idx);
+
+    conv.b = val;
+    sensor_set_conv(sensor, idx, &conv);
 }
 
 void
 ipmi_sensor_set_raw_accuracy(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].accuracy = val;
+    sensor_conv_t conv = *sensor_conv(sensor, idx);
+
+    conv.accuracy = val;
+    sensor_set_conv(sensor, idx, &conv);
 }
 
 void
 ipmi_sensor_set_raw_accuracy_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].accuracy_exp = val;
+    sensor_conv_t conv = *sensor_conv(sensor, idx);
+
+    conv.accuracy_exp = val;
+    sensor_set_conv(sensor, idx, &conv);
 }
 
 void
 ipmi_sensor_set_raw_r_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].r_exp = val;
+    sensor_conv_t conv = *sensor_conv(sensor, idx);
+
+    conv.r_exp = val;
+    sensor_set_conv(sensor, idx, &conv);
 }
 
 void
 ipmi_sensor_set_raw_b_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].b_exp = val;
+    sensor_conv_t conv = *sensor_conv(sensor, idx);
+
+    conv.b_exp = val;
+    sensor_set_conv(sensor, idx, &conv);
 }
 
 void
@@ -5040,33 +5154,33 @@ sign_extend(int m, int bits)
 	return m & (~(-1 << bits));
 }
 
+/* Convert a raw value with the given factors, linearization and data
+   format. */
 static int
-stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
-				   int           val,
-				   double        *result)
+convert_raw(sensor_conv_t *conv,
+	    int           linearization,
+	    int           analog_data_format,
+	    int           val,
+	    double        *result)
 {
-    double m, b, b_exp, r_exp, fval;
+    double     m, b, b_exp, r_exp, fval;
     linearizer c_func;
 
-    if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
-	/* Not a threshold sensor, it doesn't have readings. */
-	return ENOSYS;
-
-    if (sensor->linearization == IPMI_LINEARIZATION_NONLINEAR)
+    if (linearization == IPMI_LINEARIZATION_NONLINEAR)
 	c_func = c_linear;
-    else if (sensor->linearization <= 11)
-	c_func = linearize[sensor->linearization];
+    else if (linearization <= 11)
+	c_func = linearize[linearization];
     else
 	return EINVAL;
 
     val &= 0xff;
 
-    m = sensor->conv[val].m;
-    b = sensor->conv[val].b;
-    r_exp = sensor->conv[val].r_exp;
-    b_exp = sensor->conv[val].b_exp;
+    m = conv->m;
+    b = conv->b;
+    r_exp = conv->r_exp;
+    b_exp = conv->b_exp;
 
-    switch(sensor->analog_data_format) {
+    switch(analog_data_format) {
 	case IPMI_ANALOG_DATA_FORMAT_UNSIGNED:
 	    fval = val;
 	    break;
@@ -5087,20 +5201,220 @@ stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
     return 0;
 }
 
+/*
+ * Tables of converted values.  Converting a raw value takes a couple
+ * of pow() calls and the linearizer, and converting to raw takes a
+ * search that does that a number of times.  Most sensors have the same
+ * factors for every raw value, and many sensors share the same
+ * factors, so the converted value for every raw value is computed once
+ * into a table the first time a sensor converts something.  Sensors
+ * with the same factors, linearization and data format share the
+ * table.  Sensors with per-raw-value factors don't use the tables.
+ */
+#define COOKED_TAB_HASH_SIZE 64
+
+struct sensor_cooked_tab_s
+{
+    sensor_conv_t       conv;
+    int                 linearization;
+    int                 analog_data_format;
+    unsigned int        refcount;
+    sensor_cooked_tab_t *next;
+
+    /* Indexed by the raw value. */
+    double              val[256];
+};
+
+static ipmi_lock_t *cooked_tab_lock;
+static sensor_cooked_tab_t *cooked_tabs[COOKED_TAB_HASH_SIZE];
+
+static unsigned int
+cooked_tab_hash(sensor_conv_t *conv, int linearization, int analog_data_format)
+{
+    unsigned int h;
+
+    h = conv->m;
+    h = (h * 31) + conv->b;
+    h = (h * 31) + conv->r_exp;
+    h = (h * 31) + conv->b_exp;
+    h = (h * 31) + linearization;
+    h = (h * 31) + analog_data_format;
+    return (h ^ (h >> 12)) % COOKED_TAB_HASH_SIZE;
+}
+
+static sensor_cooked_tab_t *
+sensor_get_cooked(ipmi_sensor_t *sensor)
+{
+    sensor_cooked_tab_t *tab = sensor->cooked;
+    sensor_conv_t       *conv = &sensor->conv;
+    unsigned int        hash;
+    int                 i;
+
+    if (tab)
+	return tab;
+    if (!cooked_tab_lock || sensor->conv_tab || sensor->cooked_failed)
+	return NULL;
+
+    hash = cooked_tab_hash(conv, sensor->linearization,
+			   sensor->analog_data_format);
+    ipmi_lock(cooked_tab_lock);
+    if (sensor->cooked) {
+	tab = sensor->cooked;
+	goto out_unlock;
+    }
+    for (tab = cooked_tabs[hash]; tab; tab = tab->next) {
+	if ((tab->conv.m == conv->m)
+	    && (tab->conv.b == conv->b)
+	    && (tab->conv.r_exp == conv->r_exp)
+	    && (tab->conv.b_exp == conv->b_exp)
+	    && (tab->linearization == sensor->linearization)
+	    && (tab->analog_data_format == sensor->analog_data_format))
+	    break;
+    }
+    if (!tab) {
+	tab = ipmi_mem_alloc(sizeof(*tab));
+	if (!tab)
+	    goto out_unlock;
+	tab->conv = *conv;
+	tab->linearization = sensor->linearization;
+	tab->analog_data_format = sensor->analog_data_format;
+	tab->refcount = 0;
+	for (i=0; i<256; i++) {
+	    if (convert_raw(conv, tab->linearization, tab->analog_data_format,
+			    i, &tab->val[i]))
+	    {
+		/* Bad linearization or format, don't cache anything. */
+		ipmi_mem_free(tab);
+		tab = NULL;
+		sensor->cooked_failed = 1;
+		goto out_unlock;
+	    }
+	}
+	tab->next = cooked_tabs[hash];
+	cooked_tabs[hash] = tab;
+    }
+    tab->refcount++;
+    sensor->cooked = tab;
+ out_unlock:
+    ipmi_unlock(cooked_tab_lock);
+    return tab;
+}
+
+/* Called when the sensor's factors change or it goes away. */
+static void
+sensor_put_cooked(ipmi_sensor_t *sensor)
+{
+    sensor_cooked_tab_t *tab = sensor->cooked;
+    sensor_cooked_tab_t **prev;
+    unsigned int        hash;
+
+    sensor->cooked_failed = 0;
+    if (!tab)
+	return;
+    sensor->cooked = NULL;
+    if (!cooked_tab_lock)
+	return;
+
+    ipmi_lock(cooked_tab_lock);
+    tab->refcount--;
+    if (tab->refcount == 0) {
+	hash = cooked_tab_hash(&tab->conv, tab->linearization,
+			       tab->analog_data_format);
+	for (prev = &cooked_tabs[hash]; *prev; prev = &(*prev)->next) {
+	    if (*prev == tab) {
+		*prev = tab->next;
+		break;
+	    }
+	}
+	ipmi_mem_free(tab);
+    }
+    ipmi_unlock(cooked_tab_lock);
+}
+
+int
+_ipmi_sensor_init(void)
+{
+    if (cooked_tab_lock)
+	return 0;
+    return ipmi_create_global_lock(&cooked_tab_lock);
+}
+
+void
+_ipmi_sensor_shutdown(void)
+{
+    sensor_cooked_tab_t *tab;
+    int                 i;
+
+    if (!cooked_tab_lock)
+	return;
+
+    for (i=0; i<COOKED_TAB_HASH_SIZE; i++) {
+	while (cooked_tabs[i]) {
+	    tab = cooked_tabs[i];
+	    cooked_tabs[i] = tab->next;
+	    ipmi_mem_free(tab);
+	}
+    }
+    ipmi_destroy_lock(cooked_tab_lock);
+    cooked_tab_lock = NULL;
+}
+
+static int
+stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
+				   int           val,
+				   double        *result)
+{
+    sensor_cooked_tab_t *tab;
+
+    if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
+	/* Not a threshold sensor, it doesn't have readings. */
+	return ENOSYS;
+
+    tab = sensor_get_cooked(sensor);
+    if (tab) {
+	*result = tab->val[val & 0xff];
+	return 0;
+    }
+
+    return convert_raw(sensor_conv(sensor, val), sensor->linearization,
+		       sensor->analog_data_format, val, result);
+}
+
+/* Get the converted value for the raw value while converting to raw.
+   If the sensor uses the standard conversion, this comes straight out
+   of the table. */
+static int
+to_raw_convert(ipmi_sensor_t       *sensor,
+	       sensor_cooked_tab_t *tab,
+	       int                 raw,
+	       double              *result)
+{
+    if (tab) {
+	*result = tab->val[raw & 0xff];
+	return 0;
+    }
+    return ipmi_sensor_convert_from_raw(sensor, raw, result);
+}
+
 static int
 stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 				 enum ipmi_round_e rounding,
 				 double            val,
 				 int               *result)
 {
-    double cval;
-    int    lowraw, highraw, raw, maxraw, minraw, next_raw;
-    int    rv;
+    double              cval;
+    int                 lowraw, highraw, raw, maxraw, minraw, next_raw;
+    int                 rv;
+    sensor_cooked_tab_t *tab = NULL;
 
     if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
 	/* Not a threshold sensor, it doesn't have readings. */
 	return ENOSYS;
 
+    if (sensor->cbs.ipmi_sensor_convert_from_raw
+	== stand_ipmi_sensor_convert_from_raw)
+	tab = sensor_get_cooked(sensor);
+
     switch(sensor->analog_data_format) {
 	case IPMI_ANALOG_DATA_FORMAT_UNSIGNED:
 	    lowraw = 0;
@@ -5128,10 +5442,11 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
     }
 
     /* We do a binary search for the right value.  Yuck, but I don't
-       have a better plan that will work with non-linear sensors. */
+       have a better plan that will work with non-linear sensors.  At
+       least with the table each step is just a load. */
     do {
 	raw = next_raw;
-	rv = ipmi_sensor_convert_from_raw(sensor, raw, &cval);
+	rv = to_raw_convert(sensor, tab, raw, &cval);
 	if (rv)
 	    return rv;
 
@@ -5152,7 +5467,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    if (val > cval) {
 		if (raw < maxraw) {
 		    double nval;
-		    rv = ipmi_sensor_convert_from_raw(sensor, raw+1, &nval);
+		    rv = to_raw_convert(sensor, tab, raw+1, &nval);
 		    if (rv)
 			return rv;
 		    nval = cval + ((nval - cval) / 2.0);
@@ -5162,7 +5477,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    } else {
 		if (raw > minraw) {
 		    double pval;
-		    rv = ipmi_sensor_convert_from_raw(sensor, raw-1, &pval);
+		    rv = to_raw_convert(sensor, tab, raw-1, &pval);
 		    if (rv)
 			return rv;
 		    pval = pval + ((cval - pval) / 2.0);
@@ -5213,8 +5528,8 @@ stand_ipmi_sensor_get_tolerance(ipmi_sensor_t *sensor,
 
     val &= 0xff;
 
-    m = sensor->conv[val].m;
-    r_exp = sensor->conv[val].r_exp;
+    m = sensor_conv(sensor, val)->m;
+    r_exp = sensor_conv(sensor, val)->r_exp;
 
     fval = sign_extend(val, 8);
 
@@ -5234,8 +5549,8 @@ stand_ipmi_sensor_get_accuracy(ipmi_sensor_t *sensor, int val, double *accuracy)
 
     val &= 0xff;
 
-    a = sensor->conv[val].accuracy;
-    a_exp = sensor->conv[val].r_exp;
+    a = sensor_conv(sensor, val)->accuracy;
+    a_exp = sensor_conv(sensor, val)->r_exp;
 
     *accuracy = (a * pow(10, a_exp)) / 100.0;
     return 0;
@@ -0,0 +1,335 @@
+/*
+ * bench_domain_cmds.c
+ *
+ * Measure how long it takes a domain to track its outstanding
+ * commands.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A domain is opened on a stub connection that never comes up.  The
+ * stub holds on to every command sent on it.  N commands to an IPMB
+ * address (the ones the domain tracks so it can reroute them) are
+ * sent through the domain, then the stub answers them in reverse
+ * order.  The average time per command to send and to handle the
+ * response is printed for each N, along with how many times per
+ * command the OS handler's allocator was called.  Each N is run once
+ * to warm up and then BENCH_ROUNDS times, the numbers printed are the
+ * average over those rounds.
+ *
+ * Usage: bench_domain_cmds [commands ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <OpenIPMI/ipmiif.h>
+#include <OpenIPMI/ipmi_conn.h>
+#include <OpenIPMI/ipmi_msgbits.h>
+#include <OpenIPMI/ipmi_posix.h>
+
+#define BENCH_ROUNDS 20
+
+typedef struct pending_s
+{
+    ipmi_ll_rsp_handler_t handler;
+    ipmi_msgi_t           *rspi;
+    ipmi_addr_t           addr;
+    unsigned int          addr_len;
+    unsigned char         netfn;
+    unsigned char         cmd;
+} pending_t;
+
+static pending_t    *pending;
+static unsigned int num_pending;
+static unsigned int max_pending;
+static unsigned int num_rsps;
+
+static void *(*os_mem_alloc)(int size);
+static unsigned long os_allocs;
+
+static void *
+count_mem_alloc(int size)
+{
+    os_allocs++;
+    return os_mem_alloc(size);
+}
+
+static int
+stub_start_con(ipmi_con_t *ipmi)
+{
+    return 0;
+}
+
+static int
+stub_con_change_handler(ipmi_con_t             *ipmi,
+			ipmi_ll_con_changed_cb handler,
+			void                   *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_ipmb_addr_handler(ipmi_con_t           *ipmi,
+		       ipmi_ll_ipmb_addr_cb handler,
+		       void                 *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_event_handler(ipmi_con_t            *ipmi,
+		   ipmi_ll_evt_handler_t handler,
+		   void                  *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_send_command(ipmi_con_t            *ipmi,
+		  const ipmi_addr_t     *addr,
+		  unsigned int          addr_len,
+		  const ipmi_msg_t      *msg,
+		  ipmi_ll_rsp_handler_t rsp_handler,
+		  ipmi_msgi_t           *rspi)
+{
+    pending_t *p;
+
+    if (num_pending >= max_pending)
+	return EAGAIN;
+    p = &pending[num_pending++];
+    p->handler = rsp_handler;
+    p->rspi = rspi;
+    memcpy(&p->addr, addr, addr_len);
+    p->addr_len = addr_len;
+    p->netfn = msg->netfn;
+    p->cmd = msg->cmd;
+    return 0;
+}
+
+static int
+stub_close_connection_done(ipmi_con_t            *ipmi,
+			   ipmi_ll_con_closed_cb handler,
+			   void                  *cb_data)
+{
+    if (handler)
+	handler(ipmi, cb_data);
+    return 0;
+}
+
+static int
+stub_close_connection(ipmi_con_t *ipmi)
+{
+    return stub_close_connection_done(ipmi, NULL, NULL);
+}
+
+static int
+rsp_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
+{
+    num_rsps++;
+    return IPMI_MSG_ITEM_NOT_USED;
+}
+
+static double
+usec_since(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (((double) (now.tv_sec - start->tv_sec)) * 1000000.0
+	    + (now.tv_usec - start->tv_usec));
+}
+
+static void
+send_cmds(ipmi_domain_t *domain, void *cb_data)
+{
+    unsigned int     count = *((unsigned int *) cb_data);
+    ipmi_ipmb_addr_t addr;
+    ipmi_msg_t       msg;
+    unsigned int     i;
+    int              rv;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.addr_type = IPMI_IPMB_ADDR_TYPE;
+    addr.channel = 0;
+    addr.slave_addr = 0xb0;
+    addr.lun = 0;
+    msg.netfn = IPMI_APP_NETFN;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.data = NULL;
+    msg.data_len = 0;
+
+    for (i=0; i<count; i++) {
+	rv = ipmi_send_command_addr(domain, (ipmi_addr_t *) &addr,
+				    sizeof(addr), &msg, rsp_handler,
+				    NULL, NULL);
+	if (rv) {
+	    fprintf(stderr, "Error sending command %u: %d\n", i, rv);
+	    exit(1);
+	}
+    }
+}
+
+/* Answer everything the stub is holding, newest first. */
+static void
+answer_cmds(ipmi_con_t *con)
+{
+    pending_t   *p;
+    ipmi_msgi_t *rspi;
+
+    while (num_pending > 0) {
+	p = &pending[--num_pending];
+	rspi = p->rspi;
+	memcpy(&rspi->addr, &p->addr, p->addr_len);
+	rspi->addr_len = p->addr_len;
+	rspi->msg.netfn = p->netfn | 1;
+	rspi->msg.cmd = p->cmd;
+	rspi->msg.data = rspi->data;
+	rspi->msg.data_len = 1;
+	rspi->data[0] = 0;
+	if (p->handler(con, rspi) == IPMI_MSG_ITEM_NOT_USED)
+	    ipmi_free_msg_item(rspi);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    static unsigned int default_counts[] = { 64, 512, 4096, 16384 };
+    os_handler_t        *os_hnd;
+    ipmi_con_t          con;
+    ipmi_con_t          *cons[1];
+    ipmi_domain_id_t    domain_id;
+    unsigned int        *counts = default_counts;
+    unsigned int        num_counts = 4;
+    unsigned int        i, round;
+    struct timeval      start;
+    double              send_usec, rsp_usec;
+    double              round_send_usec, round_rsp_usec;
+    unsigned long       allocs, round_allocs;
+    int                 rv;
+
+    if (argc > 1) {
+	num_counts = argc - 1;
+	counts = malloc(sizeof(*counts) * num_counts);
+	if (!counts) {
+	    fprintf(stderr, "Out of memory\n");
+	    return 1;
+	}
+	for (i=0; i<num_counts; i++)
+	    counts[i] = strtoul(argv[i + 1], NULL, 0);
+    }
+
+    os_hnd = ipmi_posix_setup_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "Unable to allocate os handler\n");
+	return 1;
+    }
+    os_mem_alloc = os_hnd->mem_alloc;
+    os_hnd->mem_alloc = count_mem_alloc;
+    rv = ipmi_init(os_hnd);
+    if (rv) {
+	fprintf(stderr, "ipmi_init failed: %d\n", rv);
+	return 1;
+    }
+
+    memset(&con, 0, sizeof(con));
+    con.os_hnd = os_hnd;
+    con.con_type = "stub";
+    con.start_con = stub_start_con;
+    con.add_con_change_handler = stub_con_change_handler;
+    con.remove_con_change_handler = stub_con_change_handler;
+    con.add_ipmb_addr_handler = stub_ipmb_addr_handler;
+    con.remove_ipmb_addr_handler = stub_ipmb_addr_handler;
+    con.add_event_handler = stub_event_handler;
+    con.remove_event_handler = stub_event_handler;
+    con.send_command = stub_send_command;
+    con.close_connection = stub_close_connection;
+    con.close_connection_done = stub_close_connection_done;
+    cons[0] = &con;
+
+    rv = ipmi_open_domain("bench", cons, 1, NULL, NULL, NULL, NULL,
+			  NULL, 0, &domain_id);
+    if (rv) {
+	fprintf(stderr, "ipmi_open_domain failed: %d\n", rv);
+	return 1;
+    }
+
+    for (i=0; i<num_counts; i++) {
+	if (counts[i] == 0)
+	    continue;
+
+	max_pending = counts[i];
+	pending = malloc(sizeof(*pending) * max_pending);
+	if (!pending) {
+	    fprintf(stderr, "Out of memory\n");
+	    return 1;
+	}
+	send_usec = 0;
+	rsp_usec = 0;
+	allocs = 0;
+	for (round=0; round<=BENCH_ROUNDS; round++) {
+	    num_pending = 0;
+	    num_rsps = 0;
+	    round_allocs = os_allocs;
+
+	    gettimeofday(&start, NULL);
+	    rv = ipmi_domain_pointer_cb(domain_id, send_cmds, &counts[i]);
+	    round_send_usec = usec_since(&start);
+	    if (rv) {
+		fprintf(stderr, "Domain went away: %d\n", rv);
+		return 1;
+	    }
+
+	    gettimeofday(&start, NULL);
+	    answer_cmds(&con);
+	    round_rsp_usec = usec_since(&start);
+	    round_allocs = os_allocs - round_allocs;
+
+	    if (num_rsps != counts[i]) {
+		fprintf(stderr, "Sent %u commands but got %u responses\n",
+			counts[i], num_rsps);
+		return 1;
+	    }
+
+	    /* Round 0 is the warmup. */
+	    if (round > 0) {
+		send_usec += round_send_usec;
+		rsp_usec += round_rsp_usec;
+		allocs += round_allocs;
+	    }
+	}
+	send_usec /= BENCH_ROUNDS;
+	rsp_usec /= BENCH_ROUNDS;
+
+	printf("%6u commands: send %.3f usec, response %.3f usec,"
+	       " %.2f allocs per command\n",
+	       counts[i], send_usec / counts[i], rsp_usec / counts[i],
+	       ((double) allocs) / BENCH_ROUNDS / counts[i]);
+	free(pending);
+    }
+
+    return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * bench_entity_scan.c
+ *
+ * Measure how long it takes to create the entities for a large set
+ * of SDRs.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A domain is opened on a stub connection that never comes up.  For
+ * each N, a synthetic SDR repository holding N FRU device locator
+ * records, each for a different entity, is scanned into a fresh
+ * entity info for the domain.  The repository is then scanned again,
+ * which finds every entity that is already there.  The time for each
+ * scan is printed.
+ *
+ * Usage: bench_entity_scan [entities ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <OpenIPMI/ipmiif.h>
+#include <OpenIPMI/ipmi_conn.h>
+#include <OpenIPMI/ipmi_sdr.h>
+#include <OpenIPMI/ipmi_posix.h>
+#include <OpenIPMI/internal/ipmi_domain.h>
+#include <OpenIPMI/internal/ipmi_entity.h>
+#include <OpenIPMI/internal/ipmi_mc.h>
+
+/* Instances below 0x60 are system-relative. */
+#define INSTANCES_PER_ID 0x60
+
+static int
+stub_start_con(ipmi_con_t *ipmi)
+{
+    return 0;
+}
+
+static int
+stub_con_change_handler(ipmi_con_t             *ipmi,
+			ipmi_ll_con_changed_cb handler,
+			void                   *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_ipmb_addr_handler(ipmi_con_t           *ipmi,
+		       ipmi_ll_ipmb_addr_cb handler,
+		       void                 *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_event_handler(ipmi_con_t            *ipmi,
+		   ipmi_ll_evt_handler_t handler,
+		   void                  *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_send_command(ipmi_con_t            *ipmi,
+		  const ipmi_addr_t     *addr,
+		  unsigned int          addr_len,
+		  const ipmi_msg_t      *msg,
+		  ipmi_ll_rsp_handler_t rsp_handler,
+		  ipmi_msgi_t           *rspi)
+{
+    /* Nothing ever answers. */
+    return 0;
+}
+
+static int
+stub_close_connection_done(ipmi_con_t            *ipmi,
+			   ipmi_ll_con_closed_cb handler,
+			   void                  *cb_data)
+{
+    if (handler)
+	handler(ipmi, cb_data);
+    return 0;
+}
+
+static int
+stub_close_connection(ipmi_con_t *ipmi)
+{
+    return stub_close_connection_done(ipmi, NULL, NULL);
+}
+
+static double
+usec_since(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (((double) (now.tv_sec - start->tv_sec)) * 1000000.0
+	    + (now.tv_usec - start->tv_usec));
+}
+
+static void
+add_frudlr(ipmi_sdr_info_t *sdrs, unsigned int n)
+{
+    ipmi_sdr_t sdr;
+    int        rv;
+
+    memset(&sdr, 0, sizeof(sdr));
+    sdr.major_version = 1;
+    sdr.minor_version = 5;
+    sdr.type = IPMI_SDR_FRU_DEVICE_LOCATOR_RECORD;
+    /* An access address of zero, so no MC gets created for it. */
+    sdr.data[7] = (n / INSTANCES_PER_ID) + 1;	/* Entity ID */
+    sdr.data[8] = n % INSTANCES_PER_ID;		/* Entity instance */
+    sdr.data[10] = 0xc0 | 4;			/* ASCII ID string */
+    snprintf((char *) sdr.data + 11, 5, "%04x", n & 0xffff);
+    sdr.length = 15;
+
+    rv = ipmi_sdr_add(sdrs, &sdr);
+    if (rv) {
+	fprintf(stderr, "Unable to add SDR %u: %d\n", n, rv);
+	exit(1);
+    }
+}
+
+static void
+scan_sdrs(ipmi_domain_t *domain, void *cb_data)
+{
+    unsigned int       count = *((unsigned int *) cb_data);
+    ipmi_system_interface_addr_t si;
+    ipmi_mc_t          *mc;
+    ipmi_sdr_info_t    *sdrs;
+    ipmi_entity_info_t *ents;
+    struct timeval     start;
+    double             first_usec, second_usec;
+    unsigned int       i;
+    int                rv;
+
+    si.addr_type = IPMI_SYSTEM_INTERFACE_ADDR_TYPE;
+    si.channel = IPMI_BMC_CHANNEL;
+    si.lun = 0;
+    mc = _ipmi_find_mc_by_addr(domain, (ipmi_addr_t *) &si, sizeof(si));
+    if (!mc) {
+	fprintf(stderr, "Domain has no system interface MC\n");
+	exit(1);
+    }
+
+    rv = ipmi_sdr_info_alloc(domain, mc, 0, 0, &sdrs);
+    if (rv) {
+	fprintf(stderr, "ipmi_sdr_info_alloc failed: %d\n", rv);
+	exit(1);
+    }
+    for (i=0; i<count; i++)
+	add_frudlr(sdrs, i);
+
+    rv = ipmi_entity_info_alloc(domain, &ents);
+    if (rv) {
+	fprintf(stderr, "ipmi_entity_info_alloc failed: %d\n", rv);
+	exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    rv = ipmi_entity_scan_sdrs(domain, NULL, ents, sdrs);
+    first_usec = usec_since(&start);
+    if (rv) {
+	fprintf(stderr, "ipmi_entity_scan_sdrs failed: %d\n", rv);
+	exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    rv = ipmi_entity_scan_sdrs(domain, NULL, ents, sdrs);
+    second_usec = usec_since(&start);
+    if (rv) {
+	fprintf(stderr, "ipmi_entity_scan_sdrs failed: %d\n", rv);
+	exit(1);
+    }
+
+    printf("%6u entities: first scan %.1f msec, rescan %.1f msec\n",
+	   count, first_usec / 1000.0, second_usec / 1000.0);
+
+    ipmi_entity_info_destroy(ents);
+    ipmi_sdr_info_destroy(sdrs, NULL, NULL);
+    _ipmi_mc_put(mc);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static unsigned int default_counts[] = { 1000, 5000, 10000 };
+    os_handler_t        *os_hnd;
+    ipmi_con_t          con;
+    ipmi_con_t          *cons[1];
+    ipmi_domain_id_t    domain_id;
+    unsigned int        *counts = default_counts;
+    unsigned int        num_counts = 3;
+    unsigned int        i;
+    int                 rv;
+
+    if (argc > 1) {
+	num_counts = argc - 1;
+	counts = malloc(sizeof(*counts) * num_counts);
+	if (!counts) {
+	    fprintf(stderr, "Out of memory\n");
+	    return 1;
+	}
+	for (i=0; i<num_counts; i++)
+	    counts[i] = strtoul(argv[i + 1], NULL, 0);
+    }
+
+    os_hnd = ipmi_posix_setup_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "Unable to allocate os handler\n");
+	return 1;
+    }
+    rv = ipmi_init(os_hnd);
+    if (rv) {
+	fprintf(stderr, "ipmi_init failed: %d\n", rv);
+	return 1;
+    }
+
+    memset(&con, 0, sizeof(con));
+    con.os_hnd = os_hnd;
+    con.con_type = "stub";
+    con.start_con = stub_start_con;
+    con.add_con_change_handler = stub_con_change_handler;
+    con.remove_con_change_handler = stub_con_change_handler;
+    con.add_ipmb_addr_handler = stub_ipmb_addr_handler;
+    con.remove_ipmb_addr_handler = stub_ipmb_addr_handler;
+    con.add_event_handler = stub_event_handler;
+    con.remove_event_handler = stub_event_handler;
+    con.send_command = stub_send_command;
+    con.close_connection = stub_close_connection;
+    con.close_connection_done = stub_close_connection_done;
+    cons[0] = &con;
+
+    rv = ipmi_open_domain("bench", cons, 1, NULL, NULL, NULL, NULL,
+			  NULL, 0, &domain_id);
+    if (rv) {
+	fprintf(stderr, "ipmi_open_domain failed: %d\n", rv);
+	return 1;
+    }
+
+    for (i=0; i<num_counts; i++) {
+	if (counts[i] == 0)
+	    continue;
+	if (counts[i] > 255 * INSTANCES_PER_ID) {
+	    fprintf(stderr, "At most %d entities\n", 255 * INSTANCES_PER_ID);
+	    return 1;
+	}
+	rv = ipmi_domain_pointer_cb(domain_id, scan_sdrs, &counts[i]);
+	if (rv) {
+	    fprintf(stderr, "Domain went away: %d\n", rv);
+	    return 1;
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * bench_sensor_conv.c
+ *
+ * Measure how long threshold sensor value conversions take.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A standalone threshold sensor with the standard callbacks is set up
+ * for each linearization.  Every raw value is converted to a cooked
+ * value, and every cooked value is converted back to raw (with normal
+ * rounding), the given number of times.  The average time for each
+ * conversion is printed, along with sums of the results so different
+ * builds can be checked against each other.  Last, the time for a
+ * conversion that fails (an invalid linearization) is printed.
+ *
+ * With -dmem, the debug allocator is used and anything left allocated
+ * at the end is reported.
+ *
+ * Usage: bench_sensor_conv [-dmem] [passes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <OpenIPMI/ipmiif.h>
+#include <OpenIPMI/ipmi_sdr.h>
+#include <OpenIPMI/ipmi_posix.h>
+#include <OpenIPMI/internal/ipmi_sensor.h>
+#include <OpenIPMI/internal/ipmi_malloc.h>
+
+static const char *lin_names[12] = {
+    "linear", "ln", "log10", "log2", "e", "exp10", "exp2", "1/x",
+    "sqr", "cube", "sqrt", "1/cube"
+};
+
+static double
+usec_since(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (((double) (now.tv_sec - start->tv_sec)) * 1000000.0
+	    + (now.tv_usec - start->tv_usec));
+}
+
+static ipmi_sensor_t *
+make_sensor(int linearization)
+{
+    ipmi_sensor_t     *sensor;
+    ipmi_sensor_cbs_t cbs = ipmi_standard_sensor_cb;
+    int               i;
+
+    if (ipmi_sensor_alloc_nonstandard(&sensor)) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    ipmi_sensor_set_callbacks(sensor, &cbs);
+    ipmi_sensor_set_event_reading_type(sensor,
+				       IPMI_EVENT_READING_TYPE_THRESHOLD);
+    ipmi_sensor_set_analog_data_format(sensor,
+				       IPMI_ANALOG_DATA_FORMAT_UNSIGNED);
+    ipmi_sensor_set_linearization(sensor, linearization);
+    for (i=0; i<256; i++) {
+	ipmi_sensor_set_raw_m(sensor, i, 3);
+	ipmi_sensor_set_raw_b(sensor, i, 5);
+	ipmi_sensor_set_raw_b_exp(sensor, i, 1);
+	ipmi_sensor_set_raw_r_exp(sensor, i, -2);
+    }
+    return sensor;
+}
+
+int
+main(int argc, char *argv[])
+{
+    os_handler_t   *os_hnd;
+    ipmi_sensor_t  *sensor;
+    unsigned int   passes = 2000;
+    unsigned int   p;
+    int            lin, raw, rv;
+    double         cooked[256];
+    double         cooked_sum;
+    long           raw_sum;
+    struct timeval start;
+    double         from_usec, to_usec;
+    double         bad;
+    int            dmem = 0;
+
+    if ((argc > 1) && (strcmp(argv[1], "-dmem") == 0)) {
+	DEBUG_MALLOC_ENABLE();
+	dmem = 1;
+	argc--;
+	argv++;
+    }
+    if (argc > 1)
+	passes = strtoul(argv[1], NULL, 0);
+    if (passes == 0)
+	passes = 1;
+
+    os_hnd = ipmi_posix_setup_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "Unable to allocate os handler\n");
+	return 1;
+    }
+    rv = ipmi_init(os_hnd);
+    if (rv) {
+	fprintf(stderr, "ipmi_init failed: %d\n", rv);
+	return 1;
+    }
+
+    for (lin=0; lin<12; lin++) {
+	sensor = make_sensor(lin);
+
+	cooked_sum = 0;
+	gettimeofday(&start, NULL);
+	for (p=0; p<passes; p++) {
+	    for (raw=0; raw<256; raw++) {
+		rv = ipmi_sensor_convert_from_raw(sensor, raw, &cooked[raw]);
+		if (rv) {
+		    fprintf(stderr, "convert_from_raw failed: %d\n", rv);
+		    return 1;
+		}
+	    }
+	}
+	from_usec = usec_since(&start);
+	for (raw=0; raw<256; raw++)
+	    cooked_sum += cooked[raw];
+
+	raw_sum = 0;
+	gettimeofday(&start, NULL);
+	for (p=0; p<passes; p++) {
+	    for (raw=0; raw<256; raw++) {
+		int r;
+
+		rv = ipmi_sensor_convert_to_raw(sensor, ROUND_NORMAL,
+						cooked[raw], &r);
+		if (rv) {
+		    fprintf(stderr, "convert_to_raw failed: %d\n", rv);
+		    return 1;
+		}
+		if (p == 0)
+		    raw_sum += r;
+	    }
+	}
+	to_usec = usec_since(&start);
+
+	printf("%-7s from_raw %7.1f nsec, to_raw %7.1f nsec,"
+	       " sums %.6g %ld\n", lin_names[lin],
+	       from_usec * 1000.0 / (passes * 256.0),
+	       to_usec * 1000.0 / (passes * 256.0),
+	       cooked_sum, raw_sum);
+	ipmi_sensor_free_nonstandard(sensor);
+    }
+
+    sensor = make_sensor(12);
+    gettimeofday(&start, NULL);
+    for (p=0; p<passes; p++) {
+	for (raw=0; raw<256; raw++) {
+	    rv = ipmi_sensor_convert_from_raw(sensor, raw, &bad);
+	    if (rv != EINVAL) {
+		fprintf(stderr, "convert_from_raw did not fail: %d\n", rv);
+		return 1;
+	    }
+	}
+    }
+    from_usec = usec_since(&start);
+    printf("%-7s from_raw %7.1f nsec\n", "invalid",
+	   from_usec * 1000.0 / (passes * 256.0));
+    ipmi_sensor_free_nonstandard(sensor);
+
+    ipmi_shutdown();
+    if (dmem)
+	ipmi_debug_malloc_cleanup();
+    os_hnd->free_os_handler(os_hnd);
+    return 0;
+}
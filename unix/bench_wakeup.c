@@ -0,0 +1,164 @@
+/*
+ * bench_wakeup.c
+ *
+ * Measure how long it takes to wake a thread waiting in the selector,
+ * using a signal and using the selector's wake fd.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A thread sits in the selector.  The main thread starts a timer that
+ * goes off immediately, which requires waking the selector thread,
+ * and waits for the timer handler to tell it the timer ran.  The
+ * average round trip is printed for each way of waking the thread.
+ *
+ * Usage: bench_wakeup [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <OpenIPMI/ipmi_posix.h>
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int done;
+static int stop; /* Protected by done_lock. */
+
+/* If cb_data is not NULL, this tells the selector thread to stop. */
+static void
+timeout_handler(void *cb_data, os_hnd_timer_id_t *id)
+{
+    pthread_mutex_lock(&done_lock);
+    if (cb_data)
+	stop = 1;
+    done = 1;
+    pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&done_lock);
+}
+
+static int
+stopped(void)
+{
+    int rv;
+
+    pthread_mutex_lock(&done_lock);
+    rv = stop;
+    pthread_mutex_unlock(&done_lock);
+    return rv;
+}
+
+static void *
+sel_thread(void *data)
+{
+    os_handler_t *os_hnd = data;
+
+    while (!stopped())
+	os_hnd->perform_one_op(os_hnd, NULL);
+    return NULL;
+}
+
+static void
+run_timer(os_handler_t *os_hnd, os_hnd_timer_id_t *timer, int last)
+{
+    struct timeval tv = { 0, 0 };
+    int            rv;
+
+    pthread_mutex_lock(&done_lock);
+    done = 0;
+    rv = os_hnd->start_timer(os_hnd, timer, &tv, timeout_handler,
+			     last ? &stop : NULL);
+    if (rv) {
+	fprintf(stderr, "Unable to start timer: %s\n", strerror(rv));
+	exit(1);
+    }
+    while (!done)
+	pthread_cond_wait(&done_cond, &done_lock);
+    pthread_mutex_unlock(&done_lock);
+}
+
+static void
+bench(const char *name, int wake_sig, unsigned int iterations)
+{
+    os_handler_t      *os_hnd;
+    os_hnd_timer_id_t *timer;
+    pthread_t         thread;
+    struct timeval    start, end;
+    double            usecs;
+    unsigned int      i;
+    int               rv;
+
+    os_hnd = ipmi_posix_thread_setup_os_handler(wake_sig);
+    if (!os_hnd) {
+	fprintf(stderr, "Unable to allocate os handler\n");
+	exit(1);
+    }
+    rv = os_hnd->alloc_timer(os_hnd, &timer);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate timer: %s\n", strerror(rv));
+	exit(1);
+    }
+
+    stop = 0;
+    pthread_create(&thread, NULL, sel_thread, os_hnd);
+
+    /* Warm up, and make sure the thread is waiting. */
+    for (i=0; i<100; i++)
+	run_timer(os_hnd, timer, 0);
+
+    gettimeofday(&start, NULL);
+    for (i=0; i<iterations; i++)
+	run_timer(os_hnd, timer, 0);
+    gettimeofday(&end, NULL);
+
+    run_timer(os_hnd, timer, 1);
+    pthread_join(thread, NULL);
+
+    usecs = ((end.tv_sec - start.tv_sec) * 1000000.0
+	     + (end.tv_usec - start.tv_usec));
+    printf("%-8s %u wakeups, %.2f usec per wakeup\n", name, iterations,
+	   usecs / iterations);
+
+    os_hnd->free_timer(os_hnd, timer);
+    os_hnd->free_os_handler(os_hnd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int iterations = 100000;
+
+    if (argc > 1)
+	iterations = strtoul(argv[1], NULL, 0);
+    if (iterations == 0) {
+	fprintf(stderr, "Invalid iteration count\n");
+	exit(1);
+    }
+
+    bench("signal", SIGUSR1, iterations);
+    bench("wake fd", 0, iterations);
+    return 0;
+}
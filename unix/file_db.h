@@ -0,0 +1,264 @@
+/*
+ * A simple file-per-key database for the OS handlers.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * This implements the database_xxx calls of the OS handler.  Each key
+ * is kept in its own file in a directory.  The user still sets a
+ * database file name, as with gdbm, and the directory is that name
+ * with ".d" added, $HOME/.OpenIPMI_db.d by default.  Finding a key maps its file read-only and hands back the
+ * mapping, so the user can use the data in place without copying it.
+ *
+ * A store writes a temporary file and renames it over the old one.
+ * Anyone who has the old data mapped keeps seeing the old data, and a
+ * crash cannot leave a partly written file under the key's name.  The
+ * file is not synced, it is only a cache; the users of the data check
+ * it anyway.
+ *
+ * Each file starts with a small header holding a magic number and the
+ * length of the data.  The data comes right after it, so it is
+ * aligned to FILE_DB_HDR_LEN, and file_db_free() can find the length
+ * to unmap from the data pointer alone.
+ *
+ * Everything here is static, so it may be included in more than one
+ * file.
+ *
+ * char *file_db_dir(const char *fname);
+ *   Return the directory for the given database file name in
+ *   malloc()ed memory, or NULL if out of memory.
+ * char *file_db_default_dir(void);
+ *   Return the default directory in malloc()ed memory, or NULL if it
+ *   cannot be found.
+ * int file_db_store(const char *dir, const char *key,
+ *                   const unsigned char *data, unsigned int len);
+ *   Store the data under the key, creating the directory if needed.
+ * int file_db_find(const char *dir, const char *key,
+ *                  unsigned char **data, unsigned int *len);
+ *   Map the data for the key.  The data is read-only.
+ * void file_db_free(unsigned char *data);
+ *   Unmap data returned by file_db_find().
+ */
+
+#ifndef _FILE_DB_H
+#define _FILE_DB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define FILE_DB_FILE	".OpenIPMI_db"
+#define FILE_DB_DIR_SUFFIX ".d"
+#define FILE_DB_MAGIC	0x4f494442 /* "OIDB" */
+#define FILE_DB_HDR_LEN	8
+
+static char *
+file_db_dir(const char *fname)
+{
+    char *dir;
+
+    dir = malloc(strlen(fname) + strlen(FILE_DB_DIR_SUFFIX) + 1);
+    if (!dir)
+	return NULL;
+    strcpy(dir, fname);
+    strcat(dir, FILE_DB_DIR_SUFFIX);
+    return dir;
+}
+
+static char *
+file_db_default_dir(void)
+{
+    char *home = getenv("HOME");
+    char *dir;
+
+    if (!home)
+	return NULL;
+    dir = malloc(strlen(home) + strlen(FILE_DB_FILE)
+		 + strlen(FILE_DB_DIR_SUFFIX) + 2);
+    if (!dir)
+	return NULL;
+    strcpy(dir, home);
+    strcat(dir, "/");
+    strcat(dir, FILE_DB_FILE);
+    strcat(dir, FILE_DB_DIR_SUFFIX);
+    return dir;
+}
+
+static char *
+file_db_path(const char *dir, const char *key, const char *prefix,
+	     const char *suffix)
+{
+    char *path;
+
+    /* Keys become file names, keep them inside the directory.  Names
+       starting with '.' are used for temporary files. */
+    if ((*key == '\0') || (*key == '.') || strchr(key, '/'))
+	return NULL;
+
+    path = malloc(strlen(dir) + strlen(prefix) + strlen(key)
+		  + strlen(suffix) + 2);
+    if (path)
+	sprintf(path, "%s/%s%s%s", dir, prefix, key, suffix);
+    return path;
+}
+
+static int
+file_db_write(int fd, const void *data, unsigned int len)
+{
+    const char *d = data;
+    ssize_t    count;
+
+    while (len > 0) {
+	count = write(fd, d, len);
+	if (count == -1) {
+	    if (errno == EINTR)
+		continue;
+	    return errno;
+	}
+	d += count;
+	len -= count;
+    }
+    return 0;
+}
+
+static int
+file_db_store(const char          *dir,
+	      const char          *key,
+	      const unsigned char *data,
+	      unsigned int        len)
+{
+    uint32_t hdr[2];
+    char     *path, *tmp;
+    int      fd;
+    int      err = 0;
+
+    path = file_db_path(dir, key, "", "");
+    if (!path)
+	return EINVAL;
+    tmp = file_db_path(dir, key, ".", ".XXXXXX");
+    if (!tmp) {
+	free(path);
+	return ENOMEM;
+    }
+
+    if ((mkdir(dir, 0700) == -1) && (errno != EEXIST)) {
+	err = errno;
+	goto out;
+    }
+
+    fd = mkstemp(tmp);
+    if (fd == -1) {
+	err = errno;
+	goto out;
+    }
+
+    hdr[0] = FILE_DB_MAGIC;
+    hdr[1] = len;
+    err = file_db_write(fd, hdr, FILE_DB_HDR_LEN);
+    if (!err)
+	err = file_db_write(fd, data, len);
+    if ((close(fd) == -1) && !err)
+	err = errno;
+    if (!err && (rename(tmp, path) == -1))
+	err = errno;
+    if (err)
+	unlink(tmp);
+
+ out:
+    free(tmp);
+    free(path);
+    return err;
+}
+
+static int
+file_db_find(const char    *dir,
+	     const char    *key,
+	     unsigned char **data,
+	     unsigned int  *len)
+{
+    char          *path;
+    int           fd;
+    struct stat   st;
+    void          *map;
+    uint32_t      *hdr;
+    int           err = 0;
+
+    path = file_db_path(dir, key, "", "");
+    if (!path)
+	return EINVAL;
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1)
+	return errno;
+
+    if (fstat(fd, &st) == -1) {
+	err = errno;
+	goto out;
+    }
+    if ((st.st_size < FILE_DB_HDR_LEN)
+	|| (((unsigned long long) st.st_size - FILE_DB_HDR_LEN)
+	    > 0xffffffffULL))
+    {
+	err = EINVAL;
+	goto out;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	err = errno;
+	goto out;
+    }
+
+    hdr = map;
+    if ((hdr[0] != FILE_DB_MAGIC)
+	|| (hdr[1] != (st.st_size - FILE_DB_HDR_LEN)))
+    {
+	munmap(map, st.st_size);
+	err = EINVAL;
+	goto out;
+    }
+
+    *data = ((unsigned char *) map) + FILE_DB_HDR_LEN;
+    *len = hdr[1];
+
+ out:
+    close(fd);
+    return err;
+}
+
+static void
+file_db_free(unsigned char *data)
+{
+    uint32_t *hdr = (uint32_t *) (data - FILE_DB_HDR_LEN);
+
+    munmap(hdr, hdr[1] + FILE_DB_HDR_LEN);
+}
+
+#endif /* _FILE_DB_H */
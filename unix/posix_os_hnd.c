@@ -44,12 +44,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
-#ifdef HAVE_GDBM
-#include <gdbm.h>
-#endif
 
 #include <OpenIPMI/ipmi_posix.h>
 
+#include "file_db.h"
+
 /* CHEAP HACK - we don't want the user to have to provide this any
    more. */
 extern void posix_vlog(char                 *format,
@@ -61,10 +60,7 @@ typedef struct iposix_info_s
 {
     selector_t *sel;
     os_vlog_t  log_handler;
-#ifdef HAVE_GDBM
-    char *gdbm_filename;
-    GDBM_FILE gdbmf;
-#endif
+    char       *db_dir;
 } iposix_info_t;
 
 struct os_hnd_fd_id_s
@@ -446,29 +442,6 @@ posix_free(void *data)
     free(data);
 }
 
-#ifdef HAVE_GDBM
-#define GDBM_FILE ".OpenIPMI_db"
-
-static void
-init_gdbm(iposix_info_t *info)
-{
-    if (!info->gdbm_filename) {
-	char *home = getenv("HOME");
-	if (!home)
-	    return;
-	info->gdbm_filename = malloc(strlen(home)+strlen(GDBM_FILE)+2);
-	if (!info->gdbm_filename)
-	    return;
-	strcpy(info->gdbm_filename, home);
-	strcat(info->gdbm_filename, "/");
-	strcat(info->gdbm_filename, GDBM_FILE);
-    }
-
-    info->gdbmf = gdbm_open(info->gdbm_filename, 512, GDBM_WRCREAT, 0600,
-			    NULL);
-    /* gdbmf will be NULL on error, which is what reports an error. */
-}
-
 static int
 database_store(os_handler_t  *handler,
 	       char          *key,
@@ -476,24 +449,10 @@ database_store(os_handler_t  *handler,
 	       unsigned int  data_len)
 {
     iposix_info_t *info = handler->internal_data;
-    datum         gkey, gdata;
-    int           rv;
-
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf)
-	    return EINVAL;
-    }
 
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata.dptr = (char *) data;
-    gdata.dsize = data_len;
-
-    rv = gdbm_store(info->gdbmf, gkey, gdata, GDBM_REPLACE);
-    if (rv)
+    if (!info->db_dir)
 	return EINVAL;
-    return 0;
+    return file_db_store(info->db_dir, key, data, data_len);
 }
 
 static int
@@ -509,21 +468,13 @@ database_find(os_handler_t  *handler,
 	      void *cb_data)
 {
     iposix_info_t *info = handler->internal_data;
-    datum         gkey, gdata;
-
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf)
-	    return EINVAL;
-    }
+    int           rv;
 
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata = gdbm_fetch(info->gdbmf, gkey);
-    if (!gdata.dptr)
+    if (!info->db_dir)
 	return EINVAL;
-    *data = (unsigned char *) gdata.dptr;
-    *data_len = gdata.dsize;
+    rv = file_db_find(info->db_dir, key, data, data_len);
+    if (rv)
+	return rv;
     *fetch_completed = 1;
     return 0;
 }
@@ -532,24 +483,23 @@ static void
 database_free(os_handler_t  *handler,
 	      unsigned char *data)
 {
-    free(data);
+    file_db_free(data);
 }
 
 static int
-set_gdbm_filename(os_handler_t *os_hnd, char *name)
+set_db_filename(os_handler_t *os_hnd, char *name)
 {
     iposix_info_t *info = os_hnd->internal_data;
     char          *nname;
 
-    nname = strdup(name);
+    nname = file_db_dir(name);
     if (!nname)
 	return ENOMEM;
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    info->gdbm_filename = nname;
+    if (info->db_dir)
+	free(info->db_dir);
+    info->db_dir = nname;
     return 0;
 }
-#endif
 
 static void sset_log_handler(os_handler_t *handler,
 			     os_vlog_t    log_handler)
@@ -603,12 +553,10 @@ static os_handler_t ipmi_posix_os_handler =
     .free_os_handler = free_os_handler,
     .perform_one_op = perform_one_op,
     .operation_loop = operation_loop,
-#ifdef HAVE_GDBM
     .database_store = database_store,
     .database_find = database_find,
     .database_free = database_free,
-    .database_set_filename = set_gdbm_filename,
-#endif
+    .database_set_filename = set_db_filename,
     .set_log_handler = sset_log_handler,
     .get_monotonic_time = get_monotonic_time,
     .get_real_time = get_real_time
@@ -633,6 +581,9 @@ ipmi_posix_get_os_handler(void)
     }
     memset(info, 0, sizeof(*info));
 
+    /* It's not fatal if this fails, there is just no database. */
+    info->db_dir = file_db_default_dir();
+
     rv->internal_data = info;
 
     return rv;
@@ -643,12 +594,8 @@ ipmi_posix_free_os_handler(os_handler_t *os_hnd)
 {
     iposix_info_t *info = os_hnd->internal_data;
 
-#ifdef HAVE_GDBM
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    if (info->gdbmf)
-	gdbm_close(info->gdbmf);
-#endif
+    if (info->db_dir)
+	free(info->db_dir);
     free(info);
     free(os_hnd);
 }
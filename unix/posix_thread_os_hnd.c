@@ -47,16 +47,14 @@
 #include <string.h>
 #include <signal.h>
 
-#ifdef HAVE_GDBM
-#include <gdbm.h>
-#endif
-
 #include <OpenIPMI/os_handler.h>
 #include <OpenIPMI/selector.h>
 #include <OpenIPMI/ipmi_posix.h>
 
 #include <OpenIPMI/internal/ipmi_int.h>
 
+#include "file_db.h"
+
 /* CHEAP HACK - we don't want the user to have to provide this any
    more. */
 extern void posix_vlog(char                 *format,
@@ -70,11 +68,7 @@ typedef struct pt_os_hnd_data_s
     os_vlog_t        log_handler;
     int              wake_sig;
     struct sigaction oldact;
-#ifdef HAVE_GDBM
-    char *gdbm_filename;
-    GDBM_FILE gdbmf;
-    pthread_mutex_t gdbm_lock;
-#endif
+    char             *db_dir;
 } pt_os_hnd_data_t;
 
 
@@ -612,13 +606,8 @@ ipmi_posix_thread_free_os_handler(os_handler_t *os_hnd)
 {
     pt_os_hnd_data_t *info = os_hnd->internal_data;
 
-#ifdef HAVE_GDBM
-    pthread_mutex_destroy(&info->gdbm_lock);
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    if (info->gdbmf)
-	gdbm_close(info->gdbmf);
-#endif
+    if (info->db_dir)
+	free(info->db_dir);
     free(info);
     free(os_hnd);
 }
@@ -660,10 +649,12 @@ perform_one_op(os_handler_t   *os_hnd,
 {
     pthread_t        self = pthread_self();
     pt_os_hnd_data_t *info = os_hnd->internal_data;
+    sel_send_sig_cb  send_sig = NULL;
     int              rv;
 
-    rv = sel_select(info->sel, posix_thread_send_sig, (long) &self, info,
-		    timeout);
+    if (info->wake_sig)
+	send_sig = posix_thread_send_sig;
+    rv = sel_select(info->sel, send_sig, (long) &self, info, timeout);
     if (rv == -1)
 	return errno;
     return 0;
@@ -674,8 +665,11 @@ operation_loop(os_handler_t *os_hnd)
 {
     pthread_t        self = pthread_self();
     pt_os_hnd_data_t *info = os_hnd->internal_data;
+    sel_send_sig_cb  send_sig = NULL;
 
-    sel_select_loop(info->sel, posix_thread_send_sig, (long) &self, info);
+    if (info->wake_sig)
+	send_sig = posix_thread_send_sig;
+    sel_select_loop(info->sel, send_sig, (long) &self, info);
 }
 
 static void
@@ -683,7 +677,8 @@ free_os_handler(os_handler_t *os_hnd)
 {
     pt_os_hnd_data_t *info = os_hnd->internal_data;
 
-    sigaction(info->wake_sig, &info->oldact, NULL);
+    if (info->wake_sig)
+	sigaction(info->wake_sig, &info->oldact, NULL);
     sel_free_selector(info->sel);
     ipmi_posix_thread_free_os_handler(os_hnd);
 }
@@ -700,29 +695,6 @@ posix_free(void *data)
     free(data);
 }
 
-#ifdef HAVE_GDBM
-#define GDBM_FILE ".OpenIPMI_db"
-
-static void
-init_gdbm(pt_os_hnd_data_t *info)
-{
-    if (!info->gdbm_filename) {
-	char *home = getenv("HOME");
-	if (!home)
-	    return;
-	info->gdbm_filename = malloc(strlen(home)+strlen(GDBM_FILE)+2);
-	if (!info->gdbm_filename)
-	    return;
-	strcpy(info->gdbm_filename, home);
-	strcat(info->gdbm_filename, "/");
-	strcat(info->gdbm_filename, GDBM_FILE);
-    }
-
-    info->gdbmf = gdbm_open(info->gdbm_filename, 512, GDBM_WRCREAT, 0600,
-			    NULL);
-    /* gdbmf will be NULL on error, which is what reports an error. */
-}
-
 static int
 database_store(os_handler_t  *handler,
 	       char          *key,
@@ -730,28 +702,10 @@ database_store(os_handler_t  *handler,
 	       unsigned int  data_len)
 {
     pt_os_hnd_data_t *info = handler->internal_data;
-    datum            gkey, gdata;
-    int              rv;
 
-    pthread_mutex_lock(&info->gdbm_lock);
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf) {
-	    pthread_mutex_unlock(&info->gdbm_lock);
-	    return EINVAL;
-	}
-    }
-
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata.dptr = (char *) data;
-    gdata.dsize = data_len;
-
-    rv = gdbm_store(info->gdbmf, gkey, gdata, GDBM_REPLACE);
-    pthread_mutex_unlock(&info->gdbm_lock);
-    if (rv)
+    if (!info->db_dir)
 	return EINVAL;
-    return 0;
+    return file_db_store(info->db_dir, key, data, data_len);
 }
 
 static int
@@ -767,25 +721,13 @@ database_find(os_handler_t  *handler,
 	      void *cb_data)
 {
     pt_os_hnd_data_t *info = handler->internal_data;
-    datum            gkey, gdata;
-
-    pthread_mutex_lock(&info->gdbm_lock);
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf) {
-	    pthread_mutex_unlock(&info->gdbm_lock);
-	    return EINVAL;
-	}
-    }
+    int              rv;
 
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata = gdbm_fetch(info->gdbmf, gkey);
-    pthread_mutex_unlock(&info->gdbm_lock);
-    if (!gdata.dptr)
+    if (!info->db_dir)
 	return EINVAL;
-    *data = (unsigned char *) gdata.dptr;
-    *data_len = gdata.dsize;
+    rv = file_db_find(info->db_dir, key, data, data_len);
+    if (rv)
+	return rv;
     *fetch_completed = 1;
     return 0;
 }
@@ -794,24 +736,23 @@ static void
 database_free(os_handler_t  *handler,
 	      unsigned char *data)
 {
-    free(data);
+    file_db_free(data);
 }
 
 static int
-set_gdbm_filename(os_handler_t *os_hnd, char *name)
+set_db_filename(os_handler_t *os_hnd, char *name)
 {
     pt_os_hnd_data_t *info = os_hnd->internal_data;
     char             *nname;
 
-    nname = strdup(name);
+    nname = file_db_dir(name);
     if (!nname)
 	return ENOMEM;
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    info->gdbm_filename = nname;
+    if (info->db_dir)
+	free(info->db_dir);
+    info->db_dir = nname;
     return 0;
 }
-#endif
 
 static void sset_log_handler(os_handler_t *handler,
 			     os_vlog_t    log_handler)
@@ -875,12 +816,10 @@ static os_handler_t ipmi_posix_thread_os_handler =
     .free_os_handler = free_os_handler,
     .perform_one_op = perform_one_op,
     .operation_loop = operation_loop,
-#ifdef HAVE_GDBM
     .database_store = database_store,
     .database_find = database_find,
     .database_free = database_free,
-    .database_set_filename = set_gdbm_filename,
-#endif
+    .database_set_filename = set_db_filename,
     .set_log_handler = sset_log_handler,
     .get_monotonic_time = get_monotonic_time,
     .get_real_time = get_real_time
@@ -891,9 +830,6 @@ ipmi_posix_thread_get_os_handler(void)
 {
     os_handler_t     *rv;
     pt_os_hnd_data_t *info;
-#ifdef HAVE_GDBM
-    int              err;
-#endif
 
     rv = malloc(sizeof(*rv));
     if (!rv)
@@ -909,14 +845,8 @@ ipmi_posix_thread_get_os_handler(void)
     memset(info, 0, sizeof(*info));
     rv->internal_data = info;
 
-#ifdef HAVE_GDBM
-    err = pthread_mutex_init(&info->gdbm_lock, NULL);
-    if (err) {
-	free(info);
-	free(rv);
-	return NULL;
-    }
-#endif
+    /* It's not fatal if this fails, there is just no database. */
+    info->db_dir = file_db_default_dir();
 
     return rv;
 }
@@ -936,6 +866,16 @@ ipmi_posix_thread_setup_os_handler(int wake_sig)
     info = os_hnd->internal_data;
     info->wake_sig = wake_sig;
 
+    if (!wake_sig) {
+	/* Wake threads with an fd instead of a signal. */
+	rv = sel_alloc_selector_flags(os_hnd, SEL_FLAG_WAKE_FD, &info->sel);
+	if (rv) {
+	    ipmi_posix_thread_free_os_handler(os_hnd);
+	    os_hnd = NULL;
+	}
+	goto out;
+    }
+
     rv = sel_alloc_selector(os_hnd, &info->sel);
     if (rv) {
 	ipmi_posix_thread_free_os_handler(os_hnd);
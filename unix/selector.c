@@ -36,7 +36,24 @@
    uses a callback interface.  Basically, other parts of the program
    can register file descriptors with this code, when interesting
    things happen on those file descriptors this code will call
-   routines registered with it. */
+   routines registered with it.
+
+   If the OS supports it, epoll() is used to wait for I/O instead of
+   select(), so only the file descriptors that are actually ready are
+   looked at on each wakeup.  epoll refuses regular files and some
+   devices, which select() always reports as ready.  Those fds are
+   kept out of the epoll set and their handlers are called on every
+   pass through the loop instead.
+
+   Normally the handlers are called by the thread that calls
+   sel_select().  If worker threads are started with
+   sel_start_workers(), the threads calling sel_select() only poll;
+   ready fds and expired timers are put on per-worker queues and run
+   by the workers.  An idle worker steals work from the other queues.
+   While an fd is queued or its handlers are running it is not
+   polled, so its handlers never run in two threads at once. */
+
+#include <config.h>
 
 #include <OpenIPMI/selector.h>
 #include <OpenIPMI/os_handler.h>
@@ -50,15 +67,54 @@
 #include <syslog.h>
 #include <signal.h>
 #include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+
+/* The maximum number of events to fetch with a single epoll_wait(). */
+#define SEL_EPOLL_MAX_EVENTS	64
+#endif
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+typedef struct sel_worker_s sel_worker_t;
+
+/* An item of work handed to a worker thread. */
+typedef struct sel_work_s
+{
+    enum { SEL_WORK_FD, SEL_WORK_TIMER } type;
+    void              *item; /* The fd_state_t or sel_timer_t */
+
+    /* The queue the work is on, NULL if not queued.  Protected by the
+       worker's lock. */
+    sel_worker_t      *worker;
+    struct sel_work_s *next, *prev;
+} sel_work_t;
 
 typedef struct fd_state_s
 {
     int               deleted;
     unsigned int      use_count;
     sel_fd_cleared_cb done;
+    void              *data;
+
+    /* Used when running handlers in worker threads.  busy is set
+       while the fd is queued to or being run by a worker, ready holds
+       the operations (1 << SEL_FD_OP_xxx) the worker needs to run.
+       These are protected by the fd lock. */
+    int               fd;
+    int               busy;
+    unsigned int      ready;
+    sel_work_t        work;
 } fd_state_t;
 
-/* The control structure for each file descriptor. */
+/* Which handler to call for an fd. */
+enum sel_fd_op_e { SEL_FD_OP_READ, SEL_FD_OP_WRITE, SEL_FD_OP_EXCEPT };
+
+/* The control structure for each file descriptor.  These are only
+   allocated for fds that have been registered with the selector. */
 typedef struct fd_control_s
 {
     /* This structure is allocated when an FD is set and it holds
@@ -69,8 +125,29 @@ typedef struct fd_control_s
     sel_fd_handler_t handle_read;
     sel_fd_handler_t handle_write;
     sel_fd_handler_t handle_except;
+
+    /* Which operations are monitored, a bitmask of
+       (1 << SEL_FD_OP_xxx). */
+    unsigned int     enabled;
+#ifdef HAVE_EPOLL_CREATE
+    /* The events currently registered with epoll for this fd, 0 if
+       not registered. */
+    uint32_t         epoll_events;
+
+    /* Set if epoll refused the fd.  It is always ready, its enabled
+       handlers are called on every pass. */
+    int              always_ready;
+#endif
 } fd_control_t;
 
+/* The size of the fd table when the first fd is registered. */
+#define SEL_FD_TABLE_MIN_SIZE	16
+
+#include "timer_wheel.h"
+
+/* The length of a timer wheel tick, in microseconds. */
+#define SEL_WHEEL_TICK_USEC	1000
+
 typedef struct heap_val_s
 {
     /* Set this to the function to call when the timeout occurs. */
@@ -86,8 +163,16 @@ typedef struct heap_val_s
     /* Who owns me? */
     selector_t *sel;
 
-    /* Am I currently running? */
+    /* Am I currently running?  This is set for the timer wheel,
+       too. */
     int in_heap;
+
+    /* Used instead of the heap links if the selector has a timer
+       wheel. */
+    twheel_link_t wheel_link;
+
+    /* Used to queue the timer to a worker when it expires. */
+    sel_work_t work;
 } heap_val_t;
 
 typedef struct theap_s theap_t;
@@ -145,16 +230,11 @@ typedef struct sel_wait_list_s
 
 struct selector_s
 {
-    /* This is an array of all the file descriptors possible.  This is
-       moderately wasteful of space, but easy to do.  Hey, memory is
-       cheap. */
-    volatile fd_control_t fds[FD_SETSIZE];
-    
-    /* These are the offical fd_sets used to track what file descriptors
-       need to be monitored. */
-    volatile fd_set read_set;
-    volatile fd_set write_set;
-    volatile fd_set except_set;
+    /* The registered file descriptors, indexed by fd.  Entries are
+       NULL for unregistered fds, the table grows as larger fds are
+       registered.  Only access this with the fd lock held. */
+    fd_control_t **fds;
+    int          fds_size;
 
     os_hnd_lock_t *fd_lock;
     int           have_fd_lock;
@@ -162,8 +242,22 @@ struct selector_s
     volatile int maxfd; /* The largest file descriptor registered with
 			   this code. */
 
-    /* The timer heap. */
-    theap_t timer_heap;
+#ifdef HAVE_EPOLL_CREATE
+    /* If >= 0, the epoll fd used to wait for I/O.  Otherwise select()
+       is used. */
+    int epollfd;
+
+    /* The number of fds with always_ready set. */
+    int num_always_ready;
+#endif
+
+    /* The timer heap, or the timer wheel if timer_wheel is not
+       NULL.  For the wheel, wheel_wake_time is the earliest time a
+       thread in select is waiting for, if wheel_wake_valid is set. */
+    theap_t        timer_heap;
+    twheel_t       *timer_wheel;
+    struct timeval wheel_wake_time;
+    int            wheel_wake_valid;
 
     os_hnd_lock_t *timer_lock;
     int           have_timer_lock;
@@ -179,6 +273,41 @@ struct selector_s
     /* This is a list of items waiting to be woken up because they are
        sitting in a select.  See wake_sel_thread() for more info. */
     sel_wait_list_t wait_list;
+
+    /* If wake_fd[0] >= 0, waiting threads are woken by making it
+       readable instead of sending them a signal.  This is an eventfd
+       (both entries are the same) or a pipe.  wake_pending is set
+       while a wakeup has been written but not read, it is protected
+       by the timer lock. */
+    int wake_fd[2];
+    int wake_pending;
+
+    /* Worker threads to run the handlers, see sel_start_workers().
+       num_workers is zero if handlers are run by the polling
+       thread. */
+    sel_worker_t  *workers;
+    unsigned int  num_workers;
+    unsigned int  next_worker;
+    os_hnd_lock_t *workers_lock;
+    os_hnd_cond_t *workers_done_cond;
+    unsigned int  workers_running;
+    volatile int  workers_stopping;
+};
+
+struct sel_worker_s
+{
+    selector_t    *sel;
+    os_hnd_lock_t *lock;
+    os_hnd_cond_t *cond;
+
+    /* The queue of work, a circular list with this as the head. */
+    sel_work_t    queue;
+
+    /* Set while waiting on the condition. */
+    volatile int  idle;
+
+    /* Set when the worker is woken to look for work. */
+    int           kick;
 };
 
 /* This function will wake the SEL thread.  It must be called with the
@@ -197,15 +326,44 @@ static void
 wake_sel_thread(selector_t *sel)
 {
     sel_wait_list_t *item;
+    uint64_t        val = 1;
 
     item = sel->wait_list.next;
     while (item != &sel->wait_list) {
 	item->timeout->tv_sec = 0;
 	item->timeout->tv_usec = 0;
-	if (item->send_sig)
+	if (item->send_sig && (sel->wake_fd[0] < 0))
 	    item->send_sig(item->thread_id, item->send_sig_cb_data);
 	item = item->next;
     }
+
+    /* With a wake fd, one write wakes every thread in select.  Only
+       one write is outstanding at a time so one read clears it. */
+    if ((sel->wake_fd[0] >= 0) && (sel->wait_list.next != &sel->wait_list)
+	&& !sel->wake_pending)
+    {
+	sel->wake_pending = 1;
+	if (write(sel->wake_fd[1], &val, sizeof(val)) < 0)
+	    sel->wake_pending = 0;
+    }
+}
+
+/* Called when the wake fd is readable. */
+static void
+clear_wake_fd(selector_t *sel)
+{
+    uint64_t val;
+
+    if (sel->have_timer_lock)
+	sel->os_hnd->lock(sel->os_hnd, sel->timer_lock);
+    if (sel->wake_pending) {
+	sel->wake_pending = 0;
+	if (read(sel->wake_fd[0], &val, sizeof(val)) < 0) {
+	    /* Somebody else got it, nothing to do. */
+	}
+    }
+    if (sel->have_timer_lock)
+	sel->os_hnd->unlock(sel->os_hnd, sel->timer_lock);
 }
 
 /* Wait list management.  These *must* be called with the timer list
@@ -243,15 +401,261 @@ wake_sel_thread_lock(selector_t *sel)
 	sel->os_hnd->unlock(sel->os_hnd, sel->timer_lock);
 }
 
-/* Initialize a single file descriptor. */
+/* Remove work from the queue it is on.  Must be called with the
+   worker's lock held. */
+static void
+dequeue_work(sel_work_t *work)
+{
+    work->next->prev = work->prev;
+    work->prev->next = work->next;
+    work->worker = NULL;
+}
+
+/* Remove the first (or last, if stealing) item from a worker's queue.
+   Must be called with the worker's lock held. */
+static sel_work_t *
+pop_work(sel_worker_t *w, int steal)
+{
+    sel_work_t *work = steal ? w->queue.prev : w->queue.next;
+
+    if (work == &w->queue)
+	return NULL;
+    dequeue_work(work);
+    return work;
+}
+
+/* Wake a worker to look for work.  Must be called with the worker's
+   lock held. */
+static void
+kick_worker(selector_t *sel, sel_worker_t *w)
+{
+    w->kick = 1;
+    sel->os_hnd->cond_wake(sel->os_hnd, w->cond);
+}
+
+/* Put work on a worker's queue.  If that worker is busy, wake an idle
+   worker so it can steal the work.  This may be called with the fd or
+   timer lock held, but never with a worker lock held. */
+static void
+queue_work(selector_t *sel, sel_worker_t *w, sel_work_t *work)
+{
+    os_handler_t *os_hnd = sel->os_hnd;
+    unsigned int i;
+
+    os_hnd->lock(os_hnd, w->lock);
+    work->worker = w;
+    work->next = &w->queue;
+    work->prev = w->queue.prev;
+    w->queue.prev->next = work;
+    w->queue.prev = work;
+    if (w->idle) {
+	kick_worker(sel, w);
+	os_hnd->unlock(os_hnd, w->lock);
+	return;
+    }
+    os_hnd->unlock(os_hnd, w->lock);
+
+    for (i=0; i<sel->num_workers; i++) {
+	sel_worker_t *other = &sel->workers[i];
+
+	/* Check idle without the lock first, it's just a hint. */
+	if ((other == w) || !other->idle)
+	    continue;
+	os_hnd->lock(os_hnd, other->lock);
+	if (other->idle) {
+	    kick_worker(sel, other);
+	    os_hnd->unlock(os_hnd, other->lock);
+	    break;
+	}
+	os_hnd->unlock(os_hnd, other->lock);
+    }
+}
+
+/* Find the control structure for an fd.  If alloc is set, allocate
+   it (and grow the fd table) if it doesn't exist.  Returns NULL if the
+   fd is not registered or cannot be allocated.  Must be called with
+   the fd lock held. */
+static fd_control_t *
+get_fd_control(selector_t *sel, int fd, int alloc)
+{
+    fd_control_t *fdc;
+
+    if (fd < sel->fds_size && sel->fds[fd])
+	return sel->fds[fd];
+    if (!alloc)
+	return NULL;
+
+    if (fd >= sel->fds_size) {
+	fd_control_t **new_fds;
+	int          new_size = sel->fds_size * 2;
+
+	if (new_size < SEL_FD_TABLE_MIN_SIZE)
+	    new_size = SEL_FD_TABLE_MIN_SIZE;
+	if (new_size <= fd)
+	    new_size = fd + 1;
+	new_fds = realloc(sel->fds, new_size * sizeof(*new_fds));
+	if (!new_fds)
+	    return NULL;
+	memset(new_fds + sel->fds_size, 0,
+	       (new_size - sel->fds_size) * sizeof(*new_fds));
+	sel->fds = new_fds;
+	sel->fds_size = new_size;
+    }
+
+    fdc = malloc(sizeof(*fdc));
+    if (!fdc)
+	return NULL;
+    memset(fdc, 0, sizeof(*fdc));
+    sel->fds[fd] = fdc;
+
+    /* Move maxfd up if necessary. */
+    if (fd > sel->maxfd)
+	sel->maxfd = fd;
+
+    return fdc;
+}
+
+/* Remove the control structure for an fd from the table and free
+   it.  Must be called with the fd lock held. */
 static void
-init_fd(fd_control_t *fd)
+free_fd_control(selector_t *sel, int fd)
 {
-    fd->state = NULL;
-    fd->data = NULL;
-    fd->handle_read = NULL;
-    fd->handle_write = NULL;
-    fd->handle_except = NULL;
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->fds[fd]->always_ready)
+	sel->num_always_ready--;
+#endif
+    free(sel->fds[fd]);
+    sel->fds[fd] = NULL;
+
+    /* Move maxfd down if necessary. */
+    if (fd == sel->maxfd) {
+	while ((sel->maxfd >= 0) && (! sel->fds[sel->maxfd]))
+	    sel->maxfd--;
+    }
+}
+
+/* Check that the fd can be monitored by this selector. */
+static int
+valid_fd(selector_t *sel, int fd)
+{
+    if (fd < 0)
+	return 0;
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->epollfd >= 0)
+	return 1;
+#endif
+    return fd < FD_SETSIZE;
+}
+
+#ifdef HAVE_EPOLL_CREATE
+/* Make the epoll registration of the fd match what is enabled.  If
+   force is set, update the registration even if it has not changed;
+   this is used to re-arm EPOLLONESHOT fds.  Must be called with the fd
+   lock held. */
+static void
+sel_update_epoll(selector_t *sel, int fd, fd_control_t *fdc, int force)
+{
+    struct epoll_event event;
+    uint32_t           events = 0;
+    int                rv;
+
+    if (fdc->enabled & (1 << SEL_FD_OP_READ))
+	events |= EPOLLIN;
+    if (fdc->enabled & (1 << SEL_FD_OP_WRITE))
+	events |= EPOLLOUT;
+    if (fdc->enabled & (1 << SEL_FD_OP_EXCEPT))
+	events |= EPOLLPRI;
+
+    if (fdc->state && fdc->state->busy)
+	/* A worker has it, it will be re-armed when the worker is
+	   done. */
+	return;
+
+    if (!force && (events == fdc->epoll_events))
+	return;
+
+    if (fdc->always_ready) {
+	/* Not in the epoll set.  If it was just enabled, a thread may
+	   be waiting in epoll, wake it up so it polls this fd. */
+	if (events & ~fdc->epoll_events)
+	    wake_sel_thread_lock(sel);
+	fdc->epoll_events = events;
+	return;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    if (sel->num_workers)
+	/* Only report the fd once, until a worker has handled it. */
+	event.events |= EPOLLONESHOT;
+    event.data.fd = fd;
+    if (events == 0) {
+	/* Nothing to monitor, take it out completely so we don't get
+	   hangups and errors reported for it.  This may fail if the
+	   fd has already been closed, that's ok. */
+	epoll_ctl(sel->epollfd, EPOLL_CTL_DEL, fd, &event);
+    } else if (fdc->epoll_events == 0) {
+	rv = epoll_ctl(sel->epollfd, EPOLL_CTL_ADD, fd, &event);
+	if (rv && (errno == EEXIST))
+	    rv = epoll_ctl(sel->epollfd, EPOLL_CTL_MOD, fd, &event);
+	if (rv && (errno == EPERM)) {
+	    /* A regular file or the like, it can't be waited for. */
+	    fdc->always_ready = 1;
+	    sel->num_always_ready++;
+	    fdc->epoll_events = events;
+	    wake_sel_thread_lock(sel);
+	    return;
+	}
+	if (rv) {
+	    syslog(LOG_ERR, "sel_update_epoll: Unable to add fd %d: %m", fd);
+	    events = 0;
+	}
+    } else {
+	/* If the fd was closed and reopened behind our back, it will
+	   no longer be in the epoll set, so re-add it. */
+	rv = epoll_ctl(sel->epollfd, EPOLL_CTL_MOD, fd, &event);
+	if (rv && (errno == ENOENT))
+	    rv = epoll_ctl(sel->epollfd, EPOLL_CTL_ADD, fd, &event);
+	if (rv) {
+	    syslog(LOG_ERR, "sel_update_epoll: Unable to modify fd %d: %m",
+		   fd);
+	    events = 0;
+	}
+    }
+    fdc->epoll_events = events;
+}
+#endif
+
+/* Called with the fd lock held when the handlers or the monitoring of
+   an fd change, to get the threads waiting for I/O to notice. */
+static void
+fd_monitoring_changed(selector_t *sel, int fd, fd_control_t *fdc)
+{
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->epollfd >= 0) {
+	/* Changes to an epoll set take effect even in threads already
+	   waiting on it, so no need to wake anything up. */
+	sel_update_epoll(sel, fd, fdc, 0);
+	return;
+    }
+#endif
+    wake_sel_thread_lock(sel);
+}
+
+/* Start monitoring an fd again after a worker has run its handlers.
+   Must be called with the fd lock held. */
+static void
+fd_rearm(selector_t *sel, int fd, fd_control_t *fdc)
+{
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->epollfd >= 0) {
+	/* EPOLLONESHOT disabled the fd when it was reported. */
+	sel_update_epoll(sel, fd, fdc, 1);
+	return;
+    }
+#endif
+    /* The pollers skip busy fds, get them to rebuild their sets. */
+    wake_sel_thread_lock(sel);
 }
 
 /* Set the handlers for a file descriptor. */
@@ -267,16 +671,28 @@ sel_set_fd_handlers(selector_t        *sel,
     fd_control_t *fdc;
     fd_state_t   *state;
 
+    if (!valid_fd(sel, fd))
+	return EINVAL;
+
     state = malloc(sizeof(*state));
     if (!state)
 	return ENOMEM;
-    state->deleted = 0;
-    state->use_count = 0;
+    memset(state, 0, sizeof(*state));
     state->done = done;
+    state->data = data;
+    state->fd = fd;
+    state->work.type = SEL_WORK_FD;
+    state->work.item = state;
 
     if (sel->have_fd_lock)
 	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-    fdc = (fd_control_t *) &(sel->fds[fd]);
+    fdc = get_fd_control(sel, fd, 1);
+    if (!fdc) {
+	if (sel->have_fd_lock)
+	    sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+	free(state);
+	return ENOMEM;
+    }
     if (fdc->state) {
 	fdc->state->deleted = 1;
 	if (fdc->state->use_count == 0) {
@@ -291,12 +707,7 @@ sel_set_fd_handlers(selector_t        *sel,
     fdc->handle_write = write_handler;
     fdc->handle_except = except_handler;
 
-    /* Move maxfd up if necessary. */
-    if (fd > sel->maxfd) {
-	sel->maxfd = fd;
-    }
-
-    wake_sel_thread_lock(sel);
+    fd_monitoring_changed(sel, fd, fdc);
     if (sel->have_fd_lock)
 	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
     return 0;
@@ -311,7 +722,9 @@ sel_clear_fd_handlers(selector_t *sel,
     fd_control_t *fdc;
     if (sel->have_fd_lock)
 	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-    fdc = (fd_control_t *) &(sel->fds[fd]);
+    fdc = get_fd_control(sel, fd, 0);
+    if (!fdc)
+	goto out_unlock;
 
     if (fdc->state) {
 	fdc->state->deleted = 1;
@@ -323,55 +736,55 @@ sel_clear_fd_handlers(selector_t *sel,
 	fdc->state = NULL;
     }
 
-    init_fd(fdc);
-    FD_CLR(fd, &sel->read_set);
-    FD_CLR(fd, &sel->write_set);
-    FD_CLR(fd, &sel->except_set);
+    fdc->enabled = 0;
+    fd_monitoring_changed(sel, fd, fdc);
+    free_fd_control(sel, fd);
 
-    /* Move maxfd down if necessary. */
-    if (fd == sel->maxfd) {
-	while ((sel->maxfd >= 0) && (! sel->fds[sel->maxfd].state)) {
-	    sel->maxfd--;
-	}
-    }
-
-    wake_sel_thread_lock(sel);
+ out_unlock:
     if (sel->have_fd_lock)
 	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
 }
 
-/* Set whether the file descriptor will be monitored for data ready to
-   read on the file descriptor. */
-void
-sel_set_fd_read_handler(selector_t *sel, int fd, int state)
+static void
+set_fd_enable(selector_t *sel, int fd, enum sel_fd_op_e op, int state)
 {
+    fd_control_t *fdc;
+
+    if (!valid_fd(sel, fd))
+	return;
+
     if (sel->have_fd_lock)
 	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
+    /* An fd may be enabled before its handlers are set, so allocate
+       it in that case.  Nothing to do if disabling an unknown fd. */
+    fdc = get_fd_control(sel, fd, state == SEL_FD_HANDLER_ENABLED);
+    if (!fdc)
+	goto out_unlock;
     if (state == SEL_FD_HANDLER_ENABLED) {
-	FD_SET(fd, &sel->read_set);
+	fdc->enabled |= 1 << op;
     } else if (state == SEL_FD_HANDLER_DISABLED) {
-	FD_CLR(fd, &sel->read_set);
+	fdc->enabled &= ~(1 << op);
     }
-    wake_sel_thread_lock(sel);
+    fd_monitoring_changed(sel, fd, fdc);
+ out_unlock:
     if (sel->have_fd_lock)
 	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
 }
 
+/* Set whether the file descriptor will be monitored for data ready to
+   read on the file descriptor. */
+void
+sel_set_fd_read_handler(selector_t *sel, int fd, int state)
+{
+    set_fd_enable(sel, fd, SEL_FD_OP_READ, state);
+}
+
 /* Set whether the file descriptor will be monitored for when the file
    descriptor can be written to. */
 void
 sel_set_fd_write_handler(selector_t *sel, int fd, int state)
 {
-    if (sel->have_fd_lock)
-	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-    if (state == SEL_FD_HANDLER_ENABLED) {
-	FD_SET(fd, &sel->write_set);
-    } else if (state == SEL_FD_HANDLER_DISABLED) {
-	FD_CLR(fd, &sel->write_set);
-    }
-    wake_sel_thread_lock(sel);
-    if (sel->have_fd_lock)
-	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+    set_fd_enable(sel, fd, SEL_FD_OP_WRITE, state);
 }
 
 /* Set whether the file descriptor will be monitored for exceptions
@@ -379,16 +792,7 @@ sel_set_fd_write_handler(selector_t *sel, int fd, int state)
 void
 sel_set_fd_except_handler(selector_t *sel, int fd, int state)
 {
-    if (sel->have_fd_lock)
-	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-    if (state == SEL_FD_HANDLER_ENABLED) {
-	FD_SET(fd, &sel->except_set);
-    } else if (state == SEL_FD_HANDLER_DISABLED) {
-	FD_CLR(fd, &sel->except_set);
-    }
-    wake_sel_thread_lock(sel);
-    if (sel->have_fd_lock)
-	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+    set_fd_enable(sel, fd, SEL_FD_OP_EXCEPT, state);
 }
 
 static void
@@ -415,6 +819,115 @@ diff_timeval(struct timeval *dest,
     }
 }
 
+#define wheel_link_to_timer(l) ((sel_timer_t *) (((char *) (l)) \
+			 - offsetof(sel_timer_t, val.wheel_link)))
+
+static uint64_t
+timeval_to_tick(const struct timeval *tv, int round_up)
+{
+    uint64_t usec = ((uint64_t) tv->tv_sec) * 1000000 + tv->tv_usec;
+
+    if (round_up)
+	usec += SEL_WHEEL_TICK_USEC - 1;
+    return usec / SEL_WHEEL_TICK_USEC;
+}
+
+static void
+tick_to_timeval(uint64_t tick, struct timeval *tv)
+{
+    uint64_t usec = tick * SEL_WHEEL_TICK_USEC;
+
+    tv->tv_sec = usec / 1000000;
+    tv->tv_usec = usec % 1000000;
+}
+
+/* The functions below hide whether the heap or the timer wheel is
+   in use.  They must be called with the timer lock held. */
+
+/* Add the timer, returns true if a thread waiting in select needs to
+   be woken to pick up the new timeout. */
+static int
+sel_timer_add(selector_t *sel, sel_timer_t *timer)
+{
+    volatile sel_timer_t *top;
+
+    if (sel->timer_wheel) {
+	twheel_add(sel->timer_wheel, &timer->val.wheel_link,
+		   timeval_to_tick(&timer->val.timeout, 1));
+	if (sel->wheel_wake_valid
+	    && (cmp_timeval(&timer->val.timeout, &sel->wheel_wake_time) >= 0))
+	    return 0;
+	sel->wheel_wake_time = timer->val.timeout;
+	sel->wheel_wake_valid = 1;
+	return 1;
+    }
+
+    top = theap_get_top(&sel->timer_heap);
+    theap_add(&sel->timer_heap, timer);
+    return top != theap_get_top(&sel->timer_heap);
+}
+
+/* Remove the timer, returns true if a thread waiting in select needs
+   to be woken.  With the wheel a thread that wakes up too early just
+   recalculates its timeout, so it is never woken. */
+static int
+sel_timer_remove(selector_t *sel, sel_timer_t *timer)
+{
+    volatile sel_timer_t *top;
+
+    if (sel->timer_wheel) {
+	twheel_remove(sel->timer_wheel, &timer->val.wheel_link);
+	return 0;
+    }
+
+    top = theap_get_top(&sel->timer_heap);
+    theap_remove(&sel->timer_heap, timer);
+    return top != theap_get_top(&sel->timer_heap);
+}
+
+/* Return a timer that has expired at the given time, or NULL if
+   none have. */
+static sel_timer_t *
+sel_timer_get_expired(selector_t *sel, struct timeval *now)
+{
+    sel_timer_t   *timer;
+    twheel_link_t *link;
+
+    if (sel->timer_wheel) {
+	link = twheel_get_expired(sel->timer_wheel, timeval_to_tick(now, 0));
+	if (!link)
+	    return NULL;
+	return wheel_link_to_timer(link);
+    }
+
+    timer = theap_get_top(&sel->timer_heap);
+    if (timer && (cmp_timeval(now, &timer->val.timeout) >= 0))
+	return timer;
+    return NULL;
+}
+
+/* Get the time select should wait until.  Returns false if no timers
+   are running. */
+static int
+sel_timer_next_timeout(selector_t *sel, struct timeval *next)
+{
+    sel_timer_t *timer;
+    uint64_t    tick;
+
+    if (sel->timer_wheel) {
+	if (!twheel_next_tick(sel->timer_wheel, &tick))
+	    return 0;
+	tick_to_timeval(tick, next);
+	return 1;
+    }
+
+    timer = theap_get_top(&sel->timer_heap);
+    if (!timer)
+	return 0;
+    *next = timer->val.timeout;
+    return 1;
+}
+
 int
 sel_alloc_timer(selector_t            *sel,
 		sel_timeout_handler_t handler,
@@ -431,6 +944,9 @@ sel_alloc_timer(selector_t            *sel,
     timer->val.user_data = user_data;
     timer->val.in_heap = 0;
     timer->val.sel = sel;
+    timer->val.work.type = SEL_WORK_TIMER;
+    timer->val.work.item = timer;
+    timer->val.work.worker = NULL;
     *new_timer = timer;
 
     return 0;
@@ -443,7 +959,7 @@ sel_free_timer(sel_timer_t *timer)
 
     if (sel->have_timer_lock)
 	sel->os_hnd->lock(sel->os_hnd, sel->timer_lock);
-    if (timer->val.in_heap) {
+    if (timer->val.in_heap || timer->val.work.worker) {
 	sel_stop_timer(timer);
     }
     if (sel->have_timer_lock)
@@ -458,25 +974,22 @@ sel_start_timer(sel_timer_t    *timer,
 		struct timeval *timeout)
 {
     selector_t *sel = timer->val.sel;
-    volatile sel_timer_t *top;
 
     if (sel->have_timer_lock)
 	sel->os_hnd->lock(sel->os_hnd, sel->timer_lock);
-    if (timer->val.in_heap) {
+    if (timer->val.in_heap || timer->val.work.worker) {
+	/* Still running, or expired and waiting for a worker. */
 	if (sel->have_timer_lock)
 	    sel->os_hnd->unlock(sel->os_hnd, sel->timer_lock);
 	return EBUSY;
     }
 
-    top = theap_get_top(&timer->val.sel->timer_heap);
-
     timer->val.timeout = *timeout;
-    theap_add(&timer->val.sel->timer_heap, timer);
     timer->val.in_heap = 1;
 
-    if (top != theap_get_top(&timer->val.sel->timer_heap))
-	/* If the top value changed, restart the waiting thread. */
-	wake_sel_thread(timer->val.sel);
+    if (sel_timer_add(sel, timer))
+	/* If the first timeout changed, restart the waiting thread. */
+	wake_sel_thread(sel);
 
     if (sel->have_timer_lock)
 	sel->os_hnd->unlock(sel->os_hnd, sel->timer_lock);
@@ -487,24 +1000,35 @@ int
 sel_stop_timer(sel_timer_t *timer)
 {
     selector_t *sel = timer->val.sel;
-    volatile sel_timer_t *top;
 
     if (sel->have_timer_lock)
 	sel->os_hnd->lock(sel->os_hnd, sel->timer_lock);
     if (!timer->val.in_heap) {
+	int          rv = ETIMEDOUT;
+	sel_worker_t *w = timer->val.work.worker;
+
+	if (w) {
+	    /* The timer expired but a worker has not run it yet, the
+	       handler can still be stopped.  The timer lock keeps it
+	       from being queued again, but a worker may take it off
+	       the queue at any time. */
+	    sel->os_hnd->lock(sel->os_hnd, w->lock);
+	    if (timer->val.work.worker == w) {
+		dequeue_work(&timer->val.work);
+		rv = 0;
+	    }
+	    sel->os_hnd->unlock(sel->os_hnd, w->lock);
+	}
 	if (sel->have_timer_lock)
 	    sel->os_hnd->unlock(sel->os_hnd, sel->timer_lock);
-	return ETIMEDOUT;
+	return rv;
     }
 
-    top = theap_get_top(&timer->val.sel->timer_heap);
-
-    theap_remove(&timer->val.sel->timer_heap, timer);
     timer->val.in_heap = 0;
 
-    if (top != theap_get_top(&timer->val.sel->timer_heap))
-	/* If the top value changed, restart the waiting thread. */
-	wake_sel_thread(timer->val.sel);
+    if (sel_timer_remove(sel, timer))
+	/* If the first timeout changed, restart the waiting thread. */
+	wake_sel_thread(sel);
 
     if (sel->have_timer_lock)
 	sel->os_hnd->unlock(sel->os_hnd, sel->timer_lock);
@@ -533,15 +1057,24 @@ process_timers(selector_t	       *sel,
 	       volatile struct timeval *timeout)
 {
     struct timeval now;
+    struct timeval next;
     sel_timer_t    *timer;
     int            called = 0;
     
-    timer = theap_get_top(&sel->timer_heap);
     get_monotonic_time(&now);
-    while (timer && cmp_timeval(&now, &timer->val.timeout) >= 0) {
-	called = 1;
-	theap_remove(&(sel->timer_heap), timer);
+    timer = sel_timer_get_expired(sel, &now);
+    while (timer) {
+	sel_timer_remove(sel, timer);
 	timer->val.in_heap = 0;
+	if (sel->num_workers) {
+	    /* Queued with the timer lock held, see sel_stop_timer(). */
+	    queue_work(sel,
+		       &sel->workers[sel->next_worker++ % sel->num_workers],
+		       &timer->val.work);
+	    timer = sel_timer_get_expired(sel, &now);
+	    continue;
+	}
+	called = 1;
 	if (sel->have_timer_lock)
 	    sel->os_hnd->unlock(sel->os_hnd, sel->timer_lock);
 	
@@ -549,18 +1082,19 @@ process_timers(selector_t	       *sel,
 	
 	if (sel->have_timer_lock)
 	    sel->os_hnd->lock(sel->os_hnd, sel->timer_lock);
-	timer = theap_get_top(&sel->timer_heap);
+	timer = sel_timer_get_expired(sel, &now);
     }
 
+    sel->wheel_wake_valid = 0;
     if (called) {
 	/* If called, set the timeout to zero. */
 	timeout->tv_sec = 0;
 	timeout->tv_usec = 0;
-    } else if (timer) {
+    } else if (sel_timer_next_timeout(sel, &next)) {
 	get_monotonic_time(&now);
-	diff_timeval((struct timeval *) timeout,
-		     (struct timeval *) &timer->val.timeout,
-		     &now);
+	diff_timeval((struct timeval *) timeout, &next, &now);
+	sel->wheel_wake_time = next;
+	sel->wheel_wake_valid = 1;
     } else {
 	/* No timers, just set a long time. */
 	timeout->tv_sec = 100000;
@@ -568,6 +1102,321 @@ process_timers(selector_t	       *sel,
     }
 }
 
+/* Call the handler for op on the fd, if it is enabled.  Must be
+   called with the fd lock held and with a use_count held on the fd's
+   state.  The lock is released while the handler runs, so fdc may not
+   be valid after this returns. */
+static void
+call_fd_handler(selector_t       *sel,
+		int              fd,
+		fd_control_t     *fdc,
+		enum sel_fd_op_e op)
+{
+    sel_fd_handler_t handler;
+    void             *data;
+
+    if (!(fdc->enabled & (1 << op)))
+	/* Disabled since we waited for it. */
+	return;
+    switch (op) {
+    case SEL_FD_OP_READ:
+	handler = fdc->handle_read;
+	break;
+    case SEL_FD_OP_WRITE:
+	handler = fdc->handle_write;
+	break;
+    default:
+	handler = fdc->handle_except;
+	break;
+    }
+    if (handler == NULL) {
+	/* Somehow we don't have a handler for this.  Just shut it
+	   down.  Note that the fd lock is recursive. */
+	set_fd_enable(sel, fd, op, SEL_FD_HANDLER_DISABLED);
+	return;
+    }
+    data = fdc->data;
+    if (sel->have_fd_lock)
+	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+    handler(fd, data);
+    if (sel->have_fd_lock)
+	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
+}
+
+/* Release a use of the fd's state, freeing it if it has been deleted
+   and this was the last user.  Must be called with the fd lock
+   held. */
+static void
+put_fd_state(int fd, fd_state_t *state)
+{
+    state->use_count--;
+    if (state->deleted && state->use_count == 0) {
+	if (state->done)
+	    state->done(fd, state->data);
+	free(state);
+    }
+}
+
+/* Call the given handler for the fd.  The state is held (with
+   use_count) while the handler runs so that the done handler will not
+   be called while the handler is in use. */
+static void
+handle_fd(selector_t *sel, int fd, enum sel_fd_op_e op)
+{
+    fd_control_t *fdc;
+    fd_state_t   *state;
+
+    if (sel->have_fd_lock)
+	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
+    fdc = get_fd_control(sel, fd, 0);
+    if (!fdc)
+	/* Removed since we waited for it. */
+	goto out_unlock;
+    state = fdc->state;
+    if (state)
+	state->use_count++;
+    call_fd_handler(sel, fd, fdc, op);
+    if (state)
+	put_fd_state(fd, state);
+ out_unlock:
+    if (sel->have_fd_lock)
+	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+}
+
+/* Hand an fd that the poller found ready to a worker.  The fd is
+   marked busy so it is not polled or queued again until the worker
+   is done with it. */
+static void
+queue_fd_work(selector_t *sel, int fd, unsigned int ready)
+{
+    fd_control_t *fdc;
+    fd_state_t   *state;
+    int          op;
+
+    sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
+    fdc = get_fd_control(sel, fd, 0);
+    if (!fdc)
+	goto out_unlock;
+    state = fdc->state;
+    ready &= fdc->enabled;
+    if (!state || !ready) {
+	/* Nothing to run.  If there are no handlers, shut it down like
+	   handle_fd() does. */
+	for (op = SEL_FD_OP_READ; op <= SEL_FD_OP_EXCEPT; op++) {
+	    if (ready & (1 << op))
+		set_fd_enable(sel, fd, op, SEL_FD_HANDLER_DISABLED);
+	}
+	fd_rearm(sel, fd, fdc);
+	goto out_unlock;
+    }
+    if (state->busy) {
+	/* Another poller beat us to it (only possible with select()),
+	   the worker will pick these up before it finishes. */
+	state->ready |= ready;
+	goto out_unlock;
+    }
+    state->busy = 1;
+    state->ready = ready;
+    state->use_count++;
+    queue_work(sel, &sel->workers[fd % sel->num_workers], &state->work);
+ out_unlock:
+    sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+}
+
+/* Run the handlers of a busy fd from a worker thread. */
+static void
+run_fd_work(selector_t *sel, fd_state_t *state)
+{
+    int          fd = state->fd;
+    fd_control_t *fdc;
+    int          op;
+
+    sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
+    while (state->ready && !state->deleted) {
+	for (op = SEL_FD_OP_READ; op <= SEL_FD_OP_EXCEPT; op++) {
+	    if (!(state->ready & (1 << op)))
+		continue;
+	    state->ready &= ~(1 << op);
+	    fdc = get_fd_control(sel, fd, 0);
+	    if (!fdc || (fdc->state != state))
+		break;
+	    call_fd_handler(sel, fd, fdc, op);
+	}
+    }
+    state->ready = 0;
+    state->busy = 0;
+    fdc = get_fd_control(sel, fd, 0);
+    if (fdc)
+	fd_rearm(sel, fd, fdc);
+    put_fd_state(fd, state);
+    sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+}
+
+/* Handle the operations in ready (1 << SEL_FD_OP_xxx) for an fd the
+   poller found ready, either directly or through a worker. */
+static void
+dispatch_fd(selector_t *sel, int fd, unsigned int ready)
+{
+    int op;
+
+    if (sel->num_workers) {
+	queue_fd_work(sel, fd, ready);
+	return;
+    }
+
+    for (op = SEL_FD_OP_READ; op <= SEL_FD_OP_EXCEPT; op++) {
+	if (ready & (1 << op))
+	    handle_fd(sel, fd, op);
+    }
+}
+
+#ifdef HAVE_EPOLL_CREATE
+/* Call the enabled read and write handlers of the fds that epoll
+   refused, like select() would report them.  Returns the number of
+   fds dispatched. */
+static int
+dispatch_always_ready(selector_t *sel)
+{
+    int          fds[SEL_EPOLL_MAX_EVENTS];
+    unsigned int ready[SEL_EPOLL_MAX_EVENTS];
+    fd_control_t *fdc;
+    int          count = 0;
+    int          fd = 0;
+    int          n, i;
+
+    do {
+	n = 0;
+	if (sel->have_fd_lock)
+	    sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
+	for (; (fd <= sel->maxfd) && (n < SEL_EPOLL_MAX_EVENTS); fd++) {
+	    fdc = sel->fds[fd];
+	    if (!fdc || !fdc->always_ready)
+		continue;
+	    if (fdc->state && fdc->state->busy)
+		continue;
+	    ready[n] = fdc->enabled & ((1 << SEL_FD_OP_READ)
+				       | (1 << SEL_FD_OP_WRITE));
+	    if (ready[n])
+		fds[n++] = fd;
+	}
+	if (sel->have_fd_lock)
+	    sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+
+	for (i=0; i<n; i++)
+	    dispatch_fd(sel, fds[i], ready[i]);
+	count += n;
+    } while (n == SEL_EPOLL_MAX_EVENTS);
+
+    return count;
+}
+
+/*
+ * Like process_fds(), but uses epoll to wait.  If the user has
+ * registered extra fds through ipmi_sel_set_read_fds_handler(), those
+ * are waited for with select() along with the epoll fd.
+ */
+static int
+process_fds_epoll(selector_t	          *sel,
+		  volatile struct timeval *timeout)
+{
+    struct epoll_event events[SEL_EPOLL_MAX_EVENTS];
+    fd_set             tmp_read_set;
+    int                num_fds = 0;
+    int                epoll_timeout;
+    struct timeval     zero_timeout = { 0, 0 };
+    int                always_ready;
+    int                i;
+    int                err;
+
+    if (sel->have_fd_lock)
+	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
+    always_ready = sel->num_always_ready > 0;
+    if (always_ready)
+	/* Don't wait, there is something to do already. */
+	timeout = &zero_timeout;
+    if (sel->add_read) {
+	int timeout_invalid;
+	struct timeval ttimeout;
+
+	FD_ZERO(&tmp_read_set);
+	timeout_invalid = 1;
+	sel->add_read(sel, &num_fds, &tmp_read_set,
+		      &ttimeout, &timeout_invalid,
+		      sel->read_cb_data);
+	if (!timeout_invalid
+	    && (cmp_timeval(&ttimeout, (struct timeval *)timeout) <= 0))
+	{
+	    *timeout= ttimeout;
+	}
+    }
+    if (sel->have_fd_lock)
+	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
+
+    if (num_fds > 0) {
+	/* The user has fds of their own, wait for those and the epoll
+	   fd (which is readable when it has events) with select(). */
+	FD_SET(sel->epollfd, &tmp_read_set);
+	if (sel->epollfd >= num_fds)
+	    num_fds = sel->epollfd + 1;
+	err = select(num_fds, &tmp_read_set, NULL, NULL,
+		     (struct timeval *) timeout);
+	if (err <= 0) {
+	    if ((err == 0) && (sel->check_timeout))
+		sel->check_timeout(sel, sel->read_cb_data);
+	    goto out;
+	}
+
+	i = FD_ISSET(sel->epollfd, &tmp_read_set);
+	FD_CLR(sel->epollfd, &tmp_read_set);
+	if (sel->check_read)
+	    sel->check_read(sel, &tmp_read_set, sel->read_cb_data);
+	if (!i)
+	    goto out;
+	epoll_timeout = 0;
+    } else {
+	/* Round up, we don't want to wake up before the timer. */
+	epoll_timeout = (timeout->tv_sec * 1000
+			 + (timeout->tv_usec + 999) / 1000);
+    }
+
+    err = epoll_wait(sel->epollfd, events, SEL_EPOLL_MAX_EVENTS,
+		     epoll_timeout);
+    if (err <= 0) {
+	if ((err == 0) && (num_fds == 0) && (sel->check_timeout))
+	    sel->check_timeout(sel, sel->read_cb_data);
+	goto out;
+    }
+
+    /* We got some I/O, only look at the fds that are ready.  Errors
+       and hangups are reported to the read and write handlers, like
+       select() does.  Operations that are not enabled are ignored
+       when dispatching. */
+    for (i=0; i<err; i++) {
+	uint32_t     ev = events[i].events;
+	unsigned int ready = 0;
+
+	if (events[i].data.fd == sel->wake_fd[0]) {
+	    clear_wake_fd(sel);
+	    continue;
+	}
+	if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))
+	    ready |= 1 << SEL_FD_OP_READ;
+	if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+	    ready |= 1 << SEL_FD_OP_WRITE;
+	if (ev & EPOLLPRI)
+	    ready |= 1 << SEL_FD_OP_EXCEPT;
+	dispatch_fd(sel, events[i].data.fd, ready);
+    }
+ out:
+    if (always_ready) {
+	i = dispatch_always_ready(sel);
+	if ((i > 0) && (err <= 0))
+	    err = i;
+    }
+    return err;
+}
+#endif
+
 /*
  * return == 0  when timeout
  * 	  >  0  when successful 
@@ -586,13 +1435,38 @@ process_fds(selector_t	            *sel,
     int i;
     int err;
     int num_fds;
-    
+
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->epollfd >= 0)
+	return process_fds_epoll(sel, timeout);
+#endif
+
     if (sel->have_fd_lock)
 	sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-    memcpy(&tmp_read_set, (void *) &sel->read_set, sizeof(tmp_read_set));
-    memcpy(&tmp_write_set, (void *) &sel->write_set, sizeof(tmp_write_set));
-    memcpy(&tmp_except_set, (void *) &sel->except_set, sizeof(tmp_except_set));
+    FD_ZERO(&tmp_read_set);
+    FD_ZERO(&tmp_write_set);
+    FD_ZERO(&tmp_except_set);
+    for (i=0; i<=sel->maxfd; i++) {
+	fd_control_t *fdc = sel->fds[i];
+
+	if (!fdc)
+	    continue;
+	if (fdc->state && fdc->state->busy)
+	    /* A worker is handling it. */
+	    continue;
+	if (fdc->enabled & (1 << SEL_FD_OP_READ))
+	    FD_SET(i, &tmp_read_set);
+	if (fdc->enabled & (1 << SEL_FD_OP_WRITE))
+	    FD_SET(i, &tmp_write_set);
+	if (fdc->enabled & (1 << SEL_FD_OP_EXCEPT))
+	    FD_SET(i, &tmp_except_set);
+    }
     num_fds = sel->maxfd+1;
+    if (sel->wake_fd[0] >= 0) {
+	FD_SET(sel->wake_fd[0], &tmp_read_set);
+	if (sel->wake_fd[0] >= num_fds)
+	    num_fds = sel->wake_fd[0] + 1;
+    }
     if (sel->add_read) {
 	int timeout_invalid;
 	struct timeval ttimeout;
@@ -621,104 +1495,26 @@ process_fds(selector_t	            *sel,
 	goto out;
     }
 
+    if ((sel->wake_fd[0] >= 0) && FD_ISSET(sel->wake_fd[0], &tmp_read_set)) {
+	FD_CLR(sel->wake_fd[0], &tmp_read_set);
+	clear_wake_fd(sel);
+    }
+
     if (sel->check_read)
 	sel->check_read(sel, &tmp_read_set, sel->read_cb_data);
     
     /* We got some I/O. */
-    for (i=0; i<=sel->maxfd; i++) {
-	if (FD_ISSET(i, &tmp_read_set)) {
-	    sel_fd_handler_t handle_read;
-	    void             *data;
-	    fd_state_t       *state;
-
-	    if (sel->have_fd_lock)
-		sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-	    if (sel->fds[i].handle_read == NULL) {
-		/* Somehow we don't have a handler for this.
-		   Just shut it down. */
-		sel_set_fd_read_handler(sel, i, SEL_FD_HANDLER_DISABLED);
-	    } else {
-		handle_read = sel->fds[i].handle_read;
-		data = sel->fds[i].data;
-		state = sel->fds[i].state;
-		state->use_count++;
-		if (sel->have_fd_lock)
-		    sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
-		handle_read(i, data);
-		if (sel->have_fd_lock)
-		    sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-		state->use_count--;
-		if (state->deleted && state->use_count == 0) {
-		    if (state->done)
-			state->done(i, data);
-		    free(state);
-		}
-	    }
-	    if (sel->have_fd_lock)
-		sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
-	}
-	if (FD_ISSET(i, &tmp_write_set)) {
-	    sel_fd_handler_t handle_write;
-	    void             *data;
-	    fd_state_t       *state;
-
-	    if (sel->have_fd_lock)
-		sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-	    if (sel->fds[i].handle_write == NULL) {
-		/* Somehow we don't have a handler for this.
-                   Just shut it down. */
-		sel_set_fd_write_handler(sel, i, SEL_FD_HANDLER_DISABLED);
-	    } else {
-		handle_write = sel->fds[i].handle_write;
-		data = sel->fds[i].data;
-		state = sel->fds[i].state;
-		state->use_count++;
-		if (sel->have_fd_lock)
-		    sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
-		handle_write(i, data);
-		if (sel->have_fd_lock)
-		    sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-		state->use_count--;
-		if (state->deleted && state->use_count == 0) {
-		    if (state->done)
-			state->done(i, data);
-		    free(state);
-		}
-	    }
-	    if (sel->have_fd_lock)
-		sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
-	}
-	if (FD_ISSET(i, &tmp_except_set)) {
-	    sel_fd_handler_t handle_except;
-	    void             *data;
-	    fd_state_t       *state;
-
-	    if (sel->have_fd_lock)
-		sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-	    if (sel->fds[i].handle_except == NULL) {
-		/* Somehow we don't have a handler for this.
-                   Just shut it down. */
-		sel_set_fd_except_handler(sel, i, SEL_FD_HANDLER_DISABLED);
-	    } else {
-	        handle_except = sel->fds[i].handle_except;
-		data = sel->fds[i].data;
-		state = sel->fds[i].state;
-		state->use_count++;
-		if (sel->have_fd_lock)
-		    sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
-	        handle_except(i, data);
-		if (sel->have_fd_lock)
-		    sel->os_hnd->lock(sel->os_hnd, sel->fd_lock);
-		state->use_count--;
-		if (state->deleted && state->use_count == 0) {
-		    if (state->done)
-			state->done(i, data);
-		    free(state);
-		}
-	    }
-	    if (sel->have_fd_lock)
-		sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
-	}
+    for (i=0; i<num_fds; i++) {
+	unsigned int ready = 0;
+
+	if (FD_ISSET(i, &tmp_read_set))
+	    ready |= 1 << SEL_FD_OP_READ;
+	if (FD_ISSET(i, &tmp_write_set))
+	    ready |= 1 << SEL_FD_OP_WRITE;
+	if (FD_ISSET(i, &tmp_except_set))
+	    ready |= 1 << SEL_FD_OP_EXCEPT;
+	if (ready)
+	    dispatch_fd(sel, i, ready);
     }
 out:
     return err;
@@ -780,6 +1576,187 @@ sel_select_loop(selector_t      *sel,
     }
 }
 
+/* Get the next item of work for a worker, waiting for it if
+   necessary.  Returns NULL when the workers are being stopped. */
+static sel_work_t *
+get_work(selector_t *sel, sel_worker_t *w)
+{
+    os_handler_t *os_hnd = sel->os_hnd;
+    sel_work_t   *work;
+    unsigned int i;
+
+    os_hnd->lock(os_hnd, w->lock);
+    for (;;) {
+	work = pop_work(w, 0);
+	if (work || sel->workers_stopping)
+	    break;
+	w->kick = 0;
+	os_hnd->unlock(os_hnd, w->lock);
+
+	/* Nothing on our queue, try to steal from the others. */
+	work = NULL;
+	for (i=1; !work && (i<sel->num_workers); i++) {
+	    sel_worker_t *other;
+
+	    other = &sel->workers[((w - sel->workers) + i) % sel->num_workers];
+	    os_hnd->lock(os_hnd, other->lock);
+	    work = pop_work(other, 1);
+	    os_hnd->unlock(os_hnd, other->lock);
+	}
+
+	os_hnd->lock(os_hnd, w->lock);
+	if (work)
+	    break;
+	/* If we were kicked while looking, look again. */
+	if (!w->kick && (w->queue.next == &w->queue)
+	    && !sel->workers_stopping)
+	{
+	    w->idle = 1;
+	    os_hnd->cond_wait(os_hnd, w->cond, w->lock);
+	    w->idle = 0;
+	}
+    }
+    os_hnd->unlock(os_hnd, w->lock);
+    return work;
+}
+
+static void
+sel_worker_thread(void *data)
+{
+    sel_worker_t *w = data;
+    selector_t   *sel = w->sel;
+    sel_work_t   *work;
+
+    while ((work = get_work(sel, w))) {
+	if (work->type == SEL_WORK_FD) {
+	    run_fd_work(sel, work->item);
+	} else {
+	    sel_timer_t *timer = work->item;
+
+	    timer->val.handler(sel, timer, timer->val.user_data);
+	}
+    }
+
+    sel->os_hnd->lock(sel->os_hnd, sel->workers_lock);
+    sel->workers_running--;
+    sel->os_hnd->cond_broadcast(sel->os_hnd, sel->workers_done_cond);
+    sel->os_hnd->unlock(sel->os_hnd, sel->workers_lock);
+}
+
+/* Stop the running worker threads and free the worker data. */
+static void
+stop_workers(selector_t *sel, unsigned int count)
+{
+    os_handler_t *os_hnd = sel->os_hnd;
+    unsigned int i;
+
+    sel->workers_stopping = 1;
+    for (i=0; i<count; i++) {
+	os_hnd->lock(os_hnd, sel->workers[i].lock);
+	kick_worker(sel, &sel->workers[i]);
+	os_hnd->unlock(os_hnd, sel->workers[i].lock);
+    }
+    os_hnd->lock(os_hnd, sel->workers_lock);
+    while (sel->workers_running > 0)
+	os_hnd->cond_wait(os_hnd, sel->workers_done_cond, sel->workers_lock);
+    os_hnd->unlock(os_hnd, sel->workers_lock);
+
+    for (i=0; i<count; i++) {
+	os_hnd->destroy_cond(os_hnd, sel->workers[i].cond);
+	os_hnd->destroy_lock(os_hnd, sel->workers[i].lock);
+    }
+    os_hnd->destroy_cond(os_hnd, sel->workers_done_cond);
+    os_hnd->destroy_lock(os_hnd, sel->workers_lock);
+    free(sel->workers);
+    sel->workers = NULL;
+    sel->num_workers = 0;
+}
+
+int
+sel_start_workers(selector_t *sel, unsigned int num_workers)
+{
+    os_handler_t *os_hnd = sel->os_hnd;
+    unsigned int i;
+    int          rv;
+
+    if (num_workers == 0)
+	return EINVAL;
+    if (!sel->have_fd_lock || !sel->have_timer_lock
+	|| !os_hnd->create_thread || !os_hnd->create_cond)
+	return ENOSYS;
+    if (sel->workers)
+	return EBUSY;
+
+    sel->workers = malloc(num_workers * sizeof(sel_worker_t));
+    if (!sel->workers)
+	return ENOMEM;
+    memset(sel->workers, 0, num_workers * sizeof(sel_worker_t));
+    rv = os_hnd->create_lock(os_hnd, &sel->workers_lock);
+    if (rv)
+	goto out_err_free;
+    rv = os_hnd->create_cond(os_hnd, &sel->workers_done_cond);
+    if (rv) {
+	os_hnd->destroy_lock(os_hnd, sel->workers_lock);
+	goto out_err_free;
+    }
+    sel->workers_stopping = 0;
+
+    /* The workers just wait on their queues until num_workers is set
+       below, so they can be started one at a time. */
+    for (i=0; i<num_workers; i++) {
+	sel_worker_t *w = &sel->workers[i];
+
+	w->sel = sel;
+	w->queue.next = &w->queue;
+	w->queue.prev = &w->queue;
+	rv = os_hnd->create_lock(os_hnd, &w->lock);
+	if (rv)
+	    goto out_err;
+	rv = os_hnd->create_cond(os_hnd, &w->cond);
+	if (rv) {
+	    os_hnd->destroy_lock(os_hnd, w->lock);
+	    goto out_err;
+	}
+	os_hnd->lock(os_hnd, sel->workers_lock);
+	sel->workers_running++;
+	os_hnd->unlock(os_hnd, sel->workers_lock);
+	rv = os_hnd->create_thread(os_hnd, 0, sel_worker_thread, w);
+	if (rv) {
+	    os_hnd->lock(os_hnd, sel->workers_lock);
+	    sel->workers_running--;
+	    os_hnd->unlock(os_hnd, sel->workers_lock);
+	    os_hnd->destroy_cond(os_hnd, w->cond);
+	    os_hnd->destroy_lock(os_hnd, w->lock);
+	    goto out_err;
+	}
+    }
+
+    os_hnd->lock(os_hnd, sel->timer_lock);
+    os_hnd->lock(os_hnd, sel->fd_lock);
+    sel->num_workers = num_workers;
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->epollfd >= 0) {
+	/* Re-register the current fds with EPOLLONESHOT. */
+	for (i=0; (int) i<sel->fds_size; i++) {
+	    if (sel->fds[i])
+		sel_update_epoll(sel, i, sel->fds[i], 1);
+	}
+    }
+#endif
+    os_hnd->unlock(os_hnd, sel->fd_lock);
+    os_hnd->unlock(os_hnd, sel->timer_lock);
+    return 0;
+
+ out_err:
+    stop_workers(sel, i);
+    return rv;
+
+ out_err_free:
+    free(sel->workers);
+    sel->workers = NULL;
+    return rv;
+}
+
 void
 ipmi_sel_set_read_fds_handler(selector_t                 *sel, 
 			      ipmi_sel_add_read_fds_cb   add,
@@ -797,12 +1774,75 @@ ipmi_sel_set_read_fds_handler(selector_t                 *sel,
 	sel->os_hnd->unlock(sel->os_hnd, sel->fd_lock);
 }
 
+static void
+close_wake_fd(selector_t *sel)
+{
+    if (sel->wake_fd[0] >= 0)
+	close(sel->wake_fd[0]);
+    if ((sel->wake_fd[1] >= 0) && (sel->wake_fd[1] != sel->wake_fd[0]))
+	close(sel->wake_fd[1]);
+    sel->wake_fd[0] = -1;
+    sel->wake_fd[1] = -1;
+}
+
+/* Create the fd used to wake threads in select, an eventfd if
+   possible, otherwise a pipe. */
+static int
+setup_wake_fd(selector_t *sel)
+{
+    int fd = -1;
+    int i;
+    int rv;
+
+#ifdef HAVE_EVENTFD
+    fd = eventfd(0, 0);
+#endif
+    if (fd >= 0) {
+	sel->wake_fd[0] = fd;
+	sel->wake_fd[1] = fd;
+    } else if (pipe(sel->wake_fd)) {
+	sel->wake_fd[0] = -1;
+	sel->wake_fd[1] = -1;
+	return errno;
+    }
+
+    for (i=0; i<2; i++) {
+	fcntl(sel->wake_fd[i], F_SETFL, O_NONBLOCK);
+	fcntl(sel->wake_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    if (!valid_fd(sel, sel->wake_fd[0])) {
+	rv = EMFILE;
+	goto out_err;
+    }
+
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->epollfd >= 0) {
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = sel->wake_fd[0];
+	if (epoll_ctl(sel->epollfd, EPOLL_CTL_ADD, sel->wake_fd[0], &event)) {
+	    rv = errno;
+	    goto out_err;
+	}
+    }
+#endif
+
+    return 0;
+
+ out_err:
+    close_wake_fd(sel);
+    return rv;
+}
+
 /* Initialize the select code. */
 int
-sel_alloc_selector(os_handler_t *os_hnd, selector_t **new_selector)
+sel_alloc_selector_flags(os_handler_t *os_hnd, unsigned int flags,
+			 selector_t **new_selector)
 {
     selector_t *sel;
-    unsigned int        i;
     int        rv;
 
     sel = malloc(sizeof(*sel));
@@ -812,10 +1852,34 @@ sel_alloc_selector(os_handler_t *os_hnd, selector_t **new_selector)
 
     sel->os_hnd = os_hnd;
 
+#ifdef HAVE_EPOLL_CREATE
+    sel->epollfd = -1;
+    if (!(flags & SEL_FLAG_USE_SELECT)) {
+	/* The size is just a hint. */
+	sel->epollfd = epoll_create(32);
+	if (sel->epollfd < 0) {
+	    /* Maybe the kernel doesn't support it, fall back to
+	       select(). */
+	    syslog(LOG_WARNING, "sel_alloc_selector: epoll_create: %m,"
+		   " using select()");
+	} else {
+	    fcntl(sel->epollfd, F_SETFD, FD_CLOEXEC);
+	}
+    }
+#endif
+
     /* The list is initially empty. */
     sel->wait_list.next = &sel->wait_list;
     sel->wait_list.prev = &sel->wait_list;
 
+    sel->wake_fd[0] = -1;
+    sel->wake_fd[1] = -1;
+    if (flags & SEL_FLAG_WAKE_FD) {
+	rv = setup_wake_fd(sel);
+	if (rv)
+	    goto out_err;
+    }
+
     rv = 0;
     if (sel->os_hnd->create_lock) {
 	rv = sel->os_hnd->create_lock(sel->os_hnd, &sel->timer_lock);
@@ -834,15 +1898,23 @@ sel_alloc_selector(os_handler_t *os_hnd, selector_t **new_selector)
     if (rv)
 	goto out_err;
 
-    FD_ZERO((fd_set *) &sel->read_set);
-    FD_ZERO((fd_set *) &sel->write_set);
-    FD_ZERO((fd_set *) &sel->except_set);
-
-    for (i=0; i<FD_SETSIZE; i++) {
-	init_fd((fd_control_t *) &(sel->fds[i]));
-    }
+    /* The fd table is allocated when the first fd is registered. */
+    sel->fds = NULL;
+    sel->fds_size = 0;
+    sel->maxfd = -1;
 
     theap_init(&sel->timer_heap);
+    if (flags & SEL_FLAG_TIMER_WHEEL) {
+	struct timeval now;
+
+	sel->timer_wheel = malloc(sizeof(*sel->timer_wheel));
+	if (!sel->timer_wheel) {
+	    rv = ENOMEM;
+	    goto out_err;
+	}
+	get_monotonic_time(&now);
+	twheel_init(sel->timer_wheel, timeval_to_tick(&now, 0));
+    }
 
     *new_selector = sel;
 
@@ -852,15 +1924,32 @@ sel_alloc_selector(os_handler_t *os_hnd, selector_t **new_selector)
 	    sel->os_hnd->destroy_lock(sel->os_hnd, sel->timer_lock);
 	if (sel->have_fd_lock)
 	    sel->os_hnd->destroy_lock(sel->os_hnd, sel->fd_lock);
+	if (sel->timer_wheel)
+	    free(sel->timer_wheel);
+	close_wake_fd(sel);
+#ifdef HAVE_EPOLL_CREATE
+	if (sel->epollfd >= 0)
+	    close(sel->epollfd);
+#endif
 	free(sel);
     }
     return rv;
 }
 
+int
+sel_alloc_selector(os_handler_t *os_hnd, selector_t **new_selector)
+{
+    return sel_alloc_selector_flags(os_hnd, 0, new_selector);
+}
+
 int
 sel_free_selector(selector_t *sel)
 {
     sel_timer_t *elem;
+    int         i;
+
+    if (sel->workers)
+	stop_workers(sel, sel->num_workers);
 
     if (sel->have_timer_lock)
 	sel->os_hnd->destroy_lock(sel->os_hnd, sel->timer_lock);
@@ -873,6 +1962,29 @@ sel_free_selector(selector_t *sel)
 	free(elem);
 	elem = theap_get_top(&(sel->timer_heap));
     }
+    if (sel->timer_wheel) {
+	twheel_link_t *link;
+
+	while ((link = twheel_get_any(sel->timer_wheel))) {
+	    twheel_remove(sel->timer_wheel, link);
+	    free(wheel_link_to_timer(link));
+	}
+	free(sel->timer_wheel);
+    }
+    for (i=0; i<sel->fds_size; i++) {
+	if (sel->fds[i]) {
+	    if (sel->fds[i]->state)
+		free(sel->fds[i]->state);
+	    free(sel->fds[i]);
+	}
+    }
+    if (sel->fds)
+	free(sel->fds);
+    close_wake_fd(sel);
+#ifdef HAVE_EPOLL_CREATE
+    if (sel->epollfd >= 0)
+	close(sel->epollfd);
+#endif
     free(sel);
 
     return 0;
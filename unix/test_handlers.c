@@ -58,6 +58,9 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 #include <OpenIPMI/ipmi_posix.h>
 
 os_handler_t *test_os_hnd;
@@ -161,8 +164,256 @@ timeout_handler(void *cb_data, os_hnd_timer_id_t *id)
     }
 }
 
+os_handler_waiter_t *fd_waiter;
+int expect_fd_data = 0;
+int fd_freed = 0;
 static void
-test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
+fd_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    char c;
+    int  rv;
+
+    /* With multiple threads, more than one may be woken for the
+       same data, so the fd is non-blocking. */
+    rv = read(fd, &c, 1);
+    if ((rv == -1) && (errno == EAGAIN))
+	return;
+    if (rv != 1)
+	err_leave(errno, "Unable to read from pipe\n");
+    if (c != 'a' + expect_fd_data)
+	err_leave(0, "Invalid fd data: %c\n", c);
+    expect_fd_data++;
+    os_handler_waiter_release(fd_waiter);
+}
+
+static void
+fd_data_freed(int fd, void *cb_data)
+{
+    fd_freed++;
+    os_handler_waiter_release(fd_waiter);
+}
+
+/* Move the fd above FD_SETSIZE, if the fd limit allows it.  Returns
+   the new fd, or the old one if it could not be moved. */
+static int
+move_fd_high(int fd)
+{
+    struct rlimit lim;
+    int           newfd = FD_SETSIZE + 10;
+
+    if (getrlimit(RLIMIT_NOFILE, &lim) == -1)
+	return fd;
+    if (lim.rlim_cur <= (rlim_t) newfd) {
+	if (lim.rlim_max <= (rlim_t) newfd)
+	    return fd;
+	lim.rlim_cur = newfd + 1;
+	if (setrlimit(RLIMIT_NOFILE, &lim) == -1)
+	    return fd;
+    }
+    if (dup2(fd, newfd) == -1)
+	return fd;
+    close(fd);
+    return newfd;
+}
+
+static void
+test_fds(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory,
+	 int high_fd)
+{
+    os_hnd_fd_id_t *fd_id;
+    struct timeval tv;
+    int            fds[2];
+    int            i;
+    int            rv;
+
+    printf("FD test%s\n", high_fd ? " (above FD_SETSIZE)" : "");
+    if (pipe(fds) == -1)
+	err_leave(errno, "Unable to allocate pipe\n");
+    if (high_fd) {
+	fds[0] = move_fd_high(fds[0]);
+	if (fds[0] < FD_SETSIZE) {
+	    printf("Unable to allocate a high fd, skipping\n");
+	    close(fds[0]);
+	    close(fds[1]);
+	    return;
+	}
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    fd_waiter = os_handler_alloc_waiter(factory);
+    if (!fd_waiter)
+	err_leave(0, "Unable to allocate waiter\n");
+
+    rv = os_hnd->add_fd_to_wait_for(os_hnd, fds[0], fd_data_ready, NULL,
+				    fd_data_freed, &fd_id);
+    if (high_fd && (rv == EINVAL)) {
+	/* The selector was built without epoll. */
+	printf("High fds not supported, skipping\n");
+	os_handler_free_waiter(fd_waiter);
+	close(fds[0]);
+	close(fds[1]);
+	return;
+    }
+    if (rv)
+	err_leave(rv, "Unable to add fd");
+
+    for (i=0; i<3; i++) {
+	char c = 'a' + i;
+
+	if (i > 0)
+	    os_handler_waiter_use(fd_waiter);
+	if (write(fds[1], &c, 1) != 1)
+	    err_leave(errno, "Unable to write to pipe\n");
+	tv.tv_sec = 3;
+	tv.tv_usec = 0;
+	os_handler_waiter_wait(fd_waiter, &tv);
+	if (expect_fd_data != i + 1)
+	    err_leave(0, "Error in fd handling: %d\n", expect_fd_data);
+    }
+
+    /* The freed handler may run in another thread, wait for it. */
+    os_handler_waiter_use(fd_waiter);
+    rv = os_hnd->remove_fd_to_wait_for(os_hnd, fd_id);
+    if (rv)
+	err_leave(rv, "Unable to remove fd");
+    tv.tv_sec = 3;
+    tv.tv_usec = 0;
+    os_handler_waiter_wait(fd_waiter, &tv);
+    if (fd_freed != 1)
+	err_leave(0, "fd data not freed: %d\n", fd_freed);
+
+    os_handler_free_waiter(fd_waiter);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int file_data_count = 0;
+static void
+file_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    char c;
+
+    /* A regular file is always ready, even at the end.  More than
+       one thread may be in here, so don't check the order. */
+    if (read(fd, &c, 1) != 1)
+	return;
+    if ((c < 'a') || (c > 'c'))
+	err_leave(0, "Invalid file data: %c\n", c);
+    if (__sync_add_and_fetch(&file_data_count, 1) == 3)
+	os_handler_waiter_release(fd_waiter);
+}
+
+/* epoll can't wait for regular files, make sure they are still
+   handled like select() handles them. */
+static void
+test_file_fd(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
+{
+    char           name[] = "/tmp/test_handlers.XXXXXX";
+    os_hnd_fd_id_t *fd_id;
+    struct timeval tv;
+    int            fd;
+    int            rv;
+
+    printf("Regular file FD test\n");
+    fd = mkstemp(name);
+    if (fd == -1)
+	err_leave(errno, "Unable to create file\n");
+    unlink(name);
+    if (write(fd, "abc", 3) != 3)
+	err_leave(errno, "Unable to write to file\n");
+    lseek(fd, 0, SEEK_SET);
+
+    fd_waiter = os_handler_alloc_waiter(factory);
+    if (!fd_waiter)
+	err_leave(0, "Unable to allocate waiter\n");
+
+    file_data_count = 0;
+    rv = os_hnd->add_fd_to_wait_for(os_hnd, fd, file_data_ready, NULL,
+				    NULL, &fd_id);
+    if (rv)
+	err_leave(rv, "Unable to add file fd");
+    tv.tv_sec = 3;
+    tv.tv_usec = 0;
+    os_handler_waiter_wait(fd_waiter, &tv);
+    if (file_data_count != 3)
+	err_leave(0, "Error in file fd handling: %d\n", file_data_count);
+
+    rv = os_hnd->remove_fd_to_wait_for(os_hnd, fd_id);
+    if (rv)
+	err_leave(rv, "Unable to remove file fd");
+    os_handler_free_waiter(fd_waiter);
+    close(fd);
+}
+
+static void
+test_database(os_handler_t *os_hnd)
+{
+    char          dir[] = "/tmp/test_handlers.XXXXXX";
+    char          path[64];
+    unsigned char data1[] = "first data";
+    unsigned char data2[] = "the second data";
+    unsigned char *data, *data_old;
+    unsigned int  len;
+    unsigned int  fetch_completed;
+    int           rv;
+
+    if (!os_hnd->database_set_filename)
+	return;
+
+    printf("Database test\n");
+    if (!mkdtemp(dir))
+	err_leave(errno, "Unable to create database directory\n");
+    snprintf(path, sizeof(path), "%s/db", dir);
+    rv = os_hnd->database_set_filename(os_hnd, path);
+    if (rv)
+	err_leave(rv, "Unable to set database file\n");
+
+    rv = os_hnd->database_find(os_hnd, "key", &fetch_completed,
+			       &data, &len, NULL, NULL);
+    if (rv != ENOENT)
+	err_leave(rv, "Expected ENOENT finding missing key\n");
+    rv = os_hnd->database_store(os_hnd, "../key", data1, sizeof(data1));
+    if (rv != EINVAL)
+	err_leave(rv, "Expected EINVAL storing bad key\n");
+
+    rv = os_hnd->database_store(os_hnd, "key", data1, sizeof(data1));
+    if (rv)
+	err_leave(rv, "Unable to store data\n");
+    rv = os_hnd->database_find(os_hnd, "key", &fetch_completed,
+			       &data_old, &len, NULL, NULL);
+    if (rv)
+	err_leave(rv, "Unable to find data\n");
+    if (!fetch_completed || (len != sizeof(data1))
+	|| (memcmp(data_old, data1, len) != 0))
+	err_leave(0, "Invalid data found\n");
+
+    /* Replacing the data must not change data already found. */
+    rv = os_hnd->database_store(os_hnd, "key", data2, sizeof(data2));
+    if (rv)
+	err_leave(rv, "Unable to replace data\n");
+    rv = os_hnd->database_find(os_hnd, "key", &fetch_completed,
+			       &data, &len, NULL, NULL);
+    if (rv)
+	err_leave(rv, "Unable to find replaced data\n");
+    if ((len != sizeof(data2)) || (memcmp(data, data2, len) != 0))
+	err_leave(0, "Invalid replaced data found\n");
+    if (memcmp(data_old, data1, sizeof(data1)) != 0)
+	err_leave(0, "Old data changed by replace\n");
+    os_hnd->database_free(os_hnd, data);
+    os_hnd->database_free(os_hnd, data_old);
+
+    /* The data goes in a directory named after the database file. */
+    snprintf(path, sizeof(path), "%s/db.d/key", dir);
+    if (unlink(path))
+	err_leave(errno, "Data not stored in the database directory\n");
+    snprintf(path, sizeof(path), "%s/db.d", dir);
+    rmdir(path);
+    rmdir(dir);
+}
+
+static void
+test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory,
+		int high_fd)
 {
     os_hnd_timer_id_t           *timer;
     struct timeval              now;
@@ -201,6 +452,16 @@ test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
 
     os_handler_free_waiter(timer_waiter);
 
+    test_fds(os_hnd, factory, 0);
+    if (high_fd) {
+	expect_fd_data = 0;
+	fd_freed = 0;
+	test_fds(os_hnd, factory, 1);
+    }
+    test_file_fd(os_hnd, factory);
+
+    test_database(os_hnd);
+
     rv = os_handler_free_waiter_factory(factory);
     if (rv)
 	err_leave(rv, "Error freeing factory\n");
@@ -213,6 +474,8 @@ reset_tests(void)
 {
     expect_log = 0;
     expect_timeout = 0;
+    expect_fd_data = 0;
+    fd_freed = 0;
 }
 
 int ipmi_malloc_init(os_handler_t *os_hnd);
@@ -222,6 +485,7 @@ main(int argc, char *argv[])
 {
     os_handler_waiter_factory_t *factory;
     os_handler_t *os_hnd;
+    selector_t   *sel;
     int          rv;
 
     printf("*** Testing POSIX OS handler\n");
@@ -238,7 +502,41 @@ main(int argc, char *argv[])
     rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
     if (rv)
 	err_leave(rv, "Unable to allocate waiter factory\n");
-    test_os_handler(os_hnd, factory);
+    test_os_handler(os_hnd, factory, 1);
+
+    printf("*** Testing POSIX OS handler (select)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_get_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    rv = sel_alloc_selector_flags(os_hnd, SEL_FLAG_USE_SELECT, &sel);
+    if (rv)
+	err_leave(rv, "Unable to allocate selector\n");
+    ipmi_posix_os_handler_set_sel(os_hnd, sel);
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory, 0);
+
+    printf("*** Testing POSIX OS handler (timer wheel)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_get_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    rv = sel_alloc_selector_flags(os_hnd, SEL_FLAG_TIMER_WHEEL, &sel);
+    if (rv)
+	err_leave(rv, "Unable to allocate selector\n");
+    ipmi_posix_os_handler_set_sel(os_hnd, sel);
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory, 1);
 
     printf("*** Testing POSIX Threaded OS handler (multithread)\n");
     reset_tests();
@@ -251,7 +549,36 @@ main(int argc, char *argv[])
     rv = os_handler_alloc_waiter_factory(os_hnd, 2, 0, &factory);
     if (rv)
 	err_leave(rv, "Unable to allocate waiter factory\n");
-    test_os_handler(os_hnd, factory);
+    test_os_handler(os_hnd, factory, 1);
+
+    printf("*** Testing POSIX Threaded OS handler (wake fd)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_thread_setup_os_handler(0);
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 2, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory, 1);
+
+    printf("*** Testing POSIX Threaded OS handler (workers)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_thread_setup_os_handler(SIGUSR1);
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    rv = sel_start_workers(ipmi_posix_thread_os_handler_get_sel(os_hnd), 4);
+    if (rv)
+	err_leave(rv, "Unable to start workers\n");
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 2, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory, 1);
 
     printf("*** Testing POSIX Threaded OS handler (singlethread)\n");
     reset_tests();
@@ -264,7 +591,7 @@ main(int argc, char *argv[])
     rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
     if (rv)
 	err_leave(rv, "Unable to allocate waiter factory\n");
-    test_os_handler(os_hnd, factory);
+    test_os_handler(os_hnd, factory, 1);
 
     return 0;
 }
@@ -0,0 +1,429 @@
+/*
+ * test_sel.c
+ *
+ * Check that the SEL code follows changes made to a SEL by someone
+ * else.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A domain is opened on a stub connection that never comes up.  The
+ * stub answers the SEL commands from a small emulated SEL on the
+ * system interface MC.  The SEL is fetched, then changed behind the
+ * library's back, then fetched again, and the events the library
+ * holds are checked each time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <OpenIPMI/ipmiif.h>
+#include <OpenIPMI/ipmi_conn.h>
+#include <OpenIPMI/ipmi_msgbits.h>
+#include <OpenIPMI/ipmi_err.h>
+#include <OpenIPMI/ipmi_posix.h>
+#include <OpenIPMI/internal/ipmi_int.h>
+#include <OpenIPMI/internal/ipmi_domain.h>
+#include <OpenIPMI/internal/ipmi_mc.h>
+#include <OpenIPMI/internal/ipmi_sel.h>
+
+#define MAX_PENDING 16
+#define MAX_SEL_ENTRIES 16
+
+typedef struct pending_s
+{
+    ipmi_ll_rsp_handler_t handler;
+    ipmi_msgi_t           *rspi;
+    ipmi_addr_t           addr;
+    unsigned int          addr_len;
+    unsigned char         netfn;
+    unsigned char         cmd;
+    unsigned char         data[IPMI_MAX_MSG_LENGTH];
+    unsigned int          data_len;
+} pending_t;
+
+static pending_t    pending[MAX_PENDING];
+static unsigned int num_pending;
+
+/* The emulated SEL. */
+static unsigned int  num_entries;
+static unsigned char entries[MAX_SEL_ENTRIES][16];
+static uint32_t      add_timestamp;
+static uint32_t      erase_timestamp;
+static unsigned int  reservation;
+
+static int
+stub_start_con(ipmi_con_t *ipmi)
+{
+    return 0;
+}
+
+static int
+stub_con_change_handler(ipmi_con_t             *ipmi,
+			ipmi_ll_con_changed_cb handler,
+			void                   *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_ipmb_addr_handler(ipmi_con_t           *ipmi,
+		       ipmi_ll_ipmb_addr_cb handler,
+		       void                 *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_event_handler(ipmi_con_t            *ipmi,
+		   ipmi_ll_evt_handler_t handler,
+		   void                  *cb_data)
+{
+    return 0;
+}
+
+static int
+stub_send_command(ipmi_con_t            *ipmi,
+		  const ipmi_addr_t     *addr,
+		  unsigned int          addr_len,
+		  const ipmi_msg_t      *msg,
+		  ipmi_ll_rsp_handler_t rsp_handler,
+		  ipmi_msgi_t           *rspi)
+{
+    pending_t *p;
+
+    if (num_pending >= MAX_PENDING)
+	return EAGAIN;
+    p = &pending[num_pending++];
+    p->handler = rsp_handler;
+    p->rspi = rspi;
+    memcpy(&p->addr, addr, addr_len);
+    p->addr_len = addr_len;
+    p->netfn = msg->netfn;
+    p->cmd = msg->cmd;
+    memcpy(p->data, msg->data, msg->data_len);
+    p->data_len = msg->data_len;
+    return 0;
+}
+
+static int
+stub_close_connection_done(ipmi_con_t            *ipmi,
+			   ipmi_ll_con_closed_cb handler,
+			   void                  *cb_data)
+{
+    if (handler)
+	handler(ipmi, cb_data);
+    return 0;
+}
+
+static int
+stub_close_connection(ipmi_con_t *ipmi)
+{
+    return stub_close_connection_done(ipmi, NULL, NULL);
+}
+
+static void
+add_entry(unsigned char type)
+{
+    unsigned char *e = entries[num_entries];
+
+    memset(e, 0, 16);
+    ipmi_set_uint16(e, num_entries + 1);
+    e[2] = type;
+    ipmi_set_uint32(e + 3, ++add_timestamp);
+    e[7] = 0x20;
+    e[9] = 0x04;
+    num_entries++;
+}
+
+static void
+clear_entries(void)
+{
+    num_entries = 0;
+    erase_timestamp++;
+}
+
+/* Fill in the response for a command to the emulated SEL. */
+static void
+handle_cmd(pending_t *p, ipmi_msg_t *rsp)
+{
+    unsigned char *d = rsp->data;
+    unsigned int  recid;
+
+    d[0] = 0;
+    rsp->data_len = 1;
+    if (p->netfn != IPMI_STORAGE_NETFN) {
+	d[0] = IPMI_INVALID_CMD_CC;
+	return;
+    }
+
+    switch (p->cmd) {
+    case IPMI_GET_SEL_INFO_CMD:
+	d[1] = 0x51;
+	ipmi_set_uint16(d + 2, num_entries);
+	ipmi_set_uint16(d + 4, (MAX_SEL_ENTRIES - num_entries) * 16);
+	ipmi_set_uint32(d + 6, add_timestamp);
+	ipmi_set_uint32(d + 10, erase_timestamp);
+	d[14] = 0x0a; /* Supports delete and reserve. */
+	rsp->data_len = 15;
+	break;
+
+    case IPMI_RESERVE_SEL_CMD:
+	ipmi_set_uint16(d + 1, ++reservation);
+	rsp->data_len = 3;
+	break;
+
+    case IPMI_GET_SEL_ENTRY_CMD:
+	recid = ipmi_get_uint16(p->data + 2);
+	if (recid == 0)
+	    recid = 1;
+	else if (recid == 0xffff)
+	    recid = num_entries;
+	if ((recid < 1) || (recid > num_entries)) {
+	    d[0] = IPMI_NOT_PRESENT_CC;
+	    break;
+	}
+	if (recid == num_entries)
+	    ipmi_set_uint16(d + 1, 0xffff);
+	else
+	    ipmi_set_uint16(d + 1, recid + 1);
+	memcpy(d + 3, entries[recid - 1], 16);
+	rsp->data_len = 19;
+	break;
+
+    case IPMI_CLEAR_SEL_CMD:
+	if (p->data[5] == 0xaa)
+	    clear_entries();
+	d[1] = 1; /* Erase completed. */
+	rsp->data_len = 2;
+	break;
+
+    default:
+	d[0] = IPMI_INVALID_CMD_CC;
+	break;
+    }
+}
+
+/* Answer commands in the order sent until nothing is left. */
+static void
+answer_cmds(ipmi_con_t *con)
+{
+    pending_t   p;
+    ipmi_msgi_t *rspi;
+
+    while (num_pending > 0) {
+	p = pending[0];
+	num_pending--;
+	memmove(pending, pending + 1, sizeof(pending[0]) * num_pending);
+
+	rspi = p.rspi;
+	memcpy(&rspi->addr, &p.addr, p.addr_len);
+	rspi->addr_len = p.addr_len;
+	rspi->msg.netfn = p.netfn | 1;
+	rspi->msg.cmd = p.cmd;
+	rspi->msg.data = rspi->data;
+	handle_cmd(&p, &rspi->msg);
+	if (p.handler(con, rspi) == IPMI_MSG_ITEM_NOT_USED)
+	    ipmi_free_msg_item(rspi);
+    }
+}
+
+static ipmi_mc_t       *mc;
+static ipmi_sel_info_t *sel;
+
+static void
+setup_sel(ipmi_domain_t *domain, void *cb_data)
+{
+    ipmi_system_interface_addr_t si;
+    unsigned char                devid[12];
+    ipmi_msg_t                   msg;
+    int                          rv;
+
+    si.addr_type = IPMI_SYSTEM_INTERFACE_ADDR_TYPE;
+    si.channel = IPMI_BMC_CHANNEL;
+    si.lun = 0;
+    mc = _ipmi_find_mc_by_addr(domain, (ipmi_addr_t *) &si, sizeof(si));
+    if (!mc) {
+	fprintf(stderr, "Domain has no system interface MC\n");
+	exit(1);
+    }
+    /* Give the MC a device id that says it has a SEL. */
+    memset(devid, 0, sizeof(devid));
+    devid[5] = 0x51;
+    devid[6] = 0x04;
+    msg.netfn = IPMI_APP_NETFN | 1;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.data = devid;
+    msg.data_len = 12;
+    rv = _ipmi_mc_get_device_id_data_from_rsp(mc, &msg);
+    if (rv || !ipmi_mc_sel_device_support(mc)) {
+	fprintf(stderr, "Unable to turn on SEL support in the MC\n");
+	exit(1);
+    }
+
+    rv = ipmi_sel_alloc(mc, 0, &sel);
+    if (rv) {
+	fprintf(stderr, "ipmi_sel_alloc failed: %d\n", rv);
+	exit(1);
+    }
+}
+
+static void
+fetched(ipmi_sel_info_t *sel,
+	int             err,
+	int             changed,
+	unsigned int    count,
+	void            *cb_data)
+{
+    int *done = cb_data;
+
+    if (err) {
+	fprintf(stderr, "SEL fetch failed: %d\n", err);
+	exit(1);
+    }
+    *done = 1;
+}
+
+static int
+fetch_and_check(ipmi_con_t *con, const char *what, unsigned int expected)
+{
+    int          done = 0;
+    unsigned int count;
+    ipmi_event_t *event;
+    int          rv;
+
+    rv = ipmi_sel_get(sel, fetched, &done);
+    if (rv) {
+	fprintf(stderr, "%s: ipmi_sel_get failed: %d\n", what, rv);
+	return 1;
+    }
+    answer_cmds(con);
+    if (!done) {
+	fprintf(stderr, "%s: SEL fetch did not complete\n", what);
+	return 1;
+    }
+
+    rv = ipmi_get_sel_count(sel, &count);
+    if (rv) {
+	fprintf(stderr, "%s: ipmi_get_sel_count failed: %d\n", what, rv);
+	return 1;
+    }
+    if (count != expected) {
+	fprintf(stderr, "%s: expected %u events, got %u\n", what,
+		expected, count);
+	return 1;
+    }
+
+    event = ipmi_sel_get_first_event(sel);
+    if (event)
+	ipmi_event_free(event);
+    if ((expected == 0) != (event == NULL)) {
+	fprintf(stderr, "%s: event list does not match the count\n", what);
+	return 1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    os_handler_t     *os_hnd;
+    ipmi_con_t       con;
+    ipmi_con_t       *cons[1];
+    ipmi_domain_id_t domain_id;
+    int              rv;
+    int              errors = 0;
+
+    os_hnd = ipmi_posix_setup_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "Unable to allocate os handler\n");
+	return 1;
+    }
+    rv = ipmi_init(os_hnd);
+    if (rv) {
+	fprintf(stderr, "ipmi_init failed: %d\n", rv);
+	return 1;
+    }
+
+    memset(&con, 0, sizeof(con));
+    con.os_hnd = os_hnd;
+    con.con_type = "stub";
+    con.start_con = stub_start_con;
+    con.add_con_change_handler = stub_con_change_handler;
+    con.remove_con_change_handler = stub_con_change_handler;
+    con.add_ipmb_addr_handler = stub_ipmb_addr_handler;
+    con.remove_ipmb_addr_handler = stub_ipmb_addr_handler;
+    con.add_event_handler = stub_event_handler;
+    con.remove_event_handler = stub_event_handler;
+    con.send_command = stub_send_command;
+    con.close_connection = stub_close_connection;
+    con.close_connection_done = stub_close_connection_done;
+    cons[0] = &con;
+
+    rv = ipmi_open_domain("test", cons, 1, NULL, NULL, NULL, NULL,
+			  NULL, 0, &domain_id);
+    if (rv) {
+	fprintf(stderr, "ipmi_open_domain failed: %d\n", rv);
+	return 1;
+    }
+
+    rv = ipmi_domain_pointer_cb(domain_id, setup_sel, NULL);
+    if (rv) {
+	fprintf(stderr, "Domain went away: %d\n", rv);
+	return 1;
+    }
+
+    add_entry(0x02);
+    add_entry(0x02);
+    add_entry(0x02);
+    errors += fetch_and_check(&con, "initial fetch", 3);
+
+    add_entry(0x02);
+    errors += fetch_and_check(&con, "fetch after an add", 4);
+
+    /* A clear by someone else only changes the erase timestamp. */
+    clear_entries();
+    errors += fetch_and_check(&con, "fetch after an external clear", 0);
+
+    /* Record ids are reused after a clear. */
+    add_entry(0xc0);
+    add_entry(0xc0);
+    errors += fetch_and_check(&con, "fetch after adds into a cleared SEL",
+			      2);
+
+    clear_entries();
+    add_entry(0xc1);
+    errors += fetch_and_check(&con, "fetch after a clear and an add", 1);
+
+    ipmi_sel_destroy(sel, NULL, NULL);
+    _ipmi_mc_put(mc);
+
+    if (errors) {
+	printf("%d SEL tests failed\n", errors);
+	return 1;
+    }
+    printf("All SEL tests passed\n");
+    return 0;
+}
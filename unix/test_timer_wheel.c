@@ -0,0 +1,216 @@
+/*
+ * test_timer_wheel.c
+ *
+ * Code to test the timer wheel.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+
+typedef struct test_node_s
+{
+    twheel_link_t link;
+    int           idx;
+} test_node_t;
+
+#define link_to_node(l) ((test_node_t *) (((char *) (l)) \
+					  - offsetof(test_node_t, link)))
+
+static int debug = 0;
+static int random_seed;
+
+void
+handle_fault(int sig)
+{
+    fprintf(stderr, "Died on sig %d\n", sig);
+    printf("Seed was %d\n", random_seed);
+    exit(1);
+}
+
+static void
+fail(const char *str)
+{
+    fprintf(stderr, "%s\n", str);
+    printf("Seed was %d\n", random_seed);
+    exit(1);
+}
+
+#define TEST_SIZE 2048
+#define TEST_ROUNDS 50000
+static test_node_t *(nodes[TEST_SIZE]);
+
+/* Pick a random timeout, mostly short but some far past the wheel. */
+static uint64_t
+rand_timeout(void)
+{
+    switch (rand() % 8) {
+    case 0: return 0;
+    case 1: case 2: case 3: return rand() % TWHEEL_L0_SIZE;
+    case 4: return rand() % TWHEEL_SPAN(1);
+    case 5: return rand() % TWHEEL_SPAN(2);
+    case 6: return rand() % TWHEEL_SPAN(3);
+    default: return TWHEEL_SPAN(3) + (rand() % (4 * TWHEEL_SPAN(3)));
+    }
+}
+
+/* Make sure nothing that should have expired is still pending. */
+static void
+check_late(uint64_t now)
+{
+    int i;
+
+    for (i=0; i<TEST_SIZE; i++) {
+	if (nodes[i] && nodes[i]->link.tick <= now)
+	    fail("Timer was not expired on time");
+    }
+}
+
+static void
+check_next(twheel_t *wheel)
+{
+    uint64_t next, min = 0;
+    int      found = 0;
+    int      i;
+
+    for (i=0; i<TEST_SIZE; i++) {
+	if (nodes[i] && (!found || nodes[i]->link.tick < min)) {
+	    min = nodes[i]->link.tick;
+	    found = 1;
+	}
+    }
+    if (twheel_next_tick(wheel, &next) != found)
+	fail("Next tick did not match the wheel contents");
+    if (found && (next > min))
+	fail("Next tick is after the first timer");
+}
+
+int
+main(int argc, char *argv[])
+{
+    twheel_t         wheel;
+    int              i;
+    int              err;
+    test_node_t      *val1;
+    twheel_link_t    *link;
+    struct sigaction act;
+    int              rand_val;
+    uint64_t         now = 0, last;
+    unsigned int     expired = 0;
+
+    i = 1;
+    while ((i < argc) && (argv[i][0] == '-')) {
+	if (strcmp(argv[i], "--") == 0)
+	    break;
+	else if (strcmp(argv[i], "-d") == 0)
+	    debug++;
+	else {
+	    fprintf(stderr, "Invalid option: '%s'\n", argv[i]);
+	    exit(1);
+	}
+	
+	i++;
+    }
+    if (i < argc) {
+	random_seed = atoi(argv[i]);
+    } else {
+	random_seed = time(NULL);
+    }
+    if (debug)
+	printf("Random seed is %d\n", random_seed);
+    srand(random_seed);
+
+    act.sa_handler = handle_fault;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    err = sigaction(SIGSEGV, &act, NULL);
+    if (err) {
+	perror("sigaction");
+    }
+
+    now = rand();
+    twheel_init(&wheel, now);
+
+    for (i=0; i<TEST_ROUNDS; i++) {
+	rand_val = rand() & (TEST_SIZE-1);
+	if (nodes[rand_val]) {
+	    if (debug > 1)
+		printf("Removing item %d\n", rand_val);
+	    twheel_remove(&wheel, &nodes[rand_val]->link);
+	    free(nodes[rand_val]);
+	    nodes[rand_val] = NULL;
+	} else {
+	    val1 = malloc(sizeof(*val1));
+	    if (!val1)
+		fail("Out of memory");
+	    val1->idx = rand_val;
+	    twheel_add(&wheel, &val1->link, now + rand_timeout());
+	    if (debug > 1)
+		printf("Adding item %d at %llu\n", rand_val,
+		       (unsigned long long) val1->link.tick);
+	    nodes[rand_val] = val1;
+	}
+
+	/* Move time forward, sometimes by a lot. */
+	if (rand() % 64 == 0)
+	    now += rand() % TWHEEL_SPAN(3);
+	else
+	    now += rand() % 512;
+
+	last = 0;
+	while ((link = twheel_get_expired(&wheel, now))) {
+	    val1 = link_to_node(link);
+	    if (link->tick > now)
+		fail("Timer expired early");
+	    if (link->tick < last)
+		fail("Timers expired out of order");
+	    last = link->tick;
+	    twheel_remove(&wheel, link);
+	    nodes[val1->idx] = NULL;
+	    free(val1);
+	    expired++;
+	}
+	check_late(now);
+	check_next(&wheel);
+    }
+    if (debug)
+	printf("%u timers expired, %u pending\nSeed was %d\n",
+	       expired, wheel.count, random_seed);
+
+    while ((link = twheel_get_any(&wheel))) {
+	val1 = link_to_node(link);
+	twheel_remove(&wheel, link);
+	nodes[val1->idx] = NULL;
+	free(val1);
+    }
+    if (wheel.count != 0)
+	fail("Timers left in the wheel");
+
+    return 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * A hierarchical timer wheel in C.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * This is a hierarchical timer wheel, an alternative to heap.h for
+ * large numbers of timers.  Adding and removing a timer is O(1), the
+ * cost of expiring timers is amortized over the ticks that pass.
+ *
+ * Time is measured in ticks, the user picks what a tick is.  The
+ * first level has 256 slots of one tick each, the three levels above
+ * it have 64 slots each covering 256, 16384 and 1048576 ticks.  When
+ * the current tick reaches the start of a slot in an upper level,
+ * that slot is "cascaded" down into the lower levels.  Timers further
+ * out than the wheel covers (2^26 ticks) are parked in the last slot
+ * of the top level and re-placed as time passes.
+ *
+ * To use it, embed a twheel_link_t in your element and use something
+ * like offsetof() to get back from a link to your element.  Everything
+ * here is static, so it may be included in more than one file.
+ *
+ * void twheel_init(twheel_t *wheel, uint64_t now);
+ *   Initialize the wheel with the current tick.
+ * void twheel_add(twheel_t *wheel, twheel_link_t *link, uint64_t tick);
+ *   Add the element to expire at the given tick.  Ticks in the past
+ *   are treated as the current tick.
+ * void twheel_remove(twheel_t *wheel, twheel_link_t *link);
+ *   Remove an element that is in the wheel.
+ * twheel_link_t *twheel_get_expired(twheel_t *wheel, uint64_t now);
+ *   Return an element whose tick is <= now, or NULL if there are
+ *   none.  The element is not removed, call twheel_remove() on it.
+ *   Elements come out in tick order.
+ * int twheel_next_tick(twheel_t *wheel, uint64_t *tick);
+ *   Returns 0 if the wheel is empty.  Otherwise it returns 1 and sets
+ *   tick to a tick at which twheel_get_expired() should be called
+ *   again.  This may be before the first element expires (when an
+ *   upper level must be cascaded), but is never after it.
+ * twheel_link_t *twheel_get_any(twheel_t *wheel);
+ *   Return some element in the wheel, or NULL if it is empty.  This
+ *   is for cleaning up, it is not fast.
+ */
+
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define TWHEEL_L0_BITS	8
+#define TWHEEL_LN_BITS	6
+#define TWHEEL_LEVELS	4
+#define TWHEEL_L0_SIZE	(1 << TWHEEL_L0_BITS)
+#define TWHEEL_LN_SIZE	(1 << TWHEEL_LN_BITS)
+#define TWHEEL_L0_MASK	(TWHEEL_L0_SIZE - 1)
+#define TWHEEL_LN_MASK	(TWHEEL_LN_SIZE - 1)
+
+/* The number of ticks a single slot covers at the given level. */
+#define TWHEEL_SHIFT(l) (((l) == 0) ? 0 \
+			 : (TWHEEL_L0_BITS + (((l) - 1) * TWHEEL_LN_BITS)))
+
+/* The span of ticks covered by all the levels up to the given one. */
+#define TWHEEL_SPAN(l) (((l) == 0) ? ((uint64_t) TWHEEL_L0_SIZE) \
+			: (((uint64_t) 1) << (TWHEEL_SHIFT(l) + TWHEEL_LN_BITS)))
+
+typedef struct twheel_link_s
+{
+    struct twheel_link_s *next;
+    struct twheel_link_s **pprev;
+    uint64_t             tick;
+    int                  level;
+} twheel_link_t;
+
+typedef struct twheel_s
+{
+    uint64_t      cur_tick;
+    unsigned int  count;
+    unsigned int  level_count[TWHEEL_LEVELS];
+    twheel_link_t *l0[TWHEEL_L0_SIZE];
+    twheel_link_t *ln[TWHEEL_LEVELS - 1][TWHEEL_LN_SIZE];
+} twheel_t;
+
+static void
+twheel_init(twheel_t *wheel, uint64_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->cur_tick = now;
+}
+
+static twheel_link_t **
+twheel_slot(twheel_t *wheel, int level, uint64_t tick)
+{
+    if (level == 0)
+	return &wheel->l0[tick & TWHEEL_L0_MASK];
+    return &wheel->ln[level - 1][(tick >> TWHEEL_SHIFT(level))
+				 & TWHEEL_LN_MASK];
+}
+
+static void
+twheel_place(twheel_t *wheel, twheel_link_t *link)
+{
+    uint64_t      delta = link->tick - wheel->cur_tick;
+    uint64_t      tick = link->tick;
+    twheel_link_t **slot;
+    int           level;
+
+    for (level=0; level<TWHEEL_LEVELS; level++) {
+	if (delta < TWHEEL_SPAN(level))
+	    break;
+    }
+    if (level == TWHEEL_LEVELS) {
+	/* Too far out, park it at the far end of the wheel. */
+	level = TWHEEL_LEVELS - 1;
+	tick = wheel->cur_tick + TWHEEL_SPAN(level) - 1;
+    }
+
+    slot = twheel_slot(wheel, level, tick);
+    link->level = level;
+    link->next = *slot;
+    if (link->next)
+	link->next->pprev = &link->next;
+    link->pprev = slot;
+    *slot = link;
+    wheel->level_count[level]++;
+}
+
+static void
+twheel_unlink(twheel_t *wheel, twheel_link_t *link)
+{
+    *link->pprev = link->next;
+    if (link->next)
+	link->next->pprev = link->pprev;
+    link->next = NULL;
+    link->pprev = NULL;
+    wheel->level_count[link->level]--;
+}
+
+static void
+twheel_add(twheel_t *wheel, twheel_link_t *link, uint64_t tick)
+{
+    if (tick < wheel->cur_tick)
+	tick = wheel->cur_tick;
+    link->tick = tick;
+    twheel_place(wheel, link);
+    wheel->count++;
+}
+
+static void
+twheel_remove(twheel_t *wheel, twheel_link_t *link)
+{
+    twheel_unlink(wheel, link);
+    wheel->count--;
+}
+
+static void
+twheel_cascade(twheel_t *wheel, int level)
+{
+    twheel_link_t **slot = twheel_slot(wheel, level, wheel->cur_tick);
+    twheel_link_t *list = *slot;
+    twheel_link_t *link;
+
+    *slot = NULL;
+    while (list) {
+	link = list;
+	list = link->next;
+	wheel->level_count[level]--;
+	twheel_place(wheel, link);
+    }
+}
+
+static twheel_link_t *
+twheel_get_expired(twheel_t *wheel, uint64_t now)
+{
+    twheel_link_t *link;
+    uint64_t      next;
+    int           level;
+
+    for (;;) {
+	link = wheel->l0[wheel->cur_tick & TWHEEL_L0_MASK];
+	if (link) {
+	    if (wheel->cur_tick <= now)
+		return link;
+	    return NULL;
+	}
+	if (wheel->cur_tick >= now)
+	    return NULL;
+
+	if (wheel->count == 0) {
+	    wheel->cur_tick = now;
+	    return NULL;
+	}
+
+	/* Find the lowest level with something in it.  Nothing can
+	   happen until the next cascade into that level, so skip
+	   straight to it. */
+	for (level=0; level<TWHEEL_LEVELS-1; level++) {
+	    if (wheel->level_count[level])
+		break;
+	}
+	if (level == 0)
+	    next = wheel->cur_tick + 1;
+	else {
+	    next = (wheel->cur_tick
+		    | ((((uint64_t) 1) << TWHEEL_SHIFT(level)) - 1)) + 1;
+	    if (next > now) {
+		wheel->cur_tick = now;
+		return NULL;
+	    }
+	}
+
+	wheel->cur_tick = next;
+	for (level=1; level<TWHEEL_LEVELS; level++) {
+	    if (next & ((((uint64_t) 1) << TWHEEL_SHIFT(level)) - 1))
+		break;
+	    twheel_cascade(wheel, level);
+	}
+    }
+}
+
+static int
+twheel_next_tick(twheel_t *wheel, uint64_t *tick)
+{
+    uint64_t best = 0;
+    uint64_t base;
+    int      found = 0;
+    int      level;
+    int      i;
+
+    if (wheel->count == 0)
+	return 0;
+
+    if (wheel->level_count[0]) {
+	for (i=0; i<TWHEEL_L0_SIZE; i++) {
+	    if (wheel->l0[(wheel->cur_tick + i) & TWHEEL_L0_MASK]) {
+		best = wheel->cur_tick + i;
+		found = 1;
+		break;
+	    }
+	}
+    }
+
+    for (level=1; level<TWHEEL_LEVELS; level++) {
+	if (wheel->level_count[level] == 0)
+	    continue;
+	base = wheel->cur_tick >> TWHEEL_SHIFT(level);
+	for (i=1; i<=TWHEEL_LN_SIZE; i++) {
+	    if (wheel->ln[level - 1][(base + i) & TWHEEL_LN_MASK]) {
+		uint64_t t = (base + i) << TWHEEL_SHIFT(level);
+		if (!found || (t < best)) {
+		    best = t;
+		    found = 1;
+		}
+		break;
+	    }
+	}
+    }
+
+    *tick = best;
+    return found;
+}
+
+static twheel_link_t *
+twheel_get_any(twheel_t *wheel)
+{
+    int level;
+    int i;
+
+    if (wheel->level_count[0]) {
+	for (i=0; i<TWHEEL_L0_SIZE; i++) {
+	    if (wheel->l0[i])
+		return wheel->l0[i];
+	}
+    }
+    for (level=1; level<TWHEEL_LEVELS; level++) {
+	if (wheel->level_count[level] == 0)
+	    continue;
+	for (i=0; i<TWHEEL_LN_SIZE; i++) {
+	    if (wheel->ln[level - 1][i])
+		return wheel->ln[level - 1][i];
+	}
+    }
+    return NULL;
+}
+
+#endif /* _TIMER_WHEEL_H */
@@ -55,6 +55,10 @@
 
 #include <config.h>
 #include <string.h>
+#include <errno.h>
+#ifdef HAVE_TLS
+#include <pthread.h>
+#endif
 
 #ifdef HAVE_EXECINFO_H
 #include <execinfo.h> /* For backtrace() */
@@ -64,6 +68,7 @@
 #include <OpenIPMI/os_handler.h>
 
 #include <OpenIPMI/internal/ipmi_malloc.h>
+#include <OpenIPMI/internal/ipmi_locks.h>
 #include <OpenIPMI/internal/ilist.h>
 
 void (*ipmi_malloc_log)(enum ipmi_log_type_e log_type, const char *format, ...)
@@ -465,6 +470,384 @@ ipmi_strndup(const char *str, int n)
     return rv;
 }
 
+/*
+ * Fixed-size object pools.  Objects come out of slabs that hold a
+ * whole number of batches of POOL_BATCH objects, at least
+ * POOL_SLAB_SIZE bytes worth if the objects are small.  Free objects
+ * sit in the pool, protected by the pool's lock, as a list of full
+ * batches plus a list of loose objects.
+ *
+ * If the compiler supports thread-local storage, each thread keeps a
+ * cache in front of that: a partly filled batch it allocates from and
+ * frees to, and one full spare batch.  When the current batch fills up
+ * the spare goes to the pool and the current batch becomes the spare,
+ * when it runs dry the spare is used or a batch is taken from the
+ * pool.  Batches move as a unit, only their first object is touched,
+ * so the cost doesn't depend on how many objects are outstanding.
+ * When a thread exits a pthread key destructor gives its cache back to
+ * the pool.  Slabs are only freed with the pool.
+ *
+ * A thread's caches are indexed by the pool's slot in pools[].  Every
+ * pool gets a new generation number, so a cache left over from a pool
+ * that was freed (its objects went with the slabs) is recognized and
+ * dropped.
+ *
+ * Malloc debugging is checked on every call, like ipmi_mem_alloc()
+ * does, since it may be turned on after a pool is allocated.
+ */
+#define IPMI_MEM_POOL_MAX	8
+#define POOL_SLAB_SIZE		4096
+#define POOL_BATCH		32
+
+typedef struct pool_obj_s
+{
+    struct pool_obj_s *next;
+    /* Only used in the first object of a full batch on the pool's
+       batch list. */
+    struct pool_obj_s *next_batch;
+} pool_obj_t;
+
+typedef struct pool_slab_s
+{
+    struct pool_slab_s *next;
+} pool_slab_t;
+
+struct ipmi_mem_pool_s
+{
+    os_handler_t *os_hnd;
+    ipmi_lock_t  *lock;
+    unsigned int slot;
+    unsigned int gen;
+
+    size_t       obj_size;
+    unsigned int slab_objs;
+    size_t       slab_hdr_size;
+
+    pool_slab_t  *slabs;
+    pool_obj_t   *batches;
+    pool_obj_t   *free_list;
+};
+
+static ipmi_mem_pool_t *pools[IPMI_MEM_POOL_MAX];
+static unsigned int pool_gen;
+
+#ifdef HAVE_TLS
+struct pool_cache
+{
+    unsigned int gen;
+    unsigned int count;
+    pool_obj_t   *free_list;
+    pool_obj_t   *spare;
+};
+static __thread struct pool_cache pool_caches[IPMI_MEM_POOL_MAX];
+
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static int pool_key_err;
+
+static void
+pool_cache_drain(void *data)
+{
+    struct pool_cache *caches = data;
+    struct pool_cache *cache;
+    ipmi_mem_pool_t   *pool;
+    pool_obj_t        *spare, *free_list, *last;
+    unsigned int      slot;
+
+    for (slot=0; slot<IPMI_MEM_POOL_MAX; slot++) {
+	cache = &caches[slot];
+	pool = pools[slot];
+	if (!pool || (cache->gen != pool->gen))
+	    continue;
+
+	/* Empty the cache and splice its objects in under the lock, so
+	   nothing can be added to a list while it is being moved. */
+	ipmi_lock(pool->lock);
+	spare = cache->spare;
+	free_list = cache->free_list;
+	cache->spare = NULL;
+	cache->free_list = NULL;
+	cache->count = 0;
+	cache->gen = 0;
+	if (spare) {
+	    spare->next_batch = pool->batches;
+	    pool->batches = spare;
+	}
+	if (free_list) {
+	    last = free_list;
+	    while (last->next)
+		last = last->next;
+	    last->next = pool->free_list;
+	    pool->free_list = free_list;
+	}
+	ipmi_unlock(pool->lock);
+    }
+}
+
+static void
+pool_key_init(void)
+{
+    pool_key_err = pthread_key_create(&pool_key, pool_cache_drain);
+}
+
+/* The first time a thread uses the pool, or after the pool has been
+   replaced. */
+static void
+pool_cache_init(ipmi_mem_pool_t *pool, struct pool_cache *cache)
+{
+    cache->gen = pool->gen;
+    cache->count = 0;
+    cache->free_list = NULL;
+    cache->spare = NULL;
+    pthread_setspecific(pool_key, pool_caches);
+}
+#endif
+
+int
+ipmi_mem_pool_alloc_pool(os_handler_t    *os_hnd,
+			 unsigned int    obj_size,
+			 ipmi_mem_pool_t **new_pool)
+{
+    ipmi_mem_pool_t *pool;
+    unsigned int    slot;
+    unsigned int    batches;
+    int             rv;
+
+#ifdef HAVE_TLS
+    pthread_once(&pool_key_once, pool_key_init);
+    if (pool_key_err)
+	return pool_key_err;
+#endif
+
+    for (slot=0; slot<IPMI_MEM_POOL_MAX; slot++) {
+	if (!pools[slot])
+	    break;
+    }
+    if (slot == IPMI_MEM_POOL_MAX)
+	return ENOSPC;
+
+    pool = ipmi_mem_alloc(sizeof(*pool));
+    if (!pool)
+	return ENOMEM;
+    memset(pool, 0, sizeof(*pool));
+
+    rv = ipmi_create_lock_os_hnd(os_hnd, &pool->lock);
+    if (rv) {
+	ipmi_mem_free(pool);
+	return rv;
+    }
+
+    pool->os_hnd = os_hnd;
+    pool->slot = slot;
+    pool_gen++;
+    if (pool_gen == 0)
+	pool_gen++;
+    pool->gen = pool_gen;
+    if (obj_size < sizeof(pool_obj_t))
+	obj_size = sizeof(pool_obj_t);
+    pool->obj_size = dbg_align(obj_size);
+    pool->slab_hdr_size = dbg_align(sizeof(pool_slab_t));
+    batches = ((POOL_SLAB_SIZE - pool->slab_hdr_size)
+	       / (pool->obj_size * POOL_BATCH));
+    if (batches == 0)
+	batches = 1;
+    pool->slab_objs = batches * POOL_BATCH;
+
+    pools[slot] = pool;
+    *new_pool = pool;
+    return 0;
+}
+
+void
+ipmi_mem_pool_free_pool(ipmi_mem_pool_t *pool)
+{
+    pool_slab_t *slab;
+
+#ifdef HAVE_TLS
+    /* Other threads' caches are dropped by the generation check. */
+    pool_caches[pool->slot].gen = 0;
+#endif
+    while (pool->slabs) {
+	slab = pool->slabs;
+	pool->slabs = slab->next;
+	pool->os_hnd->mem_free(slab);
+    }
+    pools[pool->slot] = NULL;
+    ipmi_destroy_lock(pool->lock);
+    ipmi_mem_free(pool);
+}
+
+/* Must be called with the pool lock held.  The new objects go on the
+   batch list. */
+static int
+pool_add_slab(ipmi_mem_pool_t *pool)
+{
+    pool_slab_t  *slab;
+    char         *obj;
+    pool_obj_t   *o;
+    unsigned int i;
+
+    slab = pool->os_hnd->mem_alloc(pool->slab_hdr_size
+				   + (pool->slab_objs * pool->obj_size));
+    if (!slab)
+	return ENOMEM;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    obj = ((char *) slab) + pool->slab_hdr_size;
+    for (i=0; i<pool->slab_objs; i++, obj += pool->obj_size) {
+	o = (pool_obj_t *) obj;
+	if ((i % POOL_BATCH) == 0) {
+	    o->next = NULL;
+	    o->next_batch = pool->batches;
+	} else {
+	    o->next = pool->batches;
+	    o->next_batch = pool->batches->next_batch;
+	}
+	pool->batches = o;
+    }
+    return 0;
+}
+
+/*
+ * Only used when malloc debugging is on.  Objects allocated while it
+ * is on come from ipmi_mem_alloc(), but it may have been turned on
+ * after some objects were allocated from the slabs.
+ */
+static int
+pool_owns(ipmi_mem_pool_t *pool, void *data)
+{
+    pool_slab_t *slab;
+    char        *objs;
+    char        *c = data;
+    int         rv = 0;
+
+    ipmi_lock(pool->lock);
+    for (slab = pool->slabs; slab; slab = slab->next) {
+	objs = ((char *) slab) + pool->slab_hdr_size;
+	if ((c >= objs) && (c < objs + (pool->slab_objs * pool->obj_size))) {
+	    rv = 1;
+	    break;
+	}
+    }
+    ipmi_unlock(pool->lock);
+    return rv;
+}
+
+void *
+ipmi_mem_pool_alloc(ipmi_mem_pool_t *pool)
+{
+    pool_obj_t *o;
+#ifdef HAVE_TLS
+    struct pool_cache *cache = &pool_caches[pool->slot];
+    unsigned int      i;
+
+    if (DEBUG_MALLOC)
+	return ipmi_mem_alloc(pool->obj_size);
+
+    if (cache->gen != pool->gen)
+	pool_cache_init(pool, cache);
+
+    if (!cache->free_list) {
+	if (cache->spare) {
+	    cache->free_list = cache->spare;
+	    cache->spare = NULL;
+	    cache->count = POOL_BATCH;
+	} else {
+	    ipmi_lock(pool->lock);
+	    if (!pool->batches && pool->free_list) {
+		/* Only loose objects left from exited threads, take
+		   up to a batch worth. */
+		for (i=0; (i<POOL_BATCH) && pool->free_list; i++) {
+		    o = pool->free_list;
+		    pool->free_list = o->next;
+		    o->next = cache->free_list;
+		    cache->free_list = o;
+		}
+		cache->count = i;
+	    } else {
+		if (!pool->batches && pool_add_slab(pool)) {
+		    ipmi_unlock(pool->lock);
+		    return NULL;
+		}
+		cache->free_list = pool->batches;
+		pool->batches = pool->batches->next_batch;
+		cache->count = POOL_BATCH;
+	    }
+	    ipmi_unlock(pool->lock);
+	}
+    }
+
+    o = cache->free_list;
+    cache->free_list = o->next;
+    cache->count--;
+#else
+    if (DEBUG_MALLOC)
+	return ipmi_mem_alloc(pool->obj_size);
+
+    ipmi_lock(pool->lock);
+    if (pool->free_list) {
+	o = pool->free_list;
+	pool->free_list = o->next;
+    } else {
+	if (!pool->batches && pool_add_slab(pool)) {
+	    ipmi_unlock(pool->lock);
+	    return NULL;
+	}
+	o = pool->batches;
+	pool->batches = o->next_batch;
+	pool->free_list = o->next;
+    }
+    ipmi_unlock(pool->lock);
+#endif
+    return o;
+}
+
+void
+ipmi_mem_pool_free(ipmi_mem_pool_t *pool, void *data)
+{
+    pool_obj_t *o = data;
+#ifdef HAVE_TLS
+    struct pool_cache *cache = &pool_caches[pool->slot];
+
+    if (DEBUG_MALLOC && !pool_owns(pool, data)) {
+	ipmi_mem_free(data);
+	return;
+    }
+
+    if (cache->gen != pool->gen)
+	pool_cache_init(pool, cache);
+
+    if (cache->count >= POOL_BATCH) {
+	/* The current batch is full, it becomes the spare and the old
+	   spare goes back to the pool. */
+	if (cache->spare) {
+	    ipmi_lock(pool->lock);
+	    cache->spare->next_batch = pool->batches;
+	    pool->batches = cache->spare;
+	    ipmi_unlock(pool->lock);
+	}
+	cache->spare = cache->free_list;
+	cache->free_list = NULL;
+	cache->count = 0;
+    }
+
+    o->next = cache->free_list;
+    cache->free_list = o;
+    cache->count++;
+#else
+    if (DEBUG_MALLOC && !pool_owns(pool, data)) {
+	ipmi_mem_free(data);
+	return;
+    }
+
+    ipmi_lock(pool->lock);
+    o->next = pool->free_list;
+    pool->free_list = o;
+    ipmi_unlock(pool->lock);
+#endif
+}
+
 int
 ipmi_malloc_init(os_handler_t *os_hnd)
 {